@@ -0,0 +1,40 @@
+/**
+ * @file   attract.h
+ * @brief  Attract animation played by TIM1 and DMA while the core sleeps.
+ *
+ * The animation is a table of ready-made GPIOA->BSRR words in flash. Every
+ * TIM1 update event makes DMA2 Stream 5 (channel 6, TIM1_UP) copy the next
+ * word into BSRR, in circular mode, so no code runs per frame. SysTick is
+ * suspended and the core waits in WFI; only button, START and USB
+ * interrupts wake it. A START edge stops the timer and the stream from its
+ * EXTI interrupt and darkens the board, so the game can start at once. A
+ * host opening the USB serial port stops it the same way from the USB
+ * interrupt.
+ */
+#ifndef __ATTRACT_H
+#define __ATTRACT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CPU usage while the animation plays, measured with the TIM2 microsecond
+ * counter: time awake (including interrupt handlers) per one-second window */
+typedef struct {
+	uint32_t active_us_per_s; // Last complete window
+	uint32_t wakeups;         // Since the animation started
+} AttractStats;
+
+extern AttractStats attract_stats;
+
+void Attract_Run(void);
+void Attract_Stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ATTRACT_H */
@@ -0,0 +1,67 @@
+/**
+ * @file   battery.h
+ * @brief  Supply voltage, state of charge and the low-battery level.
+ *
+ * The battery feeds the 3V3 rail directly, so the supply is measured
+ * through VREFINT, the 1.21 V internal reference: VDDA = 3.3 V *
+ * VREFINT_CAL / reading. It is ADC1 input 17, the last conversion of the
+ * brightness sensing scan (brightness.h), so it costs no extra trigger,
+ * DMA stream or interrupt. The scan interrupt adds each reading to a block
+ * of BATTERY_BLOCK_SAMPLES (oversampling by 64 adds 3 bits). It publishes
+ * each full block with a single word write, which Battery_Poll() reads
+ * without masking interrupts. The main loop then filters the blocks (time
+ * constant about 8 s, so LED load steps do not count) and looks the state
+ * of charge up in a discharge curve. It moves between the levels with
+ * hysteresis. Nothing here depends on HAL, so voltage traces can be
+ * replayed on the host.
+ *
+ * The curve is that of one LiFePO4 cell, whose 3.6 V to 2.5 V range suits
+ * the MCU without a regulator. The low level is at 20 %, about 3.2 V, and
+ * critical is at 10 %, about 3.0 V. Both stay above the 2.7 V that 32-bit
+ * flash programming needs, so statistics can still be saved.
+ */
+#ifndef __BATTERY_H
+#define __BATTERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATTERY_VREFINT_CAL_ADDRESS 0x1FFF7A2AU // Reading at VDDA = 3.3 V
+#define BATTERY_CAL_MV 3300U
+#define BATTERY_BLOCK_SAMPLES 64U // 128 ms at one reading per 2 ms
+#define BATTERY_LOW_PERCENT 20U
+#define BATTERY_CRITICAL_PERCENT 10U
+#define BATTERY_RECOVER_PERCENT 30U // Back to normal, e.g. on a charger
+
+/* How much the firmware has to save power */
+typedef enum {
+	BATTERY_OK,
+	BATTERY_LOW,      // Low-battery profile
+	BATTERY_CRITICAL  // Same profile, statistics flushed
+} BatteryLevel;
+
+/* Supply estimate, for the debugger and the "stats" command */
+typedef struct {
+	uint32_t vdd_mv;      // Filtered
+	uint32_t block_mv;    // Last block, unfiltered
+	uint32_t blocks;      // Blocks filtered
+	uint8_t percent;      // State of charge
+	uint8_t level;        // BatteryLevel
+} BatteryStats;
+
+extern BatteryStats battery_stats;
+
+void Battery_Init(uint16_t vrefint_cal);
+void Battery_OnVrefint(uint16_t reading);
+bool Battery_Poll(void);
+uint8_t Battery_PercentAt(uint32_t vdd_mv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BATTERY_H */
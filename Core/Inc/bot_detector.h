@@ -0,0 +1,78 @@
+/**
+ * @file   bot_detector.h
+ * @brief  Online detection of automated players from press timing.
+ *
+ * A machine wired to the buttons gives itself away in ways a hand does not:
+ *   - its inter-press intervals and hold times barely vary (coefficient of
+ *     variation below 1/64, a bound a dozen human presses at 0.15 .. 0.5
+ *     do not reach by chance),
+ *   - its intervals are whole multiples of its own timer tick, so their
+ *     remainder modulo 1 ms piles up in one or two of 16 bins instead of
+ *     spreading evenly (low entropy); a human's first dozen intervals can
+ *     bunch up by chance, so BOT_MIN_RESIDUES are collected first,
+ *   - a transistor or optocoupler closes the contact without bounce, while
+ *     the mechanical switches bounce on most presses; the debouncer reports
+ *     the edges it rejects.
+ * Each of these can fire for a human now and then, so a session is only
+ * flagged when at least BOT_VOTES_TO_FLAG of them agree. In paced modes
+ * (rhythm) the game sets the intervals, so their steadiness is not counted.
+ * All statistics are running sums with a fixed sample cap, so the memory per
+ * session is constant. Like game_core.cpp this builds on the host for
+ * simulation.
+ */
+#ifndef __BOT_DETECTOR_H
+#define __BOT_DETECTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOT_BUTTONS 4U               // Buttons of one station
+#define BOT_MIN_PRESSES 12U          // Fewer presses are never judged
+#define BOT_MIN_RESIDUES 24U         // Intervals before their residues count
+#define BOT_MAX_INTERVAL_US 2000000U // Longer gaps are pauses, not rhythm
+#define BOT_MAX_SAMPLES 1024U        // Later samples are ignored
+#define BOT_RESIDUE_BINS 16U
+#define BOT_VOTES_TO_FLAG 2U
+
+/* Signals of BotDetector_Signals() */
+#define BOT_SIGNAL_STEADY_INTERVALS 0x01U
+#define BOT_SIGNAL_STEADY_HOLDS     0x02U
+#define BOT_SIGNAL_QUANTISED        0x04U
+#define BOT_SIGNAL_NO_BOUNCE        0x08U
+
+/* Timing statistics of one session */
+typedef struct {
+	uint32_t press_us[BOT_BUTTONS]; // Press time of each held button
+	uint32_t last_press_us;
+	uint64_t interval_sum;          // Sums of intervals and their squares
+	uint64_t interval_squares;
+	uint64_t hold_sum;
+	uint64_t hold_squares;
+	uint16_t intervals;
+	uint16_t holds;
+	uint16_t presses;
+	uint16_t bounces;               // Edges rejected by the debouncer
+	uint8_t residues[BOT_RESIDUE_BINS]; // Interval modulo 1 ms, halved on overflow
+	uint8_t held;                   // Bit i set while button i is down
+	bool paced;                     // The game sets the press intervals
+} BotDetector;
+
+void BotDetector_Reset(BotDetector *detector, bool paced);
+void BotDetector_OnPress(BotDetector *detector, uint8_t button,
+		uint32_t time_us);
+void BotDetector_OnRelease(BotDetector *detector, uint8_t button,
+		uint32_t time_us);
+void BotDetector_OnBounce(BotDetector *detector);
+uint8_t BotDetector_Signals(const BotDetector *detector);
+bool BotDetector_IsAutomated(const BotDetector *detector);
+bool BotDetector_IsConsistent(const BotDetector *detector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BOT_DETECTOR_H */
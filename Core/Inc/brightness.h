@@ -0,0 +1,75 @@
+/**
+ * @file   brightness.h
+ * @brief  Ambient-adaptive LED brightness, sensed through the LEDs of
+ *         station 1.
+ *
+ * TIM1 ticks every 20 us, and at each tick DMA2 Stream 5 copies the next
+ * GPIOA->MODER word of a slot table (led_slots.h). A period of 100 ticks
+ * opens with a blank, where the LED pins are analog, followed by the lit
+ * part, where lit LEDs are outputs in their slot. The LEDs show their ODR
+ * bits in their slot only, and every other LED write stays as it was. The
+ * blank is also the sensing window. A dark LED was held near 0 V during
+ * the lit part, so once its pin floats the photocurrent charges the
+ * junction capacitance, and the voltage is set by how much light falls on
+ * the LED. PA3..PA6 are ADC1 inputs 3..6. TIM3 counts the ticks and
+ * triggers one scan of the four and of VREFINT for battery.h, a fixed time
+ * into the blank, and DMA2 Stream 0 stores it. The stream interrupt keeps
+ * only the readings of LEDs that stayed dark. When the lit LEDs or the
+ * on-time changed, it builds a new table and switches the double-buffered
+ * stream to it at the next period. Each period then costs one short
+ * interrupt and no main loop time.
+ *
+ * The pins are not reverse-biased as the classic sensing circuit does it:
+ * each LED has one pin on the MCU and its cathode on GND, so the junction is
+ * reset to 0 V and charged by the photocurrent instead.
+ *
+ * Brightness_Poll() turns the readings into a lit time 10 times per second.
+ * It works on a log scale and filters slowly, so the brightness follows the
+ * room without visible steps. An LED switched on lights once its table is
+ * in use, 2 to 4 ms later, so the reaction test stops the dimming. TIM1 is
+ * shared with the attract animation, which must stop the dimming too.
+ * Nothing limits the LEDs conducting at once while it is stopped, so both
+ * light no more than LED_SLOTS_MAX_LIT.
+ */
+#ifndef __BRIGHTNESS_H
+#define __BRIGHTNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BRIGHTNESS_PERIOD_US 2000U
+#define BRIGHTNESS_IRQ_PRIORITY 10U // Below USB, above SysTick
+
+/* Controller state and cost, for the debugger and the "stats" command */
+typedef struct {
+	uint32_t on_us;           // Requested on-time per period
+	uint32_t lit_us;          // Granted to each lit LED, see led_slots.h
+	uint32_t slots;           // Slots in the current table
+	uint32_t peak_lit;        // Most LEDs conducting at once since start
+	uint32_t peak_ma;         // Their current, worst LED assumed
+	uint32_t builds;          // Slot tables built
+	uint32_t ambient;         // Filtered reading, log2(ADC counts) in Q8
+	uint32_t isr_cycles_last; // Scan interrupt, once per period
+	uint32_t isr_cycles_max;
+	uint32_t poll_cycles_max; // Controller step in the main loop
+	uint32_t periods;         // Sensing scans completed
+} BrightnessStats;
+
+extern BrightnessStats brightness_stats;
+
+void Brightness_Start(void);
+void Brightness_Stop(void);
+void Brightness_SetAuto(bool on);
+void Brightness_SetMaxPercent(uint8_t percent);
+void Brightness_Poll(uint32_t now);
+void Brightness_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BRIGHTNESS_H */
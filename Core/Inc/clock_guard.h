@@ -0,0 +1,52 @@
+/**
+ * @file   clock_guard.h
+ * @brief  Survives a failing 25 MHz crystal.
+ *
+ * Both clock sources feed the PLL the same 1 MHz (HSE / 25 or HSI / 16), so
+ * the system clock is 96 MHz and the USB clock 48 MHz either way, and every
+ * bus, timer and SysTick keeps its frequency. Without a crystal at boot
+ * SystemClock_Config() starts on the HSI PLL. A crystal that stops later trips the Clock Security
+ * System: the hardware drops to the bare 16 MHz HSI and raises an NMI, whose
+ * handler relocks the PLL on the HSI, reloads SysTick and the microsecond
+ * timer prescaler for the new clock, and adds the time the timers lost while
+ * running slow (about 0.1 ms, the PLL lock time) back to the HAL tick and
+ * the microsecond counter. The HSI is factory trimmed to 1 %, so games stay
+ * playable but timing accuracy drops from crystal to RC precision, and USB,
+ * which asks for 0.25 %, may stop working with some hosts.
+ */
+#ifndef __CLOCK_GUARD_H
+#define __CLOCK_GUARD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* PLL profile: SYSCLK = 1 MHz * PLLN / PLLP = 96 MHz, and the USB clock
+ * 1 MHz * PLLN / PLLQ = exactly 48 MHz. 96 MHz needs 3 flash wait states. */
+#define CLOCK_HSE_PLLM 25U
+#define CLOCK_HSI_PLLM 16U
+#define CLOCK_PLLN 192U
+#define CLOCK_PLLP 2U
+#define CLOCK_PLLQ 4U
+#define CLOCK_FLASH_LATENCY FLASH_LATENCY_3
+
+/* Failover record, for the debugger */
+typedef struct {
+	bool on_hsi;         // Running from the HSI PLL
+	uint32_t failovers;  // CSS events handled
+	uint32_t slow_us;    // Time spent on the bare HSI in the last failover
+	uint32_t lag_us;     // Microseconds the timers lost there, compensated
+} ClockGuardStats;
+
+extern ClockGuardStats clock_guard_stats;
+
+void ClockGuard_Init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CLOCK_GUARD_H */
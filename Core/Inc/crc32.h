@@ -0,0 +1,34 @@
+/**
+ * @file   crc32.h
+ * @brief  CRC-32/MPEG-2 on the hardware CRC unit.
+ *
+ * Poly 0x04C11DB7, init 0xFFFFFFFF, no reflection, no final XOR, fed with
+ * 32-bit words. The unit keeps no per-caller state, so it must only be used
+ * from thread (main loop) context. Enable it once with Crc32_Init().
+ */
+#ifndef __CRC32_H
+#define __CRC32_H
+
+#include "main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void Crc32_Init(void) {
+	__HAL_RCC_CRC_CLK_ENABLE();
+}
+
+static inline uint32_t Crc32_Compute(const uint32_t *words, uint32_t count) {
+	CRC->CR = CRC_CR_RESET;
+	for (uint32_t i = 0; i < count; ++i) {
+		CRC->DR = words[i];
+	}
+	return CRC->DR;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRC32_H */
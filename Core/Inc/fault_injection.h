@@ -0,0 +1,96 @@
+/**
+ * @file   fault_injection.h
+ * @brief  Deterministic fault injection for robustness testing of the game.
+ *
+ * Build with -DFAULT_INJECTION to enable. A fault schedule is derived from a
+ * seed (xorshift32), so a run with the same seed and the same button input
+ * injects the same faults at the same ticks. Without the define every hook
+ * below compiles to an empty inline function.
+ */
+#ifndef __FAULT_INJECTION_H
+#define __FAULT_INJECTION_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Kinds of faults the injector can produce */
+typedef enum {
+	FAULT_NONE,            // No fault pending
+	FAULT_BITFLIP,         // Single bit flip in a registered RAM target
+	FAULT_EDGE_LOST,       // A button is held released for a while (lost edges)
+	FAULT_EDGE_DUPLICATED, // Short phantom press on a button (extra edge pair)
+	FAULT_TICK_JITTER,     // SysTick skips or doubles ticks for a while
+	FAULT_FLASH_WRITE,     // Next flash write reports failure
+	FAULT_TYPE_COUNT
+} FaultType;
+
+/* What happened after a fault was injected */
+typedef enum {
+	OUTCOME_MASKED,       // No visible effect until the next fault
+	OUTCOME_WRONG_RESULT, // An invariant check caught corrupted game state
+	OUTCOME_HANG,         // Main loop stopped making progress, reset by injector
+	OUTCOME_RESET,        // Unexpected reset while the fault was pending
+	OUTCOME_COUNT
+} FaultOutcome;
+
+/* Summary kept in .noinit RAM so it survives the resets it counts */
+typedef struct {
+	uint32_t magic;
+	uint32_t seed;
+	uint32_t rng_state;
+	uint32_t injected[FAULT_TYPE_COUNT];
+	uint32_t outcomes[FAULT_TYPE_COUNT][OUTCOME_COUNT];
+	uint8_t pending_fault;    // Fault waiting for an outcome (FaultType)
+	uint8_t reset_by_injector;
+} FaultSummary;
+
+#ifndef FAULT_INJECTION_SEED
+#define FAULT_INJECTION_SEED 1U
+#endif
+
+#ifdef FAULT_INJECTION
+
+extern FaultSummary fault_summary;
+
+void FaultInjection_Init(uint32_t seed, uint8_t button_count);
+void FaultInjection_RegisterTarget(volatile void *addr, uint32_t size);
+uint32_t FaultInjection_FilterButtons(uint32_t pressed_mask);
+void FaultInjection_OnTick(void);
+void FaultInjection_Heartbeat(void);
+void FaultInjection_ReportViolation(void);
+int FaultInjection_FlashWriteFails(void);
+
+#else
+
+static inline void FaultInjection_Init(uint32_t seed, uint8_t button_count) {
+	(void) seed;
+	(void) button_count;
+}
+static inline void FaultInjection_RegisterTarget(volatile void *addr,
+		uint32_t size) {
+	(void) addr;
+	(void) size;
+}
+static inline uint32_t FaultInjection_FilterButtons(uint32_t pressed_mask) {
+	return pressed_mask;
+}
+static inline void FaultInjection_OnTick(void) {
+}
+static inline void FaultInjection_Heartbeat(void) {
+}
+static inline void FaultInjection_ReportViolation(void) {
+}
+static inline int FaultInjection_FlashWriteFails(void) {
+	return 0;
+}
+
+#endif /* FAULT_INJECTION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FAULT_INJECTION_H */
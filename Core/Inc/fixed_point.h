@@ -0,0 +1,38 @@
+/**
+ * @file   fixed_point.h
+ * @brief  Fixed-point helpers shared by the statistics code.
+ */
+#ifndef __FIXED_POINT_H
+#define __FIXED_POINT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief  Base-2 logarithm in Q8 fixed point
+ * @param  x: value >= 1
+ * @return log2(x) * 256
+ */
+static inline uint32_t Log2Q8(uint32_t x) {
+	uint32_t integer = 31 - __builtin_clz(x);
+	/* Normalise to [1, 2) in Q16 and extract 8 fractional bits by squaring */
+	uint64_t m = ((uint64_t) x << 16) >> integer;
+	uint32_t fraction = 0;
+	for (int bit = 7; bit >= 0; --bit) {
+		m = (m * m) >> 16;
+		if (m >= (2U << 16)) {
+			m >>= 1;
+			fraction |= 1U << bit;
+		}
+	}
+	return (integer << 8) | fraction;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FIXED_POINT_H */
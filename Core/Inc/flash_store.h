@@ -0,0 +1,64 @@
+/**
+ * @file   flash_store.h
+ * @brief  Small persistent key/value records in internal flash sectors 5
+ *         and 7.
+ *
+ * Records are appended (header word, payload, CRC word) and the newest valid
+ * record of a key wins, so a write only programs a few words and never
+ * erases; writes still belong at the end of a game, never in timing-critical
+ * code. The log lives in one sector at a time. FlashStore_Maintain(), called
+ * at boot and while the board is idle, copies the latest record of every key
+ * to the other sector once more than half of the live one is used, and
+ * switches over only when the copy is complete, so a power loss during
+ * compaction loses nothing. Its erase stalls the CPU for 1-2 s.
+ *
+ * FlashStore_Queue() is the write path for game code: it builds the record
+ * in constant time and FlashStore_Poll(), called once per main loop pass,
+ * programs one word of it (about 16 us of stalled fetches).
+ */
+#ifndef __FLASH_STORE_H
+#define __FLASH_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_STORE_MAX_KEYS 24U
+#define FLASH_STORE_MAX_PAYLOAD 80U // Bytes per record, tag included
+
+/* Record keys. Never renumber: they identify data already in the field.
+ * The skill, reaction and rhythm records are signed (RecordAuth_Write()). */
+typedef enum {
+	STORE_KEY_SKILL = 0x10, // + profile number
+	STORE_KEY_REACTION = 0x20, // + profile number
+	STORE_KEY_RHYTHM = 0x30, // + profile number, int32_t calibration in us
+	STORE_KEY_SECRET = 0x40, // SHA-256 of the record signing secret
+	STORE_KEY_RESUME = 0x50, // + station number, ResumeRecord
+} StoreKey;
+
+/* Write path counters, for the debugger */
+typedef struct {
+	uint32_t writes;
+	uint32_t dropped;        // Queue or sector full, or a failed program
+	uint32_t compactions;
+	uint32_t failed_compactions;
+} FlashStoreStats;
+
+extern FlashStoreStats flash_store_stats;
+
+void FlashStore_Init(void);
+bool FlashStore_Read(uint16_t key, void *data, uint16_t length);
+bool FlashStore_Write(uint16_t key, const void *data, uint16_t length);
+bool FlashStore_Queue(uint16_t key, const void *data, uint16_t length);
+void FlashStore_Poll(void);
+void FlashStore_Flush(void);
+void FlashStore_Maintain(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FLASH_STORE_H */
@@ -0,0 +1,61 @@
+/**
+ * @file   frame_ring.h
+ * @brief  Lock-free ring of LED/button/game-state frames for external viewers.
+ *
+ * A single producer (the SysTick hook) publishes a frame whenever the LEDs,
+ * buttons or game state change, plus a keep-alive frame every
+ * FRAME_RING_KEEPALIVE_MS. Any number of readers (a debug probe reading RAM
+ * in the background, Tools/frame_viewer.py, a telemetry port) copy frames
+ * without ever making the producer wait:
+ *
+ *   1. read head, pick positions p in [max(last, head - capacity), head)
+ *   2. slot = p % capacity, read slot.seq, copy the frame, read slot.seq again
+ *   3. the copy is valid when both reads equal 2 * p + 2; a larger value means
+ *      the producer lapped the reader, an odd value a frame being written.
+ */
+#ifndef __FRAME_RING_H
+#define __FRAME_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RING_MAGIC 0x46524D32U // "FRM2"
+#define FRAME_RING_CAPACITY 64U      // Must be a power of two
+#define FRAME_RING_KEEPALIVE_MS 100U
+#define FRAME_RING_STATIONS 2U
+
+/* One snapshot of the board (20 bytes) */
+typedef struct {
+	uint32_t seq;     // 2 * position + 1 while written, 2 * position + 2 when complete
+	uint32_t tick;    // HAL_GetTick() at publication
+	uint16_t leds;    // Bit i set when LED i is lit, station 2 from bit 4
+	uint16_t buttons; // Bit i set when button i is pressed, station 2 from bit 4
+	uint8_t state[FRAME_RING_STATIONS]; // GameState of each station
+	uint8_t level[FRAME_RING_STATIONS];
+	uint8_t index[FRAME_RING_STATIONS];
+	uint16_t reserved;
+} LedFrame;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t capacity;
+	uint16_t frame_size;
+	uint32_t head; // Number of frames published since boot
+	LedFrame frames[FRAME_RING_CAPACITY];
+} FrameRing;
+
+extern volatile FrameRing frame_ring;
+
+void FrameRing_Init(void (*sample)(LedFrame *frame));
+void FrameRing_OnTick(void);
+bool FrameRing_Read(uint32_t position, LedFrame *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FRAME_RING_H */
@@ -0,0 +1,46 @@
+/**
+ * @file   game_batch.h
+ * @brief  Struct-of-arrays kernel that steps many Simon Says games at once.
+ *
+ * A GameBatch keeps each field of its games in its own array of 32-bit
+ * lanes (sequence step k of every game is one array), so a step is the same
+ * few compares, masks and blends for every game and no game branches on its
+ * own state. GameBatch_Step() has the effect of GameEnv_Step() on each game:
+ * GameCore_Press(), and after a level up the player's turn again at once.
+ * Host builds with AVX2 (-mavx2) advance GAME_BATCH_LANES games per vector
+ * instruction; other builds step the lanes one by one with the same masks,
+ * and the firmware does not use the kernel at all.
+ * Tests/test_game_batch.cpp checks it game by game against GameCore_Press().
+ */
+#ifndef __GAME_BATCH_H
+#define __GAME_BATCH_H
+
+#include <stdint.h>
+#include "game_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GAME_BATCH_LANES 8U // Games per AVX2 vector, count is a multiple
+
+/* Games of a batch, one caller-owned array of count lanes per field */
+typedef struct {
+	uint32_t count;
+	uint32_t *rng_state;
+	uint32_t *sequence[GAME_MAX_LEVEL]; // sequence[k][n]: step k of game n
+	uint32_t *current_level;
+	uint32_t *index;
+	uint32_t *state;                    // GameState
+} GameBatch;
+
+void GameBatch_Start(GameBatch *batch, uint32_t n, uint32_t seed);
+void GameBatch_Get(const GameBatch *batch, uint32_t n, GameCore *game);
+void GameBatch_Step(GameBatch *batch, const uint8_t *actions,
+		uint8_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GAME_BATCH_H */
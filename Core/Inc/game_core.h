@@ -0,0 +1,83 @@
+/**
+ * @file   game_core.h
+ * @brief  Hardware independent Simon Says rules.
+ *
+ * Everything the game decides (sequence generation, checking presses,
+ * levelling up, win/loss) lives here, without HAL or timing, so the firmware
+ * and off-target users run exactly the same rules. Besides the single-game
+ * API used by main.cpp there is a batched environment API for automated
+ * players: it steps N games held in caller-owned arrays and writes
+ * observations and rewards straight into caller-owned buffers. No function
+ * keeps global state, so disjoint slices of a batch can be stepped from
+ * different threads. The interface is plain C, and game_core.cpp depends only
+ * on <stdint.h>/<string.h>, so it also builds as a host shared library:
+ * make -C Tests build/libsimon.so. Tests/test_game_env.cpp links it.
+ */
+#ifndef __GAME_CORE_H
+#define __GAME_CORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GAME_MAX_LEVEL 5 // Number of levels
+#define GAME_LED_COUNT 4 // Number of LEDs/buttons the sequence uses
+
+/* An enumeration that helps determine the stage of the game and control the stage in the state machine */
+typedef enum {
+	IDLE,        // Start of the game
+	SIMON_SAYS,  // Demonstrate the sequence to the player
+	PLAYER_SAYS, // Player repeats the sequence
+	GAME_OVER,   // End of the game: Loss
+	WIN          // End of the game: Victory
+} GameState;
+
+/* Result of feeding one button press into the game */
+typedef enum {
+	GAME_STEP_IGNORED,  // Not the player's turn
+	GAME_STEP_OK,       // Correct, more steps to repeat in this level
+	GAME_STEP_LEVEL_UP, // Level completed, a new step was appended
+	GAME_STEP_WIN,      // Last level completed
+	GAME_STEP_FAIL      // Wrong button
+} GameStepResult;
+
+/* Complete state of one game (12 bytes) */
+typedef struct {
+	uint32_t rng_state;                // xorshift32 state
+	uint8_t sequence[GAME_MAX_LEVEL];  // LED sequence array for gaming situation
+	uint8_t current_level;             // Tracks player progress (0 to GAME_MAX_LEVEL-1)
+	uint8_t index;                     // Next step of the sequence the player must repeat
+	uint8_t state;                     // GameState
+} GameCore;
+
+void GameCore_Start(GameCore *game, uint32_t seed);
+void GameCore_BeginInput(GameCore *game);
+GameStepResult GameCore_Press(GameCore *game, uint8_t button);
+bool GameCore_IsValid(const GameCore *game);
+void GameCore_PreviewSequence(uint32_t seed, uint8_t *steps, uint8_t count);
+
+/* Batched environment --------------------------------------------------------*/
+
+/* Observation per game: GAME_MAX_LEVEL sequence slots (steps not yet shown
+ * read GAME_OBS_HIDDEN), then current_level, index and state. */
+#define GAME_OBS_SIZE (GAME_MAX_LEVEL + 3)
+#define GAME_OBS_HIDDEN 0xFF
+
+/* Rewards per step */
+#define GAME_REWARD_CORRECT 1
+#define GAME_REWARD_WIN 10
+#define GAME_REWARD_FAIL (-10)
+
+void GameEnv_Reset(GameCore *games, uint32_t count, const uint32_t *seeds,
+		uint8_t *obs);
+void GameEnv_Step(GameCore *games, uint32_t count, const uint8_t *actions,
+		uint8_t *obs, int8_t *rewards, uint8_t *dones);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __GAME_CORE_H */
@@ -0,0 +1,62 @@
+/**
+ * @file   led_slots.h
+ * @brief  Slot tables that limit how many LEDs conduct at the same time.
+ *
+ * brightness.cpp cuts its 2 ms period into LED_SLOTS_TICKS ticks, and DMA
+ * copies one GPIOA->MODER word per tick from a table. The period opens with
+ * the sensing blank, where the LED pins are analog, and the lit part follows.
+ * LedSlots_Build() fills a table for one set of lit LEDs. Up to
+ * LED_SLOTS_MAX_LIT lit LEDs share a single slot. More are dealt out to
+ * groups of at most that many, and each group gets a slot of its own, in
+ * which only its pins are outputs. Whatever the game shows, no more than
+ * LED_SLOTS_MAX_LIT LEDs conduct at once.
+ *
+ * Duty compensation: every lit LED gets the same on-time. It is the
+ * requested one while all slots fit the lit part, else the lit part divided
+ * by the number of slots. Brightness is kept exactly up to that point and
+ * falls evenly beyond it, so one LED is never brighter than its neighbours.
+ *
+ * Outside their slot the LED pins are inputs with a pull-down. That keeps
+ * dark LEDs discharged for sensing. An LED switched on after its table was
+ * built stays dark until the next table, instead of adding to the current.
+ * Nothing here depends on HAL, so tables can be checked on the host.
+ */
+#ifndef __LED_SLOTS_H
+#define __LED_SLOTS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LED_SLOTS_TICK_US 20U
+#define LED_SLOTS_TICKS 100U      // One brightness period
+#define LED_SLOTS_BLANK_TICKS 14U // Sensing: 160 us integration, then a scan
+#define LED_SLOTS_LIT_TICKS (LED_SLOTS_TICKS - LED_SLOTS_BLANK_TICKS)
+#define LED_SLOTS_MAX_LIT 4U      // LEDs conducting at once, at least a station
+#define LED_SLOTS_LED_MA 6U       // Worst LED: (3.3 V - 2.0 V red) / 220 Ohm
+
+/* The LED pins of one port and its MODER words */
+typedef struct {
+	uint32_t input_word;  // LED pins inputs, every other pin as configured
+	uint8_t first_pin;
+	uint8_t count;
+} LedSlotPins;
+
+/* What a table does */
+typedef struct {
+	uint8_t slots;    // Lit groups
+	uint8_t peak_lit; // Most LEDs conducting in one tick
+	uint8_t on_ticks; // On-time of each lit LED per period
+} LedSlotPlan;
+
+LedSlotPlan LedSlots_Build(uint32_t *table, const LedSlotPins *pins,
+		uint32_t lit, uint32_t on_ticks);
+uint32_t LedSlots_BlankWord(const LedSlotPins *pins);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LED_SLOTS_H */
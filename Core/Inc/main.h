@@ -59,6 +59,8 @@ void Error_Handler(void);
 /* Private defines -----------------------------------------------------------*/
 #define START_Pin GPIO_PIN_0
 #define START_GPIO_Port GPIOA
+#define START2_Pin GPIO_PIN_1
+#define START2_GPIO_Port GPIOB
 
 /* USER CODE BEGIN Private defines */
 
@@ -0,0 +1,83 @@
+/**
+ * @file   nor_log.h
+ * @brief  Append-only log of fixed-size entries on a NOR flash.
+ *
+ * The flash is a ring of 4 KB segments, the erase unit. Each segment opens
+ * with a header page (magic, sequence number, erase count), and its other
+ * 15 pages hold three entries each. Entries are appended to the newest
+ * segment. When it is full, the oldest segment is erased and continues the
+ * ring with the next sequence number. Every segment is therefore erased
+ * once per lap: the wear is level without a mapping table, and the oldest
+ * entries are given up first.
+ *
+ * NorLog_Init() reads every header once and keeps the sequence numbers as a
+ * RAM index of the segment heads. It then finds the end of the newest
+ * segment by binary search, and the address of any older entry follows
+ * from the index without further reads. NorLog_Append() only copies the
+ * entry into a queue. NorLog_Poll(), called from the main loop, starts one
+ * program or erase whenever the device is idle and never waits for it. The
+ * device is reached through NorDevice, so the log runs on the host against
+ * a file or a RAM image.
+ */
+#ifndef __NOR_LOG_H
+#define __NOR_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NOR_LOG_SEGMENT_SIZE 4096U
+#define NOR_LOG_PAGE_SIZE 256U
+#define NOR_LOG_ENTRY_SIZE 84U   // sizeof(SessionRecord)
+#define NOR_LOG_ENTRIES_PER_PAGE (NOR_LOG_PAGE_SIZE / NOR_LOG_ENTRY_SIZE)
+#define NOR_LOG_ENTRIES_PER_SEGMENT (NOR_LOG_ENTRIES_PER_PAGE \
+		* (NOR_LOG_SEGMENT_SIZE / NOR_LOG_PAGE_SIZE - 1))
+#define NOR_LOG_MAX_SEGMENTS 1024U // 4 MB, more of a bigger chip stays unused
+#define NOR_LOG_QUEUE_SIZE 4U      // Entries waiting, power of two
+
+/* A NOR flash with 4 KB sectors and 256-byte pages */
+typedef struct {
+	bool (*busy)(void); // Programming or erasing, or the bus is taken
+	/* Start programming within one page, or erasing the sector at address;
+	 both return at once */
+	void (*program)(uint32_t address, const void *data, uint32_t length);
+	void (*erase)(uint32_t address);
+	void (*read)(uint32_t address, void *data, uint32_t length); // Blocking
+	uint32_t (*now_us)(void); // Clock for the statistics
+} NorDevice;
+
+/* Outcome of NorLog_ReadLatest() */
+typedef enum {
+	NOR_LOG_FOUND,
+	NOR_LOG_MISSING, // Older than the log reaches
+	NOR_LOG_BUSY     // The device is programming or erasing, retry later
+} NorLogRead;
+
+/* Log state and cost, for the debugger */
+typedef struct {
+	uint32_t segments;   // Segments in the ring, 0 without a device
+	uint32_t sequence;   // Of the newest segment
+	uint32_t entries;    // Readable entries
+	uint32_t appended;   // Since boot
+	uint32_t dropped;    // Queue full or no device
+	uint32_t erases;     // Since boot
+	uint32_t max_erase_count; // Highest erase count of a segment seen
+	uint32_t mount_reads;     // Device reads by NorLog_Init()
+	uint32_t mount_us;
+} NorLogStats;
+
+extern NorLogStats nor_log_stats;
+
+void NorLog_Init(const NorDevice *device, uint32_t size);
+bool NorLog_Append(const void *entry);
+void NorLog_Poll(void);
+NorLogRead NorLog_ReadLatest(uint32_t age, void *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __NOR_LOG_H */
@@ -0,0 +1,87 @@
+/**
+ * @file   preempt_explorer.h
+ * @brief  Systematic exploration of interrupt preemptions in main-loop code.
+ *
+ * Part of the FAULT_INJECTION test build. Main-loop code marks the places
+ * where an interrupt could observe or modify shared state with
+ * PREEMPTION_POINT(). The explorer fires PendSV at exactly one of those
+ * places per run (one main loop iteration) and, inside the exception, runs
+ * a registered interrupt body followed by the game invariant check.
+ *
+ * Systematic mode walks every (dynamic point, interrupt body) pair in turn,
+ * i.e. all schedules with a preemption bound of one, CHESS style. Building
+ * with -DPREEMPT_RANDOM preempts each point with probability
+ * 1/PREEMPT_RANDOM_PERIOD instead. Either way the first violation is stored
+ * as (run, occurrence, line, isr), which replays the same interleaving.
+ */
+#ifndef __PREEMPT_EXPLORER_H
+#define __PREEMPT_EXPLORER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Schedule that led to the first invariant violation */
+typedef struct {
+	uint32_t run;        // Main loop iteration counted from boot
+	uint16_t occurrence; // Dynamic preemption point index inside the run
+	uint16_t line;       // Source line of the preemption point
+	uint8_t isr;         // Index of the interrupt body that was injected
+	uint8_t valid;
+} PreemptSchedule;
+
+typedef struct {
+	uint32_t runs;
+	uint32_t preemptions;           // Interleavings actually executed
+	uint32_t preemptions_per_s;     // Updated once per second from SysTick
+	uint32_t rounds;                // Complete sweeps of the systematic space
+	uint32_t violations;
+	PreemptSchedule first_violation;
+} PreemptStats;
+
+#ifdef FAULT_INJECTION
+
+#ifndef PREEMPT_RANDOM_PERIOD
+#define PREEMPT_RANDOM_PERIOD 16U
+#endif
+
+extern PreemptStats preempt_stats;
+
+void PreemptExplorer_Init(bool (*invariant)(void), uint32_t seed);
+void PreemptExplorer_RegisterIsr(void (*isr)(void));
+void PreemptExplorer_Point(uint16_t line);
+void PreemptExplorer_EndRun(void);
+void PreemptExplorer_OnPendSV(void);
+void PreemptExplorer_OnTick(void);
+
+#define PREEMPTION_POINT() PreemptExplorer_Point(__LINE__)
+
+#else
+
+static inline void PreemptExplorer_Init(bool (*invariant)(void),
+		uint32_t seed) {
+	(void) invariant;
+	(void) seed;
+}
+static inline void PreemptExplorer_RegisterIsr(void (*isr)(void)) {
+	(void) isr;
+}
+static inline void PreemptExplorer_EndRun(void) {
+}
+static inline void PreemptExplorer_OnPendSV(void) {
+}
+static inline void PreemptExplorer_OnTick(void) {
+}
+
+#define PREEMPTION_POINT() ((void) 0)
+
+#endif /* FAULT_INJECTION */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PREEMPT_EXPLORER_H */
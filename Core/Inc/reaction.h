@@ -0,0 +1,80 @@
+/**
+ * @file   reaction.h
+ * @brief  Microsecond press timestamps and a streaming latency histogram.
+ *
+ * TIM2 runs free as a 32-bit microsecond counter. Presses are timestamped in
+ * the button's EXTI interrupt, which has priority 0 and preempts everything
+ * else the firmware runs, and queued until the main loop collects them, so
+ * the timestamps do not depend on how busy the loop is. The reaction test
+ * reads the stimulus time right after the LED's BSRR write. Per-trial error
+ * budget at 96 MHz:
+ *   - counter quantisation of the two timestamps: < 1 us
+ *   - BSRR write to counter read: a few cycles, < 0.1 us
+ *   - EXTI entry and HAL dispatch to the counter read: < 100 cycles, 1.1 us
+ *   - contact bounce: excluded, an edge only counts as a press after 20 ms
+ *     without edges on that button, so a press is stamped at first contact
+ *     (the rejected edges are reported, bot_detector.h uses them)
+ * giving < 3 us in total, well inside the 10 us target. The counter cannot
+ * wrap within a trial (71 minutes).
+ *
+ * Accepted latencies go into a log-linear histogram (8 bins per octave,
+ * 12.5 % wide) small enough to be one flash store record; percentiles are
+ * interpolated within a bin.
+ */
+#ifndef __REACTION_H
+#define __REACTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REACTION_ANTICIPATION_US 100000U // Faster than humanly possible
+#define REACTION_TIMEOUT_US 2000000U
+#define REACTION_HISTOGRAM_BINS 26U
+#define REACTION_MAX_BUTTONS 8U
+#define REACTION_DEBOUNCE_US 20000U
+
+/* What the debouncer made of an edge */
+typedef enum {
+	REACTION_EDGE_BOUNCE,  // Within the quiet period of the previous edge
+	REACTION_EDGE_PRESS,
+	REACTION_EDGE_RELEASE
+} ReactionEdge;
+
+/* Latency histogram of one profile (64 bytes, one signed flash record).
+ * Bin 0 holds [100 ms, 131 ms), bins 1..24 split 131 ms .. 1.05 s in 8 bins
+ * per power of two, bin 25 holds the rest. */
+typedef struct {
+	uint16_t counts[REACTION_HISTOGRAM_BINS]; // Halved together on overflow
+	uint32_t trials;         // Accepted trials, all time
+	uint32_t best_us;
+	uint16_t anticipations;  // False starts and sub-100 ms presses
+	uint16_t reserved;
+} ReactionHistogram;
+
+void Reaction_Init(void);
+void Reaction_UpdateClock(void);
+void Reaction_AdvanceUs(uint32_t us);
+uint32_t Reaction_NowUs(void);
+void Reaction_Arm(uint32_t buttons);
+void Reaction_Disarm(void);
+ReactionEdge Reaction_OnEdge(uint8_t button, bool pressed, uint32_t now_us);
+uint32_t Reaction_LastEdgeUs(uint8_t button);
+bool Reaction_NextPress(uint8_t *button, uint32_t *press_us);
+bool Reaction_IsConsistent(void);
+
+void ReactionHistogram_Load(ReactionHistogram *histogram, uint8_t profile);
+bool ReactionHistogram_Save(const ReactionHistogram *histogram,
+		uint8_t profile);
+void ReactionHistogram_Add(ReactionHistogram *histogram, uint32_t latency_us);
+uint32_t ReactionHistogram_PercentileUs(const ReactionHistogram *histogram,
+		uint8_t percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __REACTION_H */
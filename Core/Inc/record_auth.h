@@ -0,0 +1,59 @@
+/**
+ * @file   record_auth.h
+ * @brief  HMAC-SHA-256 tags that make score records unforgeable.
+ *
+ * Every unit has its own key: HMAC-SHA-256 keyed with the provisioned
+ * secret over "SIMON-RECORD-KEY" and the unit UID (HAL_GetUIDw0..2 as
+ * little-endian words). The secret is written to the flash store once at
+ * provisioning; a build with RECORD_AUTH_SECRET defined (a string literal)
+ * provisions itself on first boot. Anyone holding the secret and a record's
+ * UID can check its tag, nobody else can produce one, as long as the flash
+ * is read-protected (RDP level 1). Tags are the first 16 bytes of the MAC
+ * (HMAC-SHA-256-128, RFC 4868). At boot the SHA-256 and HMAC known-answer
+ * tests run and the cost of one compression is measured with the DWT cycle
+ * counter; a unit that fails the tests, or has no secret, signs nothing.
+ *
+ * RecordAuth_Read() and RecordAuth_Write() keep the score records of the
+ * flash store signed: the payload is followed by the tag of the record key
+ * and payload, so a record cannot be copied to another key either. A unit
+ * that cannot sign writes a zero tag and takes records as they are; once it
+ * is provisioned it rejects every record it did not sign, so the profiles
+ * of a unit provisioned in the field start afresh.
+ */
+#ifndef __RECORD_AUTH_H
+#define __RECORD_AUTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "flash_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RECORD_AUTH_TAG_SIZE 16U
+#define RECORD_AUTH_MAX_PAYLOAD (FLASH_STORE_MAX_PAYLOAD - RECORD_AUTH_TAG_SIZE)
+
+/* Boot results, for the debugger */
+typedef struct {
+	uint32_t cycles_per_block; // Sha256_Compress(), averaged over 16 blocks
+	bool self_test_passed;
+	bool provisioned;
+} RecordAuthStats;
+
+extern RecordAuthStats record_auth_stats;
+
+void RecordAuth_Init(void);
+bool RecordAuth_Provision(const void *secret, uint32_t length);
+bool RecordAuth_Sign(const void *data, uint32_t length,
+		uint8_t tag[RECORD_AUTH_TAG_SIZE]);
+bool RecordAuth_Verify(const void *data, uint32_t length,
+		const uint8_t tag[RECORD_AUTH_TAG_SIZE]);
+bool RecordAuth_Read(uint16_t key, void *data, uint16_t length);
+bool RecordAuth_Write(uint16_t key, const void *data, uint16_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RECORD_AUTH_H */
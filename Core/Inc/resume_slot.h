@@ -0,0 +1,60 @@
+/**
+ * @file   resume_slot.h
+ * @brief  Mid-game snapshots in the flash store, resumed at boot.
+ *
+ * Every level up writes a 20-byte snapshot of the station's game: the seed,
+ * the GameCore (sequence, level and xorshift state, i.e. the RNG position),
+ * the show tempo and the player profile. The end of the game writes a
+ * cleared one. At boot the newest snapshot of each station is resumed with
+ * the show of the saved level if its game state is valid.
+ *
+ * Snapshots are flash store records (STORE_KEY_RESUME + station), so they
+ * live in its two sectors in turn: compaction copies the newest snapshot of
+ * each station into the erased sector and makes it live before the old one
+ * is ever erased, and a power loss at any point leaves a complete copy.
+ * ResumeSlot_Save() runs in constant time: it builds the record in RAM and
+ * queues it, FlashStore_Poll() programs it one word per main loop pass. A
+ * word program stalls instruction fetches for about 16 us, so no loop pass
+ * is delayed by more than that, far below what the LEDs can show. RTC
+ * backup registers would avoid flash entirely, but lose their contents when
+ * the board is unplugged unless VBAT has a battery.
+ */
+#ifndef __RESUME_SLOT_H
+#define __RESUME_SLOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "game_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One snapshot (20 bytes, one flash store record) */
+typedef struct {
+	uint16_t speed_ms;  // Show tempo
+	uint8_t station;
+	uint8_t profile;    // Skill profile of the player
+	uint32_t seed;      // Session seed
+	GameCore game;      // At the start of a level, or IDLE when cleared
+} ResumeRecord;
+
+/* Write path counters, for the debugger */
+typedef struct {
+	uint32_t saves;     // Snapshots queued
+	uint32_t dropped;   // Queue or store full
+} ResumeSlotStats;
+
+extern ResumeSlotStats resume_slot_stats;
+
+void ResumeSlot_Init(void);
+bool ResumeSlot_Load(uint8_t station, ResumeRecord *record);
+void ResumeSlot_Save(uint8_t station, uint8_t profile, uint32_t seed,
+		const GameCore *game, uint32_t speed_ms);
+void ResumeSlot_Clear(uint8_t station);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RESUME_SLOT_H */
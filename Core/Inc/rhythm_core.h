@@ -0,0 +1,76 @@
+/**
+ * @file   rhythm_core.h
+ * @brief  Hardware independent rhythm game rules.
+ *
+ * Beats fall on a fixed tempo grid in microseconds. The cue LED of a beat
+ * lights half a beat early and goes dark on the beat, and the player presses
+ * its button on the beat. Every press is matched to the nearest beat and
+ * scored by its signed timing error (positive = late) after subtracting a
+ * latency calibration offset. The round opens with count-in beats on which
+ * all LEDs flash and any button may be pressed; their mean error becomes the
+ * calibration for the rest of the round, so the player's own input and
+ * perception latency is not counted against them. Times are compared
+ * wrap-safe and come from the caller, who should stamp presses in hardware.
+ */
+#ifndef __RHYTHM_CORE_H
+#define __RHYTHM_CORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "game_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RHYTHM_COUNT_IN_BEATS 8U
+#define RHYTHM_SCORED_BEATS 32U
+#define RHYTHM_BEATS (RHYTHM_COUNT_IN_BEATS + RHYTHM_SCORED_BEATS)
+#define RHYTHM_ANY_BUTTON 0xFFU
+
+/* Timing grades, limits on the absolute error */
+#define RHYTHM_PERFECT_US 25000
+#define RHYTHM_GOOD_US 60000
+#define RHYTHM_OK_US 120000
+
+typedef enum {
+	RHYTHM_MISS,  // Outside every window, wrong button, or beat already taken
+	RHYTHM_OK,
+	RHYTHM_GOOD,
+	RHYTHM_PERFECT,
+	RHYTHM_COUNT_IN // Calibration beat, not scored
+} RhythmGrade;
+
+/* Complete state of one round */
+typedef struct {
+	uint32_t start_us;                // Time of beat 0
+	uint32_t period_us;
+	int32_t offset_us;                // Calibration subtracted from every error
+	uint8_t pattern[RHYTHM_BEATS];    // Button of each beat
+	uint64_t judged;                  // Bit k set once beat k is hit or missed
+	/* Calibration from the count-in */
+	int32_t calibration_sum_us;
+	uint8_t calibration_hits;
+	/* Running accuracy of the scored beats */
+	uint16_t grades[RHYTHM_PERFECT + 1]; // Count per RhythmGrade
+	uint16_t stray;                   // Presses that matched no beat
+	int64_t error_sum_us;
+	uint64_t abs_error_sum_us;
+	uint32_t score;
+} RhythmGame;
+
+void RhythmCore_Start(RhythmGame *game, uint32_t seed, uint32_t start_us,
+		uint32_t period_us, int32_t offset_us);
+RhythmGrade RhythmCore_Press(RhythmGame *game, uint8_t button,
+		uint32_t press_us, int32_t *error_us);
+void RhythmCore_Update(RhythmGame *game, uint32_t now_us);
+uint8_t RhythmCore_CueMask(const RhythmGame *game, uint32_t now_us);
+bool RhythmCore_IsOver(const RhythmGame *game);
+int32_t RhythmCore_MeanErrorUs(const RhythmGame *game);
+uint32_t RhythmCore_MeanAbsErrorUs(const RhythmGame *game);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __RHYTHM_CORE_H */
@@ -0,0 +1,97 @@
+/**
+ * @file   sd_archive.h
+ * @brief  Archive of fixed-size entries in a preallocated file on an SD card.
+ *
+ * The card is formatted FAT32 on a PC, which also creates SESSIONS.BIN at
+ * the root, zero-filled and in one piece (Tools/sd_archive.py create). The
+ * firmware never touches the FAT or the directory: SdArchive_Init() finds
+ * the file once, checks that its clusters are contiguous, and from then on
+ * writes blocks inside it directly.
+ *
+ * Each 512-byte block holds an 8-byte header (sequence number, entries,
+ * magic) and up to six entries. Blocks are filled in order and the file is
+ * used as a ring: sequence n goes to block (n - 1) % blocks, so the newest
+ * blocks overwrite the oldest. At boot a binary search over the sequence
+ * numbers finds where the last run stopped.
+ *
+ * Two RAM buffers of SD_ARCHIVE_BUFFER_BLOCKS blocks take turns.
+ * SdArchive_Append() copies the entry into the fill buffer. SdArchive_Poll()
+ * hands the fill buffer to the card as one multi-block write as soon as the
+ * card is ready, and entries go on to the other buffer meanwhile. A block
+ * that is only partly filled is carried over and written again with the
+ * entries that follow. Under load each write therefore takes several
+ * blocks, and when entries are rare each one is on the card within one
+ * write. The card is reached through SdBlockDevice, so the archive runs on
+ * the host against a disk image file.
+ */
+#ifndef __SD_ARCHIVE_H
+#define __SD_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_ARCHIVE_BLOCK_SIZE 512U
+#define SD_ARCHIVE_ENTRY_SIZE 84U      // sizeof(SessionRecord)
+#define SD_ARCHIVE_HEADER_SIZE 8U
+#define SD_ARCHIVE_ENTRIES_PER_BLOCK ((SD_ARCHIVE_BLOCK_SIZE \
+		- SD_ARCHIVE_HEADER_SIZE) / SD_ARCHIVE_ENTRY_SIZE)
+#define SD_ARCHIVE_BUFFER_BLOCKS 4U    // Largest write, 24 entries
+#define SD_ARCHIVE_FILE_NAME "SESSIONSBIN" // 8.3 directory entry form
+
+/* State of the card after a write */
+typedef enum {
+	SD_DEVICE_READY,
+	SD_DEVICE_BUSY,  // Write in progress, or the bus is taken
+	SD_DEVICE_FAILED // The last write was not accepted; now ready
+} SdDeviceStatus;
+
+/* An SD card in 512-byte blocks, addressed by block number */
+typedef struct {
+	bool (*read)(uint32_t block, void *data); // One block, blocking
+	/* Starts writing count consecutive blocks; returns at once, the data
+	 stays in place until status() is no longer SD_DEVICE_BUSY */
+	void (*write)(uint32_t block, const void *data, uint32_t count);
+	SdDeviceStatus (*status)(void);
+	uint32_t (*now_us)(void); // Clock for the statistics
+} SdBlockDevice;
+
+/* Why there is no archive */
+typedef enum {
+	SD_ARCHIVE_READY,
+	SD_ARCHIVE_NO_CARD,
+	SD_ARCHIVE_NO_FAT32,     // No FAT32 volume with 512-byte sectors
+	SD_ARCHIVE_NO_FILE,      // SESSIONS.BIN missing from the root
+	SD_ARCHIVE_FRAGMENTED    // SESSIONS.BIN is not in one piece
+} SdArchiveState;
+
+/* Archive state and cost, for the debugger */
+typedef struct {
+	uint32_t state;          // SdArchiveState
+	uint32_t first_block;    // Of the file on the card
+	uint32_t blocks;         // In the file, 0 without an archive
+	uint32_t sequence;       // Of the block entries go to next
+	uint32_t appended;       // Since boot
+	uint32_t dropped;        // Both buffers busy, or no archive
+	uint32_t writes;         // Multi-block writes started
+	uint32_t blocks_written;
+	uint32_t write_errors;   // Rejected writes, retried
+	uint32_t max_write_us;   // Longest write, start to ready
+	uint32_t mount_reads;    // Device reads by SdArchive_Init()
+	uint32_t mount_us;
+} SdArchiveStats;
+
+extern SdArchiveStats sd_archive_stats;
+
+void SdArchive_Init(const SdBlockDevice *device);
+bool SdArchive_Append(const void *entry);
+void SdArchive_Poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_ARCHIVE_H */
@@ -0,0 +1,50 @@
+/**
+ * @file   sd_spi.h
+ * @brief  SD card in SPI mode on SPI2, for sd_archive.h.
+ *
+ * The Black Pill's package does not bring out the SDIO pins, so the card
+ * sits on the shared SPI2 bus (spi_bus.h) with PA15 as chip select, on
+ * 3V3. It is identified at 375 kHz and then driven at 24 MHz, the limit of
+ * default speed mode. SDSC cards (byte addresses) and SDHC/SDXC cards
+ * (block addresses) both work.
+ *
+ * Reads are polled and block, they are only used while mounting. Writes
+ * use CMD25: each 512-byte block goes out by DMA, and SdSpi_Status() moves
+ * the transfer on one step per call (CRC and data response, the card's
+ * busy time, the next block, the stop token). While the card programs a
+ * block the chip select is released, so the NOR flash can use the bus.
+ */
+#ifndef __SD_SPI_H
+#define __SD_SPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sd_archive.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Card identity and traffic, for the debugger */
+typedef struct {
+	uint32_t ocr;            // 0 without a card
+	uint32_t high_capacity;  // Addressed in blocks
+	uint32_t init_ms;
+	uint32_t blocks_read;
+	uint32_t blocks_written; // Accepted by the card
+	uint32_t errors;         // Failed commands, reads and writes
+} SdSpiStats;
+
+extern SdSpiStats sd_spi_stats;
+extern const SdBlockDevice sd_spi_device;
+
+bool SdSpi_Init(void);
+bool SdSpi_Read(uint32_t block, void *data);
+void SdSpi_Write(uint32_t block, const void *data, uint32_t count);
+SdDeviceStatus SdSpi_Status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SD_SPI_H */
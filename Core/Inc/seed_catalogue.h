@@ -0,0 +1,41 @@
+/**
+ * @file   seed_catalogue.h
+ * @brief  Seeds sorted by how hard the sequence they produce is.
+ *
+ * A sequence is fully determined by its seed, so seeds can be rated before
+ * they are played. At boot the catalogue rates SEED_CATALOGUE_SIZE seeds
+ * with a pluggable metric and sorts them; picking a seed from a difficulty
+ * band is then two binary searches. Rating all seeds takes well under a
+ * millisecond on the F411 because each one is just GAME_MAX_LEVEL xorshift
+ * draws.
+ */
+#ifndef __SEED_CATALOGUE_H
+#define __SEED_CATALOGUE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SEED_CATALOGUE_SIZE 1024U
+
+/* Rates a sequence; larger means harder */
+typedef uint16_t (*DifficultyMetric)(const uint8_t *steps, uint8_t count);
+
+uint16_t Difficulty_Repeats(const uint8_t *steps, uint8_t count);
+uint16_t Difficulty_Transitions(const uint8_t *steps, uint8_t count);
+uint16_t Difficulty_Entropy(const uint8_t *steps, uint8_t count);
+uint16_t Difficulty_ChunkBot(const uint8_t *steps, uint8_t count);
+uint16_t Difficulty_Default(const uint8_t *steps, uint8_t count);
+
+void SeedCatalogue_Build(DifficultyMetric metric);
+uint32_t SeedCatalogue_Pick(uint16_t min_difficulty, uint16_t max_difficulty,
+		uint32_t entropy);
+uint16_t SeedCatalogue_DifficultyAtPercentile(uint8_t percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SEED_CATALOGUE_H */
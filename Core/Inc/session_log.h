@@ -0,0 +1,85 @@
+/**
+ * @file   session_log.h
+ * @brief  Per-game session records for fleet statistics.
+ *
+ * One fixed-size record per game: unit UID (HAL_GetUIDw0..2), seed, result
+ * and the reaction time of every press, closed by a CRC computed by the
+ * hardware CRC unit. The CRC is CRC-32/MPEG-2 (poly 0x04C11DB7, init
+ * 0xFFFFFFFF, no reflection, no final XOR) over the record's little-endian
+ * 32-bit words up to the crc field, so host tools can check it with any
+ * standard implementation. When the unit is provisioned the record also
+ * carries an HMAC-SHA-256-128 tag over the words before the tag field (see
+ * record_auth.h), which the CRC then covers too. The most recent SESSION_LOG_CAPACITY records are
+ * kept in RAM for dumping. Each game station has its own open record, so
+ * stations can play at the same time. Finished records are also appended
+ * to the external flash log (nor_log.h) and the SD card archive
+ * (sd_archive.h) when they are fitted.
+ */
+#ifndef __SESSION_LOG_H
+#define __SESSION_LOG_H
+
+#include <stdint.h>
+#include "game_core.h"
+#include "nor_log.h"
+#include "record_auth.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SESSION_RECORD_MAGIC 0x53455332U // "SES2", bump the digit on layout changes
+#define SESSION_LOG_CAPACITY 16U
+#define SESSION_MAX_PRESSES (GAME_MAX_LEVEL * (GAME_MAX_LEVEL + 1) / 2)
+#define SESSION_STATIONS 2U
+#define SESSION_FLAG_STATION_MASK 0x0003U // Station that played the game
+#define SESSION_FLAG_AUTOMATED 0x0004U     // Timing looked machine-driven
+#define SESSION_FLAG_SIGNED 0x0008U        // tag holds a valid HMAC tag
+#define SESSION_FLAG_RESUMED 0x0010U       // Continued after a power loss
+
+/* How a session ended */
+typedef enum {
+	SESSION_ABORTED, // Game abandoned (corrupted state, power loss, ...)
+	SESSION_LOST,
+	SESSION_WON
+} SessionResult;
+
+/* Game mode of a session. Never renumber: records in the field carry it */
+typedef enum {
+	SESSION_MODE_CLASSIC,
+	SESSION_MODE_REACTION, // seed gives the LED order, one press per trial
+	SESSION_MODE_WHACK,    // reaction_ms holds hit latencies
+	SESSION_MODE_RHYTHM    // reaction_ms holds absolute timing errors
+} SessionMode;
+
+/* One game (84 bytes, a multiple of 4 so the CRC unit sees whole words) */
+typedef struct {
+	uint32_t magic;
+	uint32_t uid[3];        // Unit unique ID
+	uint32_t session;       // Sessions since boot
+	uint32_t start_tick;    // HAL_GetTick() at START
+	uint32_t seed;          // Reproduces the sequence through GameCore_Start()
+	uint8_t result;         // SessionResult
+	uint8_t levels_completed;
+	uint8_t presses;        // Valid entries in reaction_ms
+	uint8_t mode;           // SessionMode
+	uint16_t reaction_ms[SESSION_MAX_PRESSES]; // Turn start (or previous press) to press
+	uint16_t flags;         // SESSION_FLAG_*, other bits reserved 0
+	uint8_t tag[RECORD_AUTH_TAG_SIZE]; // Zero when not signed
+	uint32_t crc;
+} SessionRecord;
+
+void SessionLog_Init(void);
+void SessionLog_Begin(uint8_t station, uint32_t seed, SessionMode mode);
+void SessionLog_Press(uint8_t station, uint32_t reaction_ms);
+void SessionLog_Flag(uint8_t station, uint16_t flags);
+void SessionLog_End(uint8_t station, SessionResult result,
+		uint8_t levels_completed);
+const SessionRecord* SessionLog_Latest(uint32_t age);
+uint32_t SessionLog_Crc(const SessionRecord *record);
+NorLogRead SessionLog_History(uint32_t age, SessionRecord *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SESSION_LOG_H */
@@ -0,0 +1,53 @@
+/**
+ * @file   sha256.h
+ * @brief  SHA-256 (FIPS 180-4) and HMAC-SHA-256 (RFC 2104).
+ *
+ * The compression function is written for the Cortex-M4: all 64 rounds are
+ * unrolled and the eight working variables rotate by renaming instead of
+ * being moved, so they can stay in registers, and the message schedule is a
+ * 16-word ring computed just in time. Like game_core.cpp this depends only
+ * on <stdint.h>/<string.h> and builds on the host, where test_sha256 checks
+ * it against the NIST and RFC 4231 vectors. Sha256_SelfTest() runs three of
+ * them at boot.
+ */
+#ifndef __SHA256_H
+#define __SHA256_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_BLOCK_SIZE 64U
+#define SHA256_DIGEST_SIZE 32U
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t length;                   // Bytes hashed so far
+	uint8_t buffer[SHA256_BLOCK_SIZE]; // Partial block
+} Sha256;
+
+typedef struct {
+	Sha256 inner;
+	Sha256 outer;                      // Already fed with the outer key pad
+} HmacSha256;
+
+void Sha256_Compress(uint32_t state[8], const uint8_t *block);
+void Sha256_Init(Sha256 *sha);
+void Sha256_Update(Sha256 *sha, const void *data, size_t length);
+void Sha256_Final(Sha256 *sha, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+void HmacSha256_Init(HmacSha256 *hmac, const void *key, size_t key_length);
+void HmacSha256_Update(HmacSha256 *hmac, const void *data, size_t length);
+void HmacSha256_Final(HmacSha256 *hmac, uint8_t mac[SHA256_DIGEST_SIZE]);
+
+bool Sha256_SelfTest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SHA256_H */
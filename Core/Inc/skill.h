@@ -0,0 +1,45 @@
+/**
+ * @file   skill.h
+ * @brief  Online estimate of a player's memory span and reaction speed.
+ *
+ * Elo-style model in integer fixed point, constant memory per profile.
+ * Repeating step i of a sequence is treated as a contest against difficulty
+ * i + 1 (items to recall). The expected success is a logistic function of
+ * span - difficulty, and after every press the span moves by
+ * K * (outcome - expected), with K shrinking as observations accumulate.
+ * Reaction time is an exponential moving average. The model is saved per
+ * profile in the flash store and feeds seed difficulty and show tempo.
+ */
+#ifndef __SKILL_H
+#define __SKILL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SKILL_PROFILE_COUNT 4U
+
+/* Persisted model (12 bytes) */
+typedef struct {
+	int32_t span_q8;      // Estimated memory span in sequence steps, Q8
+	uint32_t reaction_q4; // Smoothed reaction time in ms, Q4
+	uint32_t observations;
+} SkillModel;
+
+void Skill_Reset(SkillModel *model);
+void Skill_Load(SkillModel *model, uint8_t profile);
+bool Skill_Save(const SkillModel *model, uint8_t profile);
+void Skill_Observe(SkillModel *model, uint8_t position, bool correct,
+		uint32_t reaction_ms);
+uint8_t Skill_TargetPercentile(const SkillModel *model);
+uint32_t Skill_TempoMs(const SkillModel *model, uint32_t min_ms,
+		uint32_t max_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SKILL_H */
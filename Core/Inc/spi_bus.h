@@ -0,0 +1,45 @@
+/**
+ * @file   spi_bus.h
+ * @brief  SPI2, shared by the NOR flash (spi_nor.h) and the SD card (sd_spi.h).
+ *
+ * Wiring: PB13 SCK, PB14 MISO, PB15 MOSI (AF5); chip selects PB12 for the
+ * flash and PA15 for the card. Both devices use mode 0. The bus runs at
+ * PCLK1 / 2, 24 MHz, or at PCLK1 / 128, 375 kHz, while an SD card is being
+ * identified. Bytes are exchanged by polling; long writes go by DMA1
+ * Stream 4 (channel 0, SPI2_TX) and keep the chip selected across polls.
+ *
+ * Only the main loop uses the bus. A device claims it for anything that
+ * spans more than one call, such as a DMA write, and the other device then
+ * reports itself busy until it is released.
+ */
+#ifndef __SPI_BUS_H
+#define __SPI_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	SPI_BUS_NOR,
+	SPI_BUS_SD,
+	SPI_BUS_NONE
+} SpiBusDevice;
+
+void SpiBus_Init(void);
+bool SpiBus_Claim(SpiBusDevice device);
+void SpiBus_Release(SpiBusDevice device);
+void SpiBus_Select(SpiBusDevice device);
+void SpiBus_Deselect(SpiBusDevice device);
+void SpiBus_SetSlow(bool slow);
+uint8_t SpiBus_Transfer(uint8_t byte);
+void SpiBus_StartWrite(const void *data, uint32_t length);
+bool SpiBus_WriteDone(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPI_BUS_H */
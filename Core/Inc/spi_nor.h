@@ -0,0 +1,45 @@
+/**
+ * @file   spi_nor.h
+ * @brief  SPI NOR flash (W25Q32 and similar) on SPI2, for nor_log.h.
+ *
+ * The chip sits on the shared SPI2 bus (spi_bus.h) with PB12 as chip
+ * select, on 3V3. Commands and addresses are shifted out by polling. The
+ * data of a page program goes by DMA, so starting one costs a few
+ * microseconds whatever its length. SpiNor_Busy() ends the DMA transfer
+ * once it is done and then asks the chip, so nothing ever waits for a
+ * program (about 0.7 ms) or a sector erase (about 45 ms, up to 400 ms).
+ */
+#ifndef __SPI_NOR_H
+#define __SPI_NOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "nor_log.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Chip identity and traffic, for the debugger */
+typedef struct {
+	uint32_t jedec_id;  // Manufacturer, type, capacity; 0 without a chip
+	uint32_t size;      // Bytes
+	uint32_t programs;
+	uint32_t erases;
+	uint32_t bytes_read;
+} SpiNorStats;
+
+extern SpiNorStats spi_nor_stats;
+extern const NorDevice spi_nor_device;
+
+bool SpiNor_Init(void);
+bool SpiNor_Busy(void);
+void SpiNor_Program(uint32_t address, const void *data, uint32_t length);
+void SpiNor_Erase(uint32_t address);
+void SpiNor_Read(uint32_t address, void *data, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SPI_NOR_H */
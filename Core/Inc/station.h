@@ -0,0 +1,76 @@
+/**
+ * @file   station.h
+ * @brief  Non-blocking Simon Says station.
+ *
+ * A station is one player's set of 4 LEDs and 4 buttons running the classic
+ * game. All of its state lives in the Station instance and every call to
+ * Station_Step() returns at once: waiting is done by comparing HAL ticks
+ * against a deadline, never by HAL_Delay(). The main loop steps every
+ * station in turn from one input scan and writes their LED wishes to the
+ * port in one frame, so stations keep independent timing and do not
+ * interfere.
+ */
+#ifndef __STATION_H
+#define __STATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "bot_detector.h"
+#include "game_core.h"
+#include "resume_slot.h"
+#include "session_log.h"
+#include "skill.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What the station is doing inside the current GameState */
+typedef enum {
+	STATION_WAIT,       // Nothing timed: idle, or waiting for a press
+	STATION_SHOW_ON,    // Sequence step lit
+	STATION_SHOW_OFF,   // Gap after a sequence step
+	STATION_ECHO_ON,    // Pressed button's LED lit until release
+	STATION_ECHO_OFF,   // Gap before the press is judged
+	STATION_ANIMATION   // Game over or win animation
+} StationPhase;
+
+typedef struct {
+	GameCore game;
+	SkillModel skill;
+	BotDetector detector; // Fed from the EXTI edges of the station's buttons
+	uint8_t id;           // Station number, also used for session records
+	uint8_t profile;      // Skill profile of the player
+	uint8_t phase;        // StationPhase
+	uint8_t step;         // Sequence step or animation frame
+	uint8_t button;       // Button being echoed
+	uint8_t position;     // Sequence position the echoed press answers
+	uint8_t leds;         // Bit i set to light LED i of the station
+	bool pressed_now;     // A press was accepted by the last Station_Step()
+	bool quick_animations; // One blink, one running light (low battery)
+	uint32_t deadline;    // HAL tick ending the current phase
+	uint32_t turn_start;  // HAL tick the player could start the press
+	uint32_t reaction_ms; // Reaction time of the echoed press
+	uint32_t speed_ms;    // Show tempo of the current game
+	uint32_t seed;        // Seed of the current game
+	/* Worst-case press-to-LED latency, including one main loop pass */
+	uint32_t latency_last_us;
+	uint32_t latency_max_us;
+} Station;
+
+void Station_Init(Station *station, uint8_t id, uint8_t profile);
+void Station_Start(Station *station, uint32_t seed, uint32_t now,
+		uint32_t speed_ms);
+void Station_Resume(Station *station, const ResumeRecord *record,
+		uint32_t now);
+void Station_Step(Station *station, uint32_t now, uint32_t buttons);
+void Station_Abort(Station *station);
+void Station_EndSession(Station *station, SessionResult result,
+		uint8_t levels_completed);
+bool Station_IsIdle(const Station *station);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __STATION_H */
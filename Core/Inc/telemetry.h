@@ -0,0 +1,43 @@
+/**
+ * @file   telemetry.h
+ * @brief  Telemetry and command channel on the USB virtual serial port.
+ *
+ * The host sends text commands, one per line:
+ *   frames on|off     stream the LED frame ring, one "F" line per frame
+ *   sessions          dump the finished session records as hex, oldest first
+ *   history N         the same for the newest N records of the flash log
+ *   stats             one "S" line with clock, signing, stream,
+ *                     brightness and battery counters
+ *   brightness auto|full  follow the room light, or stay at full brightness
+ *   provision SECRET  store the record signing secret (RecordAuth_Provision)
+ * and gets "ok" or "error" after each one. Everything is hexadecimal and
+ * written only when a whole line fits the transmit buffer; frames that do
+ * not fit are counted as dropped instead of stalling the game loop.
+ */
+#ifndef __TELEMETRY_H
+#define __TELEMETRY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEMETRY_LINE_SIZE 64U // Longest command accepted
+
+/* Stream counters, for the debugger and the "stats" command */
+typedef struct {
+	uint32_t frames_sent;
+	uint32_t frames_dropped; // Overwritten in the ring or no room on the port
+	uint32_t commands;
+} TelemetryStats;
+
+extern TelemetryStats telemetry_stats;
+
+void Telemetry_Poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TELEMETRY_H */
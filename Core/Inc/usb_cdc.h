@@ -0,0 +1,55 @@
+/**
+ * @file   usb_cdc.h
+ * @brief  USB CDC-ACM device class (virtual serial port).
+ *
+ * The class answers the CDC control requests and runs the data endpoints
+ * on top of usb_device.h, so like the core it runs on the host against a
+ * fake controller. Its hooks run in the USB interrupt; the application
+ * calls UsbCdc_Write/Read/Poll from the main loop.
+ *
+ * Both data directions are double-buffered. Writes fill one
+ * USB_CDC_TX_BUFFER_SIZE buffer while the other is on the wire as one
+ * multi-packet bulk transfer, and UsbCdc_Poll() swaps them, so the bus
+ * stays busy as long as the loop keeps up. OUT packets land in one of two
+ * packet buffers; while the application reads one, the host can already
+ * send into the other, and the endpoint NAKs only when both are full.
+ */
+#ifndef __USB_CDC_H
+#define __USB_CDC_H
+
+#include "usb_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_CDC_PACKET_SIZE 64U       // Full-speed bulk packets
+#define USB_CDC_NOTIFY_PACKET_SIZE 8U
+#define USB_CDC_TX_BUFFER_SIZE 512U   // Each of the two transmit buffers
+#define USB_CDC_DATA_OUT_EP 0x01U
+#define USB_CDC_DATA_IN_EP 0x81U
+#define USB_CDC_NOTIFY_EP 0x82U
+
+/* Line settings the host asked for (they do not affect the data) */
+typedef struct {
+	uint32_t baud_rate;
+	uint8_t stop_bits;
+	uint8_t parity;
+	uint8_t data_bits;
+} UsbCdcLineCoding;
+
+extern const UsbClass usb_cdc_class;
+
+void UsbCdc_SetOpenHandler(void (*on_open)(void));
+bool UsbCdc_IsConnected(void);
+uint32_t UsbCdc_Write(const void *data, uint32_t length);
+uint32_t UsbCdc_WriteSpace(void);
+uint32_t UsbCdc_Read(void *data, uint32_t max_length);
+void UsbCdc_Poll(void);
+const UsbCdcLineCoding* UsbCdc_LineCoding(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_CDC_H */
@@ -0,0 +1,108 @@
+/**
+ * @file   usb_device.h
+ * @brief  USB device core: control transfers and the chapter 9 requests.
+ *
+ * The core sits between a controller driver (usb_otg.cpp) and one device
+ * class (usb_cdc.cpp or usb_hid.cpp). The driver reports bus events through
+ * UsbDevice_On* from the USB interrupt. The core runs the endpoint 0 control
+ * transfers and answers the standard requests from the class's descriptors.
+ * It passes everything else to the class hooks. Nothing here depends on HAL
+ * or CMSIS, so a class and the core run on the host against a fake
+ * controller.
+ */
+#ifndef __USB_DEVICE_H
+#define __USB_DEVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_EP0_PACKET_SIZE 64U
+#define USB_MAX_SERIAL_LENGTH 24U
+
+/* bmRequestType fields */
+#define USB_REQUEST_DEVICE_TO_HOST 0x80U
+#define USB_REQUEST_TYPE_MASK 0x60U
+#define USB_REQUEST_TYPE_STANDARD 0x00U
+#define USB_REQUEST_TYPE_CLASS 0x20U
+
+/* Descriptor types */
+#define USB_DESCRIPTOR_DEVICE 1U
+#define USB_DESCRIPTOR_CONFIGURATION 2U
+#define USB_DESCRIPTOR_STRING 3U
+
+/* USB endpoint types */
+typedef enum {
+	USB_EP_CONTROL,
+	USB_EP_ISOCHRONOUS,
+	USB_EP_BULK,
+	USB_EP_INTERRUPT
+} UsbEndpointType;
+
+/* What the core and the classes need from a device controller. Endpoints
+ * are USB addresses, bit 7 set for IN. */
+typedef struct {
+	void (*open)(uint8_t ep, UsbEndpointType type, uint16_t max_packet);
+	/* Sends length bytes as one transfer of max_packet sized packets; a zero
+	 length sends a zero-length packet. data stays untouched until
+	 UsbDevice_OnInComplete(). */
+	void (*transmit)(uint8_t ep, const uint8_t *data, uint16_t length);
+	/* Accepts one OUT packet of at most max_length bytes into buffer */
+	void (*receive)(uint8_t ep, uint8_t *buffer, uint16_t max_length);
+	void (*stall)(uint8_t ep);
+	void (*set_address)(uint8_t address);
+} UsbDriver;
+
+/* A SETUP packet, fields in host order */
+typedef struct {
+	uint8_t request_type;
+	uint8_t request;
+	uint16_t value;
+	uint16_t index;
+	uint16_t length;
+} UsbSetup;
+
+/* One device class. String indices 1, 2 and 3 of the device descriptor are
+ * the manufacturer, the product and the serial number. The hooks run in the
+ * USB interrupt. */
+typedef struct {
+	const uint8_t *device_descriptor;
+	const uint8_t *configuration_descriptor;
+	uint16_t configuration_length;
+	const char *manufacturer;
+	const char *product;
+	void (*reset)(void);     // Bus reset, or configuration 0 selected
+	void (*configure)(void); // Configuration 1 selected: open the endpoints
+	/* Requests the core does not answer itself. Reply with
+	 UsbDevice_ControlSend(), UsbDevice_ControlReceive() or
+	 UsbDevice_ControlAcknowledge(); false stalls. */
+	bool (*setup)(const UsbSetup *setup);
+	/* Data stage of a request taken with UsbDevice_ControlReceive(); the
+	 core acknowledges it, false stalls */
+	bool (*control_out)(const UsbSetup *setup, const uint8_t *data,
+			uint16_t length);
+	void (*out)(uint8_t ep, uint16_t length);
+	void (*in_complete)(uint8_t ep);
+} UsbClass;
+
+void UsbDevice_Init(const UsbDriver *driver, const UsbClass *usb_class,
+		const char *serial_number);
+void UsbDevice_OnReset(void);
+void UsbDevice_OnSetup(const uint8_t setup[8]);
+void UsbDevice_OnOut(uint8_t ep, uint16_t length);
+void UsbDevice_OnInComplete(uint8_t ep);
+
+const UsbDriver* UsbDevice_Driver(void);
+bool UsbDevice_IsConfigured(void);
+void UsbDevice_ControlSend(const uint8_t *data, uint16_t length);
+void UsbDevice_ControlReceive(void);
+void UsbDevice_ControlAcknowledge(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_DEVICE_H */
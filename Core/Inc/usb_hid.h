@@ -0,0 +1,51 @@
+/**
+ * @file   usb_hid.h
+ * @brief  USB HID gamepad class: the eight game buttons in, the eight LEDs
+ *         out.
+ *
+ * The input report is one byte, bit i for button i. The host polls its
+ * interrupt endpoint every millisecond (bInterval 1, the full-speed
+ * minimum). A report is only queued when the debounced button mask has
+ * changed: UsbHid_Poll() writes the mask straight into the endpoint's
+ * transfer buffer and arms it, so the report goes out at the next poll. The
+ * host sets the LEDs with a one-byte output report, on the interrupt OUT
+ * endpoint or by SET_REPORT. Press-to-report latency is measured from the
+ * first contact, timestamped in EXTI, to the interrupt that reports the
+ * host has collected the report. Like usb_cdc.h the class builds on the
+ * host against a fake controller.
+ */
+#ifndef __USB_HID_H
+#define __USB_HID_H
+
+#include "usb_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_HID_REPORT_EP 0x81U
+#define USB_HID_OUTPUT_EP 0x01U
+#define USB_HID_PACKET_SIZE 8U
+#define USB_HID_POLL_MS 1U
+
+/* Press-to-report latency, for the debugger */
+typedef struct {
+	uint32_t reports;         // Button changes collected by the host
+	uint32_t latency_last_us; // First edge of a change to its report collected
+	uint32_t latency_max_us;
+	uint64_t latency_sum_us;  // Mean: latency_sum_us / reports
+} UsbHidStats;
+
+extern UsbHidStats usb_hid_stats;
+extern const UsbClass usb_hid_class;
+
+void UsbHid_SetClock(uint32_t (*now_us)(void));
+void UsbHid_OnButtons(uint8_t buttons, uint32_t time_us);
+void UsbHid_Poll(void);
+uint8_t UsbHid_Leds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_HID_H */
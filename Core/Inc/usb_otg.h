@@ -0,0 +1,31 @@
+/**
+ * @file   usb_otg.h
+ * @brief  Register-level device driver for the OTG FS core.
+ *
+ * The core runs in slave mode (no DMA): the interrupt copies received
+ * packets out of the shared RX FIFO and refills the TX FIFO of an IN
+ * endpoint whenever it drains, so a multi-packet transfer runs without the
+ * main loop. Only PA11 (DM) and PA12 (DP) are used; VBUS sensing is off
+ * because PA9 drives an LED, so the board is always seen as powered.
+ */
+#ifndef __USB_OTG_H
+#define __USB_OTG_H
+
+#include "usb_device.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USB_OTG_IRQ_PRIORITY 8U // Below the buttons, above SysTick
+
+extern const UsbDriver usb_otg_driver;
+
+void UsbOtg_Init(const UsbClass *usb_class);
+void UsbOtg_IRQHandler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __USB_OTG_H */
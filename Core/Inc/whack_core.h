@@ -0,0 +1,58 @@
+/**
+ * @file   whack_core.h
+ * @brief  Hardware independent whack-a-mole rules.
+ *
+ * Moles (lit LEDs) pop up at random intervals, several can be up at once and
+ * each one has its own expiry deadline. The caller feeds the current time
+ * and the mask of buttons that went down since the last update; every
+ * update first scores all hits of the mask, then spawns and retires moles
+ * in the order their times fell due, so any number of hits in the same
+ * millisecond resolve the same way regardless of order, and updates far
+ * apart give the same round as updates every millisecond. A mole stays up
+ * to and including its deadline millisecond, and a hit scores more the
+ * faster it is. Times are compared wrap-safe, so any free-running
+ * millisecond counter works. Like game_core.cpp this depends only on
+ * <stdint.h>/<string.h> and builds on the host for simulation.
+ */
+#ifndef __WHACK_CORE_H
+#define __WHACK_CORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "game_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WHACK_ROUND_MS 30000U
+#define WHACK_HIT_POINTS 100U // Points for an instant hit, 10 % at the deadline
+
+/* Complete state of one round */
+typedef struct {
+	uint32_t rng_state;                    // xorshift32 state
+	uint32_t spawned_ms[GAME_LED_COUNT];   // When each mole popped up
+	uint32_t expiry_ms[GAME_LED_COUNT];    // Deadline of each mole
+	uint32_t next_spawn_ms;
+	uint32_t end_ms;
+	uint32_t score;
+	uint16_t window_ms;                    // Lifetime of a mole
+	uint16_t spawn_ms;                     // Mean time between spawns
+	uint16_t hits;
+	uint16_t misses;                       // Moles that expired
+	uint16_t wrong;                        // Presses with no mole up
+	uint8_t active;                        // Bit i set while mole i is up
+	uint8_t over;
+} WhackGame;
+
+void WhackCore_Start(WhackGame *game, uint32_t seed, uint32_t now_ms,
+		uint16_t window_ms, uint16_t spawn_ms);
+uint8_t WhackCore_Update(WhackGame *game, uint32_t now_ms, uint32_t pressed,
+		uint32_t *latency_ms);
+bool WhackCore_IsOver(const WhackGame *game);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __WHACK_CORE_H */
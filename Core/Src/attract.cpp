@@ -0,0 +1,151 @@
+/*
+ * @brief Attract mode
+ * TIM1 and DMA2 are driven by registers directly, the TIM HAL module is not
+ * part of the project. DMA2 is used because only DMA2 reaches the AHB1
+ * GPIO ports.
+ */
+#include "main.h"
+#include "attract.h"
+#include "led_slots.h"
+#include "reaction.h"
+
+constexpr uint32_t FRAME_RATE_HZ = 8;
+constexpr uint32_t TIMER_TICK_HZ = 10000;
+constexpr uint8_t LED_FIRST_PIN = 3; // LEDs are PA3..PA10
+constexpr uint32_t LED_PINS = 0xFFU << LED_FIRST_PIN;
+constexpr uint32_t DMA_CHANNEL_TIM1_UP = 6;
+
+/**
+ * @brief  BSRR word that shows exactly the given LEDs (bit i = LED i)
+ */
+constexpr uint32_t Frame(uint32_t leds) {
+	return ((leds << LED_FIRST_PIN) & LED_PINS)
+			| ((LED_PINS & ~(leds << LED_FIRST_PIN)) << 16);
+}
+
+/**
+ * @brief  Most LEDs lit in one frame of a table
+ */
+constexpr uint8_t MostLit(const uint32_t *frames, uint16_t count) {
+	uint8_t most = 0;
+	for (uint16_t i = 0; i < count; ++i) {
+		uint8_t lit = 0;
+		for (uint32_t bits = frames[i] & LED_PINS; bits != 0; bits &= bits - 1) {
+			++lit;
+		}
+		most = lit > most ? lit : most;
+	}
+	return most;
+}
+
+// Running light across both stations and back, then each station flashes
+static constexpr uint32_t attract_frames[] = {
+		Frame(0x01), Frame(0x02), Frame(0x04), Frame(0x08),
+		Frame(0x10), Frame(0x20), Frame(0x40), Frame(0x80),
+		Frame(0x40), Frame(0x20), Frame(0x10), Frame(0x08),
+		Frame(0x04), Frame(0x02), Frame(0x01), Frame(0x00),
+		Frame(0x0F), Frame(0xF0), Frame(0x0F), Frame(0xF0) };
+constexpr uint16_t FRAME_COUNT = sizeof(attract_frames)
+		/ sizeof(attract_frames[0]);
+
+/* The LEDs are driven directly here, without the slot scheduler */
+static_assert(MostLit(attract_frames, FRAME_COUNT) <= LED_SLOTS_MAX_LIT,
+		"a frame lights more LEDs than may conduct at once");
+
+AttractStats attract_stats;
+static volatile bool running;
+
+/**
+ * @brief  Starts TIM1 update events feeding the frame table into BSRR
+ * @return None
+ */
+static void Start() {
+	__HAL_RCC_DMA2_CLK_ENABLE();
+	__HAL_RCC_TIM1_CLK_ENABLE();
+
+	DMA2_Stream5->CR = 0;
+	while (DMA2_Stream5->CR & DMA_SxCR_EN) {
+	}
+	DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5
+			| DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+	DMA2_Stream5->PAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			&GPIOA->BSRR));
+	DMA2_Stream5->M0AR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			attract_frames));
+	DMA2_Stream5->NDTR = FRAME_COUNT;
+	DMA2_Stream5->FCR = 0; // Direct mode
+	DMA2_Stream5->CR = (DMA_CHANNEL_TIM1_UP << DMA_SxCR_CHSEL_Pos)
+			| DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC
+			| DMA_SxCR_CIRC | DMA_SxCR_DIR_0 | DMA_SxCR_EN;
+
+	/* APB2 timers run at twice PCLK2 when the APB2 prescaler is not 1 */
+	uint32_t timer_clock = HAL_RCC_GetPCLK2Freq();
+	if ((RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1) {
+		timer_clock *= 2;
+	}
+	TIM1->CR1 = 0;
+	TIM1->PSC = timer_clock / TIMER_TICK_HZ - 1;
+	TIM1->ARR = TIMER_TICK_HZ / FRAME_RATE_HZ - 1;
+	TIM1->RCR = 0;
+	TIM1->EGR = TIM_EGR_UG; // Load the prescaler now
+	TIM1->SR = 0;
+	TIM1->DIER = TIM_DIER_UDE;
+	running = true;
+	TIM1->CR1 = TIM_CR1_CEN;
+}
+
+/**
+ * @brief  Stops the animation and darkens the board. Safe to call from an
+ *         interrupt and when the animation is not running.
+ * @return None
+ */
+void Attract_Stop(void) {
+	if (!running) {
+		return;
+	}
+	/* No more DMA requests, then let the stream finish its current word */
+	TIM1->CR1 = 0;
+	TIM1->DIER = 0;
+	DMA2_Stream5->CR &= ~DMA_SxCR_EN;
+	while (DMA2_Stream5->CR & DMA_SxCR_EN) {
+	}
+	GPIOA->BSRR = LED_PINS << 16;
+	running = false;
+}
+/**
+ * @brief  Plays the animation with the core asleep until a START edge or a
+ *         host opening the serial port stops it
+ * @return None
+ */
+void Attract_Run(void) {
+	attract_stats.active_us_per_s = 0;
+	attract_stats.wakeups = 0;
+	Start();
+	HAL_SuspendTick();
+
+	uint32_t window_start_us = Reaction_NowUs();
+	uint32_t asleep_us = 0;
+	/* With interrupts masked, an edge arriving just before WFI stays pending
+	 and wakes the core instead of being lost */
+	__disable_irq();
+	while (running) {
+		uint32_t sleep_us = Reaction_NowUs();
+		__WFI();
+		uint32_t wake_us = Reaction_NowUs();
+		asleep_us += wake_us - sleep_us;
+		++attract_stats.wakeups;
+
+		uint32_t window_us = wake_us - window_start_us;
+		if (window_us >= 1000000U) {
+			attract_stats.active_us_per_s = static_cast<uint64_t>(window_us
+					- asleep_us) * 1000000U / window_us;
+			window_start_us = wake_us;
+			asleep_us = 0;
+		}
+		__enable_irq(); // The waking interrupt runs here
+		__disable_irq();
+	}
+	__enable_irq();
+
+	HAL_ResumeTick();
+}
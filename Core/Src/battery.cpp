@@ -0,0 +1,119 @@
+/*
+ * @brief Battery monitor
+ * The scan interrupt is the only writer of the block accumulator and of
+ * the published block; the main loop only reads them.
+ */
+#include "battery.h"
+
+constexpr uint8_t FILTER_SHIFT = 6;  // 64 blocks of 128 ms
+constexpr uint8_t FRACTION_BITS = 4; // Filter state in 1/16 mV
+
+/* LiFePO4 discharge curve under a light load, highest voltage first */
+struct CurvePoint {
+	uint16_t mv;
+	uint8_t percent;
+};
+static const CurvePoint DISCHARGE_CURVE[] = { { 3400, 100 }, { 3350, 90 },
+		{ 3300, 70 }, { 3270, 40 }, { 3250, 30 }, { 3200, 20 }, { 3000, 10 },
+		{ 2800, 5 }, { 2500, 0 } };
+constexpr uint8_t CURVE_POINTS = sizeof(DISCHARGE_CURVE)
+		/ sizeof(DISCHARGE_CURVE[0]);
+
+BatteryStats battery_stats;
+
+static uint32_t cal_product; // BATTERY_CAL_MV * VREFINT_CAL * block size
+static uint32_t block_sum;
+static uint32_t block_count;
+static volatile uint32_t published_sum;     // Last full block
+static volatile uint32_t published_blocks;
+static uint32_t seen_blocks;
+static uint32_t filtered;                   // FRACTION_BITS
+
+/**
+ * @brief  Sets the factory calibration and starts over
+ * @param  vrefint_cal: VREFINT reading at VDDA = 3.3 V, from
+ *         BATTERY_VREFINT_CAL_ADDRESS
+ * @return None
+ */
+void Battery_Init(uint16_t vrefint_cal) {
+	cal_product = BATTERY_CAL_MV * vrefint_cal * BATTERY_BLOCK_SAMPLES;
+	block_sum = 0;
+	block_count = 0;
+	seen_blocks = published_blocks;
+	battery_stats = { };
+	battery_stats.percent = 100;
+	battery_stats.level = BATTERY_OK;
+}
+/**
+ * @brief  Adds one VREFINT reading (scan interrupt)
+ * @return None
+ */
+void Battery_OnVrefint(uint16_t reading) {
+	block_sum += reading;
+	if (++block_count == BATTERY_BLOCK_SAMPLES) {
+		published_sum = block_sum;
+		published_blocks = published_blocks + 1;
+		block_sum = 0;
+		block_count = 0;
+	}
+}
+/**
+ * @brief  Filters the newest block, if any, and updates the level
+ * @return true if the level changed
+ */
+bool Battery_Poll(void) {
+	uint32_t blocks = published_blocks;
+	if (blocks == seen_blocks) {
+		return false;
+	}
+	/* A block is 128 ms; one overwritten while the loop was busy is lost */
+	uint32_t sum = published_sum;
+	seen_blocks = blocks;
+	if (sum == 0) {
+		return false;
+	}
+	uint32_t mv = cal_product / sum;
+	battery_stats.block_mv = mv;
+	if (battery_stats.blocks++ == 0) {
+		filtered = mv << FRACTION_BITS;
+	} else {
+		int32_t error = static_cast<int32_t>(mv << FRACTION_BITS) - filtered;
+		filtered += error >> FILTER_SHIFT;
+	}
+	battery_stats.vdd_mv = filtered >> FRACTION_BITS;
+	uint8_t percent = Battery_PercentAt(battery_stats.vdd_mv);
+	battery_stats.percent = percent;
+
+	uint8_t level = battery_stats.level;
+	if (percent <= BATTERY_CRITICAL_PERCENT) {
+		level = BATTERY_CRITICAL;
+	} else if (percent <= BATTERY_LOW_PERCENT && level == BATTERY_OK) {
+		level = BATTERY_LOW;
+	} else if (percent >= BATTERY_RECOVER_PERCENT) {
+		level = BATTERY_OK;
+	}
+	if (level == battery_stats.level) {
+		return false;
+	}
+	battery_stats.level = level;
+	return true;
+}
+/**
+ * @brief  State of charge at a supply voltage, interpolated in the
+ *         discharge curve
+ * @return 0 .. 100
+ */
+uint8_t Battery_PercentAt(uint32_t vdd_mv) {
+	if (vdd_mv >= DISCHARGE_CURVE[0].mv) {
+		return DISCHARGE_CURVE[0].percent;
+	}
+	for (uint8_t i = 1; i < CURVE_POINTS; ++i) {
+		const CurvePoint &high = DISCHARGE_CURVE[i - 1];
+		const CurvePoint &low = DISCHARGE_CURVE[i];
+		if (vdd_mv >= low.mv) {
+			return low.percent + (high.percent - low.percent)
+					* (vdd_mv - low.mv) / (high.mv - low.mv);
+		}
+	}
+	return 0;
+}
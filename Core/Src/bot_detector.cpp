@@ -0,0 +1,173 @@
+/*
+ * @brief Automated player detection
+ * Variances come from exact integer sums, n * sum(x^2) - sum(x)^2, so no
+ * precision is lost however steady the timing is. The sample cap keeps the
+ * sums inside 64 bits.
+ */
+#include "bot_detector.h"
+#include "fixed_point.h"
+#include <string.h>
+
+constexpr uint32_t RESIDUE_PERIOD_US = 1000; // Tick of a typical bot timer
+constexpr uint32_t STEADY_CV_SQUARED_SHIFT = 12; // CV below 1/64
+constexpr uint32_t QUANTISED_ENTROPY_Q8 = 2 << 8; // Below 2 of 4 bits
+
+static_assert(static_cast<uint64_t>(BOT_MAX_SAMPLES) * BOT_MAX_INTERVAL_US
+		* BOT_MAX_SAMPLES * BOT_MAX_INTERVAL_US <= UINT64_MAX,
+		"sums of BOT_MAX_SAMPLES squares fit in 64 bits");
+
+/**
+ * @brief  Adds a sample to a pair of running sums
+ */
+static void Accumulate(uint64_t *sum, uint64_t *squares, uint16_t *count,
+		uint32_t value) {
+	if (*count >= BOT_MAX_SAMPLES || value > BOT_MAX_INTERVAL_US) {
+		return;
+	}
+	*sum += value;
+	*squares += static_cast<uint64_t>(value) * value;
+	++*count;
+}
+/**
+ * @brief  Checks whether samples vary by less than 1/64 of their mean
+ */
+static bool IsSteady(uint64_t sum, uint64_t squares, uint16_t count) {
+	if (count < BOT_MIN_PRESSES - 1 || sum == 0) {
+		return false;
+	}
+	uint64_t spread = count * squares - sum * sum;
+	return spread < (sum * sum) >> STEADY_CV_SQUARED_SHIFT;
+}
+/**
+ * @brief  Shannon entropy of the interval residues
+ * @return Bits in Q8, at most 4 << 8
+ */
+static uint32_t ResidueEntropyQ8(const BotDetector *detector) {
+	uint32_t total = 0;
+	uint32_t weighted = 0;
+	for (uint8_t count : detector->residues) {
+		if (count > 0) {
+			total += count;
+			weighted += count * Log2Q8(count);
+		}
+	}
+	return total > 0 ? Log2Q8(total) - weighted / total : 0;
+}
+
+/**
+ * @brief  Forgets everything, for a new session
+ * @param  paced: true when the game dictates the press rhythm
+ * @return None
+ */
+void BotDetector_Reset(BotDetector *detector, bool paced) {
+	memset(detector, 0, sizeof(*detector));
+	detector->paced = paced;
+}
+/**
+ * @brief  Records a debounced press
+ * @param  button: button of the station, 0 .. BOT_BUTTONS - 1
+ * @param  time_us: first contact on the microsecond counter
+ * @return None
+ */
+void BotDetector_OnPress(BotDetector *detector, uint8_t button,
+		uint32_t time_us) {
+	if (button >= BOT_BUTTONS) {
+		return;
+	}
+	if (detector->presses > 0) {
+		uint32_t interval = time_us - detector->last_press_us;
+		uint16_t before = detector->intervals;
+		Accumulate(&detector->interval_sum, &detector->interval_squares,
+				&detector->intervals, interval);
+		if (detector->intervals != before) {
+			uint8_t bin = (interval % RESIDUE_PERIOD_US) * BOT_RESIDUE_BINS
+					/ RESIDUE_PERIOD_US;
+			if (detector->residues[bin] == UINT8_MAX) {
+				for (uint8_t &count : detector->residues) {
+					count /= 2;
+				}
+			}
+			++detector->residues[bin];
+		}
+	}
+	if (detector->presses < UINT16_MAX) {
+		++detector->presses;
+	}
+	detector->last_press_us = time_us;
+	detector->press_us[button] = time_us;
+	detector->held |= 1U << button;
+}
+/**
+ * @brief  Records a debounced release, which ends a hold
+ * @return None
+ */
+void BotDetector_OnRelease(BotDetector *detector, uint8_t button,
+		uint32_t time_us) {
+	if (button >= BOT_BUTTONS || !(detector->held & (1U << button))) {
+		return;
+	}
+	detector->held &= ~(1U << button);
+	Accumulate(&detector->hold_sum, &detector->hold_squares, &detector->holds,
+			time_us - detector->press_us[button]);
+}
+/**
+ * @brief  Records an edge the debouncer rejected as contact bounce
+ * @return None
+ */
+void BotDetector_OnBounce(BotDetector *detector) {
+	if (detector->bounces < UINT16_MAX) {
+		++detector->bounces;
+	}
+}
+/**
+ * @brief  Signs of automation seen so far
+ * @return BOT_SIGNAL_* bits, 0 before BOT_MIN_PRESSES presses
+ */
+uint8_t BotDetector_Signals(const BotDetector *detector) {
+	if (detector->presses < BOT_MIN_PRESSES) {
+		return 0;
+	}
+	uint8_t signals = 0;
+	if (!detector->paced && IsSteady(detector->interval_sum,
+			detector->interval_squares, detector->intervals)) {
+		signals |= BOT_SIGNAL_STEADY_INTERVALS;
+	}
+	if (IsSteady(detector->hold_sum, detector->hold_squares,
+			detector->holds)) {
+		signals |= BOT_SIGNAL_STEADY_HOLDS;
+	}
+	if (detector->intervals >= BOT_MIN_RESIDUES
+			&& ResidueEntropyQ8(detector) < QUANTISED_ENTROPY_Q8) {
+		signals |= BOT_SIGNAL_QUANTISED;
+	}
+	if (detector->bounces == 0) {
+		signals |= BOT_SIGNAL_NO_BOUNCE;
+	}
+	return signals;
+}
+/**
+ * @brief  Checks whether enough signals agree to call the session automated
+ */
+bool BotDetector_IsAutomated(const BotDetector *detector) {
+	return __builtin_popcount(BotDetector_Signals(detector))
+			>= static_cast<int>(BOT_VOTES_TO_FLAG);
+}
+/**
+ * @brief  Checks that the counters agree with each other, whatever order
+ *         the interrupt and a reset ran in
+ * @return false if the statistics are torn
+ */
+bool BotDetector_IsConsistent(const BotDetector *detector) {
+	/* Every interval needs two presses and every hold a press */
+	if (detector->intervals > BOT_MAX_SAMPLES
+			|| detector->holds > BOT_MAX_SAMPLES
+			|| (detector->presses == 0 && detector->intervals != 0)
+			|| detector->holds > detector->presses) {
+		return false;
+	}
+	if ((detector->intervals == 0 && detector->interval_sum != 0)
+			|| (detector->holds == 0 && detector->hold_sum != 0)) {
+		return false;
+	}
+	return (detector->held >> BOT_BUTTONS) == 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * @brief Ambient-adaptive brightness
+ * TIM1, TIM3, ADC1 and DMA2 are driven by registers directly, the TIM and
+ * ADC HAL modules are not part of the project. Only DMA2 reaches GPIOA, and
+ * only TIM1 requests reach DMA2, hence the sharing with attract.cpp. TIM1
+ * ticks every 20 us, too often for an ADC trigger, so TIM3 divides it down
+ * to the period.
+ */
+#include "main.h"
+#include "battery.h"
+#include "brightness.h"
+#include "fixed_point.h"
+#include "led_slots.h"
+
+constexpr uint8_t LED_FIRST_PIN = 3;  // LEDs are PA3..PA10
+constexpr uint8_t LED_COUNT = 8;
+constexpr uint32_t LED_MASK = (1U << LED_COUNT) - 1;
+constexpr uint8_t SENSOR_COUNT = 4;   // PA3..PA6 are ADC1 inputs 3..6
+constexpr uint8_t CONVERSIONS = SENSOR_COUNT + 1; // Then VREFINT, input 17
+constexpr uint32_t SENSORS = (1U << SENSOR_COUNT) - 1;
+constexpr uint32_t TIMER_TICK_HZ = 1000000;
+constexpr uint32_t INTEGRATION_TICKS = 8; // Blank start to the ADC trigger
+constexpr uint32_t SCAN_US = 105;         // 5 x (480 + 12) ADC cycles at 24 MHz
+constexpr uint32_t MIN_ON_US = 300;       // 15 %, in the dark
+constexpr uint32_t MAX_ON_US = LED_SLOTS_LIT_TICKS * LED_SLOTS_TICK_US; // 86 %
+constexpr uint32_t ADC_CLOCK_MAX_HZ = 36000000;
+constexpr uint32_t POLL_MS = 100;
+constexpr int32_t DARK_Q8 = 2 << 8;       // log2 of the readings mapped to
+constexpr int32_t BRIGHT_Q8 = 10 << 8;    // MIN_ON_US and MAX_ON_US
+constexpr uint8_t FILTER_SHIFT = 3;       // About 1 s time constant
+constexpr uint32_t DMA_CHANNEL_ADC1 = 0;
+constexpr uint32_t DMA_CHANNEL_TIM1_UP = 6;
+constexpr uint32_t ADC_TRIGGER_TIM3_CC1 = 7;
+constexpr uint8_t TABLE_COUNT = 3; // Two in the DMA registers, one to build
+
+static_assert(INTEGRATION_TICKS * LED_SLOTS_TICK_US + SCAN_US
+		< LED_SLOTS_BLANK_TICKS * LED_SLOTS_TICK_US, "the scan fits the blank");
+
+BrightnessStats brightness_stats;
+
+static uint32_t tables[TABLE_COUNT][LED_SLOTS_TICKS];
+static uint32_t *published;               // Newest table
+static LedSlotPins pins;
+static uint32_t output_word;              // GPIOA->MODER without dimming
+static uint32_t pull_word;                // GPIOA->PUPDR without dimming
+static volatile uint32_t target_ticks;    // Requested on-time
+static uint32_t built_lit;                // Inputs of the newest table
+static uint32_t built_ticks;
+static volatile uint16_t samples[CONVERSIONS];
+static uint32_t dark_before;              // Sensors dark at the last scan
+static volatile uint32_t ambient_sum;
+static volatile uint32_t ambient_count;
+static int32_t filtered_q8 = BRIGHT_Q8;
+static bool automatic = true;
+static uint32_t max_on_us = MAX_ON_US;
+static bool running;
+static uint32_t last_poll;
+
+/**
+ * @brief  Sets the on-time; the scan interrupt builds the table for it
+ * @return None
+ */
+static void SetOnTime(uint32_t on_us) {
+	brightness_stats.on_us = on_us;
+	target_ticks = on_us / LED_SLOTS_TICK_US;
+}
+/**
+ * @brief  Builds the table for the LEDs lit now into a table that neither
+ *         DMA memory register points to, and publishes it
+ * @return None
+ */
+static void BuildTable(uint32_t lit, uint32_t ticks) {
+	uint32_t *table = tables[0];
+	for (uint8_t i = 0; i < TABLE_COUNT; ++i) {
+		uint32_t address = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+				tables[i]));
+		if (address != DMA2_Stream5->M0AR && address != DMA2_Stream5->M1AR) {
+			table = tables[i];
+			break;
+		}
+	}
+	LedSlotPlan plan = LedSlots_Build(table, &pins, lit, ticks);
+	built_lit = lit;
+	built_ticks = ticks;
+	published = table;
+
+	brightness_stats.slots = plan.slots;
+	brightness_stats.lit_us = plan.on_ticks * LED_SLOTS_TICK_US;
+	if (plan.peak_lit > brightness_stats.peak_lit) {
+		brightness_stats.peak_lit = plan.peak_lit;
+		brightness_stats.peak_ma = plan.peak_lit * LED_SLOTS_LED_MA;
+	}
+	++brightness_stats.builds;
+}
+/**
+ * @brief  Sets up DMA2 Stream 5 copying the next table word into MODER at
+ *         each TIM1 update, both memory registers on the published table
+ * @return None
+ */
+static void StartTableStream(void) {
+	DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5
+			| DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+	uint32_t table = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			published));
+	DMA2_Stream5->PAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			&GPIOA->MODER));
+	DMA2_Stream5->M0AR = table;
+	DMA2_Stream5->M1AR = table;
+	DMA2_Stream5->NDTR = LED_SLOTS_TICKS;
+	DMA2_Stream5->FCR = 0; // Direct mode
+	DMA2_Stream5->CR = (DMA_CHANNEL_TIM1_UP << DMA_SxCR_CHSEL_Pos)
+			| DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 | DMA_SxCR_MINC
+			| DMA_SxCR_DBM | DMA_SxCR_CIRC | DMA_SxCR_DIR_0 | DMA_SxCR_EN;
+}
+/**
+ * @brief  Disables a DMA2 stream and waits for its current transfer
+ * @return None
+ */
+static void StopStream(DMA_Stream_TypeDef *stream) {
+	stream->CR &= ~DMA_SxCR_EN;
+	while (stream->CR & DMA_SxCR_EN) {
+	}
+}
+
+/**
+ * @brief  Takes the light collected by the interrupt since the last call
+ * @param  sum: receives the sum of the sensor readings
+ * @return Number of readings in the sum
+ */
+static uint32_t TakeAmbient(uint32_t *sum) {
+	__disable_irq();
+	*sum = ambient_sum;
+	uint32_t count = ambient_count;
+	ambient_sum = 0;
+	ambient_count = 0;
+	__enable_irq();
+	return count;
+}
+
+/**
+ * @brief  Starts dimming and sensing. GPIOA must be fully configured, the
+ *         MODER and PUPDR words are taken from it.
+ * @return None
+ */
+void Brightness_Start(void) {
+	__HAL_RCC_DMA2_CLK_ENABLE();
+	__HAL_RCC_TIM1_CLK_ENABLE();
+	__HAL_RCC_ADC1_CLK_ENABLE();
+	__HAL_RCC_TIM3_CLK_ENABLE();
+
+	/* Outside their slots the LED pins are inputs, pulled down */
+	uint32_t led_modes = 0;
+	uint32_t led_pulls = 0;
+	for (uint8_t i = 0; i < LED_COUNT; ++i) {
+		led_modes |= 3U << ((LED_FIRST_PIN + i) * 2);
+		led_pulls |= 2U << ((LED_FIRST_PIN + i) * 2);
+	}
+	output_word = GPIOA->MODER;
+	pull_word = GPIOA->PUPDR;
+	pins.input_word = output_word & ~led_modes;
+	pins.first_pin = LED_FIRST_PIN;
+	pins.count = LED_COUNT;
+	GPIOA->PUPDR = (pull_word & ~led_modes) | led_pulls;
+
+	/* ADC clock PCLK2 / 4 at 96 MHz, / 2 at 48 MHz. Long sampling: the LEDs
+	 are a weak source, and VREFINT needs 10 us. */
+	ADC->CCR = (HAL_RCC_GetPCLK2Freq() / 2 > ADC_CLOCK_MAX_HZ ?
+			ADC_CCR_ADCPRE_0 : 0) | ADC_CCR_TSVREFE;
+	ADC1->CR2 = 0;
+	ADC1->CR1 = ADC_CR1_SCAN;
+	ADC1->SMPR1 = ADC_SMPR1_SMP17;
+	ADC1->SMPR2 = ADC_SMPR2_SMP3 | ADC_SMPR2_SMP4 | ADC_SMPR2_SMP5
+			| ADC_SMPR2_SMP6;
+	ADC1->SQR1 = (CONVERSIONS - 1) << ADC_SQR1_L_Pos;
+	ADC1->SQR3 = 3U << ADC_SQR3_SQ1_Pos | 4U << ADC_SQR3_SQ2_Pos
+			| 5U << ADC_SQR3_SQ3_Pos | 6U << ADC_SQR3_SQ4_Pos
+			| 17U << ADC_SQR3_SQ5_Pos;
+
+	DMA2_Stream0->CR = 0;
+	while (DMA2_Stream0->CR & DMA_SxCR_EN) {
+	}
+	DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0
+			| DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+	DMA2_Stream0->PAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			&ADC1->DR));
+	DMA2_Stream0->M0AR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			samples));
+	DMA2_Stream0->NDTR = CONVERSIONS;
+	DMA2_Stream0->FCR = 0;
+	DMA2_Stream0->CR = (DMA_CHANNEL_ADC1 << DMA_SxCR_CHSEL_Pos)
+			| DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC
+			| DMA_SxCR_CIRC | DMA_SxCR_TCIE | DMA_SxCR_EN;
+	ADC1->CR2 = ADC_CR2_ADON | ADC_CR2_DMA | ADC_CR2_DDS | ADC_CR2_EXTEN_0
+			| ADC_TRIGGER_TIM3_CC1 << ADC_CR2_EXTSEL_Pos;
+	HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, BRIGHTNESS_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+	uint32_t on_us = brightness_stats.on_us;
+	if (!automatic || on_us < MIN_ON_US || on_us > max_on_us) {
+		on_us = max_on_us; // Full brightness until the first readings
+	}
+	SetOnTime(on_us);
+	StopStream(DMA2_Stream5); // Attract may have left it pointing elsewhere
+	BuildTable((GPIOA->ODR >> LED_FIRST_PIN) & LED_MASK, target_ticks);
+	StartTableStream();
+
+	/* APB2 timers run at twice PCLK2 when the APB2 prescaler is not 1 */
+	uint32_t timer_clock = HAL_RCC_GetPCLK2Freq();
+	if ((RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1) {
+		timer_clock *= 2;
+	}
+	TIM1->CR1 = 0;
+	TIM1->CR2 = 0;
+	TIM1->PSC = timer_clock / TIMER_TICK_HZ - 1;
+	TIM1->ARR = LED_SLOTS_TICK_US - 1;
+	TIM1->RCR = 0;
+	TIM1->EGR = TIM_EGR_UG; // Load the prescaler now
+	TIM1->SR = 0;
+	TIM1->CR2 = TIM_CR2_MMS_1; // TRGO on update
+
+	/* TIM3 counts TIM1 updates (ITR0), so its count is the table position:
+	 word i is written when it reaches i + 1. CC1 in PWM mode 2 rises at
+	 its compare once per period, the ADC trigger; PA6 and PB4 are not in
+	 AF mode, so nothing reaches them. */
+	TIM3->CR1 = 0;
+	TIM3->SMCR = TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0;
+	TIM3->PSC = 0;
+	TIM3->ARR = LED_SLOTS_TICKS - 1;
+	TIM3->CCR1 = INTEGRATION_TICKS + 1;
+	TIM3->CCMR1 = TIM_CCMR1_OC1M_2 | TIM_CCMR1_OC1M_1 | TIM_CCMR1_OC1M_0;
+	TIM3->CCER = TIM_CCER_CC1E;
+	TIM3->EGR = TIM_EGR_UG;
+	TIM3->SR = 0;
+	TIM3->CR1 = TIM_CR1_CEN;
+
+	TIM1->DIER = TIM_DIER_UDE;
+	dark_before = 0;
+	ambient_sum = 0; // Light from before the stop is stale
+	ambient_count = 0;
+	running = true;
+	TIM1->CR1 = TIM_CR1_CEN;
+}
+/**
+ * @brief  Stops dimming and sensing and leaves the LEDs driven
+ * @return None
+ */
+void Brightness_Stop(void) {
+	if (!running) {
+		return;
+	}
+	TIM1->CR1 = 0;
+	TIM1->DIER = 0;
+	TIM1->CR2 = 0;
+	TIM3->CR1 = 0;
+	StopStream(DMA2_Stream5);
+	StopStream(DMA2_Stream0);
+	ADC1->CR2 = 0;
+	HAL_NVIC_DisableIRQ(DMA2_Stream0_IRQn);
+	GPIOA->MODER = output_word;
+	GPIOA->PUPDR = pull_word;
+	running = false;
+}
+/**
+ * @brief  Follows the room (true) or stays at the highest brightness
+ * @return None
+ */
+void Brightness_SetAuto(bool on) {
+	if (on && !automatic) {
+		uint32_t sum;
+		TakeAmbient(&sum); // Only light seen from now on counts
+	}
+	automatic = on;
+	if (!on && running) {
+		SetOnTime(max_on_us);
+	}
+}
+/**
+ * @brief  Caps the brightness, e.g. to save a weak battery
+ * @param  percent: of the highest lit time, 100 for no cap
+ * @return None
+ */
+void Brightness_SetMaxPercent(uint8_t percent) {
+	max_on_us = MIN_ON_US + (MAX_ON_US - MIN_ON_US) * percent / 100;
+	if (running && (!automatic || brightness_stats.on_us > max_on_us)) {
+		SetOnTime(max_on_us);
+	}
+}
+/**
+ * @brief  Adjusts the lit time to the light seen since the last call, at
+ *         most every POLL_MS. The readings are taken even at a fixed
+ *         brightness, so the sums never overflow.
+ * @param  now: HAL tick
+ * @return None
+ */
+void Brightness_Poll(uint32_t now) {
+	if (!running || now - last_poll < POLL_MS) {
+		return;
+	}
+	last_poll = now;
+	uint32_t start_cycles = DWT->CYCCNT;
+
+	uint32_t sum;
+	uint32_t count = TakeAmbient(&sum);
+	if (!automatic || count == 0) {
+		return; // Fixed, or every sensor lit all the time: keep the brightness
+	}
+
+	int32_t level_q8 = Log2Q8(sum / count + 1);
+	filtered_q8 += (level_q8 - filtered_q8) >> FILTER_SHIFT;
+	brightness_stats.ambient = filtered_q8;
+
+	int32_t position = filtered_q8 - DARK_Q8;
+	if (position < 0) {
+		position = 0;
+	} else if (position > BRIGHT_Q8 - DARK_Q8) {
+		position = BRIGHT_Q8 - DARK_Q8;
+	}
+	SetOnTime(MIN_ON_US + (max_on_us - MIN_ON_US) * position
+			/ (BRIGHT_Q8 - DARK_Q8));
+
+	uint32_t cycles = DWT->CYCCNT - start_cycles;
+	if (cycles > brightness_stats.poll_cycles_max) {
+		brightness_stats.poll_cycles_max = cycles;
+	}
+}
+/**
+ * @brief  Collects one scan: sensors whose LED was dark at this and the
+ *         previous scan count, and the VREFINT reading goes to the battery
+ *         monitor. Then hands the slot table for the LEDs lit now to the
+ *         DMA (DMA2 Stream 0 interrupt).
+ * @return None
+ */
+void Brightness_IRQHandler(void) {
+	uint32_t start_cycles = DWT->CYCCNT;
+	DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0;
+
+	uint32_t dark = ~(GPIOA->ODR >> LED_FIRST_PIN) & SENSORS;
+	uint32_t usable = dark & dark_before;
+	dark_before = dark;
+	uint32_t sum = 0;
+	uint32_t count = 0;
+	for (uint8_t i = 0; i < SENSOR_COUNT; ++i) {
+		if (usable & (1U << i)) {
+			sum += samples[i];
+			++count;
+		}
+	}
+	ambient_sum += sum;
+	ambient_count += count;
+	Battery_OnVrefint(samples[SENSOR_COUNT]);
+	++brightness_stats.periods;
+
+	/* The next period starts on the other memory register, so pointing the
+	 idle one at the newest table switches at a period boundary. The
+	 active one cannot be written and follows a period later. */
+	uint32_t lit = (GPIOA->ODR >> LED_FIRST_PIN) & LED_MASK;
+	uint32_t ticks = target_ticks;
+	if (lit != built_lit || ticks != built_ticks) {
+		BuildTable(lit, ticks);
+	}
+	uint32_t table = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			published));
+	if (DMA2_Stream5->CR & DMA_SxCR_CT) {
+		DMA2_Stream5->M0AR = table;
+	} else {
+		DMA2_Stream5->M1AR = table;
+	}
+
+	uint32_t cycles = DWT->CYCCNT - start_cycles;
+	brightness_stats.isr_cycles_last = cycles;
+	if (cycles > brightness_stats.isr_cycles_max) {
+		brightness_stats.isr_cycles_max = cycles;
+	}
+}
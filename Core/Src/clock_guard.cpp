@@ -0,0 +1,68 @@
+/*
+ * @brief Clock failover
+ * The NMI path is register level: HAL_RCC_OscConfig() times out with
+ * HAL_GetTick(), which cannot advance while the NMI runs. The DWT cycle
+ * counter measures the slow phase, because it counts core cycles at any
+ * clock.
+ */
+#include "main.h"
+#include "clock_guard.h"
+#include "reaction.h"
+
+ClockGuardStats clock_guard_stats;
+
+/**
+ * @brief  Arms the Clock Security System when running from the crystal.
+ * A failover before Reaction_Init() leaves the stopped TIM2 alone.
+ * @return None
+ */
+void ClockGuard_Init(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	clock_guard_stats.on_hsi = __HAL_RCC_GET_PLL_OSCSOURCE()
+			== RCC_PLLSOURCE_HSI;
+	if (!clock_guard_stats.on_hsi) {
+		HAL_RCC_EnableCSS();
+	}
+}
+/**
+ * @brief  Moves the PLL to the HSI after the crystal failed (NMI context).
+ * On entry the hardware has already switched SYSCLK to the 16 MHz HSI and
+ * stopped the HSE and the PLL, so everything runs slow until the PLL locks.
+ * @return None
+ */
+void HAL_RCC_CSSCallback(void) {
+	uint32_t start_cycles = DWT->CYCCNT;
+	uint32_t start_us = Reaction_NowUs();
+	/* The core counts HCLK cycles: the HSI over the AHB prescaler, which
+	 the low-battery profile sets to 2 */
+	uint32_t hclk_mhz = (HSI_VALUE >> AHBPrescTable[(RCC->CFGR & RCC_CFGR_HPRE)
+			>> RCC_CFGR_HPRE_Pos]) / 1000000U;
+
+	__HAL_RCC_PLL_DISABLE();
+	while (__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY)) {
+	}
+	__HAL_RCC_PLL_CONFIG(RCC_PLLSOURCE_HSI, CLOCK_HSI_PLLM, CLOCK_PLLN,
+			CLOCK_PLLP, CLOCK_PLLQ);
+	__HAL_RCC_PLL_ENABLE();
+	while (!__HAL_RCC_GET_FLAG(RCC_FLAG_PLLRDY)) {
+	}
+	__HAL_RCC_SYSCLK_CONFIG(RCC_SYSCLKSOURCE_PLLCLK);
+	while (__HAL_RCC_GET_SYSCLK_SOURCE() != RCC_SYSCLKSOURCE_STATUS_PLLCLK) {
+	}
+	uint32_t slow_us = (DWT->CYCCNT - start_cycles) / hclk_mhz;
+
+	/* Timers were clocked at HSI / SYSCLK of their speed meanwhile */
+	SystemCoreClockUpdate();
+	HAL_InitTick(uwTickPrio);
+	Reaction_UpdateClock();
+	uint32_t counted_us = Reaction_NowUs() - start_us;
+	uint32_t lag_us = slow_us > counted_us ? slow_us - counted_us : 0;
+	Reaction_AdvanceUs(lag_us);
+	uwTick += (lag_us + 500) / 1000;
+
+	clock_guard_stats.on_hsi = true;
+	clock_guard_stats.slow_us = slow_us;
+	clock_guard_stats.lag_us = lag_us;
+	++clock_guard_stats.failovers;
+}
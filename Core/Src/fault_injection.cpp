@@ -0,0 +1,224 @@
+/*
+ * @brief Deterministic fault injection engine
+ * Faults are drawn one at a time from a seeded xorshift32 generator, so the
+ * schedule costs a few words of RAM and replays exactly for a given seed.
+ * Every injected fault stays "pending" until it is resolved to an outcome;
+ * the per-type outcome table in fault_summary can be read with the debugger.
+ */
+#include "main.h"
+#include "fault_injection.h"
+
+#ifdef FAULT_INJECTION
+
+constexpr uint32_t SUMMARY_MAGIC = 0x46494E4A; // "FINJ"
+constexpr uint8_t MAX_TARGETS = 4;
+
+// Scheduling limits (in ms)
+constexpr uint32_t MIN_FAULT_INTERVAL_MS = 200;
+constexpr uint32_t MAX_FAULT_INTERVAL_MS = 3000;
+constexpr uint32_t MAX_EDGE_LOST_MS = 300;
+constexpr uint32_t MAX_EDGE_GLITCH_MS = 30;
+constexpr uint32_t MAX_JITTER_MS = 100;
+constexpr uint32_t HANG_TIMEOUT_MS = 5000;
+
+FaultSummary fault_summary __attribute__((section(".noinit")));
+
+struct FaultTarget {
+	volatile uint8_t *addr;
+	uint32_t size;
+};
+
+static FaultTarget targets[MAX_TARGETS];
+static uint8_t target_count;
+static uint8_t buttons = 1;
+
+static volatile uint32_t next_fault_tick;
+static volatile uint32_t last_heartbeat_tick;
+
+// Currently active input/timing faults
+static volatile uint32_t lost_mask;
+static volatile uint32_t glitch_mask;
+static volatile uint32_t input_fault_end_tick;
+static volatile uint32_t jitter_end_tick;
+static volatile uint8_t flash_write_fail;
+
+/**
+ * @brief  Advances the schedule generator
+ * @return Next pseudo-random 32-bit value
+ */
+static uint32_t NextRandom() {
+	uint32_t x = fault_summary.rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	fault_summary.rng_state = x;
+	return x;
+}
+/**
+ * @brief  Returns a pseudo-random value in [min, max]
+ */
+static uint32_t RandomRange(uint32_t min, uint32_t max) {
+	return min + NextRandom() % (max - min + 1);
+}
+/**
+ * @brief  Closes the pending fault with the given outcome
+ * @return None
+ */
+static void ResolvePending(FaultOutcome outcome) {
+	if (fault_summary.pending_fault != FAULT_NONE) {
+		++fault_summary.outcomes[fault_summary.pending_fault][outcome];
+		fault_summary.pending_fault = FAULT_NONE;
+	}
+}
+/**
+ * @brief  Draws the next fault from the schedule and applies it
+ * @param  now: current tick
+ * @return None
+ */
+static void InjectNext(uint32_t now) {
+	/* A fault that produced no outcome before the next one is masked */
+	ResolvePending(OUTCOME_MASKED);
+
+	FaultType type = static_cast<FaultType>(RandomRange(FAULT_BITFLIP,
+			FAULT_TYPE_COUNT - 1));
+	switch (type) {
+	case FAULT_BITFLIP:
+		if (target_count == 0) {
+			return;
+		} else {
+			const FaultTarget &t = targets[NextRandom() % target_count];
+			t.addr[NextRandom() % t.size] ^= 1U << (NextRandom() % 8);
+		}
+		break;
+	case FAULT_EDGE_LOST:
+		lost_mask = 1U << (NextRandom() % buttons);
+		input_fault_end_tick = now + RandomRange(1, MAX_EDGE_LOST_MS);
+		break;
+	case FAULT_EDGE_DUPLICATED:
+		glitch_mask = 1U << (NextRandom() % buttons);
+		input_fault_end_tick = now + RandomRange(1, MAX_EDGE_GLITCH_MS);
+		break;
+	case FAULT_TICK_JITTER:
+		jitter_end_tick = now + RandomRange(1, MAX_JITTER_MS);
+		break;
+	case FAULT_FLASH_WRITE:
+		flash_write_fail = 1;
+		break;
+	default:
+		return;
+	}
+	++fault_summary.injected[type];
+	fault_summary.pending_fault = type;
+}
+
+/**
+ * @brief  Starts the injector. Keeps the summary if it survived a reset
+ *         for the same seed and attributes that reset to the pending fault.
+ * @param  seed: schedule seed (0 is replaced by 1, xorshift needs non-zero)
+ * @param  button_count: number of bits in the button mask that input faults may hit
+ * @return None
+ */
+void FaultInjection_Init(uint32_t seed, uint8_t button_count) {
+	if (seed == 0) {
+		seed = 1;
+	}
+	if (button_count > 0) {
+		buttons = button_count;
+	}
+	if (fault_summary.magic != SUMMARY_MAGIC || fault_summary.seed != seed
+			|| __HAL_RCC_GET_FLAG(RCC_FLAG_PORRST)) {
+		fault_summary = FaultSummary { };
+		fault_summary.magic = SUMMARY_MAGIC;
+		fault_summary.seed = seed;
+		fault_summary.rng_state = seed;
+	} else if (fault_summary.reset_by_injector) {
+		fault_summary.reset_by_injector = 0;
+	} else {
+		ResolvePending(OUTCOME_RESET);
+	}
+	__HAL_RCC_CLEAR_RESET_FLAGS();
+
+	uint32_t now = HAL_GetTick();
+	last_heartbeat_tick = now;
+	next_fault_tick = now
+			+ RandomRange(MIN_FAULT_INTERVAL_MS, MAX_FAULT_INTERVAL_MS);
+}
+/**
+ * @brief  Registers a RAM region that bit flips may hit
+ * @return None
+ */
+void FaultInjection_RegisterTarget(volatile void *addr, uint32_t size) {
+	if (target_count < MAX_TARGETS && size > 0) {
+		targets[target_count++] = { static_cast<volatile uint8_t*>(addr), size };
+	}
+}
+/**
+ * @brief  Applies the active input fault to a pressed-buttons bitmask
+ * @param  pressed_mask: bit i set when button i is pressed
+ * @return Bitmask as seen by the game
+ */
+uint32_t FaultInjection_FilterButtons(uint32_t pressed_mask) {
+	if (static_cast<int32_t>(HAL_GetTick() - input_fault_end_tick) >= 0) {
+		lost_mask = 0;
+		glitch_mask = 0;
+	}
+	return (pressed_mask & ~lost_mask) | glitch_mask;
+}
+/**
+ * @brief  SysTick hook: injects scheduled faults, applies tick jitter and
+ *         watches the main loop heartbeat
+ * @return None
+ */
+void FaultInjection_OnTick(void) {
+	uint32_t now = HAL_GetTick();
+
+	if (static_cast<int32_t>(now - jitter_end_tick) < 0) {
+		/* Either swallow this tick or count it twice */
+		if (NextRandom() & 1U) {
+			uwTick -= uwTickFreq;
+		} else {
+			uwTick += uwTickFreq;
+		}
+	}
+
+	if (static_cast<int32_t>(now - next_fault_tick) >= 0) {
+		InjectNext(now);
+		next_fault_tick = now
+				+ RandomRange(MIN_FAULT_INTERVAL_MS, MAX_FAULT_INTERVAL_MS);
+	}
+
+	if (now - last_heartbeat_tick > HANG_TIMEOUT_MS) {
+		if (fault_summary.pending_fault != FAULT_NONE) {
+			ResolvePending(OUTCOME_HANG);
+		}
+		fault_summary.reset_by_injector = 1;
+		NVIC_SystemReset();
+	}
+}
+/**
+ * @brief  Signals that the main loop is making progress
+ * @return None
+ */
+void FaultInjection_Heartbeat(void) {
+	last_heartbeat_tick = HAL_GetTick();
+}
+/**
+ * @brief  Called by the game when an invariant check fails
+ * @return None
+ */
+void FaultInjection_ReportViolation(void) {
+	ResolvePending(OUTCOME_WRONG_RESULT);
+}
+/**
+ * @brief  Consumes a pending flash write failure
+ * @return 1 if the caller must treat its flash write as failed
+ */
+int FaultInjection_FlashWriteFails(void) {
+	if (flash_write_fail) {
+		flash_write_fail = 0;
+		return 1;
+	}
+	return 0;
+}
+
+#endif /* FAULT_INJECTION */
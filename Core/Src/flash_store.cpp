@@ -0,0 +1,379 @@
+/*
+ * @brief Flash store
+ * Record layout, all 32-bit words:
+ *   [length << 16 | key] [payload, zero padded] [CRC-32 of the words before]
+ * An erased header word (0xFFFFFFFF) marks the end of the log. A record whose
+ * CRC does not match (interrupted write) is skipped using its length.
+ *
+ * The log lives in one of two sectors, which start with a header
+ * [STORE_MAGIC] [generation]. Compaction copies the newest record of every
+ * key to the other sector and programs its header last, magic word after
+ * generation, so until that last word is in place the old copy is the live
+ * one. Boards that ran firmware with a single store sector have a log
+ * without header at the start of sector 7; it is used as it is until the
+ * first compaction moves it.
+ *
+ * Queued records get their space when they are queued and are programmed
+ * word by word through the flash registers, one word per FlashStore_Poll(),
+ * which returns only once the word is done and PG is cleared again. They
+ * are indexed once complete. FlashStore_Write() and compaction program
+ * everything queued first, so the log never has a gap before a record.
+ */
+#include "main.h"
+#include "crc32.h"
+#include "fault_injection.h"
+#include "flash_store.h"
+#include <string.h>
+
+constexpr uint32_t STORE_SECTORS[2] = { FLASH_SECTOR_5, FLASH_SECTOR_7 };
+constexpr uint32_t STORE_BASES[2] = { 0x08020000U, 0x08060000U };
+constexpr uint8_t LEGACY_SECTOR = 1; // Sector 7
+constexpr uint32_t STORE_SIZE = 128U * 1024U;
+constexpr uint32_t STORE_MAGIC = 0x53544F52U; // "STOR"
+constexpr uint32_t HEADER_SIZE = 8;
+constexpr uint32_t ERASED = 0xFFFFFFFFU;
+constexpr uint32_t MAX_RECORD_WORDS = 2 + FLASH_STORE_MAX_PAYLOAD / 4;
+constexpr uint32_t QUEUE_SIZE = 4; // Power of two
+constexpr uint32_t FLASH_ERRORS = FLASH_SR_PGSERR | FLASH_SR_PGPERR
+		| FLASH_SR_PGAERR | FLASH_SR_WRPERR;
+
+struct IndexEntry {
+	uint16_t key;
+	uint32_t offset; // Offset of the newest valid record of the key
+};
+
+struct PendingRecord {
+	uint32_t words[MAX_RECORD_WORDS];
+	uint32_t count;
+	uint32_t offset;
+	uint16_t key;
+};
+
+FlashStoreStats flash_store_stats;
+
+static IndexEntry store_index[FLASH_STORE_MAX_KEYS];
+static uint8_t key_count;
+static uint8_t active;          // Sector holding the live log
+static uint32_t generation;     // Of the live log, 0 for a legacy log
+static uint32_t write_offset;
+static PendingRecord queue[QUEUE_SIZE];
+static uint32_t queue_head;
+static uint32_t queue_tail;     // Record being programmed
+static uint32_t word_index;     // Its next word
+static bool record_failed;
+
+/**
+ * @brief  Word at an offset inside a store sector
+ */
+static const uint32_t* StoreWords(uint8_t sector, uint32_t offset) {
+	return reinterpret_cast<const uint32_t*>(STORE_BASES[sector] + offset);
+}
+/**
+ * @brief  Number of payload words for a payload length in bytes
+ */
+static uint32_t PayloadWords(uint32_t length) {
+	return (length + 3) / 4;
+}
+/**
+ * @brief  Finds the index entry of a key
+ * @return Entry, or nullptr if the key has no record
+ */
+static IndexEntry* FindKey(uint16_t key) {
+	for (uint8_t i = 0; i < key_count; ++i) {
+		if (store_index[i].key == key) {
+			return &store_index[i];
+		}
+	}
+	return nullptr;
+}
+/**
+ * @brief  Points the index at a newer record of a key
+ * @return false if the index is full
+ */
+static bool IndexRecord(uint16_t key, uint32_t offset) {
+	IndexEntry *entry = FindKey(key);
+	if (entry == nullptr) {
+		if (key_count >= FLASH_STORE_MAX_KEYS) {
+			return false;
+		}
+		entry = &store_index[key_count++];
+		entry->key = key;
+	}
+	entry->offset = offset;
+	return true;
+}
+/**
+ * @brief  Programs words at an offset of a store sector and reads the last
+ *         one back
+ * @param  count: number of words
+ * @return true if every word was programmed
+ */
+static bool ProgramWords(uint8_t sector, uint32_t offset,
+		const uint32_t *words, uint32_t count) {
+	if (FaultInjection_FlashWriteFails()) {
+		return false;
+	}
+	bool ok = true;
+	HAL_FLASH_Unlock();
+	for (uint32_t i = 0; i < count && ok; ++i) {
+		ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD,
+				STORE_BASES[sector] + offset + i * 4, words[i]) == HAL_OK;
+	}
+	HAL_FLASH_Lock();
+	return ok && StoreWords(sector, offset)[count - 1] == words[count - 1];
+}
+/**
+ * @brief  Programs a prepared record (header, payload, CRC) at write_offset
+ * @param  words: complete record
+ * @param  count: number of words
+ * @return true if every word was programmed
+ */
+static bool ProgramRecord(const uint32_t *words, uint32_t count) {
+	uint32_t offset = write_offset;
+	/* Reserve the space first, a failed record is skipped on the next scan */
+	write_offset += count * 4;
+	return ProgramWords(active, offset, words, count);
+}
+/**
+ * @brief  Builds a record in RAM
+ * @param  record: MAX_RECORD_WORDS words
+ * @return Number of words of the record
+ */
+static uint32_t BuildRecord(uint32_t *record, uint16_t key, const void *data,
+		uint16_t length) {
+	uint32_t payload_words = PayloadWords(length);
+	if (payload_words > 0) {
+		record[payload_words] = 0; // Zero the padding of the last payload word
+	}
+	record[0] = static_cast<uint32_t>(length) << 16 | key;
+	memcpy(&record[1], data, length);
+	record[1 + payload_words] = Crc32_Compute(record, 1 + payload_words);
+	return 2 + payload_words;
+}
+/**
+ * @brief  Indexes the valid records of the live log and finds its end
+ * @return None
+ */
+static void ScanLog(void) {
+	key_count = 0;
+	uint32_t offset = generation != 0 ? HEADER_SIZE : 0;
+	while (offset + 8 <= STORE_SIZE) {
+		const uint32_t *words = StoreWords(active, offset);
+		if (words[0] == ERASED) {
+			break;
+		}
+		uint32_t length = words[0] >> 16;
+		uint32_t payload_words = PayloadWords(length);
+		if (length > FLASH_STORE_MAX_PAYLOAD
+				|| offset + (2 + payload_words) * 4 > STORE_SIZE) {
+			/* Garbage: treat the rest of the sector as used */
+			offset = STORE_SIZE;
+			break;
+		}
+		if (Crc32_Compute(words, 1 + payload_words) == words[1 + payload_words]) {
+			IndexRecord(words[0] & 0xFFFF, offset);
+		}
+		offset += (2 + payload_words) * 4;
+	}
+	write_offset = offset;
+}
+/**
+ * @brief  Copies the newest record of every key to the other sector and
+ *         makes it the live one. A power loss at any point leaves the old
+ *         sector live, so no record is ever lost.
+ * @return true if the copy is complete
+ */
+static bool Compact(void) {
+	uint8_t target = 1 - active;
+	FLASH_EraseInitTypeDef erase = { };
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Sector = STORE_SECTORS[target];
+	erase.NbSectors = 1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+	uint32_t sector_error;
+	HAL_FLASH_Unlock();
+	HAL_StatusTypeDef erased = HAL_FLASHEx_Erase(&erase, &sector_error);
+	HAL_FLASH_Lock();
+	if (erased != HAL_OK) {
+		return false;
+	}
+
+	/* Straight from the live sector, which stays as it is */
+	uint32_t offset = HEADER_SIZE;
+	for (uint8_t i = 0; i < key_count; ++i) {
+		const uint32_t *words = StoreWords(active, store_index[i].offset);
+		uint32_t count = 2 + PayloadWords(words[0] >> 16);
+		if (!ProgramWords(target, offset, words, count)) {
+			return false;
+		}
+		offset += count * 4;
+	}
+	uint32_t next = generation + 1;
+	if (!ProgramWords(target, 4, &next, 1)
+			|| !ProgramWords(target, 0, &STORE_MAGIC, 1)) {
+		return false;
+	}
+	active = target;
+	generation = next;
+	ScanLog();
+	return true;
+}
+
+/**
+ * @brief  Finds the live sector and indexes the newest valid record of
+ *         each key
+ * @return None
+ */
+void FlashStore_Init(void) {
+	Crc32_Init();
+	flash_store_stats = { };
+	active = LEGACY_SECTOR;
+	generation = 0;
+	for (uint8_t sector = 0; sector < 2; ++sector) {
+		const uint32_t *header = StoreWords(sector, 0);
+		if (header[0] == STORE_MAGIC && header[1] != ERASED
+				&& (generation == 0
+						|| static_cast<int32_t>(header[1] - generation) > 0)) {
+			active = sector;
+			generation = header[1];
+		}
+	}
+	ScanLog();
+}
+/**
+ * @brief  Reads the newest record of a key
+ * @param  length: bytes expected, must match the stored length
+ * @return false if there is no valid record of that size
+ */
+bool FlashStore_Read(uint16_t key, void *data, uint16_t length) {
+	IndexEntry *entry = FindKey(key);
+	if (entry == nullptr) {
+		return false;
+	}
+	const uint32_t *words = StoreWords(active, entry->offset);
+	if ((words[0] >> 16) != length) {
+		return false;
+	}
+	memcpy(data, &words[1], length);
+	return true;
+}
+/**
+ * @brief  Appends a new record for a key, after the queued ones. Never
+ *         erases: a full sector drops the record, FlashStore_Maintain()
+ *         makes room.
+ * @param  length: at most FLASH_STORE_MAX_PAYLOAD bytes
+ * @return true if the record was stored
+ */
+bool FlashStore_Write(uint16_t key, const void *data, uint16_t length) {
+	if (length > FLASH_STORE_MAX_PAYLOAD || key == 0xFFFF) {
+		return false;
+	}
+	uint32_t record[MAX_RECORD_WORDS];
+	uint32_t count = BuildRecord(record, key, data, length);
+
+	FlashStore_Flush();
+	if (write_offset + count * 4 > STORE_SIZE) {
+		++flash_store_stats.dropped;
+		return false;
+	}
+	uint32_t offset = write_offset;
+	if (ProgramRecord(record, count) && IndexRecord(key, offset)) {
+		++flash_store_stats.writes;
+		return true;
+	}
+	++flash_store_stats.dropped;
+	return false;
+}
+/**
+ * @brief  Queues a record for a key, to be programmed by FlashStore_Poll().
+ *         Constant time for a given length.
+ * @param  length: at most FLASH_STORE_MAX_PAYLOAD bytes
+ * @return true if the record was queued
+ */
+bool FlashStore_Queue(uint16_t key, const void *data, uint16_t length) {
+	if (length > FLASH_STORE_MAX_PAYLOAD || key == 0xFFFF
+			|| queue_head - queue_tail >= QUEUE_SIZE
+			|| FaultInjection_FlashWriteFails()) {
+		++flash_store_stats.dropped;
+		return false;
+	}
+	PendingRecord *pending = &queue[queue_head % QUEUE_SIZE];
+	pending->count = BuildRecord(pending->words, key, data, length);
+	if (write_offset + pending->count * 4 > STORE_SIZE) {
+		++flash_store_stats.dropped;
+		return false;
+	}
+	pending->key = key;
+	pending->offset = write_offset;
+	write_offset += pending->count * 4;
+	++queue_head;
+	return true;
+}
+/**
+ * @brief  Programs the next queued word unless the flash is busy, and
+ *         clears PG again once it is done
+ * @return None
+ */
+void FlashStore_Poll(void) {
+	if (queue_tail == queue_head || (FLASH->SR & FLASH_SR_BSY) != 0) {
+		return;
+	}
+	if ((FLASH->CR & FLASH_CR_LOCK) != 0) {
+		HAL_FLASH_Unlock();
+	}
+	const PendingRecord *pending = &queue[queue_tail % QUEUE_SIZE];
+	FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_PSIZE_WORD
+			| FLASH_CR_PG;
+	*reinterpret_cast<volatile uint32_t*>(STORE_BASES[active]
+			+ pending->offset + word_index * 4) = pending->words[word_index];
+	/* Instruction fetches from flash stall until the word is programmed
+	 anyway, so waiting for it here costs nothing */
+	while ((FLASH->SR & FLASH_SR_BSY) != 0) {
+	}
+	FLASH->CR &= ~FLASH_CR_PG;
+	if ((FLASH->SR & FLASH_ERRORS) != 0) {
+		FLASH->SR = FLASH_ERRORS;
+		record_failed = true;
+	}
+	if (++word_index < pending->count) {
+		return;
+	}
+	if (!record_failed && IndexRecord(pending->key, pending->offset)) {
+		++flash_store_stats.writes;
+	} else {
+		++flash_store_stats.dropped;
+	}
+	word_index = 0;
+	record_failed = false;
+	if (++queue_tail == queue_head) {
+		HAL_FLASH_Lock();
+	}
+}
+/**
+ * @brief  Programs everything queued, waiting for the flash (at most a few
+ *         hundred microseconds)
+ * @return None
+ */
+void FlashStore_Flush(void) {
+	while (queue_tail != queue_head) {
+		FlashStore_Poll();
+	}
+}
+/**
+ * @brief  Compacts the log into the other sector once more than half of
+ *         the live one is used, or if it has no header yet. The erase
+ *         stalls the CPU for 1-2 s, so call it only at boot or while nobody
+ *         plays.
+ * @return None
+ */
+void FlashStore_Maintain(void) {
+	if (generation != 0 && write_offset <= STORE_SIZE / 2) {
+		return;
+	}
+	FlashStore_Flush();
+	if (Compact()) {
+		++flash_store_stats.compactions;
+	} else {
+		++flash_store_stats.failed_compactions;
+	}
+}
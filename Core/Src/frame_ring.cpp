@@ -0,0 +1,111 @@
+/*
+ * @brief LED frame ring
+ * Each slot carries its own sequence word (a per-slot seqlock), so writing a
+ * frame never depends on what readers are doing.
+ */
+#include "main.h"
+#include "frame_ring.h"
+
+static_assert((FRAME_RING_CAPACITY & (FRAME_RING_CAPACITY - 1)) == 0,
+		"FRAME_RING_CAPACITY must be a power of two");
+static_assert(sizeof(LedFrame) == 20, "viewers expect 20-byte frames");
+
+volatile FrameRing frame_ring;
+
+static void (*sampler)(LedFrame *frame);
+static LedFrame last_frame;
+static uint32_t last_publish_tick;
+
+/**
+ * @brief  Writes one frame into the next slot
+ * @return None
+ */
+static void Publish(const LedFrame &frame) {
+	uint32_t position = frame_ring.head;
+	volatile LedFrame &slot = frame_ring.frames[position
+			& (FRAME_RING_CAPACITY - 1)];
+
+	slot.seq = 2 * position + 1;
+	__DMB();
+	slot.tick = frame.tick;
+	slot.leds = frame.leds;
+	slot.buttons = frame.buttons;
+	for (uint8_t i = 0; i < FRAME_RING_STATIONS; ++i) {
+		slot.state[i] = frame.state[i];
+		slot.level[i] = frame.level[i];
+		slot.index[i] = frame.index[i];
+	}
+	__DMB();
+	slot.seq = 2 * position + 2;
+	__DMB();
+	frame_ring.head = position + 1;
+}
+
+/**
+ * @brief  Clears the ring and sets the function that samples the board
+ * @param  sample: fills leds, buttons, state, level and index
+ * @return None
+ */
+void FrameRing_Init(void (*sample)(LedFrame *frame)) {
+	frame_ring.head = 0;
+	frame_ring.capacity = FRAME_RING_CAPACITY;
+	frame_ring.frame_size = sizeof(LedFrame);
+	__DMB();
+	/* Written last: viewers wait for the magic before trusting the layout */
+	frame_ring.magic = FRAME_RING_MAGIC;
+	sampler = sample;
+}
+/**
+ * @brief  Producer, called from SysTick. Never blocks.
+ * Must only run at one interrupt priority so there is a single producer.
+ * @return None
+ */
+void FrameRing_OnTick(void) {
+	if (sampler == nullptr) {
+		return;
+	}
+	LedFrame frame { };
+	sampler(&frame);
+	frame.tick = HAL_GetTick();
+
+	bool changed = frame.leds != last_frame.leds
+			|| frame.buttons != last_frame.buttons;
+	for (uint8_t i = 0; i < FRAME_RING_STATIONS; ++i) {
+		changed = changed || frame.state[i] != last_frame.state[i]
+				|| frame.level[i] != last_frame.level[i]
+				|| frame.index[i] != last_frame.index[i];
+	}
+	if (changed || frame.tick - last_publish_tick >= FRAME_RING_KEEPALIVE_MS) {
+		Publish(frame);
+		last_frame = frame;
+		last_publish_tick = frame.tick;
+	}
+}
+/**
+ * @brief  Consumer side of the protocol for readers running on the MCU
+ * @param  position: frame number to read (0 = first frame since boot)
+ * @param  out: receives the frame
+ * @return false if the frame is not published yet or was already overwritten
+ */
+bool FrameRing_Read(uint32_t position, LedFrame *out) {
+	const volatile LedFrame &slot = frame_ring.frames[position
+			& (FRAME_RING_CAPACITY - 1)];
+	uint32_t expected = 2 * position + 2;
+
+	if (slot.seq != expected) {
+		return false;
+	}
+	__DMB();
+	out->tick = slot.tick;
+	out->leds = slot.leds;
+	out->buttons = slot.buttons;
+	for (uint8_t i = 0; i < FRAME_RING_STATIONS; ++i) {
+		out->state[i] = slot.state[i];
+		out->level[i] = slot.level[i];
+		out->index[i] = slot.index[i];
+	}
+	out->reserved = 0;
+	__DMB();
+	out->seq = slot.seq;
+	return out->seq == expected;
+}
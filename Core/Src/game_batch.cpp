@@ -0,0 +1,170 @@
+/*
+ * @brief Batched Simon Says kernel
+ * Every rule of GameCore_Press() becomes a lane mask (all ones where it
+ * applies), and each field is updated by blending under its mask. Results
+ * are the GameStepResult values, which the masks build up bit by bit:
+ * OK 1, LEVEL_UP 2, WIN 3, FAIL 4.
+ */
+#include "game_batch.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+static_assert(GAME_STEP_OK == 1 && GAME_STEP_LEVEL_UP == 2
+		&& GAME_STEP_WIN == 3 && GAME_STEP_FAIL == 4,
+		"results are built from the masks");
+static_assert(GAME_LED_COUNT == 4, "a step is the top two bits of the RNG");
+
+/**
+ * @brief  Starts game n of the batch like GameEnv_Reset(): level 0 with its
+ *         first step drawn, on the player's turn
+ * @return None
+ */
+void GameBatch_Start(GameBatch *batch, uint32_t n, uint32_t seed) {
+	GameCore game;
+	GameCore_Start(&game, seed);
+	GameCore_BeginInput(&game);
+	batch->rng_state[n] = game.rng_state;
+	for (uint8_t k = 0; k < GAME_MAX_LEVEL; ++k) {
+		batch->sequence[k][n] = game.sequence[k];
+	}
+	batch->current_level[n] = game.current_level;
+	batch->index[n] = game.index;
+	batch->state[n] = game.state;
+}
+/**
+ * @brief  Copies game n out of the batch
+ * @return None
+ */
+void GameBatch_Get(const GameBatch *batch, uint32_t n, GameCore *game) {
+	game->rng_state = batch->rng_state[n];
+	for (uint8_t k = 0; k < GAME_MAX_LEVEL; ++k) {
+		game->sequence[k] = batch->sequence[k][n];
+	}
+	game->current_level = batch->current_level[n];
+	game->index = batch->index[n];
+	game->state = batch->state[n];
+}
+
+#if defined(__AVX2__)
+/**
+ * @brief  Applies one press to each game, eight lanes per iteration
+ * @param  actions: button index per game
+ * @param  results: GameStepResult per game
+ * @return None
+ */
+void GameBatch_Step(GameBatch *batch, const uint8_t *actions,
+		uint8_t *results) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i player_says = _mm256_set1_epi32(PLAYER_SAYS);
+	const __m256i last_level = _mm256_set1_epi32(GAME_MAX_LEVEL - 1);
+	for (uint32_t n = 0; n < batch->count; n += GAME_BATCH_LANES) {
+		__m256i *rng = reinterpret_cast<__m256i*>(&batch->rng_state[n]);
+		__m256i *level_lanes =
+				reinterpret_cast<__m256i*>(&batch->current_level[n]);
+		__m256i *index_lanes = reinterpret_cast<__m256i*>(&batch->index[n]);
+		__m256i *state_lanes = reinterpret_cast<__m256i*>(&batch->state[n]);
+		__m256i action = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+				reinterpret_cast<const __m128i*>(&actions[n])));
+		__m256i level = _mm256_loadu_si256(level_lanes);
+		__m256i index = _mm256_loadu_si256(index_lanes);
+		__m256i state = _mm256_loadu_si256(state_lanes);
+
+		__m256i expected = zero;
+		for (uint8_t k = 0; k < GAME_MAX_LEVEL; ++k) {
+			__m256i at = _mm256_cmpeq_epi32(index, _mm256_set1_epi32(k));
+			expected = _mm256_or_si256(expected, _mm256_and_si256(at,
+					_mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+							&batch->sequence[k][n]))));
+		}
+		__m256i active = _mm256_cmpeq_epi32(state, player_says);
+		__m256i correct = _mm256_cmpeq_epi32(action, expected);
+		__m256i fail = _mm256_andnot_si256(correct, active);
+		__m256i hit = _mm256_and_si256(active, correct);
+		__m256i ok = _mm256_and_si256(hit, _mm256_cmpgt_epi32(level, index));
+		__m256i complete = _mm256_andnot_si256(ok, hit);
+		__m256i win = _mm256_and_si256(complete,
+				_mm256_cmpeq_epi32(level, last_level));
+		__m256i up = _mm256_andnot_si256(win, complete);
+
+		__m256i x = _mm256_loadu_si256(rng);
+		x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+		x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+		x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+		_mm256_storeu_si256(rng,
+				_mm256_blendv_epi8(_mm256_loadu_si256(rng), x, up));
+		__m256i step = _mm256_srli_epi32(x, 30);
+		level = _mm256_sub_epi32(level, up);
+		for (uint8_t k = 1; k < GAME_MAX_LEVEL; ++k) {
+			__m256i *lanes =
+					reinterpret_cast<__m256i*>(&batch->sequence[k][n]);
+			__m256i write = _mm256_and_si256(up,
+					_mm256_cmpeq_epi32(level, _mm256_set1_epi32(k)));
+			_mm256_storeu_si256(lanes,
+					_mm256_blendv_epi8(_mm256_loadu_si256(lanes), step, write));
+		}
+		_mm256_storeu_si256(level_lanes, level);
+		index = _mm256_andnot_si256(up,
+				_mm256_add_epi32(index, _mm256_and_si256(ok, one)));
+		_mm256_storeu_si256(index_lanes, index);
+		state = _mm256_blendv_epi8(state, _mm256_set1_epi32(GAME_OVER), fail);
+		state = _mm256_blendv_epi8(state, _mm256_set1_epi32(WIN), win);
+		_mm256_storeu_si256(state_lanes, state);
+
+		__m256i result = _mm256_or_si256(
+				_mm256_or_si256(_mm256_and_si256(ok, one),
+						_mm256_and_si256(up, _mm256_set1_epi32(2))),
+				_mm256_or_si256(_mm256_and_si256(win, _mm256_set1_epi32(3)),
+						_mm256_and_si256(fail, _mm256_set1_epi32(4))));
+		/* 32-bit lanes to bytes: each 128-bit half packs its own four */
+		result = _mm256_packus_epi32(result, result);
+		result = _mm256_packus_epi16(result, result);
+		uint32_t low = _mm_cvtsi128_si32(_mm256_castsi256_si128(result));
+		uint32_t high = _mm_cvtsi128_si32(_mm256_extracti128_si256(result, 1));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(&results[n]),
+				_mm_set_epi32(0, 0, high, low));
+	}
+}
+#else
+/**
+ * @brief  Applies one press to each game, one lane at a time. Without
+ *         vector gathers a lane reads and writes its sequence step directly
+ *         instead of blending every step under a mask.
+ * @param  actions: button index per game
+ * @param  results: GameStepResult per game
+ * @return None
+ */
+void GameBatch_Step(GameBatch *batch, const uint8_t *actions,
+		uint8_t *results) {
+	for (uint32_t n = 0; n < batch->count; ++n) {
+		uint32_t level = batch->current_level[n];
+		uint32_t index = batch->index[n];
+		uint32_t state = batch->state[n];
+		uint32_t expected = batch->sequence[index][n];
+		uint32_t active = -static_cast<uint32_t>(state == PLAYER_SAYS);
+		uint32_t correct = -static_cast<uint32_t>(actions[n] == expected);
+		uint32_t fail = active & ~correct;
+		uint32_t hit = active & correct;
+		uint32_t ok = hit & -static_cast<uint32_t>(level > index);
+		uint32_t complete = hit & ~ok;
+		uint32_t win = complete
+				& -static_cast<uint32_t>(level == GAME_MAX_LEVEL - 1);
+		uint32_t up = complete & ~win;
+
+		if (up != 0) {
+			uint32_t x = batch->rng_state[n];
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			batch->rng_state[n] = x;
+			batch->sequence[level + 1][n] = x >> 30;
+		}
+		batch->current_level[n] = level - up;
+		batch->index[n] = (index + (ok & 1)) & ~up;
+		state = (GAME_OVER & fail) | (state & ~fail);
+		batch->state[n] = (WIN & win) | (state & ~win);
+		results[n] = (ok & 1) | (up & 2) | (win & 3) | (fail & 4);
+	}
+}
+#endif
@@ -0,0 +1,176 @@
+/*
+ * @brief Simon Says game rules
+ * Pure state transitions on a GameCore. The firmware adds LEDs, buttons and
+ * timing around these calls; the batched environment drives them directly.
+ */
+#include "game_core.h"
+#include <string.h>
+
+/**
+ * @brief  Draws the next step of the sequence
+ * @return LED index in [0, GAME_LED_COUNT)
+ */
+static uint8_t NextSequenceStep(GameCore *game) {
+	uint32_t x = game->rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	game->rng_state = x;
+	/* Multiply-shift maps the full 32-bit range onto [0, GAME_LED_COUNT) without a division */
+	return static_cast<uint8_t>((static_cast<uint64_t>(x) * GAME_LED_COUNT)
+			>> 32);
+}
+
+/**
+ * @brief  Starts a new game: level 0 with its first step already drawn
+ * @param  seed: any value, the same seed always gives the same sequence
+ * @return None
+ */
+void GameCore_Start(GameCore *game, uint32_t seed) {
+	/* xorshift must never hold zero */
+	game->rng_state = seed ^ 0x9E3779B9U;
+	if (game->rng_state == 0) {
+		game->rng_state = 1;
+	}
+	memset(game->sequence, 0, sizeof(game->sequence));
+	game->current_level = 0;
+	game->index = 0;
+	game->sequence[0] = NextSequenceStep(game);
+	game->state = SIMON_SAYS;
+}
+/**
+ * @brief  Hands the turn to the player once the sequence has been shown
+ * @return None
+ */
+void GameCore_BeginInput(GameCore *game) {
+	if (game->state == SIMON_SAYS) {
+		game->index = 0;
+		game->state = PLAYER_SAYS;
+	}
+}
+/**
+ * @brief  Checks one button press against the sequence
+ * @param  button: index of the pressed button
+ * @return What the press did to the game
+ */
+GameStepResult GameCore_Press(GameCore *game, uint8_t button) {
+	if (game->state != PLAYER_SAYS) {
+		return GAME_STEP_IGNORED;
+	}
+	if (button != game->sequence[game->index]) {
+		game->state = GAME_OVER;
+		return GAME_STEP_FAIL;
+	}
+	if (game->index < game->current_level) {
+		++game->index;
+		return GAME_STEP_OK;
+	}
+	/* All LEDs repeated correctly: count the victory or add a new blink */
+	if (game->current_level == GAME_MAX_LEVEL - 1) {
+		game->state = WIN;
+		return GAME_STEP_WIN;
+	}
+	++game->current_level;
+	game->sequence[game->current_level] = NextSequenceStep(game);
+	game->index = 0;
+	game->state = SIMON_SAYS;
+	return GAME_STEP_LEVEL_UP;
+}
+/**
+ * @brief  Verifies that the game state is consistent.
+ * Protects the LED table lookups against corrupted RAM.
+ * @return true if every field is in range
+ */
+bool GameCore_IsValid(const GameCore *game) {
+	if (game->state > WIN || game->current_level >= GAME_MAX_LEVEL
+			|| game->index > game->current_level) {
+		return false;
+	}
+	for (int i = 0; i <= game->current_level; ++i) {
+		if (game->sequence[i] >= GAME_LED_COUNT) {
+			return false;
+		}
+	}
+	return true;
+}
+/**
+ * @brief  Computes the sequence a seed will produce without playing it
+ * @param  steps: receives count LED indices, the first is the level 0 step
+ * @param  count: at most GAME_MAX_LEVEL
+ * @return None
+ */
+void GameCore_PreviewSequence(uint32_t seed, uint8_t *steps, uint8_t count) {
+	GameCore preview;
+	GameCore_Start(&preview, seed);
+	steps[0] = preview.sequence[0];
+	for (uint8_t i = 1; i < count && i < GAME_MAX_LEVEL; ++i) {
+		steps[i] = NextSequenceStep(&preview);
+	}
+}
+
+/**
+ * @brief  Writes the observation of one game
+ * @param  out: GAME_OBS_SIZE bytes
+ * @return None
+ */
+static void Observe(const GameCore *game, uint8_t *out) {
+	for (int i = 0; i < GAME_MAX_LEVEL; ++i) {
+		out[i] = i <= game->current_level ? game->sequence[i] : GAME_OBS_HIDDEN;
+	}
+	out[GAME_MAX_LEVEL] = game->current_level;
+	out[GAME_MAX_LEVEL + 1] = game->index;
+	out[GAME_MAX_LEVEL + 2] = game->state;
+}
+
+/**
+ * @brief  Starts count games and writes their first observations.
+ * The sequence is shown instantly, every game starts on the player's turn.
+ * @param  games: count game states owned by the caller
+ * @param  seeds: one seed per game
+ * @param  obs: count * GAME_OBS_SIZE bytes
+ * @return None
+ */
+void GameEnv_Reset(GameCore *games, uint32_t count, const uint32_t *seeds,
+		uint8_t *obs) {
+	for (uint32_t n = 0; n < count; ++n) {
+		GameCore_Start(&games[n], seeds[n]);
+		GameCore_BeginInput(&games[n]);
+		Observe(&games[n], &obs[n * GAME_OBS_SIZE]);
+	}
+}
+/**
+ * @brief  Applies one press to each of count games.
+ * A finished game stays finished (reward 0, done 1) until it is reset.
+ * @param  actions: button index per game
+ * @param  obs: count * GAME_OBS_SIZE bytes
+ * @param  rewards: one reward per game
+ * @param  dones: set to 1 when the game ended with this step
+ * @return None
+ */
+void GameEnv_Step(GameCore *games, uint32_t count, const uint8_t *actions,
+		uint8_t *obs, int8_t *rewards, uint8_t *dones) {
+	for (uint32_t n = 0; n < count; ++n) {
+		GameCore *game = &games[n];
+		int8_t reward = 0;
+		switch (GameCore_Press(game, actions[n])) {
+		case GAME_STEP_OK:
+			reward = GAME_REWARD_CORRECT;
+			break;
+		case GAME_STEP_LEVEL_UP:
+			reward = GAME_REWARD_CORRECT;
+			GameCore_BeginInput(game);
+			break;
+		case GAME_STEP_WIN:
+			reward = GAME_REWARD_WIN;
+			break;
+		case GAME_STEP_FAIL:
+			reward = GAME_REWARD_FAIL;
+			break;
+		case GAME_STEP_IGNORED:
+			break;
+		}
+		rewards[n] = reward;
+		dones[n] = game->state == WIN || game->state == GAME_OVER;
+		Observe(game, &obs[n * GAME_OBS_SIZE]);
+	}
+}
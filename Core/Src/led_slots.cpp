@@ -0,0 +1,70 @@
+/*
+ * @brief LED slot tables
+ * Lit LEDs are dealt out in turn, so the groups differ by one LED at most
+ * and each slot draws about the same current.
+ */
+#include "led_slots.h"
+
+constexpr uint32_t MODE_OUTPUT = 1;
+constexpr uint32_t MODE_ANALOG = 3;
+constexpr uint8_t PORT_PINS = 16;
+
+/**
+ * @brief  MODER word of the sensing blank: the LED pins analog
+ * @return The word
+ */
+uint32_t LedSlots_BlankWord(const LedSlotPins *pins) {
+	uint32_t word = pins->input_word;
+	for (uint8_t i = 0; i < pins->count; ++i) {
+		word |= MODE_ANALOG << ((pins->first_pin + i) * 2);
+	}
+	return word;
+}
+/**
+ * @brief  Fills a table of LED_SLOTS_TICKS MODER words for a set of lit
+ *         LEDs. Slots follow each other from the start of the lit part.
+ * @param  lit: bit i set if LED i is on
+ * @param  on_ticks: requested on-time per period, at most
+ *         LED_SLOTS_LIT_TICKS
+ * @return The slots, the peak and the on-time granted
+ */
+LedSlotPlan LedSlots_Build(uint32_t *table, const LedSlotPins *pins,
+		uint32_t lit, uint32_t on_ticks) {
+	uint32_t group_words[PORT_PINS] = { };
+	uint8_t group_sizes[PORT_PINS] = { };
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < pins->count; ++i) {
+		count += (lit >> i) & 1;
+	}
+	LedSlotPlan plan = { };
+	plan.slots = (count + LED_SLOTS_MAX_LIT - 1) / LED_SLOTS_MAX_LIT;
+	if (plan.slots > 0) {
+		uint8_t next = 0;
+		for (uint8_t i = 0; i < pins->count; ++i) {
+			if ((lit >> i) & 1) {
+				group_words[next] |= MODE_OUTPUT << ((pins->first_pin + i) * 2);
+				++group_sizes[next];
+				next = (next + 1) % plan.slots;
+			}
+		}
+		plan.peak_lit = group_sizes[0];
+		plan.on_ticks = on_ticks < LED_SLOTS_LIT_TICKS / plan.slots ?
+				on_ticks : LED_SLOTS_LIT_TICKS / plan.slots;
+	}
+
+	uint32_t blank = LedSlots_BlankWord(pins);
+	uint32_t tick = 0;
+	for (; tick < LED_SLOTS_BLANK_TICKS; ++tick) {
+		table[tick] = blank;
+	}
+	for (uint8_t slot = 0; slot < plan.slots; ++slot) {
+		uint32_t word = pins->input_word | group_words[slot];
+		for (uint8_t i = 0; i < plan.on_ticks; ++i) {
+			table[tick++] = word;
+		}
+	}
+	for (; tick < LED_SLOTS_TICKS; ++tick) {
+		table[tick] = pins->input_word;
+	}
+	return plan;
+}
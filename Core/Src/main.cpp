@@ -5,75 +5,551 @@
  * Author: Taras Zaluzhnyi
  */
 #include "main.h"
-#include <random>
+#include "attract.h"
+#include "battery.h"
+#include "bot_detector.h"
+#include "brightness.h"
+#include "clock_guard.h"
+#include "fault_injection.h"
+#include "flash_store.h"
+#include "frame_ring.h"
+#include "game_core.h"
+#include "led_slots.h"
+#include "nor_log.h"
+#include "preempt_explorer.h"
+#include "reaction.h"
+#include "record_auth.h"
+#include "resume_slot.h"
+#include "rhythm_core.h"
+#include "sd_archive.h"
+#include "sd_spi.h"
+#include "seed_catalogue.h"
+#include "session_log.h"
+#include "skill.h"
+#include "spi_bus.h"
+#include "spi_nor.h"
+#include "station.h"
+#include "telemetry.h"
+#include "usb_cdc.h"
+#include "usb_hid.h"
+#include "usb_otg.h"
+#include "whack_core.h"
 
-constexpr uint8_t MAX_LEVEL = 5; // Number of levels
-uint32_t sequence[MAX_LEVEL];    // LED sequence array for gaming situation
-uint8_t current_level;           // Tracks player progress (0 to MAX_LEVEL-1)
+// Two side-by-side stations, each with 4 LEDs and 4 buttons
+constexpr uint8_t STATION_COUNT = 2;
+constexpr uint8_t BUTTONS_PER_STATION = GAME_LED_COUNT;
+constexpr uint32_t STATION_BUTTONS = (1U << BUTTONS_PER_STATION) - 1;
+
+Station stations[STATION_COUNT]; // Classic games, stepped in turn
+ReactionHistogram reaction_stats; // Reaction test latencies of the profile
+WhackGame whack; // Whack-a-mole round in progress
+RhythmGame rhythm; // Rhythm round in progress
+int32_t rhythm_offset_us; // Input latency calibration of the profile
+volatile bool gamepad_mode; // Buttons reported over USB HID
+volatile uint32_t gamepad_buttons; // Debounced mask of gamepad mode
 
 // Game timing constants (in ms)
 constexpr uint32_t GAME_SPEED_MS = 500;
+constexpr uint32_t GAME_SPEED_MIN_MS = 250;
 constexpr uint32_t ERROR_BLINK_MS = 200;
-constexpr uint32_t WIN_ANIMATION_MS = 100;
-
-// Auxiliary variables for creating a random blinking sequence
-std::mt19937 generator;
-std::uniform_int_distribution<uint32_t> distrib(0, 3);
-
-//// Mapping logical indices (0-3) to physical GPIO pins on the board
-uint16_t led_pins[] = { GPIO_PIN_3, GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_6 };
-uint16_t button_pins[] = { GPIO_PIN_3, GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_6 };
-constexpr uint8_t BUTTON_COUNT = 4;
-constexpr uint8_t LED_COUNT = 4;
-
-/* An enumeration that helps determine the stage of the game and control the stage in the state machine */
-enum GameState {
-	IDLE,        // Start of the game
-	SIMON_SAYS,  // Demonstrate the sequence to the player
-	PLAYER_SAYS, // Player repeats the sequence
-	GAME_OVER,   // End of the game: Loss
-	WIN          // End of the game: Victory
-};
+constexpr uint32_t ATTRACT_IDLE_MS = 10000; // Idle time before the attract animation
+
+// Reaction test: trials per run and the random wait before each stimulus
+constexpr uint8_t REACTION_TRIALS = 5;
+constexpr uint32_t FOREPERIOD_MIN_MS = 1000;
+constexpr uint32_t FOREPERIOD_SPREAD_MS = 2000;
+
+// Whack-a-mole: mole lifetime, mean time between moles, button debounce
+constexpr uint16_t WHACK_WINDOW_MS = 1200;
+constexpr uint16_t WHACK_SPAWN_MS = 700;
+constexpr uint32_t DEBOUNCE_MS = 20;
+
+// Rhythm: 120 BPM, first beat one second after START
+constexpr uint32_t BEAT_PERIOD_US = 500000;
+constexpr uint32_t RHYTHM_LEAD_IN_US = 1000000;
+
+//// Mapping logical indices to physical GPIO pins on the board:
+//// 0-3 station 1 (PA3-PA6, PB3-PB6), 4-7 station 2 (PA7-PA10, PB7-PB10)
+uint16_t led_pins[] = { GPIO_PIN_3, GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_6,
+GPIO_PIN_7, GPIO_PIN_8, GPIO_PIN_9, GPIO_PIN_10 };
+uint16_t button_pins[] = { GPIO_PIN_3, GPIO_PIN_4, GPIO_PIN_5, GPIO_PIN_6,
+GPIO_PIN_7, GPIO_PIN_8, GPIO_PIN_9, GPIO_PIN_10 };
+constexpr uint8_t BUTTON_COUNT = STATION_COUNT * BUTTONS_PER_STATION;
+constexpr uint8_t LED_COUNT = STATION_COUNT * GAME_LED_COUNT;
+// Holding one of these station 1 buttons while pressing its START selects
+// another mode. These modes take over the board, so they only start while
+// station 2 is idle.
+constexpr uint8_t WHACK_MODE_BUTTON = 0;
+constexpr uint8_t RHYTHM_MODE_BUTTON = 1;
+constexpr uint8_t REACTION_MODE_BUTTON = 3;
 
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 
 /**
- * @brief  Checks if a button has been pressed
- * @return Array index of the pressed button
+ * @brief  Switches a game LED with a single atomic BSRR write
+ * @param  index: logical LED index (0-7)
+ * @param  on: true to light the LED
+ * @return None
  */
-int8_t GetPressedButtonIndex() {
+inline void SetLed(uint8_t index, bool on) {
+	GPIOA->BSRR =
+			on ? led_pins[index] : static_cast<uint32_t>(led_pins[index]) << 16;
+}
+/**
+ * @brief  Shows the LED frame of the whole board with a single atomic BSRR
+ *         write
+ * @param  mask: bit i set to light LED i
+ * @return None
+ */
+void ShowLedMask(uint32_t mask) {
+	uint32_t set = 0;
+	uint32_t reset = 0;
+	for (int i = 0; i < LED_COUNT; ++i) {
+		if (mask & (1U << i)) {
+			set |= led_pins[i];
+		} else {
+			reset |= led_pins[i];
+		}
+	}
+	GPIOA->BSRR = (reset << 16) | set;
+}
+/**
+ * @brief  Checks a station's Start button (active low) with one IDR read
+ * @param  station: 0 or 1
+ * @return true while the button is held
+ */
+inline bool IsStartPressed(uint8_t station) {
+	return station == 0 ?
+			(START_GPIO_Port->IDR & START_Pin) == 0 :
+			(START2_GPIO_Port->IDR & START2_Pin) == 0;
+}
+/**
+ * @brief  Reads all game buttons at once.
+ * A single IDR read gives a coherent snapshot of every button; this is the
+ * one input scanner shared by all stations.
+ * @return Bitmask of pressed buttons (bit i set when button i is pressed)
+ */
+uint32_t ReadButtonMask() {
+	uint32_t idr = GPIOB->IDR;
+	uint32_t mask = 0;
 	for (int i = 0; i < BUTTON_COUNT; ++i) {
-		if (HAL_GPIO_ReadPin(GPIOB, button_pins[i]) == 0) {
-			return i;
+		if ((idr & button_pins[i]) == 0) {
+			mask |= 1U << i;
+		}
+	}
+	return FaultInjection_FilterButtons(mask);
+}
+/**
+ * @brief  Extracts one station's buttons from a scan
+ * @return Bit i set when button i of the station is pressed
+ */
+inline uint32_t StationButtons(uint32_t mask, uint8_t station) {
+	return (mask >> (station * BUTTONS_PER_STATION)) & STATION_BUTTONS;
+}
+/**
+ * @brief  Invariant check shared by the main loop and the preemption explorer
+ * @return true if the state of every station, and the press state it shares
+ *         with the EXTI interrupt, is consistent
+ */
+bool CheckGameInvariants() {
+	for (const Station &station : stations) {
+		if (!GameCore_IsValid(&station.game)
+				|| !BotDetector_IsConsistent(&station.detector)) {
+			return false;
 		}
 	}
-	return -1;
+	return Reaction_IsConsistent();
 }
 /**
- * @brief  Flashes all LEDs when losing
+ * @brief  Samples the board for the frame ring (runs in SysTick context)
+ * @param  frame: receives LEDs, buttons and the progress of both stations
+ * @return None
+ */
+void SampleFrame(LedFrame *frame) {
+	uint32_t odr = GPIOA->ODR;
+	for (int i = 0; i < LED_COUNT; ++i) {
+		if (odr & led_pins[i]) {
+			frame->leds |= 1U << i;
+		}
+	}
+	frame->buttons = ReadButtonMask();
+	for (uint8_t i = 0; i < STATION_COUNT; ++i) {
+		frame->state[i] = stations[i].game.state;
+		frame->level[i] = stations[i].game.current_level;
+		frame->index[i] = stations[i].game.index;
+	}
+}
+static_assert(STATION_COUNT == FRAME_RING_STATIONS,
+		"frames carry the progress of every station");
+/* The reaction test runs without the slot scheduler */
+static_assert(BUTTONS_PER_STATION <= LED_SLOTS_MAX_LIT,
+		"the flash lights more LEDs than may conduct at once");
+
+/**
+ * @brief  Flashes the LEDs of station 1 after an anticipated press
  * @return None
  */
 void ToggleLEDsForGameOver() {
+	const uint32_t all_leds = led_pins[0] | led_pins[1] | led_pins[2]
+			| led_pins[3];
 	for (int i = 0; i < 4; ++i) {
-		HAL_GPIO_TogglePin(GPIOA,
-				led_pins[0] | led_pins[1] | led_pins[2] | led_pins[3]);
+		/* Set the LEDs that are off and reset those that are on in one write */
+		uint32_t odr = GPIOA->ODR;
+		GPIOA->BSRR = ((odr & all_leds) << 16) | (~odr & all_leds);
 		HAL_Delay(ERROR_BLINK_MS);
 	}
 }
 /**
- * @brief  Launches "Running Light" when winning
+ * @brief  Starts a classic game on a station
+ * Seeds around the player's estimated span; the moment of the press is the
+ * entropy that picks one of them.
+ * @return None
+ */
+void StartClassic(Station *station, uint32_t now) {
+	uint8_t target = Skill_TargetPercentile(&station->skill);
+	uint32_t seed = SeedCatalogue_Pick(
+			SeedCatalogue_DifficultyAtPercentile(target > 20 ? target - 20 : 0),
+			SeedCatalogue_DifficultyAtPercentile(target + 20), now);
+	Station_Start(station, seed, now,
+			Skill_TempoMs(&station->skill, GAME_SPEED_MIN_MS, GAME_SPEED_MS));
+}
+/**
+ * @brief  Plays one whack-a-mole round without blocking: every pass of the
+ * loop reads all buttons at once, debounces them and hands the new presses
+ * to the rules together with the current tick.
+ * @param  seed: reproduces the moles of the round
+ * @return None
+ */
+void RunWhackAMole(uint32_t seed) {
+	uint32_t now = HAL_GetTick();
+	uint32_t debounced = StationButtons(ReadButtonMask(), 0);
+	uint32_t last_change[BUTTONS_PER_STATION] = { };
+	uint32_t latency_ms[GAME_LED_COUNT];
+	WhackCore_Start(&whack, seed, now, WHACK_WINDOW_MS, WHACK_SPAWN_MS);
+
+	while (!WhackCore_IsOver(&whack)) {
+		FaultInjection_Heartbeat();
+		now = HAL_GetTick();
+		uint32_t changed = StationButtons(ReadButtonMask(), 0) ^ debounced;
+		uint32_t pressed = 0;
+		for (int i = 0; i < BUTTONS_PER_STATION; ++i) {
+			if ((changed & (1U << i)) && now - last_change[i] >= DEBOUNCE_MS) {
+				last_change[i] = now;
+				debounced ^= 1U << i;
+				pressed |= debounced & (1U << i);
+			}
+		}
+		uint8_t hit = WhackCore_Update(&whack, now, pressed, latency_ms);
+		for (int i = 0; i < GAME_LED_COUNT; ++i) {
+			if (hit & (1U << i)) {
+				SessionLog_Press(0, latency_ms[i]);
+			}
+		}
+		ShowLedMask(whack.active);
+	}
+}
+/**
+ * @brief  Plays one rhythm round. Presses are scored with their EXTI
+ * timestamps, so a slow pass of this loop only delays the LED cues by a
+ * moment, never the scoring. The calibration learned in the count-in is
+ * kept for the profile.
+ * @param  seed: gives the button pattern
+ * @return None
+ */
+void RunRhythm(uint32_t seed) {
+	while (StationButtons(ReadButtonMask(), 0) != 0) {
+		FaultInjection_Heartbeat();
+	}
+	Reaction_Arm(STATION_BUTTONS);
+	RhythmCore_Start(&rhythm, seed, Reaction_NowUs() + RHYTHM_LEAD_IN_US,
+			BEAT_PERIOD_US, rhythm_offset_us);
+
+	while (!RhythmCore_IsOver(&rhythm)) {
+		FaultInjection_Heartbeat();
+		uint32_t now_us = Reaction_NowUs();
+		uint8_t button;
+		uint32_t press_us;
+		while (Reaction_NextPress(&button, &press_us)) {
+			int32_t error_us;
+			RhythmGrade grade = RhythmCore_Press(&rhythm, button, press_us,
+					&error_us);
+			if (grade != RHYTHM_MISS && grade != RHYTHM_COUNT_IN) {
+				SessionLog_Press(0, (error_us < 0 ? -error_us : error_us) / 1000);
+			}
+		}
+		RhythmCore_Update(&rhythm, now_us);
+		ShowLedMask(RhythmCore_CueMask(&rhythm, now_us));
+	}
+	Reaction_Disarm();
+	ShowLedMask(0);
+
+	if (rhythm.offset_us != rhythm_offset_us) {
+		rhythm_offset_us = rhythm.offset_us;
+		RecordAuth_Write(STORE_KEY_RHYTHM + stations[0].profile,
+				&rhythm_offset_us, sizeof(rhythm_offset_us));
+	}
+}
+/**
+ * @brief  Updates one button of the gamepad report (EXTI context, or with
+ *         interrupts masked)
+ * @param  time_us: first contact of the press or release
+ * @return None
+ */
+static void SetGamepadButton(uint8_t button, bool pressed, uint32_t time_us) {
+	uint32_t mask = pressed ?
+			gamepad_buttons | 1U << button : gamepad_buttons & ~(1U << button);
+	if (mask != gamepad_buttons) {
+		gamepad_buttons = mask;
+		UsbHid_OnButtons(mask, time_us);
+	}
+}
+/**
+ * @brief  USB gamepad mode, selected by holding START at power-up: the host
+ *         reads the buttons and drives the LEDs. Never returns.
  * @return None
  */
-void RunningLightForWin() {
-	for (int j = 0; j < 4; ++j) {
-		for (int i = 0; i < LED_COUNT; ++i) {
-			HAL_GPIO_WritePin(GPIOA, led_pins[i], GPIO_PIN_SET);
-			HAL_Delay(WIN_ANIMATION_MS);
-			HAL_GPIO_WritePin(GPIOA, led_pins[i], GPIO_PIN_RESET);
+static void RunGamepad(void) {
+	UsbHid_SetClock(Reaction_NowUs);
+	gamepad_mode = true;
+	UsbOtg_Init(&usb_hid_class);
+	while (1) {
+		FaultInjection_Heartbeat();
+		/* A release sooner than the quiet period after the press, or the
+		 other way round, is taken for bounce; once a button has been quiet
+		 that long its level is stable, and reported from its last edge. A
+		 pending edge is the interrupt's to handle. */
+		__disable_irq();
+		uint32_t now_us = Reaction_NowUs();
+		uint32_t raw = ReadButtonMask();
+		for (uint8_t i = 0; i < BUTTON_COUNT; ++i) {
+			bool pressed = (raw & (1U << i)) != 0;
+			uint32_t edge_us = Reaction_LastEdgeUs(i);
+			if (pressed != ((gamepad_buttons & (1U << i)) != 0)
+					&& now_us - edge_us >= REACTION_DEBOUNCE_US
+					&& (EXTI->PR & button_pins[i]) == 0) {
+				SetGamepadButton(i, pressed, edge_us);
+			}
 		}
+		__enable_irq();
+
+		UsbHid_Poll();
+		ShowLedMask(UsbHid_Leds());
 	}
 }
+/**
+ * @brief  Halves the core and bus clocks (HCLK 48 MHz) or restores them.
+ * The PLL keeps running, so USB keeps its 48 MHz and the change takes
+ * effect at once; SysTick and the microsecond timer follow.
+ * @return None
+ */
+static void SetHalfClock(bool half) {
+	RCC_ClkInitTypeDef clocks = { };
+	clocks.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_PCLK1
+			| RCC_CLOCKTYPE_PCLK2;
+	clocks.AHBCLKDivider = half ? RCC_SYSCLK_DIV2 : RCC_SYSCLK_DIV1;
+	clocks.APB1CLKDivider = RCC_HCLK_DIV2;
+	clocks.APB2CLKDivider = RCC_HCLK_DIV1;
+	if (HAL_RCC_ClockConfig(&clocks, CLOCK_FLASH_LATENCY) != HAL_OK) {
+		Error_Handler();
+	}
+	Reaction_UpdateClock();
+}
+/**
+ * @brief  Switches the low-battery profile on or off: half clock, LEDs at
+ *         half brightness, short animations. From the low level on, the
+ *         skill of games in progress and the queued snapshots are saved at
+ *         once, while the supply still allows flash programming.
+ * @return None
+ */
+static void ApplyBatteryLevel(uint8_t level) {
+	bool low = level != BATTERY_OK;
+	Brightness_Stop(); // TIM1 and the ADC follow the new clock
+	SetHalfClock(low);
+	Brightness_SetMaxPercent(low ? 50 : 100);
+	Brightness_Start();
+	for (Station &station : stations) {
+		station.quick_animations = low;
+		if (low && !Station_IsIdle(&station)) {
+			Skill_Save(&station.skill, station.profile);
+		}
+	}
+	if (low) {
+		FlashStore_Flush();
+	}
+}
+/**
+ * @brief  Passes a button edge through the debouncer to the bot detector of
+ *         its station and the gamepad report (EXTI context)
+ * @param  i: button, 0 .. BUTTON_COUNT - 1
+ * @param  pressed: button level right after the edge
+ * @param  now_us: time of the edge
+ * @return None
+ */
+static void OnButtonEdge(uint8_t i, bool pressed, uint32_t now_us) {
+	BotDetector *detector = &stations[i / BUTTONS_PER_STATION].detector;
+	uint8_t button = i % BUTTONS_PER_STATION;
+	switch (Reaction_OnEdge(i, pressed, now_us)) {
+	case REACTION_EDGE_PRESS:
+		BotDetector_OnPress(detector, button, now_us);
+		if (gamepad_mode) {
+			SetGamepadButton(i, true, now_us);
+		}
+		break;
+	case REACTION_EDGE_RELEASE:
+		BotDetector_OnRelease(detector, button, now_us);
+		if (gamepad_mode) {
+			SetGamepadButton(i, false, now_us);
+		}
+		break;
+	case REACTION_EDGE_BOUNCE:
+		BotDetector_OnBounce(detector);
+		break;
+	}
+}
+/**
+ * @brief  Timestamps button edges for the timed modes and the bot detector
+ *         of their station, feeds the gamepad report, and stops the attract
+ *         animation on START (EXTI context)
+ * @param  GPIO_Pin: pin of the interrupting EXTI line
+ * @return None
+ */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+	uint32_t now_us = Reaction_NowUs();
+	if (GPIO_Pin == START_Pin || GPIO_Pin == START2_Pin) {
+		Attract_Stop();
+		return;
+	}
+	for (int i = 0; i < BUTTON_COUNT; ++i) {
+		if (button_pins[i] == GPIO_Pin) {
+			OnButtonEdge(i, (GPIOB->IDR & GPIO_Pin) == 0, now_us);
+		}
+	}
+}
+/**
+ * @brief  Interrupt body for the preemption explorer: the next edge of the
+ *         buttons in turn, as the EXTI interrupt would deliver it. Each
+ *         button alternates press and release, and whether the debouncer
+ *         takes the edge or rejects it as bounce depends on timing, so all
+ *         three paths get interleaved with the main loop.
+ * @return None
+ */
+static void InjectButtonEdge(void) {
+	static uint8_t next;
+	static uint32_t levels;
+	uint8_t i = next++ % BUTTON_COUNT;
+	levels ^= 1U << i;
+	OnButtonEdge(i, (levels >> i) & 1U, Reaction_NowUs());
+}
+/**
+ * @brief  Runs one reaction test: after a random wait a random LED lights
+ * and the player presses its button as fast as possible. Presses during the
+ * wait or within 100 ms of the stimulus are anticipations and are rejected.
+ * @param  seed: gives the LED of every trial
+ * @return Number of accepted trials
+ */
+uint8_t RunReactionTest(uint32_t seed) {
+	uint8_t leds[REACTION_TRIALS];
+	GameCore_PreviewSequence(seed, leds, REACTION_TRIALS);
+	uint8_t accepted = 0;
+
+	for (uint8_t trial = 0; trial < REACTION_TRIALS; ++trial) {
+		while (StationButtons(ReadButtonMask(), 0) != 0) {
+			FaultInjection_Heartbeat();
+		}
+		/* The microsecond counter after a human press is unpredictable */
+		uint32_t foreperiod_ms = FOREPERIOD_MIN_MS
+				+ Reaction_NowUs() % FOREPERIOD_SPREAD_MS;
+		Reaction_Arm(STATION_BUTTONS);
+		uint32_t wait_start = HAL_GetTick();
+		while (HAL_GetTick() - wait_start < foreperiod_ms) {
+			FaultInjection_Heartbeat();
+		}
+
+		uint8_t button;
+		uint32_t press_us;
+		if (Reaction_NextPress(&button, &press_us)) {
+			Reaction_Disarm();
+			++reaction_stats.anticipations;
+			ToggleLEDsForGameOver();
+			continue;
+		}
+		SetLed(leds[trial], true);
+		uint32_t stimulus_us = Reaction_NowUs();
+		bool pressed = false;
+		while (!pressed && Reaction_NowUs() - stimulus_us < REACTION_TIMEOUT_US) {
+			FaultInjection_Heartbeat();
+			pressed = Reaction_NextPress(&button, &press_us);
+		}
+		Reaction_Disarm();
+		SetLed(leds[trial], false);
+
+		if (!pressed || button != leds[trial]) {
+			SessionLog_Press(0, REACTION_TIMEOUT_US / 1000);
+			continue;
+		}
+		/* A press just before the stimulus gives a negative latency */
+		int32_t latency_us = press_us - stimulus_us;
+		if (latency_us < static_cast<int32_t>(REACTION_ANTICIPATION_US)) {
+			++reaction_stats.anticipations;
+			ToggleLEDsForGameOver();
+		} else {
+			ReactionHistogram_Add(&reaction_stats, latency_us);
+			SessionLog_Press(0, latency_us / 1000);
+			++accepted;
+		}
+	}
+	return accepted;
+}
+/**
+ * @brief  Runs a special mode on station 1 if its button is held with START
+ * @param  mode_buttons: station 1 buttons held
+ * @return true if a mode was played
+ */
+bool RunSpecialMode(uint32_t mode_buttons) {
+	uint8_t profile = stations[0].profile;
+	/* Program the snapshots cleared by the last games, the loops below
+	 do not poll */
+	FlashStore_Flush();
+	if (mode_buttons & (1U << REACTION_MODE_BUTTON)) {
+		uint32_t seed = Reaction_NowUs();
+		BotDetector_Reset(&stations[0].detector, false);
+		SessionLog_Begin(0, seed, SESSION_MODE_REACTION);
+		/* A dimmed LED may light up to a blank later than its BSRR write */
+		Brightness_Stop();
+		uint8_t accepted = RunReactionTest(seed);
+		Brightness_Start();
+		Station_EndSession(&stations[0],
+				accepted == REACTION_TRIALS ? SESSION_WON : SESSION_LOST,
+				accepted);
+		ReactionHistogram_Save(&reaction_stats, profile);
+	} else if (mode_buttons & (1U << WHACK_MODE_BUTTON)) {
+		uint32_t seed = HAL_GetTick();
+		BotDetector_Reset(&stations[0].detector, false);
+		SessionLog_Begin(0, seed, SESSION_MODE_WHACK);
+		RunWhackAMole(seed);
+		Station_EndSession(&stations[0],
+				whack.hits > whack.misses + whack.wrong ?
+						SESSION_WON : SESSION_LOST,
+				whack.hits > UINT8_MAX ? UINT8_MAX : whack.hits);
+		/* Wait for the buttons to be released before the next START */
+		while (StationButtons(ReadButtonMask(), 0) != 0) {
+			FaultInjection_Heartbeat();
+		}
+	} else if (mode_buttons & (1U << RHYTHM_MODE_BUTTON)) {
+		uint32_t seed = HAL_GetTick();
+		BotDetector_Reset(&stations[0].detector, true);
+		SessionLog_Begin(0, seed, SESSION_MODE_RHYTHM);
+		RunRhythm(seed);
+		uint32_t misses = rhythm.grades[RHYTHM_MISS];
+		Station_EndSession(&stations[0],
+				misses <= RHYTHM_SCORED_BEATS / 4 ? SESSION_WON : SESSION_LOST,
+				RHYTHM_SCORED_BEATS - misses);
+	} else {
+		return false;
+	}
+	return true;
+}
 /**
  * @brief  The application entry point.
  * @return int
@@ -89,93 +565,147 @@ int main(void) {
 	/* Initialize all configured peripherals */
 	MX_GPIO_Init();
 
-	/* Determining the initial state of the game */
-	GameState state = IDLE;
+	/* Fault injection hooks (no-ops unless built with FAULT_INJECTION) */
+	FaultInjection_Init(FAULT_INJECTION_SEED, BUTTON_COUNT);
+	for (Station &station : stations) {
+		FaultInjection_RegisterTarget(&station.game, sizeof(station.game));
+	}
+	PreemptExplorer_Init(CheckGameInvariants, FAULT_INJECTION_SEED);
+
+	SessionLog_Init();
+	SeedCatalogue_Build(Difficulty_Default);
+
+	/* Holding a game button at power-up selects the profile of the player at
+	 that station. Determining the initial state of the games */
+	FlashStore_Init();
+	RecordAuth_Init();
+	uint32_t held = ReadButtonMask();
+	for (uint8_t i = 0; i < STATION_COUNT; ++i) {
+		uint32_t station_held = StationButtons(held, i);
+		Station_Init(&stations[i], i,
+				station_held != 0 ? __builtin_ctz(station_held) : 0);
+	}
+	/* A game cut short by a power loss continues at the level it reached,
+	 with the profile that played it */
+	ResumeSlot_Init();
+	for (Station &station : stations) {
+		ResumeRecord record;
+		if (ResumeSlot_Load(station.id, &record)) {
+			Station_Resume(&station, &record, HAL_GetTick());
+		}
+	}
+	FlashStore_Maintain();
+	ReactionHistogram_Load(&reaction_stats, stations[0].profile);
+	if (!RecordAuth_Read(STORE_KEY_RHYTHM + stations[0].profile,
+			&rhythm_offset_us, sizeof(rhythm_offset_us))) {
+		rhythm_offset_us = 0;
+	}
+	Reaction_Init();
 
-	/* Implementing the gameplay using a state machine method*/
+	/* Session history on an external SPI NOR flash and the session archive
+	 on an SD card, each if one is fitted; both share SPI2 */
+	SpiBus_Init();
+	if (SpiNor_Init()) {
+		NorLog_Init(&spi_nor_device, spi_nor_stats.size);
+	}
+	if (SdSpi_Init()) {
+		SdArchive_Init(&sd_spi_device);
+	}
+
+	/* Holding START at power-up turns the board into a USB gamepad */
+	if (IsStartPressed(0)) {
+		RunGamepad();
+	}
+
+	/* Publish LED/button/game frames for external viewers from SysTick */
+	FrameRing_Init(SampleFrame);
+	PreemptExplorer_RegisterIsr(FrameRing_OnTick);
+	PreemptExplorer_RegisterIsr(InjectButtonEdge);
+
+	/* Telemetry and commands on the USB virtual serial port; a host opening
+	 it ends the attract animation */
+	UsbCdc_SetOpenHandler(Attract_Stop);
+	UsbOtg_Init(&usb_cdc_class);
+
+	/* LED brightness follows the room, sensed through the LEDs themselves;
+	 the same ADC scan measures the supply */
+	Battery_Init(*reinterpret_cast<const uint16_t*>(
+			BATTERY_VREFINT_CAL_ADDRESS));
+	Brightness_Start();
+
+	/* Every pass scans the inputs once, steps each station without
+	 blocking, and writes all LEDs in one frame */
+	uint32_t previous_scan_us = Reaction_NowUs();
+	uint32_t idle_since = HAL_GetTick();
 	while (1) {
-		switch (state) {
-		// Game start: expect the player to press the Start button
-		case IDLE:
-			if (HAL_GPIO_ReadPin(START_GPIO_Port, START_Pin) == 0) {
-				generator.seed(HAL_GetTick());
-				current_level = 0;
-				state = SIMON_SAYS;
-			}
-			break;
-
-			/* Demonstrate the sequence to the player */
-		case SIMON_SAYS:
-			/* With each additional level, we add one new blink. */
-			sequence[current_level] = distrib(generator);
-			/* LED flashes alternately depending on the level */
-			for (int i = 0; i <= current_level; ++i) {
-				HAL_GPIO_WritePin(GPIOA, led_pins[sequence[i]], GPIO_PIN_SET);
-				HAL_Delay(GAME_SPEED_MS);
-				HAL_GPIO_WritePin(GPIOA, led_pins[sequence[i]], GPIO_PIN_RESET);
-				HAL_Delay(GAME_SPEED_MS);
-				state = PLAYER_SAYS;
+		PreemptExplorer_EndRun();
+		FaultInjection_Heartbeat();
+		Telemetry_Poll();
+		FlashStore_Poll();
+		NorLog_Poll();
+		SdArchive_Poll();
+		Brightness_Poll(HAL_GetTick());
+		if (Battery_Poll()) {
+			ApplyBatteryLevel(battery_stats.level);
+		}
+
+		/* On corrupted state abandon the game instead of indexing out of bounds */
+		for (Station &station : stations) {
+			if (!Station_IsIdle(&station) && !GameCore_IsValid(&station.game)) {
+				FaultInjection_ReportViolation();
+				Station_Abort(&station);
 			}
-			break;
-
-			/* Player repeats the sequence */
-		case PLAYER_SAYS:
-			for (int i = 0; i <= current_level; ++i) {
-				bool flag = false;
-				while (!flag) {
-					/* Wait for a button to be pressed and read which button was pressed.
-					 When pressed, the LED flashes */
-					int8_t index = GetPressedButtonIndex();
-					if (index >= 0) {
-						HAL_GPIO_WritePin(GPIOA, led_pins[index], GPIO_PIN_SET);
-						HAL_Delay(GAME_SPEED_MS);
-						/* Waiting for the button to be released */
-						while (HAL_GPIO_ReadPin(GPIOB, button_pins[index]) == 0) {
-						}
-						HAL_GPIO_WritePin(GPIOA, led_pins[index],
-								GPIO_PIN_RESET);
-						HAL_Delay(GAME_SPEED_MS);
-						/* Check if the player's input matches the expected sequence
-						 If so, exit the loop and move on to the next LED */
-						if (static_cast<uint32_t>(index) == sequence[i]) {
-							flag = true;
-						}
-						/* If not, the player loses */
-						else {
-							state = GAME_OVER;
-							break;
-						}
-					}
-				}
-				/* Checking if the player has not lost after pressing the button */
-				if (state != PLAYER_SAYS) {
-					break;
-				}
+		}
+
+		uint32_t scan_us = Reaction_NowUs();
+		uint32_t buttons = ReadButtonMask();
+		uint32_t now = HAL_GetTick();
+
+		/* Nobody playing for a while: animate by DMA with the core asleep,
+		 unless a host on the port expects answers */
+		if (!Station_IsIdle(&stations[0]) || !Station_IsIdle(&stations[1])
+				|| UsbCdc_IsConnected()) {
+			idle_since = now;
+		} else if (now - idle_since >= ATTRACT_IDLE_MS) {
+			FlashStore_Maintain();
+			Brightness_Stop(); // The animation takes TIM1
+			Attract_Run();
+			Brightness_Start();
+			idle_since = HAL_GetTick();
+			continue;
+		}
+
+		// Game start: expect a player to press their Start button
+		if (Station_IsIdle(&stations[0]) && IsStartPressed(0)) {
+			uint32_t mode_buttons = StationButtons(buttons, 0);
+			if (!Station_IsIdle(&stations[1]) || !RunSpecialMode(mode_buttons)) {
+				StartClassic(&stations[0], now);
 			}
-			/* If all the LEDs are pressed correctly, increase the level,
-			 or count the victory if the maximum level is reached */
-			if (state == PLAYER_SAYS) {
-				if (current_level == MAX_LEVEL - 1) {
-					state = WIN;
-				} else {
-					++current_level;
-					state = SIMON_SAYS;
+			continue;
+		}
+		if (Station_IsIdle(&stations[1]) && IsStartPressed(1)) {
+			StartClassic(&stations[1], now);
+		}
+
+		uint32_t frame = 0;
+		for (uint8_t i = 0; i < STATION_COUNT; ++i) {
+			Station_Step(&stations[i], now, StationButtons(buttons, i));
+			frame |= stations[i].leds << (i * GAME_LED_COUNT);
+		}
+		ShowLedMask(frame);
+
+		/* A press may have landed just after the previous scan, so the
+		 worst-case press-to-LED latency spans from there to this write */
+		uint32_t shown_us = Reaction_NowUs();
+		for (Station &station : stations) {
+			if (station.pressed_now) {
+				station.latency_last_us = shown_us - previous_scan_us;
+				if (station.latency_last_us > station.latency_max_us) {
+					station.latency_max_us = station.latency_last_us;
 				}
 			}
-			break;
-
-			/* Player loss */
-		case GAME_OVER:
-			ToggleLEDsForGameOver();
-			state = IDLE;
-			break;
-
-			/* Player win */
-		case WIN:
-			RunningLightForWin();
-			state = IDLE;
-			break;
 		}
+		previous_scan_us = scan_us;
 	}
 }
 
@@ -199,12 +729,22 @@ void SystemClock_Config(void) {
 	RCC_OscInitStruct.HSEState = RCC_HSE_ON;
 	RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
 	RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-	RCC_OscInitStruct.PLL.PLLM = 25;
-	RCC_OscInitStruct.PLL.PLLN = 168;
-	RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-	RCC_OscInitStruct.PLL.PLLQ = 4;
+	RCC_OscInitStruct.PLL.PLLM = CLOCK_HSE_PLLM;
+	RCC_OscInitStruct.PLL.PLLN = CLOCK_PLLN;
+	RCC_OscInitStruct.PLL.PLLP = CLOCK_PLLP;
+	RCC_OscInitStruct.PLL.PLLQ = CLOCK_PLLQ;
 	if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
-		Error_Handler();
+		/* No crystal: the same 96 MHz from the HSI PLL */
+		RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE
+				| RCC_OSCILLATORTYPE_HSI;
+		RCC_OscInitStruct.HSEState = RCC_HSE_OFF;
+		RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+		RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
+		RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+		RCC_OscInitStruct.PLL.PLLM = CLOCK_HSI_PLLM;
+		if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK) {
+			Error_Handler();
+		}
 	}
 
 	/** Initializes the CPU, AHB and APB buses clocks
@@ -216,9 +756,14 @@ void SystemClock_Config(void) {
 	RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
 	RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
 
-	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK) {
+	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, CLOCK_FLASH_LATENCY)
+			!= HAL_OK) {
 		Error_Handler();
 	}
+
+	/** Enables the Clock Security System
+	 */
+	ClockGuard_Init();
 }
 
 /**
@@ -235,17 +780,25 @@ static void MX_GPIO_Init(void) {
 	__HAL_RCC_GPIOB_CLK_ENABLE();
 
 	/*Configure GPIO pin Output Level */
-	HAL_GPIO_WritePin(GPIOA, GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6,
-			GPIO_PIN_RESET);
+	HAL_GPIO_WritePin(GPIOA,
+			GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6 | GPIO_PIN_7
+					| GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10, GPIO_PIN_RESET);
 
 	/*Configure GPIO pin : START_Pin */
 	GPIO_InitStruct.Pin = START_Pin;
-	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
 	GPIO_InitStruct.Pull = GPIO_PULLUP;
 	HAL_GPIO_Init(START_GPIO_Port, &GPIO_InitStruct);
 
-	/*Configure GPIO pins : PA3 PA4 PA5 PA6 */
-	GPIO_InitStruct.Pin = GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6;
+	/*Configure GPIO pin : START2_Pin */
+	GPIO_InitStruct.Pin = START2_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	HAL_GPIO_Init(START2_GPIO_Port, &GPIO_InitStruct);
+
+	/*Configure GPIO pins : PA3 PA4 PA5 PA6 PA7 PA8 PA9 PA10 */
+	GPIO_InitStruct.Pin = GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6
+			| GPIO_PIN_7 | GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10;
 	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
 	GPIO_InitStruct.Pull = GPIO_NOPULL;
 	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
@@ -253,9 +806,36 @@ static void MX_GPIO_Init(void) {
 
 	/*Configure GPIO pins : PB3 PB4 PB5 PB6 */
 	GPIO_InitStruct.Pin = GPIO_PIN_3 | GPIO_PIN_4 | GPIO_PIN_5 | GPIO_PIN_6;
-	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+	GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
 	GPIO_InitStruct.Pull = GPIO_PULLUP;
 	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	/*Configure GPIO pins : PB7 PB8 PB9 PB10 */
+	GPIO_InitStruct.Pin = GPIO_PIN_7 | GPIO_PIN_8 | GPIO_PIN_9 | GPIO_PIN_10;
+	GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	/* EXTI interrupt init*/
+	/* Highest priority: the press timestamp must not wait for other handlers,
+	 and START must stop the attract animation at once */
+	HAL_NVIC_SetPriority(EXTI0_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI0_IRQn);
+
+	HAL_NVIC_SetPriority(EXTI1_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
+	HAL_NVIC_SetPriority(EXTI3_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
+	HAL_NVIC_SetPriority(EXTI4_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+
+	HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+
+	HAL_NVIC_SetPriority(EXTI15_10_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
 }
 
 /**
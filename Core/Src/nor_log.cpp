@@ -0,0 +1,268 @@
+/*
+ * @brief NOR flash log
+ * At most one device operation is in flight, and its data stays in place
+ * (queue slot or pending header) until NorLog_Poll() sees it finished.
+ */
+#include "nor_log.h"
+#include <string.h>
+
+constexpr uint32_t MAGIC = 0x314C524EU; // "NRL1"
+constexpr uint32_t ERASED = 0xFFFFFFFFU;
+
+static_assert((NOR_LOG_QUEUE_SIZE & (NOR_LOG_QUEUE_SIZE - 1)) == 0,
+		"the queue indices wrap");
+
+/* First 16 bytes of a segment */
+struct SegmentHeader {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t erase_count;
+	uint32_t check; // ~(magic ^ sequence ^ erase_count)
+};
+
+/* Device operation in flight */
+enum Step {
+	STEP_IDLE,
+	STEP_PROGRAM, // Entry at the queue tail
+	STEP_ERASE,   // Segment after the head
+	STEP_HEADER   // Its header
+};
+
+NorLogStats nor_log_stats;
+
+static const NorDevice *device;
+static uint32_t sequences[NOR_LOG_MAX_SEGMENTS]; // 0: not part of the log
+static uint32_t head;         // Newest segment
+static uint32_t head_entries; // Entries programmed in it
+static uint8_t queue[NOR_LOG_QUEUE_SIZE][NOR_LOG_ENTRY_SIZE];
+static uint32_t queue_head;
+static uint32_t queue_tail;
+static Step step;
+static SegmentHeader pending_header;
+
+/**
+ * @brief  Device address of an entry
+ * @return The address
+ */
+static uint32_t EntryAddress(uint32_t segment, uint32_t index) {
+	return segment * NOR_LOG_SEGMENT_SIZE + NOR_LOG_PAGE_SIZE
+			* (1 + index / NOR_LOG_ENTRIES_PER_PAGE)
+			+ index % NOR_LOG_ENTRIES_PER_PAGE * NOR_LOG_ENTRY_SIZE;
+}
+/**
+ * @brief  Reads and checks a segment header
+ * @return Its sequence number, 0 if it has no valid header
+ */
+static uint32_t ReadHeader(uint32_t segment, SegmentHeader *header) {
+	device->read(segment * NOR_LOG_SEGMENT_SIZE, header, sizeof(*header));
+	if (header->magic != MAGIC || header->sequence == 0
+			|| header->check != ~(header->magic ^ header->sequence
+					^ header->erase_count)) {
+		return 0;
+	}
+	return header->sequence;
+}
+/**
+ * @brief  Previous segment in the ring
+ */
+static uint32_t Previous(uint32_t segment) {
+	return (segment + nor_log_stats.segments - 1) % nor_log_stats.segments;
+}
+/**
+ * @brief  Next segment in the ring
+ */
+static uint32_t Next(uint32_t segment) {
+	return (segment + 1) % nor_log_stats.segments;
+}
+/**
+ * @brief  Counts the entries of the newest segment and of the unbroken run
+ *         of full segments before it
+ * @return None
+ */
+static void CountEntries(void) {
+	if (sequences[head] == 0) {
+		nor_log_stats.entries = 0;
+		return;
+	}
+	uint32_t entries = head_entries;
+	uint32_t segment = head;
+	/* Sequence numbers start at 1: a log that has not wrapped yet ends at
+	 the segment with sequence 1, not at a blank one before it */
+	for (uint32_t i = 1; i < nor_log_stats.segments && i < sequences[head];
+			++i) {
+		segment = Previous(segment);
+		if (sequences[segment] != sequences[head] - i) {
+			break;
+		}
+		entries += NOR_LOG_ENTRIES_PER_SEGMENT;
+	}
+	nor_log_stats.entries = entries;
+}
+
+/**
+ * @brief  Builds the index of segment heads and finds the end of the log
+ * @param  size: device size in bytes
+ * @return None
+ */
+void NorLog_Init(const NorDevice *nor_device, uint32_t size) {
+	device = nor_device;
+	nor_log_stats = { };
+	queue_head = queue_tail = 0;
+	step = STEP_IDLE;
+	uint32_t start_us = device->now_us();
+	uint32_t segments = size / NOR_LOG_SEGMENT_SIZE;
+	nor_log_stats.segments =
+			segments < NOR_LOG_MAX_SEGMENTS ? segments : NOR_LOG_MAX_SEGMENTS;
+	if (nor_log_stats.segments < 2) {
+		nor_log_stats.segments = 0;
+		return;
+	}
+
+	/* Without any valid segment, the first append starts segment 0 */
+	head = nor_log_stats.segments - 1;
+	head_entries = NOR_LOG_ENTRIES_PER_SEGMENT;
+	for (uint32_t i = 0; i < nor_log_stats.segments; ++i) {
+		SegmentHeader header;
+		sequences[i] = ReadHeader(i, &header);
+		if (sequences[i] > nor_log_stats.sequence) {
+			nor_log_stats.sequence = sequences[i];
+			head = i;
+		}
+		if (sequences[i] != 0
+				&& header.erase_count > nor_log_stats.max_erase_count) {
+			nor_log_stats.max_erase_count = header.erase_count;
+		}
+	}
+	nor_log_stats.mount_reads = nor_log_stats.segments;
+
+	/* Entries are programmed in order, first word first */
+	if (nor_log_stats.sequence != 0) {
+		uint32_t low = 0;
+		uint32_t high = NOR_LOG_ENTRIES_PER_SEGMENT;
+		while (low < high) {
+			uint32_t middle = (low + high) / 2;
+			uint32_t word;
+			device->read(EntryAddress(head, middle), &word, sizeof(word));
+			++nor_log_stats.mount_reads;
+			if (word == ERASED) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+		head_entries = low;
+	}
+	CountEntries();
+	nor_log_stats.mount_us = device->now_us() - start_us;
+}
+/**
+ * @brief  Queues an entry. Constant time, NorLog_Poll() writes it.
+ * @param  entry: NOR_LOG_ENTRY_SIZE bytes
+ * @return false if the queue is full or there is no device
+ */
+bool NorLog_Append(const void *entry) {
+	if (nor_log_stats.segments == 0
+			|| queue_head - queue_tail >= NOR_LOG_QUEUE_SIZE) {
+		++nor_log_stats.dropped;
+		return false;
+	}
+	memcpy(queue[queue_head % NOR_LOG_QUEUE_SIZE], entry, NOR_LOG_ENTRY_SIZE);
+	++queue_head;
+	return true;
+}
+/**
+ * @brief  Finishes the device operation in flight, if it is done, and
+ *         starts the next one. Never waits for the device.
+ * @return None
+ */
+void NorLog_Poll(void) {
+	if (nor_log_stats.segments == 0
+			|| (step == STEP_IDLE && queue_tail == queue_head)) {
+		return;
+	}
+	/* Also when idle: the device may share its bus */
+	if (device->busy()) {
+		return;
+	}
+	if (step != STEP_IDLE) {
+		switch (step) {
+		case STEP_PROGRAM:
+			++queue_tail;
+			++head_entries;
+			++nor_log_stats.entries;
+			++nor_log_stats.appended;
+			break;
+		case STEP_ERASE:
+			device->program(Next(head) * NOR_LOG_SEGMENT_SIZE, &pending_header,
+					sizeof(pending_header));
+			step = STEP_HEADER;
+			return;
+		case STEP_HEADER:
+			head = Next(head);
+			head_entries = 0;
+			sequences[head] = pending_header.sequence;
+			nor_log_stats.sequence = pending_header.sequence;
+			if (pending_header.erase_count > nor_log_stats.max_erase_count) {
+				nor_log_stats.max_erase_count = pending_header.erase_count;
+			}
+			CountEntries();
+			break;
+		case STEP_IDLE:
+			break;
+		}
+		step = STEP_IDLE;
+	}
+	if (queue_tail == queue_head) {
+		return;
+	}
+
+	if (head_entries < NOR_LOG_ENTRIES_PER_SEGMENT) {
+		device->program(EntryAddress(head, head_entries),
+				queue[queue_tail % NOR_LOG_QUEUE_SIZE], NOR_LOG_ENTRY_SIZE);
+		step = STEP_PROGRAM;
+		return;
+	}
+	/* The newest segment is full: the oldest one becomes the newest */
+	uint32_t next = Next(head);
+	SegmentHeader old;
+	uint32_t erase_count = ReadHeader(next, &old) != 0 ? old.erase_count : 0;
+	sequences[next] = 0;
+	CountEntries();
+	pending_header.magic = MAGIC;
+	pending_header.sequence = nor_log_stats.sequence + 1;
+	pending_header.erase_count = erase_count + 1;
+	pending_header.check = ~(pending_header.magic ^ pending_header.sequence
+			^ pending_header.erase_count);
+	device->erase(next * NOR_LOG_SEGMENT_SIZE);
+	step = STEP_ERASE;
+	++nor_log_stats.erases;
+}
+/**
+ * @brief  Reads an entry back
+ * @param  age: 0 for the newest entry, 1 for the one before, ...
+ * @param  entry: NOR_LOG_ENTRY_SIZE bytes
+ * @return Whether it was read. The caller checks its contents, an entry cut
+ *         short by a power loss is read as it is.
+ */
+NorLogRead NorLog_ReadLatest(uint32_t age, void *entry) {
+	if (age >= nor_log_stats.entries) {
+		return NOR_LOG_MISSING;
+	}
+	if (device->busy()) {
+		return NOR_LOG_BUSY;
+	}
+	uint32_t segment = head;
+	uint32_t index;
+	if (age < head_entries) {
+		index = head_entries - 1 - age;
+	} else {
+		age -= head_entries;
+		uint32_t back = 1 + age / NOR_LOG_ENTRIES_PER_SEGMENT;
+		segment = (head + nor_log_stats.segments - back)
+				% nor_log_stats.segments;
+		index = NOR_LOG_ENTRIES_PER_SEGMENT - 1
+				- age % NOR_LOG_ENTRIES_PER_SEGMENT;
+	}
+	device->read(EntryAddress(segment, index), entry, NOR_LOG_ENTRY_SIZE);
+	return NOR_LOG_FOUND;
+}
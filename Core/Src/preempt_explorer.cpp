@@ -0,0 +1,165 @@
+/*
+ * @brief Preemption explorer for the FAULT_INJECTION build
+ * PendSV stands in for "some interrupt fires here": it is pended from a
+ * preemption point and taken before the next instruction of the main loop,
+ * so the injected body sees the shared state exactly as it was at that line.
+ */
+#include "main.h"
+#include "preempt_explorer.h"
+
+#ifdef FAULT_INJECTION
+
+constexpr uint8_t MAX_ISRS = 8;
+
+PreemptStats preempt_stats;
+
+static bool (*check_invariant)(void);
+static void (*isrs[MAX_ISRS])(void);
+static uint8_t isr_count;
+
+// Systematic schedule cursor: preempt at dynamic point target_occurrence with isrs[target_isr]
+static uint16_t target_occurrence;
+static uint8_t target_isr;
+static uint16_t max_occurrences; // Largest number of points seen in one run
+
+// State of the current run
+static uint16_t occurrence;
+static volatile uint16_t pending_line;
+static volatile uint8_t pending_isr;
+
+static uint32_t rng_state;
+static uint32_t last_rate_tick;
+static uint32_t last_rate_count;
+
+#ifdef PREEMPT_RANDOM
+/**
+ * @brief  xorshift32 step for the random exploration mode
+ * @return Next pseudo-random 32-bit value
+ */
+static uint32_t NextRandom() {
+	uint32_t x = rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	rng_state = x;
+	return x;
+}
+#endif
+/**
+ * @brief  Returns how many interrupt bodies take part in the exploration.
+ * With none registered only the invariant observer runs.
+ */
+static uint8_t IsrSlots() {
+	return isr_count > 0 ? isr_count : 1;
+}
+
+/**
+ * @brief  Starts exploring from the first schedule
+ * @param  invariant: returns true when the shared state is consistent
+ * @param  seed: seed of the random mode
+ * @return None
+ */
+void PreemptExplorer_Init(bool (*invariant)(void), uint32_t seed) {
+	check_invariant = invariant;
+	rng_state = seed != 0 ? seed : 1;
+	/* Lowest priority: PendSV must not preempt the real interrupts it models */
+	HAL_NVIC_SetPriority(PendSV_IRQn, 15, 0);
+}
+/**
+ * @brief  Adds an interrupt body that will be injected at preemption points
+ * @return None
+ */
+void PreemptExplorer_RegisterIsr(void (*isr)(void)) {
+	if (isr_count < MAX_ISRS) {
+		isrs[isr_count++] = isr;
+	}
+}
+/**
+ * @brief  Instrumented point in main-loop code. Use PREEMPTION_POINT().
+ * @param  line: source line, recorded for replay
+ * @return None
+ */
+void PreemptExplorer_Point(uint16_t line) {
+	bool fire;
+#ifdef PREEMPT_RANDOM
+	fire = NextRandom() % PREEMPT_RANDOM_PERIOD == 0;
+	if (fire) {
+		target_occurrence = occurrence;
+		target_isr = NextRandom() % IsrSlots();
+	}
+#else
+	fire = occurrence == target_occurrence;
+#endif
+	++occurrence;
+	if (fire) {
+		pending_line = line;
+		pending_isr = target_isr;
+		/* Taken right here, between this statement and the next one */
+		SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+		__DSB();
+		__ISB();
+	}
+}
+/**
+ * @brief  Marks the end of one run (one main loop iteration) and moves the
+ *         systematic cursor to the next untried schedule
+ * @return None
+ */
+void PreemptExplorer_EndRun(void) {
+	++preempt_stats.runs;
+	if (occurrence > max_occurrences) {
+		max_occurrences = occurrence;
+	}
+#ifndef PREEMPT_RANDOM
+	/* Only advance once the targeted point was actually reached */
+	if (occurrence > target_occurrence) {
+		if (++target_isr >= IsrSlots()) {
+			target_isr = 0;
+			if (++target_occurrence >= max_occurrences) {
+				target_occurrence = 0;
+				++preempt_stats.rounds;
+			}
+		}
+	} else if (target_occurrence >= max_occurrences) {
+		target_occurrence = 0;
+	}
+#endif
+	occurrence = 0;
+}
+/**
+ * @brief  PendSV body: runs the injected interrupt, then checks invariants
+ * @return None
+ */
+void PreemptExplorer_OnPendSV(void) {
+	uint8_t isr = pending_isr;
+	if (isr < isr_count) {
+		isrs[isr]();
+	}
+	++preempt_stats.preemptions;
+
+	if (check_invariant && !check_invariant()) {
+		if (preempt_stats.violations++ == 0) {
+			PreemptSchedule &s = preempt_stats.first_violation;
+			s.run = preempt_stats.runs;
+			s.occurrence = occurrence - 1;
+			s.line = pending_line;
+			s.isr = isr;
+			s.valid = 1;
+		}
+	}
+}
+/**
+ * @brief  SysTick hook: refreshes the interleavings-per-second figure
+ * @return None
+ */
+void PreemptExplorer_OnTick(void) {
+	uint32_t now = HAL_GetTick();
+	if (now - last_rate_tick >= 1000) {
+		preempt_stats.preemptions_per_s = preempt_stats.preemptions
+				- last_rate_count;
+		last_rate_count = preempt_stats.preemptions;
+		last_rate_tick = now;
+	}
+}
+
+#endif /* FAULT_INJECTION */
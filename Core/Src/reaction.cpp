@@ -0,0 +1,277 @@
+/*
+ * @brief Reaction timing
+ * TIM2 is driven by registers directly, the TIM HAL module is not part of
+ * the project. Presses travel from the EXTI interrupt to the main loop
+ * through a single-producer, single-consumer queue.
+ */
+#include "main.h"
+#include "preempt_explorer.h"
+#include "reaction.h"
+#include "record_auth.h"
+#include <string.h>
+
+constexpr uint8_t FIRST_OCTAVE = 17; // Bin 1 starts at 2^17 us (131 ms)
+constexpr uint8_t OCTAVES = 3;
+constexpr uint8_t BINS_PER_OCTAVE_LOG2 = 3;
+constexpr uint8_t LAST_BIN = REACTION_HISTOGRAM_BINS - 1;
+constexpr uint8_t PRESS_QUEUE_SIZE = 8; // Power of two
+
+static_assert(sizeof(ReactionHistogram) <= RECORD_AUTH_MAX_PAYLOAD,
+		"the histogram is stored as one signed record");
+static_assert(1 + (OCTAVES << BINS_PER_OCTAVE_LOG2) == LAST_BIN,
+		"bins between the underflow and overflow bins");
+
+struct PressEvent {
+	uint8_t button;
+	uint32_t time_us;
+};
+
+static volatile uint32_t armed; // Bit i set to queue presses of button i
+static PressEvent press_queue[PRESS_QUEUE_SIZE];
+static volatile uint32_t queue_head; // Written by the interrupt only
+static volatile uint32_t queue_tail; // Written by the main loop only
+static uint32_t last_edge_us[REACTION_MAX_BUTTONS];
+
+/**
+ * @brief  TIM2 prescaler giving 1 MHz at the current APB1 clock
+ */
+static uint32_t MicrosecondPrescaler(void) {
+	/* APB1 timers run at twice PCLK1 when the APB1 prescaler is not 1 */
+	uint32_t timer_clock = HAL_RCC_GetPCLK1Freq();
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+		timer_clock *= 2;
+	}
+	return timer_clock / 1000000U - 1;
+}
+/**
+ * @brief  Starts TIM2 as a free-running 1 MHz counter
+ * @return None
+ */
+void Reaction_Init(void) {
+	__HAL_RCC_TIM2_CLK_ENABLE();
+	TIM2->CR1 = 0;
+	TIM2->PSC = MicrosecondPrescaler();
+	TIM2->ARR = 0xFFFFFFFFU;
+	TIM2->EGR = TIM_EGR_UG; // Load the prescaler now
+	TIM2->CR1 = TIM_CR1_CEN;
+}
+/**
+ * @brief  Adapts the prescaler after a system clock change, keeping the
+ *         count (SystemCoreClock must be up to date)
+ * @return None
+ */
+void Reaction_UpdateClock(void) {
+	uint32_t prescaler = MicrosecondPrescaler();
+	if (TIM2->PSC != prescaler) {
+		uint32_t count = TIM2->CNT;
+		TIM2->PSC = prescaler;
+		TIM2->EGR = TIM_EGR_UG; // Clears the counter
+		TIM2->CNT = count;
+	}
+}
+/**
+ * @brief  Moves the counter forward, for time it failed to count
+ * @return None
+ */
+void Reaction_AdvanceUs(uint32_t us) {
+	TIM2->CNT += us;
+}
+/**
+ * @brief  Current time of the microsecond counter
+ */
+uint32_t Reaction_NowUs(void) {
+	return TIM2->CNT;
+}
+/**
+ * @brief  Drops queued presses and starts accepting new ones
+ * @param  buttons: bit i set to accept presses of button i
+ * @return None
+ */
+void Reaction_Arm(uint32_t buttons) {
+	armed = 0;
+	PREEMPTION_POINT();
+	queue_tail = queue_head;
+	PREEMPTION_POINT();
+	armed = buttons;
+}
+/**
+ * @brief  Stops accepting presses
+ * @return None
+ */
+void Reaction_Disarm(void) {
+	armed = 0;
+}
+/**
+ * @brief  Handles a button edge (EXTI context) and queues presses while armed.
+ * Contact bounce is filtered here: both edges restart the quiet period, and
+ * only a press edge after a quiet period counts, so every press is stamped
+ * once, at its first contact. A full queue drops the press.
+ * @param  pressed: button level right after the edge
+ * @param  now_us: counter value read first thing in the interrupt
+ * @return How the edge was classified
+ */
+ReactionEdge Reaction_OnEdge(uint8_t button, bool pressed, uint32_t now_us) {
+	if (button >= REACTION_MAX_BUTTONS) {
+		return REACTION_EDGE_BOUNCE;
+	}
+	bool quiet = now_us - last_edge_us[button] >= REACTION_DEBOUNCE_US;
+	last_edge_us[button] = now_us;
+	if (!quiet) {
+		return REACTION_EDGE_BOUNCE;
+	}
+	if (!pressed) {
+		return REACTION_EDGE_RELEASE;
+	}
+	uint32_t head = queue_head;
+	if ((armed & (1U << button)) && head - queue_tail < PRESS_QUEUE_SIZE) {
+		press_queue[head % PRESS_QUEUE_SIZE] = { button, now_us };
+		queue_head = head + 1;
+	}
+	return REACTION_EDGE_PRESS;
+}
+/**
+ * @brief  Time of the last edge of a button, bounces included. A button
+ *         quiet for REACTION_DEBOUNCE_US since then is at a stable level.
+ */
+uint32_t Reaction_LastEdgeUs(uint8_t button) {
+	return button < REACTION_MAX_BUTTONS ? last_edge_us[button] : 0;
+}
+/**
+ * @brief  Takes the oldest queued press, if any
+ * @return true if a press was returned
+ */
+bool Reaction_NextPress(uint8_t *button, uint32_t *press_us) {
+	uint32_t tail = queue_tail;
+	if (tail == queue_head) {
+		return false;
+	}
+	*button = press_queue[tail % PRESS_QUEUE_SIZE].button;
+	*press_us = press_queue[tail % PRESS_QUEUE_SIZE].time_us;
+	PREEMPTION_POINT();
+	queue_tail = tail + 1;
+	return true;
+}
+/**
+ * @brief  Checks the press queue shared with the EXTI interrupt: never
+ *         overfilled, and only valid buttons in it
+ * @return false if the queue indices or entries are torn
+ */
+bool Reaction_IsConsistent(void) {
+	uint32_t tail = queue_tail;
+	uint32_t queued = queue_head - tail;
+	if (queued > PRESS_QUEUE_SIZE) {
+		return false;
+	}
+	for (uint32_t i = 0; i < queued; ++i) {
+		if (press_queue[(tail + i) % PRESS_QUEUE_SIZE].button
+				>= REACTION_MAX_BUTTONS) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief  Histogram bin of a latency
+ */
+static uint8_t BinOf(uint32_t latency_us) {
+	uint32_t msb = 31 - __builtin_clz(latency_us | 1);
+	if (msb < FIRST_OCTAVE) {
+		return 0;
+	}
+	if (msb >= FIRST_OCTAVE + OCTAVES) {
+		return LAST_BIN;
+	}
+	uint32_t sub = (latency_us >> (msb - BINS_PER_OCTAVE_LOG2))
+			& ((1U << BINS_PER_OCTAVE_LOG2) - 1);
+	return 1 + ((msb - FIRST_OCTAVE) << BINS_PER_OCTAVE_LOG2) + sub;
+}
+/**
+ * @brief  Lower bound of a bin in microseconds
+ */
+static uint32_t BinStart(uint8_t bin) {
+	if (bin == 0) {
+		return REACTION_ANTICIPATION_US;
+	}
+	if (bin == LAST_BIN) {
+		return 1U << (FIRST_OCTAVE + OCTAVES);
+	}
+	uint32_t octave = FIRST_OCTAVE + ((bin - 1) >> BINS_PER_OCTAVE_LOG2);
+	uint32_t sub = (bin - 1) & ((1U << BINS_PER_OCTAVE_LOG2) - 1);
+	return ((1U << BINS_PER_OCTAVE_LOG2) + sub)
+			<< (octave - BINS_PER_OCTAVE_LOG2);
+}
+
+/**
+ * @brief  Loads the histogram of a profile, or an empty one if it was
+ *         never saved or its tag is not genuine
+ * @return None
+ */
+void ReactionHistogram_Load(ReactionHistogram *histogram, uint8_t profile) {
+	if (!RecordAuth_Read(STORE_KEY_REACTION + profile, histogram,
+			sizeof(*histogram))) {
+		memset(histogram, 0, sizeof(*histogram));
+		histogram->best_us = UINT32_MAX;
+	}
+}
+/**
+ * @brief  Saves the histogram of a profile to flash, signed
+ * @return true if the record was written
+ */
+bool ReactionHistogram_Save(const ReactionHistogram *histogram,
+		uint8_t profile) {
+	return RecordAuth_Write(STORE_KEY_REACTION + profile, histogram,
+			sizeof(*histogram));
+}
+/**
+ * @brief  Adds an accepted latency.
+ * When a bin would overflow all bins are halved, which keeps the shape of
+ * the distribution and slowly ages out old trials.
+ * @return None
+ */
+void ReactionHistogram_Add(ReactionHistogram *histogram, uint32_t latency_us) {
+	uint8_t bin = BinOf(latency_us);
+	if (histogram->counts[bin] == UINT16_MAX) {
+		for (uint16_t &count : histogram->counts) {
+			count /= 2;
+		}
+	}
+	++histogram->counts[bin];
+	++histogram->trials;
+	if (latency_us < histogram->best_us) {
+		histogram->best_us = latency_us;
+	}
+}
+/**
+ * @brief  Latency below which the given share of the trials lies
+ * @param  percentile: 0..100
+ * @return Latency in us, interpolated within its bin; 0 without trials
+ */
+uint32_t ReactionHistogram_PercentileUs(const ReactionHistogram *histogram,
+		uint8_t percentile) {
+	uint32_t total = 0;
+	for (uint16_t count : histogram->counts) {
+		total += count;
+	}
+	if (total == 0) {
+		return 0;
+	}
+	if (percentile > 100) {
+		percentile = 100;
+	}
+	uint32_t rank = total * percentile; // In hundredths of a trial
+	uint32_t below = 0;
+	for (uint8_t bin = 0; bin < REACTION_HISTOGRAM_BINS; ++bin) {
+		uint32_t count = histogram->counts[bin];
+		if (count > 0 && rank <= (below + count) * 100) {
+			uint32_t start = BinStart(bin);
+			uint32_t end =
+					bin == LAST_BIN ? REACTION_TIMEOUT_US : BinStart(bin + 1);
+			return start
+					+ static_cast<uint64_t>(end - start) * (rank - below * 100)
+							/ (count * 100);
+		}
+		below += count;
+	}
+	return REACTION_TIMEOUT_US;
+}
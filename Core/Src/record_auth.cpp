@@ -0,0 +1,188 @@
+/*
+ * @brief Record authentication
+ * The key pads are absorbed once at boot and the keyed context is copied for
+ * every tag, so a session record costs three compressions instead of five.
+ */
+#include "main.h"
+#include "flash_store.h"
+#include "record_auth.h"
+#include "sha256.h"
+#include <string.h>
+
+constexpr char KEY_LABEL[] = "SIMON-RECORD-KEY";
+constexpr uint8_t BENCHMARK_BLOCKS = 16;
+
+RecordAuthStats record_auth_stats;
+static HmacSha256 keyed; // Valid while record_auth_stats.provisioned is set
+
+/**
+ * @brief  Average cycles of one compression, from the DWT cycle counter
+ */
+static uint32_t MeasureCyclesPerBlock(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	uint32_t state[8] = { };
+	uint8_t block[SHA256_BLOCK_SIZE] = { };
+	uint32_t start = DWT->CYCCNT;
+	for (uint8_t i = 0; i < BENCHMARK_BLOCKS; ++i) {
+		Sha256_Compress(state, block);
+	}
+	return (DWT->CYCCNT - start) / BENCHMARK_BLOCKS;
+}
+/**
+ * @brief  Derives the unit key from the stored secret and keys the context
+ * @return true if a secret is provisioned
+ */
+static bool LoadKey(void) {
+	uint8_t secret[SHA256_DIGEST_SIZE];
+	if (!FlashStore_Read(STORE_KEY_SECRET, secret, sizeof(secret))) {
+		return false;
+	}
+	uint32_t uid[3] = { HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2() };
+	uint8_t unit_key[SHA256_DIGEST_SIZE];
+	HmacSha256 derive;
+	HmacSha256_Init(&derive, secret, sizeof(secret));
+	HmacSha256_Update(&derive, KEY_LABEL, sizeof(KEY_LABEL) - 1);
+	HmacSha256_Update(&derive, uid, sizeof(uid));
+	HmacSha256_Final(&derive, unit_key);
+	HmacSha256_Init(&keyed, unit_key, sizeof(unit_key));
+	memset(secret, 0, sizeof(secret));
+	memset(unit_key, 0, sizeof(unit_key));
+	return true;
+}
+
+/**
+ * @brief  Runs the known-answer tests and loads the unit key (after
+ *         FlashStore_Init())
+ * @return None
+ */
+void RecordAuth_Init(void) {
+	record_auth_stats.cycles_per_block = MeasureCyclesPerBlock();
+	record_auth_stats.self_test_passed = Sha256_SelfTest();
+	record_auth_stats.provisioned = false;
+	if (!record_auth_stats.self_test_passed) {
+		return;
+	}
+#ifdef RECORD_AUTH_SECRET
+	if (RecordAuth_Provision(RECORD_AUTH_SECRET,
+			sizeof(RECORD_AUTH_SECRET) - 1)) {
+		return;
+	}
+#endif
+	record_auth_stats.provisioned = LoadKey();
+}
+/**
+ * @brief  Stores the secret if the unit has none yet; the stored value is
+ *         its SHA-256, so any length works
+ * @return true if the secret was stored and the unit key is loaded
+ */
+bool RecordAuth_Provision(const void *secret, uint32_t length) {
+	uint8_t stored[SHA256_DIGEST_SIZE];
+	if (!record_auth_stats.self_test_passed
+			|| FlashStore_Read(STORE_KEY_SECRET, stored, sizeof(stored))) {
+		return false;
+	}
+	Sha256 sha;
+	Sha256_Init(&sha);
+	Sha256_Update(&sha, secret, length);
+	Sha256_Final(&sha, stored);
+	bool written = FlashStore_Write(STORE_KEY_SECRET, stored, sizeof(stored));
+	memset(stored, 0, sizeof(stored));
+	record_auth_stats.provisioned = written && LoadKey();
+	return record_auth_stats.provisioned;
+}
+/**
+ * @brief  Computes the tag of a record
+ * @param  tag: receives the tag, zeroed when the unit cannot sign
+ * @return true if the record was signed
+ */
+bool RecordAuth_Sign(const void *data, uint32_t length,
+		uint8_t tag[RECORD_AUTH_TAG_SIZE]) {
+	if (!record_auth_stats.provisioned) {
+		memset(tag, 0, RECORD_AUTH_TAG_SIZE);
+		return false;
+	}
+	HmacSha256 hmac = keyed;
+	uint8_t mac[SHA256_DIGEST_SIZE];
+	HmacSha256_Update(&hmac, data, length);
+	HmacSha256_Final(&hmac, mac);
+	memcpy(tag, mac, RECORD_AUTH_TAG_SIZE);
+	return true;
+}
+/**
+ * @brief  Compares two tags in constant time
+ */
+static bool TagsEqual(const uint8_t *a, const uint8_t *b) {
+	uint8_t difference = 0;
+	for (uint8_t i = 0; i < RECORD_AUTH_TAG_SIZE; ++i) {
+		difference |= a[i] ^ b[i];
+	}
+	return difference == 0;
+}
+/**
+ * @brief  Checks the tag of a record in constant time
+ * @return true if the tag is genuine
+ */
+bool RecordAuth_Verify(const void *data, uint32_t length,
+		const uint8_t tag[RECORD_AUTH_TAG_SIZE]) {
+	uint8_t expected[RECORD_AUTH_TAG_SIZE];
+	if (!RecordAuth_Sign(data, length, expected)) {
+		return false;
+	}
+	return TagsEqual(expected, tag);
+}
+/**
+ * @brief  Tag of a flash store record: its key, then its payload
+ * @param  tag: receives the tag, zeroed when the unit cannot sign
+ * @return true if the record was signed
+ */
+static bool SignStored(uint16_t key, const uint8_t *payload, uint16_t length,
+		uint8_t tag[RECORD_AUTH_TAG_SIZE]) {
+	if (!record_auth_stats.provisioned) {
+		memset(tag, 0, RECORD_AUTH_TAG_SIZE);
+		return false;
+	}
+	uint8_t key_bytes[2] = { static_cast<uint8_t>(key),
+			static_cast<uint8_t>(key >> 8) };
+	HmacSha256 hmac = keyed;
+	uint8_t mac[SHA256_DIGEST_SIZE];
+	HmacSha256_Update(&hmac, key_bytes, sizeof(key_bytes));
+	HmacSha256_Update(&hmac, payload, length);
+	HmacSha256_Final(&hmac, mac);
+	memcpy(tag, mac, RECORD_AUTH_TAG_SIZE);
+	return true;
+}
+/**
+ * @brief  Reads a signed flash store record (after RecordAuth_Init())
+ * @param  length: payload bytes, at most RECORD_AUTH_MAX_PAYLOAD
+ * @return true if the record exists and, on a unit that can sign, its tag
+ *         is genuine
+ */
+bool RecordAuth_Read(uint16_t key, void *data, uint16_t length) {
+	uint8_t record[FLASH_STORE_MAX_PAYLOAD];
+	uint8_t expected[RECORD_AUTH_TAG_SIZE];
+	if (length > RECORD_AUTH_MAX_PAYLOAD
+			|| !FlashStore_Read(key, record, length + RECORD_AUTH_TAG_SIZE)) {
+		return false;
+	}
+	if (SignStored(key, record, length, expected)
+			&& !TagsEqual(expected, record + length)) {
+		return false;
+	}
+	memcpy(data, record, length);
+	return true;
+}
+/**
+ * @brief  Signs a record and appends it to the flash store
+ * @param  length: payload bytes, at most RECORD_AUTH_MAX_PAYLOAD
+ * @return true if the record was stored, signed or not
+ */
+bool RecordAuth_Write(uint16_t key, const void *data, uint16_t length) {
+	uint8_t record[FLASH_STORE_MAX_PAYLOAD];
+	if (length > RECORD_AUTH_MAX_PAYLOAD) {
+		return false;
+	}
+	memcpy(record, data, length);
+	SignStored(key, record, length, record + length);
+	return FlashStore_Write(key, record, length + RECORD_AUTH_TAG_SIZE);
+}
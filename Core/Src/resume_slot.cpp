@@ -0,0 +1,93 @@
+/*
+ * @brief Resume slot
+ * A copy of the newest snapshot of each station stays in RAM, so a game
+ * that ends can queue its cleared snapshot without reading flash. A record
+ * cut short by a power loss fails the flash store's CRC, and the snapshot
+ * before it is resumed instead.
+ */
+#include "flash_store.h"
+#include "resume_slot.h"
+#include "session_log.h"
+#include "skill.h"
+
+static_assert(sizeof(ResumeRecord) == 20, "five flash words per record");
+
+ResumeSlotStats resume_slot_stats;
+
+static ResumeRecord latest[SESSION_STATIONS]; // Newest record of each station
+static bool live[SESSION_STATIONS];           // latest is a game in progress
+
+/**
+ * @brief  Queues a record in the flash store
+ * @return None
+ */
+static void Enqueue(const ResumeRecord *record) {
+	if (FlashStore_Queue(STORE_KEY_RESUME + record->station, record,
+			sizeof(*record))) {
+		++resume_slot_stats.saves;
+	} else {
+		++resume_slot_stats.dropped;
+	}
+}
+
+/**
+ * @brief  Reads the newest snapshot of each station (after FlashStore_Init())
+ * @return None
+ */
+void ResumeSlot_Init(void) {
+	for (uint8_t i = 0; i < SESSION_STATIONS; ++i) {
+		live[i] = FlashStore_Read(STORE_KEY_RESUME + i, &latest[i],
+				sizeof(latest[i])) && latest[i].station == i
+				&& latest[i].game.state != IDLE;
+	}
+}
+/**
+ * @brief  Returns the game a station was playing when the power went. A
+ *         snapshot that does not hold a valid game is cleared.
+ * @return false if there is nothing to resume
+ */
+bool ResumeSlot_Load(uint8_t station, ResumeRecord *record) {
+	if (station >= SESSION_STATIONS || !live[station]) {
+		return false;
+	}
+	const ResumeRecord *saved = &latest[station];
+	if (saved->game.state != SIMON_SAYS || !GameCore_IsValid(&saved->game)
+			|| saved->profile >= SKILL_PROFILE_COUNT) {
+		ResumeSlot_Clear(station);
+		return false;
+	}
+	*record = *saved;
+	return true;
+}
+/**
+ * @brief  Queues a snapshot of a game at the start of a level. Constant
+ *         time, the flash is programmed by FlashStore_Poll().
+ * @param  speed_ms: show tempo of the game
+ * @return None
+ */
+void ResumeSlot_Save(uint8_t station, uint8_t profile, uint32_t seed,
+		const GameCore *game, uint32_t speed_ms) {
+	if (station >= SESSION_STATIONS) {
+		return;
+	}
+	ResumeRecord *record = &latest[station];
+	record->speed_ms = speed_ms;
+	record->station = station;
+	record->profile = profile;
+	record->seed = seed;
+	record->game = *game;
+	live[station] = game->state != IDLE;
+	Enqueue(record);
+}
+/**
+ * @brief  Marks the station's game as over, if a snapshot of it was saved
+ * @return None
+ */
+void ResumeSlot_Clear(uint8_t station) {
+	if (station >= SESSION_STATIONS || !live[station]) {
+		return;
+	}
+	live[station] = false;
+	latest[station].game.state = IDLE;
+	Enqueue(&latest[station]);
+}
@@ -0,0 +1,166 @@
+/*
+ * @brief Rhythm game rules
+ * Every time is turned into a signed offset from beat 0 first, so the 32-bit
+ * clock may wrap anywhere inside a round.
+ */
+#include "rhythm_core.h"
+#include <string.h>
+
+constexpr uint64_t ALL_BEATS = (1ULL << RHYTHM_BEATS) - 1;
+
+/**
+ * @brief  Signed time of a moment relative to beat 0
+ */
+static int32_t SinceStart(const RhythmGame *game, uint32_t time_us) {
+	return static_cast<int32_t>(time_us - game->start_us);
+}
+/**
+ * @brief  Grade of a timing error
+ */
+static RhythmGrade GradeOf(int32_t error_us) {
+	uint32_t magnitude = error_us < 0 ? -error_us : error_us;
+	if (magnitude <= RHYTHM_PERFECT_US) {
+		return RHYTHM_PERFECT;
+	}
+	if (magnitude <= RHYTHM_GOOD_US) {
+		return RHYTHM_GOOD;
+	}
+	return magnitude <= RHYTHM_OK_US ? RHYTHM_OK : RHYTHM_MISS;
+}
+
+/**
+ * @brief  Starts a round
+ * @param  seed: any value, the same seed always gives the same pattern
+ * @param  start_us: time of beat 0, should leave room for its cue
+ * @param  period_us: beat length (500000 for 120 BPM)
+ * @param  offset_us: calibration to use until the count-in provides one
+ * @return None
+ */
+void RhythmCore_Start(RhythmGame *game, uint32_t seed, uint32_t start_us,
+		uint32_t period_us, int32_t offset_us) {
+	memset(game, 0, sizeof(*game));
+	game->start_us = start_us;
+	game->period_us = period_us > 1 ? period_us : 2;
+	game->offset_us = offset_us;
+
+	/* The pattern comes from the Simon sequence generator, GAME_MAX_LEVEL
+	 steps per seed */
+	for (uint8_t i = 0; i < RHYTHM_COUNT_IN_BEATS; ++i) {
+		game->pattern[i] = RHYTHM_ANY_BUTTON;
+	}
+	for (uint8_t i = RHYTHM_COUNT_IN_BEATS; i < RHYTHM_BEATS; i +=
+			GAME_MAX_LEVEL) {
+		uint8_t steps[GAME_MAX_LEVEL];
+		GameCore_PreviewSequence(seed + i, steps, GAME_MAX_LEVEL);
+		for (uint8_t j = 0; j < GAME_MAX_LEVEL && i + j < RHYTHM_BEATS; ++j) {
+			game->pattern[i + j] = steps[j];
+		}
+	}
+}
+/**
+ * @brief  Scores one press against the nearest beat
+ * @param  press_us: hardware timestamp of the press
+ * @param  error_us: receives the calibrated signed error, may be nullptr
+ * @return Grade of the press
+ */
+RhythmGrade RhythmCore_Press(RhythmGame *game, uint8_t button,
+		uint32_t press_us, int32_t *error_us) {
+	int32_t period = static_cast<int32_t>(game->period_us);
+	int32_t relative = SinceStart(game, press_us) - game->offset_us;
+	if (relative < -period / 2) {
+		++game->stray;
+		return RHYTHM_MISS;
+	}
+	uint32_t beat = (relative + period / 2) / period;
+	if (beat >= RHYTHM_BEATS || (game->judged & (1ULL << beat))) {
+		++game->stray;
+		return RHYTHM_MISS;
+	}
+	int32_t error = relative - static_cast<int32_t>(beat) * period;
+	if (error_us != nullptr) {
+		*error_us = error;
+	}
+	game->judged |= 1ULL << beat;
+
+	if (beat < RHYTHM_COUNT_IN_BEATS) {
+		/* The running mean of the raw errors replaces the calibration once
+		 half of the count-in has been hit */
+		game->calibration_sum_us += error + game->offset_us;
+		++game->calibration_hits;
+		if (game->calibration_hits >= RHYTHM_COUNT_IN_BEATS / 2) {
+			game->offset_us = game->calibration_sum_us
+					/ game->calibration_hits;
+		}
+		return RHYTHM_COUNT_IN;
+	}
+
+	RhythmGrade grade =
+			button == game->pattern[beat] ? GradeOf(error) : RHYTHM_MISS;
+	++game->grades[grade];
+	if (grade != RHYTHM_MISS) {
+		game->error_sum_us += error;
+		game->abs_error_sum_us += error < 0 ? -error : error;
+		game->score += grade;
+	}
+	return grade;
+}
+/**
+ * @brief  Counts beats whose press window has closed without a press
+ * @return None
+ */
+void RhythmCore_Update(RhythmGame *game, uint32_t now_us) {
+	int32_t period = static_cast<int32_t>(game->period_us);
+	int32_t relative = SinceStart(game, now_us) - game->offset_us;
+	for (uint32_t beat = 0; beat < RHYTHM_BEATS; ++beat) {
+		if (relative < static_cast<int32_t>(beat) * period + period / 2) {
+			break;
+		}
+		if (!(game->judged & (1ULL << beat))) {
+			game->judged |= 1ULL << beat;
+			if (beat >= RHYTHM_COUNT_IN_BEATS) {
+				++game->grades[RHYTHM_MISS];
+			}
+		}
+	}
+}
+/**
+ * @brief  LEDs to light now: the cue of the next beat, shown during the
+ *         half beat before it (all LEDs during the count-in)
+ * @return Bit i set to light LED i
+ */
+uint8_t RhythmCore_CueMask(const RhythmGame *game, uint32_t now_us) {
+	int32_t period = static_cast<int32_t>(game->period_us);
+	int32_t relative = SinceStart(game, now_us) + period / 2;
+	if (relative < 0) {
+		return 0;
+	}
+	uint32_t beat = relative / period;
+	if (beat >= RHYTHM_BEATS || relative % period >= period / 2) {
+		return 0;
+	}
+	uint8_t button = game->pattern[beat];
+	return button == RHYTHM_ANY_BUTTON ?
+			(1U << GAME_LED_COUNT) - 1 : 1U << button;
+}
+/**
+ * @brief  Checks whether every beat has been hit or missed
+ */
+bool RhythmCore_IsOver(const RhythmGame *game) {
+	return game->judged == ALL_BEATS;
+}
+/**
+ * @brief  Mean signed error of the scored hits (positive = late)
+ */
+int32_t RhythmCore_MeanErrorUs(const RhythmGame *game) {
+	uint32_t hits = game->grades[RHYTHM_OK] + game->grades[RHYTHM_GOOD]
+			+ game->grades[RHYTHM_PERFECT];
+	return hits > 0 ? game->error_sum_us / static_cast<int32_t>(hits) : 0;
+}
+/**
+ * @brief  Mean absolute error of the scored hits
+ */
+uint32_t RhythmCore_MeanAbsErrorUs(const RhythmGame *game) {
+	uint32_t hits = game->grades[RHYTHM_OK] + game->grades[RHYTHM_GOOD]
+			+ game->grades[RHYTHM_PERFECT];
+	return hits > 0 ? game->abs_error_sum_us / hits : 0;
+}
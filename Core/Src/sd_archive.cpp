@@ -0,0 +1,411 @@
+/*
+ * @brief SD card archive
+ * At most one write is in flight, from the buffer that is not taking
+ * entries, and it stays in place until SdArchive_Poll() sees it finished.
+ * While mounting, the buffers double as block scratch space.
+ */
+#include "sd_archive.h"
+#include <string.h>
+
+constexpr uint16_t MAGIC = 0x4153; // "SA"
+constexpr uint32_t FAT_ENTRIES_PER_BLOCK = SD_ARCHIVE_BLOCK_SIZE / 4;
+constexpr uint32_t FAT_MASK = 0x0FFFFFFFU;
+constexpr uint32_t DIRECTORY_ENTRY_SIZE = 32;
+constexpr uint8_t DIRECTORY_END = 0x00;
+constexpr uint8_t DIRECTORY_DELETED = 0xE5;
+constexpr uint8_t ATTRIBUTE_LONG_NAME = 0x0F;
+constexpr uint8_t ATTRIBUTE_DIRECTORY_OR_VOLUME = 0x18;
+constexpr uint8_t PARTITION_FAT32_CHS = 0x0B;
+constexpr uint8_t PARTITION_FAT32_LBA = 0x0C;
+constexpr uint32_t MBR_PARTITION = 446;
+
+/* One block of the file */
+struct ArchiveBlock {
+	uint32_t sequence; // 0 while never written
+	uint16_t entries;
+	uint16_t magic;
+	uint8_t entry[SD_ARCHIVE_ENTRIES_PER_BLOCK][SD_ARCHIVE_ENTRY_SIZE];
+};
+static_assert(sizeof(ArchiveBlock) == SD_ARCHIVE_BLOCK_SIZE,
+		"the header and entries fill a block");
+
+/* Where a FAT32 volume keeps things, in blocks */
+struct Volume {
+	uint32_t fat;
+	uint32_t data;           // Cluster 2
+	uint32_t cluster_blocks;
+	uint32_t clusters;
+	uint32_t root;           // First cluster of the root directory
+};
+
+SdArchiveStats sd_archive_stats;
+
+static const SdBlockDevice *device;
+static ArchiveBlock buffers[2][SD_ARCHIVE_BUFFER_BLOCKS];
+static uint32_t fill;           // Buffer taking entries
+static uint32_t fill_sequence;  // Of its first block
+static uint32_t fill_capacity;  // Blocks it may use before the end of the file
+static uint32_t fill_entries;
+static bool fill_dirty;         // Holds entries that are not on the card
+static bool writing;            // The other buffer is being written
+static uint32_t write_sequence;
+static uint32_t write_blocks;
+static uint32_t write_start_us;
+static uint32_t fat_block;      // Cached in buffers[1] while mounting
+
+static inline uint16_t Le16(const uint8_t *bytes) {
+	return bytes[0] | bytes[1] << 8;
+}
+static inline uint32_t Le32(const uint8_t *bytes) {
+	return Le16(bytes) | static_cast<uint32_t>(Le16(bytes + 2)) << 16;
+}
+/**
+ * @brief  Reads a block for mounting
+ * @return false if the card did not answer
+ */
+static bool Read(uint32_t block, void *data) {
+	++sd_archive_stats.mount_reads;
+	return device->read(block, data);
+}
+/**
+ * @brief  Checks for a FAT32 boot sector with 512-byte sectors
+ */
+static bool IsFat32(const uint8_t *block) {
+	return (block[0] == 0xEB || block[0] == 0xE9)
+			&& Le16(block + 510) == 0xAA55
+			&& Le16(block + 11) == SD_ARCHIVE_BLOCK_SIZE
+			&& block[13] != 0 && (block[13] & (block[13] - 1)) == 0
+			&& block[16] != 0
+			&& Le16(block + 17) == 0  // No fixed root directory
+			&& Le16(block + 22) == 0  // No 16-bit FAT size
+			&& Le32(block + 36) != 0;
+}
+/**
+ * @brief  First block of a cluster
+ */
+static uint32_t ClusterBlock(const Volume &volume, uint32_t cluster) {
+	return volume.data + (cluster - 2) * volume.cluster_blocks;
+}
+/**
+ * @brief  Looks up the FAT entry of a cluster
+ * @return false if the card did not answer
+ */
+static bool NextCluster(const Volume &volume, uint32_t cluster,
+		uint32_t *next) {
+	uint8_t *fat = reinterpret_cast<uint8_t*>(buffers[1]);
+	uint32_t block = volume.fat + cluster / FAT_ENTRIES_PER_BLOCK;
+	if (block != fat_block) {
+		if (!Read(block, fat)) {
+			return false;
+		}
+		fat_block = block;
+	}
+	*next = Le32(fat + cluster % FAT_ENTRIES_PER_BLOCK * 4) & FAT_MASK;
+	return true;
+}
+/**
+ * @brief  Finds the FAT32 volume, on a superfloppy or in the first partition
+ * @return SD_ARCHIVE_READY once volume is filled in
+ */
+static SdArchiveState MountVolume(Volume *volume) {
+	uint8_t *block = reinterpret_cast<uint8_t*>(buffers[0]);
+	if (!Read(0, block)) {
+		return SD_ARCHIVE_NO_CARD;
+	}
+	uint32_t start = 0;
+	if (!IsFat32(block)) {
+		const uint8_t *partition = block + MBR_PARTITION;
+		if (Le16(block + 510) != 0xAA55
+				|| (partition[4] != PARTITION_FAT32_CHS
+						&& partition[4] != PARTITION_FAT32_LBA)) {
+			return SD_ARCHIVE_NO_FAT32;
+		}
+		start = Le32(partition + 8);
+		if (!Read(start, block)) {
+			return SD_ARCHIVE_NO_CARD;
+		}
+		if (!IsFat32(block)) {
+			return SD_ARCHIVE_NO_FAT32;
+		}
+	}
+	volume->cluster_blocks = block[13];
+	volume->fat = start + Le16(block + 14);
+	volume->data = volume->fat + block[16] * Le32(block + 36);
+	uint32_t total = Le16(block + 19) != 0 ? Le16(block + 19) : Le32(block + 32);
+	if (start + total <= volume->data) {
+		return SD_ARCHIVE_NO_FAT32;
+	}
+	volume->clusters = (start + total - volume->data) / volume->cluster_blocks;
+	volume->root = Le32(block + 44);
+	return SD_ARCHIVE_READY;
+}
+/**
+ * @brief  Looks for SD_ARCHIVE_FILE_NAME in the root directory
+ * @return SD_ARCHIVE_READY once cluster and size are filled in
+ */
+static SdArchiveState FindFile(const Volume &volume, uint32_t *cluster,
+		uint32_t *size) {
+	uint8_t *block = reinterpret_cast<uint8_t*>(buffers[0]);
+	uint32_t directory = volume.root;
+	/* A broken chain could loop: no directory has more clusters than this */
+	for (uint32_t hops = 0; hops < volume.clusters; ++hops) {
+		if (directory < 2 || directory - 2 >= volume.clusters) {
+			return SD_ARCHIVE_NO_FILE;
+		}
+		for (uint32_t i = 0; i < volume.cluster_blocks; ++i) {
+			if (!Read(ClusterBlock(volume, directory) + i, block)) {
+				return SD_ARCHIVE_NO_CARD;
+			}
+			for (uint32_t offset = 0; offset < SD_ARCHIVE_BLOCK_SIZE;
+					offset += DIRECTORY_ENTRY_SIZE) {
+				const uint8_t *entry = block + offset;
+				if (entry[0] == DIRECTORY_END) {
+					return SD_ARCHIVE_NO_FILE;
+				}
+				if (entry[0] == DIRECTORY_DELETED
+						|| entry[11] == ATTRIBUTE_LONG_NAME
+						|| (entry[11] & ATTRIBUTE_DIRECTORY_OR_VOLUME)
+						|| memcmp(entry, SD_ARCHIVE_FILE_NAME, 11) != 0) {
+					continue;
+				}
+				*cluster = static_cast<uint32_t>(Le16(entry + 20)) << 16
+						| Le16(entry + 26);
+				*size = Le32(entry + 28);
+				return SD_ARCHIVE_READY;
+			}
+		}
+		if (!NextCluster(volume, directory, &directory)) {
+			return SD_ARCHIVE_NO_CARD;
+		}
+	}
+	return SD_ARCHIVE_NO_FILE;
+}
+/**
+ * @brief  Checks that each cluster of the file is followed by the next one
+ * @return SD_ARCHIVE_READY if the file is in one piece
+ */
+static SdArchiveState CheckContiguous(const Volume &volume, uint32_t first,
+		uint32_t clusters) {
+	if (first < 2 || first - 2 + clusters > volume.clusters) {
+		return SD_ARCHIVE_FRAGMENTED;
+	}
+	for (uint32_t i = 0; i + 1 < clusters; ++i) {
+		uint32_t next;
+		if (!NextCluster(volume, first + i, &next)) {
+			return SD_ARCHIVE_NO_CARD;
+		}
+		if (next != first + i + 1) {
+			return SD_ARCHIVE_FRAGMENTED;
+		}
+	}
+	return SD_ARCHIVE_READY;
+}
+/**
+ * @brief  Block of the file that holds a sequence number
+ */
+static uint32_t Position(uint32_t sequence) {
+	return (sequence - 1) % sd_archive_stats.blocks;
+}
+/**
+ * @brief  Reads a block of the file and checks its header
+ * @param  valid: whether the block holds entries and sits where its
+ *         sequence number belongs
+ * @return false if the card did not answer
+ */
+static bool ReadArchiveBlock(uint32_t position, ArchiveBlock *block,
+		bool *valid) {
+	if (!Read(sd_archive_stats.first_block + position, block)) {
+		return false;
+	}
+	*valid = block->magic == MAGIC && block->sequence != 0
+			&& block->entries != 0
+			&& block->entries <= SD_ARCHIVE_ENTRIES_PER_BLOCK
+			&& Position(block->sequence) == position;
+	return true;
+}
+/**
+ * @brief  Limits the fill buffer to the blocks before the end of the file,
+ *         so a write never wraps
+ * @return None
+ */
+static void SetCapacity(void) {
+	uint32_t left = sd_archive_stats.blocks - Position(fill_sequence);
+	fill_capacity =
+			left < SD_ARCHIVE_BUFFER_BLOCKS ? left : SD_ARCHIVE_BUFFER_BLOCKS;
+}
+/**
+ * @brief  Finds the newest block by binary search: from block 0 on, the
+ *         sequence numbers of the last lap run up by one
+ * @return false if the card did not answer
+ */
+static bool FindEnd(void) {
+	ArchiveBlock *block = &buffers[0][0];
+	bool valid;
+	fill = 0;
+	fill_entries = 0;
+	if (!ReadArchiveBlock(0, block, &valid)) {
+		return false;
+	}
+	if (!valid) {
+		fill_sequence = 1; // Fresh file
+		return true;
+	}
+	uint32_t first = block->sequence;
+	uint32_t low = 1;
+	uint32_t high = sd_archive_stats.blocks;
+	while (low < high) {
+		uint32_t middle = (low + high) / 2;
+		if (!ReadArchiveBlock(middle, block, &valid)) {
+			return false;
+		}
+		if (valid && block->sequence == first + middle) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (!ReadArchiveBlock(low - 1, block, &valid)) {
+		return false;
+	}
+	sd_archive_stats.sequence = block->sequence;
+	if (block->entries < SD_ARCHIVE_ENTRIES_PER_BLOCK) {
+		/* Carried over: the next entries complete it */
+		fill_sequence = block->sequence;
+		fill_entries = block->entries;
+	} else {
+		fill_sequence = block->sequence + 1;
+	}
+	return true;
+}
+/**
+ * @brief  Starts writing the buffer that is not taking entries
+ * @return None
+ */
+static void StartWrite(void) {
+	write_start_us = device->now_us();
+	device->write(sd_archive_stats.first_block + Position(write_sequence),
+			buffers[fill ^ 1], write_blocks);
+	writing = true;
+	++sd_archive_stats.writes;
+}
+
+/**
+ * @brief  Finds the archive file and where the last run stopped
+ * @return None
+ */
+void SdArchive_Init(const SdBlockDevice *sd_device) {
+	device = sd_device;
+	sd_archive_stats = { };
+	fill_dirty = false;
+	writing = false;
+	fat_block = UINT32_MAX;
+	uint32_t start_us = device->now_us();
+
+	Volume volume = { };
+	uint32_t cluster = 0;
+	uint32_t size = 0;
+	SdArchiveState state = MountVolume(&volume);
+	if (state == SD_ARCHIVE_READY) {
+		state = FindFile(volume, &cluster, &size);
+	}
+	uint32_t cluster_bytes = volume.cluster_blocks * SD_ARCHIVE_BLOCK_SIZE;
+	if (state == SD_ARCHIVE_READY && size < SD_ARCHIVE_BLOCK_SIZE) {
+		state = SD_ARCHIVE_NO_FILE;
+	}
+	if (state == SD_ARCHIVE_READY) {
+		state = CheckContiguous(volume, cluster,
+				(size + cluster_bytes - 1) / cluster_bytes);
+	}
+	if (state == SD_ARCHIVE_READY) {
+		sd_archive_stats.first_block = ClusterBlock(volume, cluster);
+		sd_archive_stats.blocks = size / SD_ARCHIVE_BLOCK_SIZE;
+		if (!FindEnd()) {
+			state = SD_ARCHIVE_NO_CARD;
+		}
+	}
+	sd_archive_stats.state = state;
+	if (state != SD_ARCHIVE_READY) {
+		sd_archive_stats.blocks = 0;
+	} else {
+		SetCapacity();
+	}
+	sd_archive_stats.mount_us = device->now_us() - start_us;
+}
+/**
+ * @brief  Copies an entry into the fill buffer. Constant time,
+ *         SdArchive_Poll() writes it.
+ * @param  entry: SD_ARCHIVE_ENTRY_SIZE bytes
+ * @return false if the fill buffer is full or there is no archive
+ */
+bool SdArchive_Append(const void *entry) {
+	if (sd_archive_stats.blocks == 0
+			|| fill_entries == fill_capacity * SD_ARCHIVE_ENTRIES_PER_BLOCK) {
+		++sd_archive_stats.dropped;
+		return false;
+	}
+	ArchiveBlock *block =
+			&buffers[fill][fill_entries / SD_ARCHIVE_ENTRIES_PER_BLOCK];
+	uint32_t slot = fill_entries % SD_ARCHIVE_ENTRIES_PER_BLOCK;
+	if (slot == 0) {
+		memset(block, 0, sizeof(*block));
+		block->sequence =
+				fill_sequence + fill_entries / SD_ARCHIVE_ENTRIES_PER_BLOCK;
+		block->magic = MAGIC;
+	}
+	memcpy(block->entry[slot], entry, SD_ARCHIVE_ENTRY_SIZE);
+	block->entries = slot + 1;
+	++fill_entries;
+	fill_dirty = true;
+	++sd_archive_stats.appended;
+	return true;
+}
+/**
+ * @brief  Finishes the write in flight, if it is done, and hands the fill
+ *         buffer to the card when it holds new entries. Never waits for
+ *         the card.
+ * @return None
+ */
+void SdArchive_Poll(void) {
+	if (sd_archive_stats.blocks == 0 || (!writing && !fill_dirty)) {
+		return;
+	}
+	SdDeviceStatus status = device->status();
+	if (status == SD_DEVICE_BUSY) {
+		return;
+	}
+	if (writing) {
+		if (status == SD_DEVICE_FAILED) {
+			++sd_archive_stats.write_errors;
+			StartWrite();
+			return;
+		}
+		writing = false;
+		uint32_t write_us = device->now_us() - write_start_us;
+		if (write_us > sd_archive_stats.max_write_us) {
+			sd_archive_stats.max_write_us = write_us;
+		}
+		sd_archive_stats.blocks_written += write_blocks;
+		sd_archive_stats.sequence = write_sequence + write_blocks - 1;
+		if (!fill_dirty) {
+			return;
+		}
+	}
+
+	/* Swap the buffers; a partly filled last block goes on taking entries */
+	uint32_t blocks = (fill_entries + SD_ARCHIVE_ENTRIES_PER_BLOCK - 1)
+			/ SD_ARCHIVE_ENTRIES_PER_BLOCK;
+	uint32_t carried = fill_entries % SD_ARCHIVE_ENTRIES_PER_BLOCK;
+	write_sequence = fill_sequence;
+	write_blocks = blocks;
+	fill ^= 1;
+	if (carried != 0) {
+		buffers[fill][0] = buffers[fill ^ 1][blocks - 1];
+		fill_sequence += blocks - 1;
+	} else {
+		fill_sequence += blocks;
+	}
+	fill_entries = carried;
+	fill_dirty = false;
+	SetCapacity();
+	StartWrite();
+}
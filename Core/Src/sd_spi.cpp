@@ -0,0 +1,332 @@
+/*
+ * @brief SD card driver, SPI mode
+ * Only the main loop calls in here. A multi-block write is a small step
+ * machine, advanced by SdSpi_Status(), that never waits for the card.
+ */
+#include "main.h"
+#include "reaction.h"
+#include "sd_spi.h"
+#include "spi_bus.h"
+
+constexpr uint8_t COMMAND_GO_IDLE = 0;
+constexpr uint8_t COMMAND_SEND_IF_COND = 8;
+constexpr uint8_t COMMAND_SET_BLOCKLEN = 16;
+constexpr uint8_t COMMAND_READ_SINGLE = 17;
+constexpr uint8_t COMMAND_WRITE_MULTIPLE = 25;
+constexpr uint8_t COMMAND_APP = 55;
+constexpr uint8_t COMMAND_READ_OCR = 58;
+constexpr uint8_t APP_SEND_OP_COND = 41;
+constexpr uint8_t CRC_GO_IDLE = 0x95;   // Only checked before SPI mode is on
+constexpr uint8_t CRC_SEND_IF_COND = 0x87;
+constexpr uint32_t IF_COND_3V3 = 0x1AA; // 2.7-3.6 V, check pattern 0xAA
+constexpr uint32_t HOST_CAPACITY = 1U << 30;
+constexpr uint32_t OCR_CCS = 1U << 30;
+constexpr uint8_t R1_IDLE = 0x01;
+constexpr uint8_t TOKEN_START_BLOCK = 0xFE;
+constexpr uint8_t TOKEN_START_MULTIPLE = 0xFC;
+constexpr uint8_t TOKEN_STOP = 0xFD;
+constexpr uint8_t DATA_RESPONSE_MASK = 0x1F;
+constexpr uint8_t DATA_ACCEPTED = 0x05;
+constexpr uint32_t IDENTIFY_TIMEOUT_MS = 1000;
+constexpr uint32_t TOKEN_TIMEOUT_MS = 100;
+constexpr uint32_t READY_TIMEOUT_MS = 500;
+
+/* Where a multi-block write stands */
+enum WriteStep {
+	WRITE_IDLE,
+	WRITE_SENDING,     // Block data going out by DMA
+	WRITE_PROGRAMMING, // The card is busy with a block
+	WRITE_STOPPING     // The card is busy after the stop token
+};
+
+SdSpiStats sd_spi_stats;
+const SdBlockDevice sd_spi_device = { SdSpi_Read, SdSpi_Write, SdSpi_Status,
+		Reaction_NowUs };
+
+static WriteStep step;
+static const uint8_t *write_data;
+static uint32_t write_left;  // Blocks, including the one going out
+static bool write_failed;
+
+static inline uint8_t Transfer(uint8_t byte) {
+	return SpiBus_Transfer(byte);
+}
+static inline void Select(void) {
+	SpiBus_Select(SPI_BUS_SD);
+}
+/**
+ * @brief  Deselects the card; it lets go of MISO on the next clock
+ * @return None
+ */
+static void Deselect(void) {
+	SpiBus_Deselect(SPI_BUS_SD);
+	Transfer(0xFF);
+}
+/**
+ * @brief  Waits while the card holds MISO low
+ * @return false on timeout
+ */
+static bool WaitReady(uint32_t timeout_ms) {
+	uint32_t start = HAL_GetTick();
+	while (Transfer(0xFF) != 0xFF) {
+		if (HAL_GetTick() - start > timeout_ms) {
+			return false;
+		}
+	}
+	return true;
+}
+/**
+ * @brief  Receives a 32-bit response, most significant byte first
+ */
+static uint32_t ReceiveWord(void) {
+	uint32_t word = 0;
+	for (uint8_t i = 0; i < 4; ++i) {
+		word = word << 8 | Transfer(0xFF);
+	}
+	return word;
+}
+/**
+ * @brief  Selects the card and sends a command; the caller deselects it
+ *         after the rest of the response
+ * @return R1, 0xFF if the card did not answer
+ */
+static uint8_t Command(uint8_t command, uint32_t argument) {
+	uint8_t crc = 0xFF;
+	if (command == COMMAND_GO_IDLE) {
+		crc = CRC_GO_IDLE;
+	} else if (command == COMMAND_SEND_IF_COND) {
+		crc = CRC_SEND_IF_COND;
+	}
+	Select();
+	WaitReady(READY_TIMEOUT_MS);
+	Transfer(0x40 | command);
+	Transfer(argument >> 24);
+	Transfer(argument >> 16);
+	Transfer(argument >> 8);
+	Transfer(argument);
+	Transfer(crc);
+	for (uint8_t i = 0; i < 8; ++i) {
+		uint8_t r1 = Transfer(0xFF);
+		if (!(r1 & 0x80)) {
+			return r1;
+		}
+	}
+	return 0xFF;
+}
+/**
+ * @brief  Card address of a block
+ */
+static uint32_t Address(uint32_t block) {
+	return sd_spi_stats.high_capacity ? block : block * SD_ARCHIVE_BLOCK_SIZE;
+}
+/**
+ * @brief  Resets the card into SPI mode and waits until it is initialized
+ * @return false if no usable card answers
+ */
+static bool Identify(void) {
+	uint8_t r1 = 0xFF;
+	for (uint8_t i = 0; i < 10 && r1 != R1_IDLE; ++i) {
+		r1 = Command(COMMAND_GO_IDLE, 0);
+		Deselect();
+	}
+	if (r1 != R1_IDLE) {
+		return false;
+	}
+	/* Version 1 cards reject CMD8 and do not know about high capacity */
+	uint32_t host_capacity = 0;
+	r1 = Command(COMMAND_SEND_IF_COND, IF_COND_3V3);
+	uint32_t echo = ReceiveWord();
+	Deselect();
+	if (r1 == R1_IDLE) {
+		if ((echo & 0xFFF) != IF_COND_3V3) {
+			return false;
+		}
+		host_capacity = HOST_CAPACITY;
+	}
+	uint32_t start = HAL_GetTick();
+	do {
+		if (HAL_GetTick() - start > IDENTIFY_TIMEOUT_MS) {
+			return false;
+		}
+		Command(COMMAND_APP, 0);
+		Deselect();
+		r1 = Command(APP_SEND_OP_COND, host_capacity);
+		Deselect();
+	} while (r1 == R1_IDLE);
+	if (r1 != 0) {
+		return false;
+	}
+	r1 = Command(COMMAND_READ_OCR, 0);
+	sd_spi_stats.ocr = ReceiveWord();
+	Deselect();
+	if (r1 != 0) {
+		return false;
+	}
+	sd_spi_stats.high_capacity = (sd_spi_stats.ocr & OCR_CCS) != 0;
+	if (!sd_spi_stats.high_capacity) {
+		r1 = Command(COMMAND_SET_BLOCKLEN, SD_ARCHIVE_BLOCK_SIZE);
+		Deselect();
+	}
+	return r1 == 0;
+}
+/**
+ * @brief  Sends the next block of a CMD25 write by DMA, with the card
+ *         selected and the bus claimed
+ * @return None
+ */
+static void SendBlock(void) {
+	Transfer(0xFF);
+	Transfer(TOKEN_START_MULTIPLE);
+	SpiBus_StartWrite(write_data, SD_ARCHIVE_BLOCK_SIZE);
+	step = WRITE_SENDING;
+}
+
+/**
+ * @brief  Identifies the card; SpiBus_Init() has set up the bus
+ * @return false if no usable card answers
+ */
+bool SdSpi_Init(void) {
+	sd_spi_stats = { };
+	step = WRITE_IDLE;
+	write_failed = false;
+	uint32_t start = HAL_GetTick();
+	SpiBus_SetSlow(true);
+	/* 74 clocks or more with the card deselected, then CMD0 */
+	for (uint8_t i = 0; i < 10; ++i) {
+		Transfer(0xFF);
+	}
+	bool identified = Identify();
+	SpiBus_SetSlow(false);
+	sd_spi_stats.init_ms = HAL_GetTick() - start;
+	if (!identified) {
+		sd_spi_stats.ocr = 0;
+		sd_spi_stats.high_capacity = 0;
+	}
+	return identified;
+}
+/**
+ * @brief  Reads one block while no write is in progress, about 0.3 ms
+ * @return false if the card did not answer
+ */
+bool SdSpi_Read(uint32_t block, void *data) {
+	if (step != WRITE_IDLE || !SpiBus_Claim(SPI_BUS_SD)) {
+		return false;
+	}
+	bool read = Command(COMMAND_READ_SINGLE, Address(block)) == 0;
+	if (read) {
+		uint32_t start = HAL_GetTick();
+		uint8_t token;
+		while ((token = Transfer(0xFF)) == 0xFF
+				&& HAL_GetTick() - start <= TOKEN_TIMEOUT_MS) {
+		}
+		read = token == TOKEN_START_BLOCK;
+	}
+	if (read) {
+		uint8_t *bytes = static_cast<uint8_t*>(data);
+		for (uint32_t i = 0; i < SD_ARCHIVE_BLOCK_SIZE; ++i) {
+			bytes[i] = Transfer(0xFF);
+		}
+		Transfer(0xFF); // CRC, not checked
+		Transfer(0xFF);
+		++sd_spi_stats.blocks_read;
+	} else {
+		++sd_spi_stats.errors;
+	}
+	Deselect();
+	SpiBus_Release(SPI_BUS_SD);
+	return read;
+}
+/**
+ * @brief  Starts writing consecutive blocks; the data must stay in place
+ *         until SdSpi_Status() is no longer SD_DEVICE_BUSY
+ * @return None
+ */
+void SdSpi_Write(uint32_t block, const void *data, uint32_t count) {
+	write_data = static_cast<const uint8_t*>(data);
+	write_left = count;
+	write_failed = false;
+	SpiBus_Claim(SPI_BUS_SD);
+	if (Command(COMMAND_WRITE_MULTIPLE, Address(block)) != 0) {
+		Deselect();
+		SpiBus_Release(SPI_BUS_SD);
+		write_failed = true;
+		++sd_spi_stats.errors;
+		return;
+	}
+	SendBlock();
+}
+/**
+ * @brief  Moves a write on by one step if the card and bus allow it
+ * @return SD_DEVICE_FAILED once after a write that was not accepted
+ */
+SdDeviceStatus SdSpi_Status(void) {
+	uint8_t response;
+	switch (step) {
+	case WRITE_SENDING:
+		if (!SpiBus_WriteDone()) {
+			return SD_DEVICE_BUSY;
+		}
+		Transfer(0xFF); // CRC, not checked in SPI mode
+		Transfer(0xFF);
+		response = Transfer(0xFF);
+		Deselect();
+		SpiBus_Release(SPI_BUS_SD);
+		write_data += SD_ARCHIVE_BLOCK_SIZE;
+		--write_left;
+		if ((response & DATA_RESPONSE_MASK) == DATA_ACCEPTED) {
+			++sd_spi_stats.blocks_written;
+		} else {
+			/* Stop the transfer as soon as the card is ready */
+			write_failed = true;
+			write_left = 0;
+			++sd_spi_stats.errors;
+		}
+		step = WRITE_PROGRAMMING;
+		return SD_DEVICE_BUSY;
+	case WRITE_PROGRAMMING:
+		if (!SpiBus_Claim(SPI_BUS_SD)) {
+			return SD_DEVICE_BUSY;
+		}
+		Select();
+		if (Transfer(0xFF) != 0xFF) {
+			Deselect();
+			SpiBus_Release(SPI_BUS_SD);
+			return SD_DEVICE_BUSY;
+		}
+		if (write_left != 0) {
+			SendBlock();
+			return SD_DEVICE_BUSY;
+		}
+		Transfer(TOKEN_STOP);
+		Transfer(0xFF);
+		Deselect();
+		SpiBus_Release(SPI_BUS_SD);
+		step = WRITE_STOPPING;
+		return SD_DEVICE_BUSY;
+	case WRITE_STOPPING:
+		if (!SpiBus_Claim(SPI_BUS_SD)) {
+			return SD_DEVICE_BUSY;
+		}
+		Select();
+		response = Transfer(0xFF);
+		Deselect();
+		SpiBus_Release(SPI_BUS_SD);
+		if (response != 0xFF) {
+			return SD_DEVICE_BUSY;
+		}
+		step = WRITE_IDLE;
+		break;
+	case WRITE_IDLE:
+		break;
+	}
+	if (write_failed) {
+		write_failed = false;
+		return SD_DEVICE_FAILED;
+	}
+	/* Ready only if the flash does not hold the bus */
+	if (!SpiBus_Claim(SPI_BUS_SD)) {
+		return SD_DEVICE_BUSY;
+	}
+	SpiBus_Release(SPI_BUS_SD);
+	return SD_DEVICE_READY;
+}
@@ -0,0 +1,153 @@
+/*
+ * @brief Seed difficulty catalogue
+ * Entries store a 16-bit seed index instead of the seed itself, which keeps
+ * the whole sorted index at 4 KB of RAM.
+ */
+#include "seed_catalogue.h"
+#include "fixed_point.h"
+#include "game_core.h"
+#include <algorithm>
+
+// Catalogue seeds are spread over the 32-bit space with a Weyl sequence
+constexpr uint32_t SEED_STRIDE = 0x9E3779B1U;
+constexpr uint32_t SEED_BASE = 0x5EED0000U;
+
+// Chunk bot: remembers at most this many runs of the same LED
+constexpr uint8_t BOT_CHUNKS = 3;
+
+struct SeedEntry {
+	uint16_t difficulty;
+	uint16_t seed_index;
+};
+
+static SeedEntry catalogue[SEED_CATALOGUE_SIZE];
+
+/**
+ * @brief  Maps a catalogue index to its seed
+ */
+static uint32_t SeedAt(uint16_t index) {
+	return SEED_BASE + index * SEED_STRIDE;
+}
+/**
+ * @brief  Immediate repeats (same LED twice in a row) are easy to miscount
+ * @return 100 per repeat
+ */
+uint16_t Difficulty_Repeats(const uint8_t *steps, uint8_t count) {
+	uint16_t repeats = 0;
+	for (uint8_t i = 1; i < count; ++i) {
+		repeats += steps[i] == steps[i - 1];
+	}
+	return repeats * 100;
+}
+/**
+ * @brief  Many different moves between LEDs are harder to remember
+ * @return 50 per distinct ordered LED pair (a -> b, a != b)
+ */
+uint16_t Difficulty_Transitions(const uint8_t *steps, uint8_t count) {
+	uint32_t seen = 0; // Bit (a * GAME_LED_COUNT + b) for each transition
+	for (uint8_t i = 1; i < count; ++i) {
+		if (steps[i] != steps[i - 1]) {
+			seen |= 1U << (steps[i - 1] * GAME_LED_COUNT + steps[i]);
+		}
+	}
+	return __builtin_popcount(seen) * 50;
+}
+/**
+ * @brief  Shannon entropy of the LED histogram
+ * @return Bits per step in Q8 (0 when one LED is used, 512 for an even spread)
+ */
+uint16_t Difficulty_Entropy(const uint8_t *steps, uint8_t count) {
+	if (count == 0) {
+		return 0;
+	}
+	uint8_t histogram[GAME_LED_COUNT] = { };
+	for (uint8_t i = 0; i < count; ++i) {
+		++histogram[steps[i]];
+	}
+	/* H = log2(n) - sum(c * log2(c)) / n */
+	uint32_t weighted = 0;
+	for (uint8_t c : histogram) {
+		if (c > 0) {
+			weighted += c * Log2Q8(c);
+		}
+	}
+	return Log2Q8(count) - weighted / count;
+}
+/**
+ * @brief  Simulated player that memorises runs of the same LED and can hold
+ *         BOT_CHUNKS of them
+ * @return 100 per level the bot cannot clear
+ */
+uint16_t Difficulty_ChunkBot(const uint8_t *steps, uint8_t count) {
+	uint8_t chunks = 0;
+	uint16_t failed_levels = 0;
+	for (uint8_t i = 0; i < count; ++i) {
+		if (i == 0 || steps[i] != steps[i - 1]) {
+			++chunks;
+		}
+		/* Level i shows steps 0..i */
+		if (chunks > BOT_CHUNKS) {
+			++failed_levels;
+		}
+	}
+	return failed_levels * 100;
+}
+/**
+ * @brief  Default blend of the metrics above
+ */
+uint16_t Difficulty_Default(const uint8_t *steps, uint8_t count) {
+	return Difficulty_Repeats(steps, count)
+			+ Difficulty_Transitions(steps, count)
+			+ Difficulty_Entropy(steps, count) / 2
+			+ Difficulty_ChunkBot(steps, count);
+}
+
+/**
+ * @brief  Rates every catalogue seed with the metric and sorts them
+ * @return None
+ */
+void SeedCatalogue_Build(DifficultyMetric metric) {
+	uint8_t steps[GAME_MAX_LEVEL];
+	for (uint32_t i = 0; i < SEED_CATALOGUE_SIZE; ++i) {
+		GameCore_PreviewSequence(SeedAt(i), steps, GAME_MAX_LEVEL);
+		catalogue[i] = { metric(steps, GAME_MAX_LEVEL), static_cast<uint16_t>(i) };
+	}
+	std::sort(catalogue, catalogue + SEED_CATALOGUE_SIZE,
+			[](const SeedEntry &a, const SeedEntry &b) {
+				return a.difficulty < b.difficulty;
+			});
+}
+/**
+ * @brief  Picks a seed whose difficulty lies in [min, max].
+ * With no seed in the band the closest one is used.
+ * @param  entropy: any varying value, selects among the seeds of the band
+ * @return Seed for GameCore_Start()
+ */
+uint32_t SeedCatalogue_Pick(uint16_t min_difficulty, uint16_t max_difficulty,
+		uint32_t entropy) {
+	const SeedEntry *begin = catalogue;
+	const SeedEntry *end = catalogue + SEED_CATALOGUE_SIZE;
+	const SeedEntry *lo = std::lower_bound(begin, end, min_difficulty,
+			[](const SeedEntry &e, uint16_t d) {
+				return e.difficulty < d;
+			});
+	const SeedEntry *hi = std::upper_bound(lo, end, max_difficulty,
+			[](uint16_t d, const SeedEntry &e) {
+				return d < e.difficulty;
+			});
+	if (lo == hi) {
+		return SeedAt(lo == end ? end[-1].seed_index : lo->seed_index);
+	}
+	return SeedAt(lo[entropy % (hi - lo)].seed_index);
+}
+/**
+ * @brief  Difficulty below which the given share of the catalogue lies
+ * @param  percentile: 0..100
+ * @return Difficulty value usable as a band limit for SeedCatalogue_Pick()
+ */
+uint16_t SeedCatalogue_DifficultyAtPercentile(uint8_t percentile) {
+	if (percentile > 100) {
+		percentile = 100;
+	}
+	return catalogue[(SEED_CATALOGUE_SIZE - 1) * percentile / 100].difficulty;
+}
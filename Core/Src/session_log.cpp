@@ -0,0 +1,159 @@
+/*
+ * @brief Session records
+ * Records are filled in place in a RAM ring and sealed with a hardware CRC
+ * when the game ends, so a finished record is never copied around.
+ */
+#include "main.h"
+#include "crc32.h"
+#include "sd_archive.h"
+#include "session_log.h"
+#include <stddef.h>
+#include <string.h>
+
+static_assert(sizeof(SessionRecord) % 4 == 0,
+		"the CRC unit consumes whole 32-bit words");
+static_assert(sizeof(SessionRecord) == NOR_LOG_ENTRY_SIZE,
+		"one record per log entry");
+static_assert(sizeof(SessionRecord) == SD_ARCHIVE_ENTRY_SIZE,
+		"one record per archive entry");
+
+SessionRecord session_log[SESSION_LOG_CAPACITY];
+static uint32_t sessions;          // Records started since boot
+static SessionRecord *open_record[SESSION_STATIONS]; // Games in progress
+
+/**
+ * @brief  Enables the CRC unit
+ * @return None
+ */
+void SessionLog_Init(void) {
+	Crc32_Init();
+}
+/**
+ * @brief  Computes the CRC of a record with the hardware CRC unit
+ * @return CRC-32/MPEG-2 of every word before the crc field
+ */
+uint32_t SessionLog_Crc(const SessionRecord *record) {
+	return Crc32_Compute(reinterpret_cast<const uint32_t*>(record),
+			offsetof(SessionRecord, crc) / 4);
+}
+/**
+ * @brief  Checks whether a record belongs to a game in progress
+ */
+static bool IsOpen(const SessionRecord *record) {
+	for (const SessionRecord *open : open_record) {
+		if (open == record) {
+			return true;
+		}
+	}
+	return false;
+}
+/**
+ * @brief  Opens a record for a new game on a station.
+ * A game still open on that station was abandoned and is sealed as aborted.
+ * @param  station: 0 .. SESSION_STATIONS - 1
+ * @param  seed: seed passed to GameCore_Start()
+ * @param  mode: game mode played in the session
+ * @return None
+ */
+void SessionLog_Begin(uint8_t station, uint32_t seed, SessionMode mode) {
+	if (station >= SESSION_STATIONS) {
+		return;
+	}
+	SessionLog_End(station, SESSION_ABORTED, 0);
+	SessionRecord *record = &session_log[sessions % SESSION_LOG_CAPACITY];
+	/* A game running through a whole ring of other games is given up */
+	for (uint8_t i = 0; i < SESSION_STATIONS; ++i) {
+		if (open_record[i] == record) {
+			SessionLog_End(i, SESSION_ABORTED, 0);
+		}
+	}
+	memset(record, 0, sizeof(*record));
+	record->magic = SESSION_RECORD_MAGIC;
+	record->uid[0] = HAL_GetUIDw0();
+	record->uid[1] = HAL_GetUIDw1();
+	record->uid[2] = HAL_GetUIDw2();
+	record->session = sessions++;
+	record->start_tick = HAL_GetTick();
+	record->seed = seed;
+	record->mode = mode;
+	record->flags = station & SESSION_FLAG_STATION_MASK;
+	open_record[station] = record;
+}
+/**
+ * @brief  Adds the reaction time of one press to the station's open record
+ * @param  reaction_ms: saturated to 65535 ms
+ * @return None
+ */
+void SessionLog_Press(uint8_t station, uint32_t reaction_ms) {
+	if (station >= SESSION_STATIONS) {
+		return;
+	}
+	SessionRecord *record = open_record[station];
+	if (record == nullptr || record->presses >= SESSION_MAX_PRESSES) {
+		return;
+	}
+	record->reaction_ms[record->presses++] =
+			reaction_ms > UINT16_MAX ? UINT16_MAX : reaction_ms;
+}
+/**
+ * @brief  Sets SESSION_FLAG_* bits of the station's open record
+ * @return None
+ */
+void SessionLog_Flag(uint8_t station, uint16_t flags) {
+	if (station < SESSION_STATIONS && open_record[station] != nullptr) {
+		open_record[station]->flags |= flags;
+	}
+}
+/**
+ * @brief  Seals the station's open record with its result, tag and CRC
+ * @return None
+ */
+void SessionLog_End(uint8_t station, SessionResult result,
+		uint8_t levels_completed) {
+	if (station >= SESSION_STATIONS || open_record[station] == nullptr) {
+		return;
+	}
+	SessionRecord *record = open_record[station];
+	record->result = result;
+	record->levels_completed = levels_completed;
+	/* The flag is part of what the tag covers, so it is set first */
+	record->flags |= SESSION_FLAG_SIGNED;
+	if (!RecordAuth_Sign(record, offsetof(SessionRecord, tag), record->tag)) {
+		record->flags &= ~SESSION_FLAG_SIGNED;
+	}
+	record->crc = SessionLog_Crc(record);
+	open_record[station] = nullptr;
+	NorLog_Append(record);
+	SdArchive_Append(record);
+}
+/**
+ * @brief  Returns a finished record
+ * @param  age: 0 for the most recent one, 1 for the one before, ...
+ * @return Record, or nullptr if it does not exist (anymore)
+ */
+const SessionRecord* SessionLog_Latest(uint32_t age) {
+	/* Walk from the newest slot, skipping games still in progress */
+	uint32_t available =
+			sessions < SESSION_LOG_CAPACITY ? sessions : SESSION_LOG_CAPACITY;
+	for (uint32_t i = 1; i <= available; ++i) {
+		const SessionRecord *record =
+				&session_log[(sessions - i) % SESSION_LOG_CAPACITY];
+		if (!IsOpen(record) && age-- == 0) {
+			return record;
+		}
+	}
+	return nullptr;
+}
+/**
+ * @brief  Reads a finished record back from the external flash log
+ * @param  age: 0 for the most recent one, 1 for the one before, ...
+ * @return NOR_LOG_MISSING also for a record cut short by a power loss
+ */
+NorLogRead SessionLog_History(uint32_t age, SessionRecord *record) {
+	NorLogRead read = NorLog_ReadLatest(age, record);
+	if (read == NOR_LOG_FOUND && (record->magic != SESSION_RECORD_MAGIC
+			|| SessionLog_Crc(record) != record->crc)) {
+		return NOR_LOG_MISSING;
+	}
+	return read;
+}
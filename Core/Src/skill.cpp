@@ -0,0 +1,135 @@
+/*
+ * @brief Player skill model
+ * All arithmetic is integer; one update is a table lookup, an interpolation
+ * and a few multiplies, so it runs after every press without being noticed.
+ */
+#include "skill.h"
+#include "record_auth.h"
+
+constexpr int32_t ONE_STEP_Q8 = 256;
+constexpr int32_t INITIAL_SPAN_Q8 = 3 * ONE_STEP_Q8;
+constexpr uint32_t INITIAL_REACTION_Q4 = 500 * 16;
+constexpr int32_t MAX_SPAN_Q8 = 16 * ONE_STEP_Q8;
+
+// Learning rate K_INITIAL * K_HALF_LIFE / (K_HALF_LIFE + n), at least K_MIN
+constexpr int32_t K_INITIAL_Q8 = ONE_STEP_Q8;
+constexpr int32_t K_MIN_Q8 = ONE_STEP_Q8 / 8;
+constexpr uint32_t K_HALF_LIFE = 16;
+
+constexpr uint8_t REACTION_SMOOTHING_SHIFT = 3; // EWMA weight 1/8
+
+// Logistic 65535 / (1 + e^-x) sampled at x = -6, -5.5, ..., 6 steps
+constexpr uint16_t LOGISTIC_Q16[] = { 162, 267, 439, 720, 1179, 1921, 3108,
+		4971, 7812, 11955, 17625, 24742, 32768, 40793, 47910, 53580, 57723,
+		60564, 62427, 63614, 64356, 64815, 65096, 65268, 65373 };
+constexpr int32_t LOGISTIC_MIN_Q8 = -6 * ONE_STEP_Q8;
+constexpr int32_t LOGISTIC_STEP_Q8 = ONE_STEP_Q8 / 2;
+constexpr int32_t LOGISTIC_LAST = sizeof(LOGISTIC_Q16) / sizeof(LOGISTIC_Q16[0])
+		- 1;
+
+/**
+ * @brief  Logistic function by table lookup and linear interpolation
+ * @param  x_q8: argument in steps, Q8
+ * @return Probability in Q16
+ */
+static int32_t LogisticQ16(int32_t x_q8) {
+	int32_t pos = x_q8 - LOGISTIC_MIN_Q8;
+	if (pos <= 0) {
+		return LOGISTIC_Q16[0];
+	}
+	int32_t i = pos / LOGISTIC_STEP_Q8;
+	if (i >= LOGISTIC_LAST) {
+		return LOGISTIC_Q16[LOGISTIC_LAST];
+	}
+	int32_t frac = pos % LOGISTIC_STEP_Q8;
+	return LOGISTIC_Q16[i]
+			+ (LOGISTIC_Q16[i + 1] - LOGISTIC_Q16[i]) * frac / LOGISTIC_STEP_Q8;
+}
+
+/**
+ * @brief  Sets the prior: span of 3 steps, 500 ms reactions
+ * @return None
+ */
+void Skill_Reset(SkillModel *model) {
+	model->span_q8 = INITIAL_SPAN_Q8;
+	model->reaction_q4 = INITIAL_REACTION_Q4;
+	model->observations = 0;
+}
+/**
+ * @brief  Loads a profile from flash, or the prior if it was never saved
+ *         or its tag is not genuine
+ * @return None
+ */
+void Skill_Load(SkillModel *model, uint8_t profile) {
+	if (!RecordAuth_Read(STORE_KEY_SKILL + profile, model, sizeof(*model))) {
+		Skill_Reset(model);
+	}
+}
+/**
+ * @brief  Saves a profile to flash, signed
+ * @return true if the record was written
+ */
+bool Skill_Save(const SkillModel *model, uint8_t profile) {
+	return RecordAuth_Write(STORE_KEY_SKILL + profile, model, sizeof(*model));
+}
+/**
+ * @brief  Updates the model with one press
+ * @param  position: index of the step in the sequence (0 = first)
+ * @param  correct: whether the press matched the sequence
+ * @param  reaction_ms: time the player took for this press
+ * @return None
+ */
+void Skill_Observe(SkillModel *model, uint8_t position, bool correct,
+		uint32_t reaction_ms) {
+	int32_t difficulty_q8 = (position + 1) * ONE_STEP_Q8;
+	int32_t expected_q16 = LogisticQ16(model->span_q8 - difficulty_q8);
+	int32_t outcome_q16 = correct ? 65535 : 0;
+
+	int32_t k_q8 = K_INITIAL_Q8 * K_HALF_LIFE
+			/ static_cast<int32_t>(K_HALF_LIFE + model->observations);
+	if (k_q8 < K_MIN_Q8) {
+		k_q8 = K_MIN_Q8;
+	}
+	model->span_q8 += k_q8 * (outcome_q16 - expected_q16) / 65536;
+	if (model->span_q8 < 0) {
+		model->span_q8 = 0;
+	} else if (model->span_q8 > MAX_SPAN_Q8) {
+		model->span_q8 = MAX_SPAN_Q8;
+	}
+
+	/* Only successful presses say something about speed */
+	if (correct) {
+		int32_t sample_q4 = static_cast<int32_t>(reaction_ms * 16);
+		int32_t current_q4 = static_cast<int32_t>(model->reaction_q4);
+		model->reaction_q4 = current_q4
+				+ ((sample_q4 - current_q4) >> REACTION_SMOOTHING_SHIFT);
+	}
+	if (model->observations < UINT32_MAX) {
+		++model->observations;
+	}
+}
+/**
+ * @brief  Maps the span to a percentile of the seed difficulty catalogue.
+ * A span of 2 steps or less picks the easiest seeds, 5 or more the hardest.
+ * @return Percentile 0..100
+ */
+uint8_t Skill_TargetPercentile(const SkillModel *model) {
+	int32_t percentile = (model->span_q8 - 2 * ONE_STEP_Q8) * 100
+			/ (3 * ONE_STEP_Q8);
+	if (percentile < 0) {
+		return 0;
+	}
+	return percentile > 100 ? 100 : percentile;
+}
+/**
+ * @brief  Show tempo matched to the player's reaction speed
+ * @return Smoothed reaction time clamped to [min_ms, max_ms]
+ */
+uint32_t Skill_TempoMs(const SkillModel *model, uint32_t min_ms,
+		uint32_t max_ms) {
+	uint32_t reaction_ms = model->reaction_q4 / 16;
+	if (reaction_ms < min_ms) {
+		return min_ms;
+	}
+	return reaction_ms > max_ms ? max_ms : reaction_ms;
+}
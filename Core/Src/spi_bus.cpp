@@ -0,0 +1,155 @@
+/*
+ * @brief Shared SPI2 bus
+ * SPI2 and DMA1 are driven by registers directly, the SPI HAL module is not
+ * part of the project.
+ */
+#include "main.h"
+#include "spi_bus.h"
+
+constexpr uint32_t DMA_CHANNEL_SPI2_TX = 0;
+constexpr uint32_t BAUD_FAST = 0;                  // PCLK1 / 2
+constexpr uint32_t BAUD_SLOW = SPI_CR1_BR_2 | SPI_CR1_BR_1; // PCLK1 / 128
+
+static SpiBusDevice owner = SPI_BUS_NONE;
+
+/**
+ * @brief  Sets up the pins, SPI2 and the DMA clock, with both chips
+ *         deselected
+ * @return None
+ */
+void SpiBus_Init(void) {
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	__HAL_RCC_SPI2_CLK_ENABLE();
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	GPIO_InitTypeDef GPIO_InitStruct = { 0 };
+	SpiBus_Deselect(SPI_BUS_NOR);
+	SpiBus_Deselect(SPI_BUS_SD);
+	GPIO_InitStruct.Pin = GPIO_PIN_12;
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+	/* PA15 leaves its reset function JTDI; SWD keeps PA13/PA14 */
+	GPIO_InitStruct.Pin = GPIO_PIN_15;
+	HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+	/* MISO pulled up: without a chip every byte reads as 0xFF */
+	GPIO_InitStruct.Pin = GPIO_PIN_13 | GPIO_PIN_14 | GPIO_PIN_15;
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	GPIO_InitStruct.Alternate = GPIO_AF5_SPI2;
+	HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+	SPI2->CR1 = 0;
+	SPI2->CR2 = 0;
+	SPI2->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_SPE;
+	owner = SPI_BUS_NONE;
+}
+/**
+ * @brief  Takes the bus for an operation spanning several calls
+ * @return false while the other device holds it
+ */
+bool SpiBus_Claim(SpiBusDevice device) {
+	if (owner != SPI_BUS_NONE && owner != device) {
+		return false;
+	}
+	owner = device;
+	return true;
+}
+/**
+ * @brief  Gives the bus back, if the device holds it
+ * @return None
+ */
+void SpiBus_Release(SpiBusDevice device) {
+	if (owner == device) {
+		owner = SPI_BUS_NONE;
+	}
+}
+/**
+ * @brief  Drives a chip select low
+ * @return None
+ */
+void SpiBus_Select(SpiBusDevice device) {
+	if (device == SPI_BUS_NOR) {
+		GPIOB->BSRR = GPIO_PIN_12 << 16;
+	} else {
+		GPIOA->BSRR = GPIO_PIN_15 << 16;
+	}
+}
+/**
+ * @brief  Drives a chip select high
+ * @return None
+ */
+void SpiBus_Deselect(SpiBusDevice device) {
+	if (device == SPI_BUS_NOR) {
+		GPIOB->BSRR = GPIO_PIN_12;
+	} else {
+		GPIOA->BSRR = GPIO_PIN_15;
+	}
+}
+/**
+ * @brief  Switches between 375 kHz, for SD card identification, and 24 MHz
+ * @return None
+ */
+void SpiBus_SetSlow(bool slow) {
+	while (!(SPI2->SR & SPI_SR_TXE) || (SPI2->SR & SPI_SR_BSY)) {
+	}
+	SPI2->CR1 &= ~SPI_CR1_SPE;
+	SPI2->CR1 = (SPI2->CR1 & ~SPI_CR1_BR) | (slow ? BAUD_SLOW : BAUD_FAST);
+	SPI2->CR1 |= SPI_CR1_SPE;
+}
+/**
+ * @brief  Exchanges one byte
+ * @return The byte received
+ */
+uint8_t SpiBus_Transfer(uint8_t byte) {
+	while (!(SPI2->SR & SPI_SR_TXE)) {
+	}
+	*reinterpret_cast<volatile uint8_t*>(&SPI2->DR) = byte;
+	while (!(SPI2->SR & SPI_SR_RXNE)) {
+	}
+	return *reinterpret_cast<volatile uint8_t*>(&SPI2->DR);
+}
+/**
+ * @brief  Starts shifting out data by DMA, discarding what comes back; the
+ *         data must stay in place until SpiBus_WriteDone() returns true
+ * @return None
+ */
+void SpiBus_StartWrite(const void *data, uint32_t length) {
+	DMA1_Stream4->CR = 0;
+	while (DMA1_Stream4->CR & DMA_SxCR_EN) {
+	}
+	DMA1->HIFCR = DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4
+			| DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4;
+	DMA1_Stream4->PAR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			&SPI2->DR));
+	DMA1_Stream4->M0AR = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(
+			data));
+	DMA1_Stream4->NDTR = length;
+	DMA1_Stream4->FCR = 0; // Direct mode
+	DMA1_Stream4->CR = (DMA_CHANNEL_SPI2_TX << DMA_SxCR_CHSEL_Pos)
+			| DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_EN;
+	SPI2->CR2 = SPI_CR2_TXDMAEN;
+}
+/**
+ * @brief  Ends a DMA write once its last byte is out; the chip stays
+ *         selected
+ * @return false while data is still going out
+ */
+bool SpiBus_WriteDone(void) {
+	if (!(SPI2->CR2 & SPI_CR2_TXDMAEN)) {
+		return true;
+	}
+	if (DMA1_Stream4->NDTR != 0) {
+		return false;
+	}
+	while (!(SPI2->SR & SPI_SR_TXE) || (SPI2->SR & SPI_SR_BSY)) {
+	}
+	SPI2->CR2 = 0;
+	/* The bytes received meanwhile were never read: clear the overrun */
+	(void) *reinterpret_cast<volatile uint8_t*>(&SPI2->DR);
+	(void) SPI2->SR;
+	return true;
+}
@@ -0,0 +1,146 @@
+/*
+ * @brief SPI NOR flash driver
+ * Only the main loop calls in here. The bus is shared with the SD card
+ * (spi_bus.h), so the chip counts as busy while the card holds it.
+ */
+#include "main.h"
+#include "reaction.h"
+#include "spi_bus.h"
+#include "spi_nor.h"
+
+constexpr uint8_t COMMAND_WRITE_ENABLE = 0x06;
+constexpr uint8_t COMMAND_READ_STATUS = 0x05;
+constexpr uint8_t COMMAND_READ = 0x03;
+constexpr uint8_t COMMAND_PAGE_PROGRAM = 0x02;
+constexpr uint8_t COMMAND_SECTOR_ERASE = 0x20; // 4 KB
+constexpr uint8_t COMMAND_RELEASE_POWER_DOWN = 0xAB;
+constexpr uint8_t COMMAND_JEDEC_ID = 0x9F;
+constexpr uint8_t STATUS_BUSY = 0x01;
+constexpr uint8_t CAPACITY_MIN = 0x10;  // 64 KB
+constexpr uint8_t CAPACITY_MAX = 0x18;  // 16 MB, the end of 3-byte addresses
+
+SpiNorStats spi_nor_stats;
+const NorDevice spi_nor_device = { SpiNor_Busy, SpiNor_Program, SpiNor_Erase,
+		SpiNor_Read, Reaction_NowUs };
+
+static bool transferring; // Page program data still going out by DMA
+
+static inline void Select(void) {
+	SpiBus_Select(SPI_BUS_NOR);
+}
+static inline void Deselect(void) {
+	SpiBus_Deselect(SPI_BUS_NOR);
+}
+static inline uint8_t Transfer(uint8_t byte) {
+	return SpiBus_Transfer(byte);
+}
+/**
+ * @brief  Sends a command and a 3-byte address with the chip selected
+ * @return None
+ */
+static void Start(uint8_t command, uint32_t address) {
+	Select();
+	Transfer(command);
+	Transfer(address >> 16);
+	Transfer(address >> 8);
+	Transfer(address);
+}
+/**
+ * @brief  Sends a command without arguments
+ * @return None
+ */
+static void Command(uint8_t command) {
+	Select();
+	Transfer(command);
+	Deselect();
+}
+
+/**
+ * @brief  Identifies the chip; SpiBus_Init() has set up the bus
+ * @return false if no usable chip answers
+ */
+bool SpiNor_Init(void) {
+	Command(COMMAND_RELEASE_POWER_DOWN);
+	HAL_Delay(1); // tRES1 is 3 us
+	Select();
+	Transfer(COMMAND_JEDEC_ID);
+	uint32_t id = Transfer(0) << 16;
+	id |= Transfer(0) << 8;
+	id |= Transfer(0);
+	Deselect();
+
+	uint8_t manufacturer = id >> 16;
+	uint8_t capacity = id;
+	spi_nor_stats = { };
+	if (manufacturer == 0x00 || manufacturer == 0xFF
+			|| capacity < CAPACITY_MIN || capacity > CAPACITY_MAX) {
+		return false;
+	}
+	spi_nor_stats.jedec_id = id;
+	spi_nor_stats.size = 1U << capacity;
+	/* After a reset without a power loss an erase may still be running */
+	while (SpiNor_Busy()) {
+	}
+	return true;
+}
+/**
+ * @brief  Finishes a page program's DMA transfer once it is out, then asks
+ *         the chip
+ * @return true while a program or erase is in progress, or while the SD
+ *         card holds the bus
+ */
+bool SpiNor_Busy(void) {
+	if (transferring) {
+		if (!SpiBus_WriteDone()) {
+			return true;
+		}
+		Deselect();
+		SpiBus_Release(SPI_BUS_NOR);
+		transferring = false;
+	}
+	if (!SpiBus_Claim(SPI_BUS_NOR)) {
+		return true;
+	}
+	Select();
+	Transfer(COMMAND_READ_STATUS);
+	uint8_t status = Transfer(0);
+	Deselect();
+	SpiBus_Release(SPI_BUS_NOR);
+	return status & STATUS_BUSY;
+}
+/**
+ * @brief  Starts programming up to one page; the data must stay in place
+ *         until SpiNor_Busy() returns false
+ * @return None
+ */
+void SpiNor_Program(uint32_t address, const void *data, uint32_t length) {
+	SpiBus_Claim(SPI_BUS_NOR);
+	Command(COMMAND_WRITE_ENABLE);
+	Start(COMMAND_PAGE_PROGRAM, address);
+	SpiBus_StartWrite(data, length);
+	transferring = true;
+	++spi_nor_stats.programs;
+}
+/**
+ * @brief  Starts erasing the 4 KB sector at address
+ * @return None
+ */
+void SpiNor_Erase(uint32_t address) {
+	Command(COMMAND_WRITE_ENABLE);
+	Start(COMMAND_SECTOR_ERASE, address);
+	Deselect();
+	++spi_nor_stats.erases;
+}
+/**
+ * @brief  Reads while the chip is idle, about 0.4 us per byte
+ * @return None
+ */
+void SpiNor_Read(uint32_t address, void *data, uint32_t length) {
+	uint8_t *bytes = static_cast<uint8_t*>(data);
+	Start(COMMAND_READ, address);
+	for (uint32_t i = 0; i < length; ++i) {
+		bytes[i] = Transfer(0);
+	}
+	Deselect();
+	spi_nor_stats.bytes_read += length;
+}
@@ -0,0 +1,259 @@
+/*
+ * @brief Simon Says station
+ * The blocking game loop turned inside out: each blocking wait became a
+ * phase with a deadline, so many stations can share one main loop.
+ */
+#include "station.h"
+#include "fault_injection.h"
+#include "preempt_explorer.h"
+#include "resume_slot.h"
+#include "session_log.h"
+#include <string.h>
+
+// Animation timing (in ms)
+constexpr uint32_t ERROR_BLINK_MS = 200;
+constexpr uint32_t WIN_ANIMATION_MS = 100;
+constexpr uint8_t GAME_OVER_FRAMES = 4;   // On, off, on, off
+constexpr uint8_t WIN_FRAMES = 4 * GAME_LED_COUNT; // Four running lights
+constexpr uint8_t ALL_LEDS = (1U << GAME_LED_COUNT) - 1;
+
+/**
+ * @brief  Wrap-safe check whether a deadline has passed
+ */
+static bool Reached(uint32_t now, uint32_t deadline) {
+	return static_cast<int32_t>(now - deadline) >= 0;
+}
+/**
+ * @brief  Lights the current sequence step
+ * @return None
+ */
+static void ShowStep(Station *station, uint32_t now) {
+	uint8_t led = station->game.sequence[station->step];
+	if (led >= GAME_LED_COUNT) {
+		/* Corrupted sequence: abandon the game instead of lighting garbage */
+		FaultInjection_ReportViolation();
+		Station_Abort(station);
+		return;
+	}
+	station->leds = 1U << led;
+	station->phase = STATION_SHOW_ON;
+	station->deadline = now + station->speed_ms;
+}
+/**
+ * @brief  Shows one frame of the game over or win animation, and returns to
+ *         IDLE after the last one
+ * @return None
+ */
+static void ShowAnimationFrame(Station *station, uint32_t now) {
+	bool win = station->game.state == WIN;
+	uint8_t frames = win ? WIN_FRAMES : GAME_OVER_FRAMES;
+	if (station->quick_animations) {
+		frames = win ? GAME_LED_COUNT : 2;
+	}
+	if (station->step >= frames) {
+		station->leds = 0;
+		station->game.state = IDLE;
+		station->phase = STATION_WAIT;
+		return;
+	}
+	if (win) {
+		station->leds = 1U << (station->step % GAME_LED_COUNT);
+		station->deadline = now + WIN_ANIMATION_MS;
+	} else {
+		station->leds = station->step % 2 == 0 ? ALL_LEDS : 0;
+		station->deadline = now + ERROR_BLINK_MS;
+	}
+	station->phase = STATION_ANIMATION;
+	++station->step;
+}
+/**
+ * @brief  Feeds the echoed press to the rules and moves to what follows:
+ *         the next press, the next level's show or an animation
+ * @return None
+ */
+static void Judge(Station *station, uint32_t now) {
+	GameCore *game = &station->game;
+	PREEMPTION_POINT();
+	GameStepResult result = GameCore_Press(game, station->button);
+	PREEMPTION_POINT();
+	if (result != GAME_STEP_IGNORED) {
+		Skill_Observe(&station->skill, station->position,
+				result != GAME_STEP_FAIL, station->reaction_ms);
+	}
+	if (result == GAME_STEP_FAIL) {
+		Station_EndSession(station, SESSION_LOST, game->current_level);
+	} else if (result == GAME_STEP_WIN) {
+		Station_EndSession(station, SESSION_WON, GAME_MAX_LEVEL);
+	}
+	if (result == GAME_STEP_FAIL || result == GAME_STEP_WIN) {
+		/* A few words of flash, the other stations pause for well under a
+		 millisecond; the store only compacts while the board is idle */
+		Skill_Save(&station->skill, station->profile);
+	} else if (result == GAME_STEP_LEVEL_UP) {
+		/* Queued in constant time, programmed by the main loop */
+		ResumeSlot_Save(station->id, station->profile, station->seed, game,
+				station->speed_ms);
+	}
+	station->turn_start = now;
+	station->step = 0;
+	if (game->state == SIMON_SAYS) {
+		ShowStep(station, now);
+	} else if (game->state == GAME_OVER || game->state == WIN) {
+		ShowAnimationFrame(station, now);
+	} else {
+		station->phase = STATION_WAIT;
+	}
+}
+
+/**
+ * @brief  Prepares an idle station and loads its player's skill profile
+ * @param  id: station number, 0 .. SESSION_STATIONS - 1
+ * @return None
+ */
+void Station_Init(Station *station, uint8_t id, uint8_t profile) {
+	memset(station, 0, sizeof(*station));
+	station->id = id;
+	station->profile = profile;
+	station->game.state = IDLE;
+	Skill_Load(&station->skill, profile);
+}
+/**
+ * @brief  Starts a classic game and the show of its first level
+ * @param  seed: seed of the sequence
+ * @param  speed_ms: how long each step is lit and dark
+ * @return None
+ */
+void Station_Start(Station *station, uint32_t seed, uint32_t now,
+		uint32_t speed_ms) {
+	BotDetector_Reset(&station->detector, false);
+	SessionLog_Begin(station->id, seed, SESSION_MODE_CLASSIC);
+	PREEMPTION_POINT();
+	GameCore_Start(&station->game, seed);
+	PREEMPTION_POINT();
+	station->speed_ms = speed_ms;
+	station->seed = seed;
+	station->step = 0;
+	ShowStep(station, now);
+}
+/**
+ * @brief  Continues a game saved before a power loss with the show of its
+ *         level, as the player who was playing it
+ * @param  record: valid snapshot of the station, see ResumeSlot_Load()
+ * @return None
+ */
+void Station_Resume(Station *station, const ResumeRecord *record,
+		uint32_t now) {
+	if (record->profile != station->profile) {
+		Station_Init(station, station->id, record->profile);
+	}
+	BotDetector_Reset(&station->detector, false);
+	SessionLog_Begin(station->id, record->seed, SESSION_MODE_CLASSIC);
+	SessionLog_Flag(station->id, SESSION_FLAG_RESUMED);
+	station->game = record->game;
+	station->speed_ms = record->speed_ms;
+	station->seed = record->seed;
+	station->step = 0;
+	ShowStep(station, now);
+}
+/**
+ * @brief  Advances the station without ever waiting
+ * @param  now: HAL tick
+ * @param  buttons: pressed buttons of this station (bit i for button i)
+ * @return None
+ */
+void Station_Step(Station *station, uint32_t now, uint32_t buttons) {
+	GameCore *game = &station->game;
+	station->pressed_now = false;
+
+	switch (station->phase) {
+	/* Show the sequence to the player */
+	case STATION_SHOW_ON:
+		if (Reached(now, station->deadline)) {
+			station->leds = 0;
+			station->phase = STATION_SHOW_OFF;
+			station->deadline = now + station->speed_ms;
+		}
+		break;
+
+	case STATION_SHOW_OFF:
+		if (!Reached(now, station->deadline)) {
+			break;
+		}
+		if (++station->step <= game->current_level) {
+			ShowStep(station, now);
+		} else {
+			PREEMPTION_POINT();
+			GameCore_BeginInput(game);
+			station->turn_start = now;
+			station->phase = STATION_WAIT;
+		}
+		break;
+
+	/* Player repeats the sequence: echo the press until it is released */
+	case STATION_WAIT:
+		if (game->state != PLAYER_SAYS || buttons == 0) {
+			break;
+		}
+		station->button = __builtin_ctz(buttons);
+		station->position = game->index;
+		station->reaction_ms = now - station->turn_start;
+		SessionLog_Press(station->id, station->reaction_ms);
+		station->leds = 1U << station->button;
+		station->phase = STATION_ECHO_ON;
+		station->deadline = now + station->speed_ms;
+		station->pressed_now = true;
+		break;
+
+	case STATION_ECHO_ON:
+		if (Reached(now, station->deadline)
+				&& !(buttons & (1U << station->button))) {
+			station->leds = 0;
+			station->phase = STATION_ECHO_OFF;
+			station->deadline = now + station->speed_ms;
+		}
+		break;
+
+	case STATION_ECHO_OFF:
+		if (Reached(now, station->deadline)) {
+			Judge(station, now);
+		}
+		break;
+
+	/* Loss or win */
+	case STATION_ANIMATION:
+		if (Reached(now, station->deadline)) {
+			ShowAnimationFrame(station, now);
+		}
+		break;
+	}
+}
+/**
+ * @brief  Abandons the game in progress and returns to IDLE
+ * @return None
+ */
+void Station_Abort(Station *station) {
+	Station_EndSession(station, SESSION_ABORTED, 0);
+	station->game.state = IDLE;
+	station->phase = STATION_WAIT;
+	station->leds = 0;
+}
+/**
+ * @brief  Closes the station's session record, flagged as automated when the
+ *         bot detector says so, and drops its resume snapshot. Timed modes
+ *         that run on the station's buttons close their records here too.
+ * @return None
+ */
+void Station_EndSession(Station *station, SessionResult result,
+		uint8_t levels_completed) {
+	if (BotDetector_IsAutomated(&station->detector)) {
+		SessionLog_Flag(station->id, SESSION_FLAG_AUTOMATED);
+	}
+	SessionLog_End(station->id, result, levels_completed);
+	ResumeSlot_Clear(station->id);
+}
+/**
+ * @brief  Checks whether the station waits for START
+ */
+bool Station_IsIdle(const Station *station) {
+	return station->game.state == IDLE;
+}
@@ -0,0 +1,255 @@
+/*
+ * @brief Telemetry channel
+ * Runs from the main loop only. Output is written a whole line at a time, so
+ * a host never sees a frame or record cut in half, and nothing here waits
+ * for the host.
+ */
+#include "main.h"
+#include "battery.h"
+#include "brightness.h"
+#include "clock_guard.h"
+#include "frame_ring.h"
+#include "nor_log.h"
+#include "record_auth.h"
+#include "session_log.h"
+#include "telemetry.h"
+#include "usb_cdc.h"
+#include <stdlib.h>
+#include <string.h>
+
+constexpr uint32_t FRAME_LINE_SIZE = 50;
+constexpr uint32_t RECORD_LINE_SIZE = 2 + 2 * sizeof(SessionRecord) + 2;
+constexpr uint32_t REPLY_RESERVE = 80; // Room for any reply but a record
+
+TelemetryStats telemetry_stats;
+
+static bool connected;
+static bool streaming;
+static uint32_t next_frame;    // Ring position streamed next
+static int32_t dump_age = -1;  // Record dumped next, -1 when not dumping
+static bool dump_history;      // From the flash log, not the RAM ring
+static char line[TELEMETRY_LINE_SIZE + 1];
+static uint8_t line_length;
+static bool line_overflow;
+
+/**
+ * @brief  Appends value as digits hex digits
+ * @return End of the digits
+ */
+static char* Hex(char *out, uint32_t value, uint8_t digits) {
+	for (int8_t i = digits - 1; i >= 0; --i) {
+		out[i] = "0123456789abcdef"[value & 0xF];
+		value >>= 4;
+	}
+	return out + digits;
+}
+/**
+ * @brief  Appends a space and value as hex
+ * @return End of the digits
+ */
+static char* Field(char *out, uint32_t value, uint8_t digits) {
+	*out++ = ' ';
+	return Hex(out, value, digits);
+}
+/**
+ * @brief  Writes text and a line end (the caller checked the space)
+ * @return None
+ */
+static void WriteLine(const char *text, uint32_t length) {
+	UsbCdc_Write(text, length);
+	UsbCdc_Write("\r\n", 2);
+}
+/**
+ * @brief  Writes one "F" line per published frame while they fit
+ * @return None
+ */
+static void StreamFrames(void) {
+	uint32_t head = frame_ring.head;
+	if (head - next_frame > FRAME_RING_CAPACITY) {
+		telemetry_stats.frames_dropped += head - next_frame
+				- FRAME_RING_CAPACITY;
+		next_frame = head - FRAME_RING_CAPACITY;
+	}
+	while (next_frame != head && UsbCdc_WriteSpace() >= FRAME_LINE_SIZE) {
+		LedFrame frame;
+		if (FrameRing_Read(next_frame, &frame)) {
+			char text[FRAME_LINE_SIZE];
+			char *end = text;
+			*end++ = 'F';
+			end = Field(end, next_frame, 8);
+			end = Field(end, frame.tick, 8);
+			end = Field(end, frame.leds, 4);
+			end = Field(end, frame.buttons, 4);
+			for (uint8_t i = 0; i < FRAME_RING_STATIONS; ++i) {
+				end = Field(end, frame.state[i], 2);
+				end = Field(end, frame.level[i], 2);
+				end = Field(end, frame.index[i], 2);
+			}
+			WriteLine(text, end - text);
+			++telemetry_stats.frames_sent;
+		} else {
+			++telemetry_stats.frames_dropped; // Overwritten while reading
+		}
+		++next_frame;
+	}
+}
+/**
+ * @brief  Writes the next "R" line of a session dump, then "ok"
+ * @return None
+ */
+static void DumpSessions(void) {
+	/* Each record leaves room for the final "ok" */
+	while (dump_age >= 0 && UsbCdc_WriteSpace() >= RECORD_LINE_SIZE + 4) {
+		SessionRecord copy;
+		const SessionRecord *record = &copy;
+		if (!dump_history) {
+			record = SessionLog_Latest(dump_age);
+		} else {
+			NorLogRead read = SessionLog_History(dump_age, &copy);
+			if (read == NOR_LOG_BUSY) {
+				return; // Try again while the flash is idle
+			}
+			if (read != NOR_LOG_FOUND) {
+				record = nullptr; // Cut short by a power loss
+			}
+		}
+		--dump_age;
+		if (record == nullptr) {
+			continue; // Overwritten by a game that ended meanwhile
+		}
+		char text[RECORD_LINE_SIZE];
+		char *end = text;
+		*end++ = 'R';
+		*end++ = ' ';
+		const uint8_t *bytes = reinterpret_cast<const uint8_t*>(record);
+		for (uint32_t i = 0; i < sizeof(SessionRecord); ++i) {
+			end = Hex(end, bytes[i], 2);
+		}
+		WriteLine(text, end - text);
+	}
+	if (dump_age < 0) {
+		WriteLine("ok", 2);
+	}
+}
+/**
+ * @brief  Runs one command line
+ * @return true if the command was valid
+ */
+static bool Execute(char *command) {
+	if (strcmp(command, "frames on") == 0) {
+		streaming = true;
+		next_frame = frame_ring.head;
+	} else if (strcmp(command, "frames off") == 0) {
+		streaming = false;
+	} else if (strcmp(command, "sessions") == 0) {
+		int32_t records = 0;
+		while (SessionLog_Latest(records) != nullptr) {
+			++records;
+		}
+		dump_age = records - 1;
+		dump_history = false;
+		DumpSessions();
+		return true; // DumpSessions() answers "ok" when done
+	} else if (strncmp(command, "history ", 8) == 0) {
+		char *end;
+		uint32_t records = strtoul(command + 8, &end, 16);
+		if (end == command + 8 || *end != '\0') {
+			return false;
+		}
+		if (records > nor_log_stats.entries) {
+			records = nor_log_stats.entries;
+		}
+		dump_age = static_cast<int32_t>(records) - 1;
+		dump_history = true;
+		DumpSessions();
+		return true;
+	} else if (strcmp(command, "stats") == 0) {
+		char text[REPLY_RESERVE];
+		char *end = text;
+		*end++ = 'S';
+		end = Field(end, clock_guard_stats.failovers, 8);
+		end = Field(end, clock_guard_stats.on_hsi, 1);
+		end = Field(end, record_auth_stats.cycles_per_block, 8);
+		end = Field(end, record_auth_stats.provisioned, 1);
+		end = Field(end, telemetry_stats.frames_sent, 8);
+		end = Field(end, telemetry_stats.frames_dropped, 8);
+		end = Field(end, brightness_stats.on_us, 4);
+		end = Field(end, brightness_stats.isr_cycles_max, 4);
+		end = Field(end, brightness_stats.peak_ma, 2);
+		end = Field(end, battery_stats.vdd_mv, 4);
+		end = Field(end, battery_stats.percent, 2);
+		WriteLine(text, end - text);
+	} else if (strcmp(command, "brightness auto") == 0) {
+		Brightness_SetAuto(true);
+	} else if (strcmp(command, "brightness full") == 0) {
+		Brightness_SetAuto(false);
+	} else if (strncmp(command, "provision ", 10) == 0) {
+		const char *secret = command + 10;
+		if (!RecordAuth_Provision(secret, strlen(secret))) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+	WriteLine("ok", 2);
+	return true;
+}
+/**
+ * @brief  Collects received bytes into a line and runs it at the line end
+ * @return None
+ */
+static void ReadCommands(void) {
+	/* One byte at a time, so every command finds room for its reply and
+	 none runs while a dump is still being written */
+	char c;
+	while (dump_age < 0 && UsbCdc_WriteSpace() >= REPLY_RESERVE
+			&& UsbCdc_Read(&c, 1) == 1) {
+		if (c != '\r' && c != '\n') {
+			if (line_length < TELEMETRY_LINE_SIZE) {
+				line[line_length++] = c;
+			} else {
+				line_overflow = true;
+			}
+			continue;
+		}
+		if (line_length == 0 && !line_overflow) {
+			continue; // Second half of "\r\n", or an empty line
+		}
+		line[line_length] = '\0';
+		++telemetry_stats.commands;
+		if (line_overflow || !Execute(line)) {
+			WriteLine("error", 5);
+		}
+		memset(line, 0, sizeof(line)); // May have held a secret
+		line_length = 0;
+		line_overflow = false;
+	}
+}
+
+/**
+ * @brief  Serves the port: commands, session dumps and the frame stream.
+ *         Call from every main loop pass.
+ * @return None
+ */
+void Telemetry_Poll(void) {
+	if (!UsbCdc_IsConnected()) {
+		if (connected) {
+			connected = false;
+			streaming = false;
+			dump_age = -1;
+			line_length = 0;
+			line_overflow = false;
+		}
+		UsbCdc_Poll();
+		return;
+	}
+	connected = true;
+	if (dump_age >= 0) {
+		DumpSessions();
+	}
+	ReadCommands();
+	if (streaming) {
+		StreamFrames();
+	}
+	UsbCdc_Poll();
+}
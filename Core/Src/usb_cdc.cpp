@@ -0,0 +1,274 @@
+/*
+ * @brief USB CDC-ACM class
+ * Ownership keeps the two contexts apart without locks: the interrupt only
+ * touches the transfer in flight and the OUT buffer it was given, the main
+ * loop only the buffers it fills and reads. The hand-overs are single
+ * flags (tx_busy, rx_full, rx_waiting) written by one side each time.
+ */
+#include "usb_cdc.h"
+#include <string.h>
+
+// CDC 1.2 class requests
+constexpr uint8_t SET_LINE_CODING = 0x20;
+constexpr uint8_t GET_LINE_CODING = 0x21;
+constexpr uint8_t SET_CONTROL_LINE_STATE = 0x22;
+constexpr uint8_t SEND_BREAK = 0x23;
+
+constexpr uint8_t LINE_CODING_SIZE = 7;
+constexpr uint8_t CONTROL_LINE_DTR = 0x01;
+
+// VID/PID of ST's virtual COM port, recognised by every host without a driver
+static const uint8_t DEVICE_DESCRIPTOR[] = { 18, USB_DESCRIPTOR_DEVICE, 0x00,
+		0x02, 0x02, 0x00, 0x00, USB_EP0_PACKET_SIZE, 0x83, 0x04, 0x40, 0x57,
+		0x00, 0x02, 1, 2, 3, 1 };
+
+static const uint8_t CONFIGURATION_DESCRIPTOR[] = {
+	/* Configuration: 2 interfaces, bus powered, 100 mA */
+	9, USB_DESCRIPTOR_CONFIGURATION, 67, 0, 2, 1, 0, 0x80, 50,
+	/* Interface 0: communication class, abstract control model */
+	9, 4, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+	5, 0x24, 0x00, 0x10, 0x01,         // Header, CDC 1.10
+	5, 0x24, 0x01, 0x00, 1,            // Call management, data on interface 1
+	4, 0x24, 0x02, 0x02,               // ACM: line coding and line state
+	5, 0x24, 0x06, 0, 1,               // Union: interface 0 controls 1
+	7, 5, USB_CDC_NOTIFY_EP, USB_EP_INTERRUPT, USB_CDC_NOTIFY_PACKET_SIZE, 0,
+	16,
+	/* Interface 1: data class, bulk endpoints */
+	9, 4, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+	7, 5, USB_CDC_DATA_OUT_EP, USB_EP_BULK, USB_CDC_PACKET_SIZE, 0, 0,
+	7, 5, USB_CDC_DATA_IN_EP, USB_EP_BULK, USB_CDC_PACKET_SIZE, 0, 0 };
+
+static_assert(sizeof(CONFIGURATION_DESCRIPTOR) == 67,
+		"wTotalLength of the configuration descriptor");
+
+static bool dtr;
+static void (*open_handler)(void);
+static UsbCdcLineCoding line_coding = { 115200, 0, 0, 8 };
+static uint8_t line_coding_reply[LINE_CODING_SIZE];
+
+static uint8_t tx_buffers[2][USB_CDC_TX_BUFFER_SIZE];
+static uint32_t tx_fill_length;      // Main loop: bytes in tx_buffers[tx_fill]
+static uint8_t tx_fill;
+static uint32_t tx_last_length;      // Length of the last transfer started
+static volatile bool tx_busy;        // Main loop sets, interrupt clears
+
+static uint8_t rx_buffers[2][USB_CDC_PACKET_SIZE];
+static volatile uint16_t rx_length[2];
+static volatile bool rx_full[2];     // Interrupt sets, main loop clears
+static volatile bool rx_waiting;     // Both full, the endpoint NAKs
+static uint8_t rx_armed;             // Buffer given to the endpoint
+static uint8_t rx_read;              // Main loop: buffer read next
+static uint16_t rx_offset;
+
+/**
+ * @brief  Forgets the transfers of the last configuration (USB interrupt)
+ * @return None
+ */
+static void Reset(void) {
+	dtr = false;
+	tx_busy = false;
+	tx_fill_length = 0;
+	tx_last_length = 0;
+	rx_full[0] = rx_full[1] = false;
+	rx_waiting = false;
+	rx_read = 0;
+	rx_offset = 0;
+	rx_armed = 0;
+}
+/**
+ * @brief  Opens the data endpoints and starts receiving (USB interrupt)
+ * @return None
+ */
+static void Configure(void) {
+	const UsbDriver *usb = UsbDevice_Driver();
+	usb->open(USB_CDC_DATA_IN_EP, USB_EP_BULK, USB_CDC_PACKET_SIZE);
+	usb->open(USB_CDC_DATA_OUT_EP, USB_EP_BULK, USB_CDC_PACKET_SIZE);
+	usb->open(USB_CDC_NOTIFY_EP, USB_EP_INTERRUPT, USB_CDC_NOTIFY_PACKET_SIZE);
+	usb->receive(USB_CDC_DATA_OUT_EP, rx_buffers[0], USB_CDC_PACKET_SIZE);
+}
+/**
+ * @brief  CDC-ACM requests (USB interrupt)
+ * @return false to stall
+ */
+static bool Setup(const UsbSetup *setup) {
+	if ((setup->request_type & USB_REQUEST_TYPE_MASK)
+			!= USB_REQUEST_TYPE_CLASS) {
+		return false;
+	}
+	switch (setup->request) {
+	case SET_LINE_CODING:
+		UsbDevice_ControlReceive();
+		return true;
+	case GET_LINE_CODING:
+		memcpy(line_coding_reply, &line_coding.baud_rate, 4); // Little endian
+		line_coding_reply[4] = line_coding.stop_bits;
+		line_coding_reply[5] = line_coding.parity;
+		line_coding_reply[6] = line_coding.data_bits;
+		UsbDevice_ControlSend(line_coding_reply, LINE_CODING_SIZE);
+		return true;
+	case SET_CONTROL_LINE_STATE: {
+		bool opened = !dtr && (setup->value & CONTROL_LINE_DTR);
+		dtr = setup->value & CONTROL_LINE_DTR;
+		UsbDevice_ControlAcknowledge();
+		if (opened && open_handler != nullptr) {
+			open_handler();
+		}
+		return true;
+	}
+	case SEND_BREAK:
+		UsbDevice_ControlAcknowledge();
+		return true;
+	default:
+		return false;
+	}
+}
+/**
+ * @brief  Data stage of SET_LINE_CODING (USB interrupt)
+ * @return false to stall
+ */
+static bool ControlOut(const UsbSetup *setup, const uint8_t *data,
+		uint16_t length) {
+	if (setup->request != SET_LINE_CODING || length < LINE_CODING_SIZE) {
+		return false;
+	}
+	memcpy(&line_coding.baud_rate, data, 4);
+	line_coding.stop_bits = data[4];
+	line_coding.parity = data[5];
+	line_coding.data_bits = data[6];
+	return true;
+}
+/**
+ * @brief  A packet has arrived on the data OUT endpoint (USB interrupt)
+ * @return None
+ */
+static void Out(uint8_t ep, uint16_t length) {
+	const UsbDriver *usb = UsbDevice_Driver();
+	if (ep != USB_CDC_DATA_OUT_EP) {
+		return;
+	}
+	uint8_t filled = rx_armed;
+	if (length == 0) {
+		usb->receive(ep, rx_buffers[filled], USB_CDC_PACKET_SIZE);
+		return;
+	}
+	rx_length[filled] = length;
+	rx_full[filled] = true;
+	uint8_t other = filled ^ 1;
+	if (!rx_full[other]) {
+		rx_armed = other;
+		usb->receive(ep, rx_buffers[other], USB_CDC_PACKET_SIZE);
+	} else {
+		rx_waiting = true;
+	}
+}
+/**
+ * @brief  The data IN transfer has been delivered (USB interrupt)
+ * @return None
+ */
+static void InComplete(uint8_t ep) {
+	if (ep == USB_CDC_DATA_IN_EP) {
+		tx_busy = false;
+	}
+}
+
+const UsbClass usb_cdc_class = { DEVICE_DESCRIPTOR, CONFIGURATION_DESCRIPTOR,
+		sizeof(CONFIGURATION_DESCRIPTOR), "Simon Says", "Simon Says Telemetry",
+		Reset, Configure, Setup, ControlOut, Out, InComplete };
+
+/**
+ * @brief  Sets a function the USB interrupt calls when a host opens the
+ *         port, i.e. when DTR rises
+ * @return None
+ */
+void UsbCdc_SetOpenHandler(void (*on_open)(void)) {
+	open_handler = on_open;
+}
+/**
+ * @brief  Checks whether a host has the port open (configured, DTR set)
+ */
+bool UsbCdc_IsConnected(void) {
+	return UsbDevice_IsConfigured() && dtr;
+}
+/**
+ * @brief  Queues data for the host; never waits
+ * @return Bytes accepted, less than length when the buffer is full
+ */
+uint32_t UsbCdc_Write(const void *data, uint32_t length) {
+	if (!UsbDevice_IsConfigured()) {
+		return 0;
+	}
+	uint32_t space = USB_CDC_TX_BUFFER_SIZE - tx_fill_length;
+	if (length > space) {
+		length = space;
+	}
+	memcpy(tx_buffers[tx_fill] + tx_fill_length, data, length);
+	tx_fill_length += length;
+	return length;
+}
+/**
+ * @brief  Bytes UsbCdc_Write() accepts right now
+ */
+uint32_t UsbCdc_WriteSpace(void) {
+	return UsbDevice_IsConfigured() ?
+			USB_CDC_TX_BUFFER_SIZE - tx_fill_length : 0;
+}
+/**
+ * @brief  Takes received data; never waits
+ * @return Bytes copied
+ */
+uint32_t UsbCdc_Read(void *data, uint32_t max_length) {
+	uint8_t *out = static_cast<uint8_t*>(data);
+	uint32_t copied = 0;
+	while (copied < max_length && rx_full[rx_read]) {
+		uint32_t take = rx_length[rx_read] - rx_offset;
+		if (take > max_length - copied) {
+			take = max_length - copied;
+		}
+		memcpy(out + copied, rx_buffers[rx_read] + rx_offset, take);
+		copied += take;
+		rx_offset += take;
+		if (rx_offset == rx_length[rx_read]) {
+			rx_offset = 0;
+			rx_full[rx_read] = false;
+			/* The interrupt re-arms the endpoint itself unless both were full */
+			if (rx_waiting) {
+				rx_waiting = false;
+				rx_armed = rx_read;
+				UsbDevice_Driver()->receive(USB_CDC_DATA_OUT_EP,
+						rx_buffers[rx_read], USB_CDC_PACKET_SIZE);
+			}
+			rx_read ^= 1;
+		}
+	}
+	return copied;
+}
+/**
+ * @brief  Starts the next IN transfer when the previous one is done: the
+ *         filled buffer goes out and the other one takes new writes
+ * @return None
+ */
+void UsbCdc_Poll(void) {
+	if (!UsbDevice_IsConfigured() || tx_busy) {
+		return;
+	}
+	if (tx_fill_length > 0) {
+		tx_last_length = tx_fill_length;
+		tx_busy = true;
+		UsbDevice_Driver()->transmit(USB_CDC_DATA_IN_EP, tx_buffers[tx_fill],
+				tx_fill_length);
+		tx_fill ^= 1;
+		tx_fill_length = 0;
+	} else if (tx_last_length > 0 && tx_last_length % USB_CDC_PACKET_SIZE == 0) {
+		/* A transfer of whole packets is only complete for the host after a
+		 short packet */
+		tx_last_length = 0;
+		tx_busy = true;
+		UsbDevice_Driver()->transmit(USB_CDC_DATA_IN_EP, nullptr, 0);
+	}
+}
+/**
+ * @brief  Line settings last set by the host
+ */
+const UsbCdcLineCoding* UsbCdc_LineCoding(void) {
+	return &line_coding;
+}
@@ -0,0 +1,286 @@
+/*
+ * @brief USB device core
+ * Endpoint 0 runs one control transfer at a time through the stages below;
+ * a new SETUP always starts over, whatever stage the last request reached.
+ */
+#include "usb_device.h"
+#include <string.h>
+
+// Standard request codes (USB 2.0 chapter 9)
+constexpr uint8_t GET_STATUS = 0x00;
+constexpr uint8_t CLEAR_FEATURE = 0x01;
+constexpr uint8_t SET_FEATURE = 0x03;
+constexpr uint8_t SET_ADDRESS = 0x05;
+constexpr uint8_t GET_DESCRIPTOR = 0x06;
+constexpr uint8_t GET_CONFIGURATION = 0x08;
+constexpr uint8_t SET_CONFIGURATION = 0x09;
+constexpr uint8_t GET_INTERFACE = 0x0A;
+constexpr uint8_t SET_INTERFACE = 0x0B;
+
+static const uint8_t LANGUAGE_STRING[] = { 4, USB_DESCRIPTOR_STRING, 0x09,
+		0x04 };
+
+/* Stage of the control transfer on endpoint 0 */
+enum ControlStage {
+	CONTROL_IDLE,
+	CONTROL_DATA_IN,
+	CONTROL_DATA_OUT,
+	CONTROL_STATUS_IN,
+	CONTROL_STATUS_OUT
+};
+
+static const UsbDriver *usb;
+static const UsbClass *device_class;
+static char serial[USB_MAX_SERIAL_LENGTH + 1];
+static uint8_t configuration;
+
+static UsbSetup request;             // Request in progress
+static ControlStage control_stage;
+static const uint8_t *control_data;  // Rest of the IN data stage
+static uint16_t control_remaining;
+static bool control_short_end;       // IN data stage ends with a ZLP
+static uint8_t control_buffer[USB_EP0_PACKET_SIZE]; // Strings, OUT data
+
+static_assert(sizeof(control_buffer) >= 2 + 2 * USB_MAX_SERIAL_LENGTH,
+		"room for the serial number string");
+
+/**
+ * @brief  Sends the next packet of the IN data stage
+ * @return None
+ */
+static void SendControlPacket(void) {
+	uint16_t length = control_remaining < USB_EP0_PACKET_SIZE ?
+			control_remaining : USB_EP0_PACKET_SIZE;
+	if (length < USB_EP0_PACKET_SIZE) {
+		control_short_end = false; // This packet is short and ends the stage
+	}
+	usb->transmit(0x80, control_data, length);
+	control_data += length;
+	control_remaining -= length;
+}
+/**
+ * @brief  Rejects the request in progress
+ * @return None
+ */
+static void ControlStall(void) {
+	control_stage = CONTROL_IDLE;
+	usb->stall(0x80);
+	usb->stall(0x00);
+}
+/**
+ * @brief  Builds a string descriptor from ASCII in control_buffer
+ * @return Descriptor length
+ */
+static uint8_t StringDescriptor(const char *text) {
+	uint8_t length = 2;
+	for (; *text != '\0' && length + 2U <= sizeof(control_buffer); ++text) {
+		control_buffer[length++] = *text;
+		control_buffer[length++] = 0;
+	}
+	control_buffer[0] = length;
+	control_buffer[1] = USB_DESCRIPTOR_STRING;
+	return length;
+}
+/**
+ * @brief  Chapter 9 requests
+ * @return false if the class should get the request
+ */
+static bool StandardRequest(void) {
+	static const uint8_t ZEROES[2] = { };
+	switch (request.request) {
+	case GET_STATUS:
+		UsbDevice_ControlSend(ZEROES, 2);
+		return true;
+	case CLEAR_FEATURE:
+	case SET_FEATURE:
+	case SET_INTERFACE:
+		UsbDevice_ControlAcknowledge();
+		return true;
+	case SET_ADDRESS:
+		usb->set_address(request.value & 0x7F);
+		UsbDevice_ControlAcknowledge();
+		return true;
+	case GET_CONFIGURATION:
+		UsbDevice_ControlSend(&configuration, 1);
+		return true;
+	case GET_INTERFACE:
+		UsbDevice_ControlSend(ZEROES, 1);
+		return true;
+	case SET_CONFIGURATION:
+		if (request.value > 1) {
+			return false;
+		}
+		configuration = request.value;
+		device_class->reset();
+		if (configuration != 0) {
+			device_class->configure();
+		}
+		UsbDevice_ControlAcknowledge();
+		return true;
+	case GET_DESCRIPTOR:
+		break;
+	default:
+		return false;
+	}
+
+	uint8_t index = request.value & 0xFF;
+	switch (request.value >> 8) {
+	case USB_DESCRIPTOR_DEVICE:
+		UsbDevice_ControlSend(device_class->device_descriptor,
+				device_class->device_descriptor[0]);
+		return true;
+	case USB_DESCRIPTOR_CONFIGURATION:
+		UsbDevice_ControlSend(device_class->configuration_descriptor,
+				device_class->configuration_length);
+		return true;
+	case USB_DESCRIPTOR_STRING:
+		if (index == 0) {
+			UsbDevice_ControlSend(LANGUAGE_STRING, sizeof(LANGUAGE_STRING));
+			return true;
+		}
+		if (index > 3) {
+			return false;
+		}
+		UsbDevice_ControlSend(control_buffer,
+				StringDescriptor(
+						index == 1 ? device_class->manufacturer :
+						index == 2 ? device_class->product : serial));
+		return true;
+	default:
+		return false; // Class descriptors; the device qualifier stalls there
+	}
+}
+
+/**
+ * @brief  Sets the controller, the class and the serial number string
+ * @param  serial_number: ASCII, at most USB_MAX_SERIAL_LENGTH characters
+ *         are used
+ * @return None
+ */
+void UsbDevice_Init(const UsbDriver *driver, const UsbClass *usb_class,
+		const char *serial_number) {
+	usb = driver;
+	device_class = usb_class;
+	strncpy(serial, serial_number, USB_MAX_SERIAL_LENGTH);
+	serial[USB_MAX_SERIAL_LENGTH] = '\0';
+	UsbDevice_OnReset();
+}
+/**
+ * @brief  Bus reset: back to the default state (USB interrupt)
+ * @return None
+ */
+void UsbDevice_OnReset(void) {
+	configuration = 0;
+	control_stage = CONTROL_IDLE;
+	device_class->reset();
+}
+/**
+ * @brief  Handles a SETUP packet (USB interrupt)
+ * @param  setup: the 8 bytes of the packet
+ * @return None
+ */
+void UsbDevice_OnSetup(const uint8_t setup[8]) {
+	request.request_type = setup[0];
+	request.request = setup[1];
+	request.value = setup[2] | setup[3] << 8;
+	request.index = setup[4] | setup[5] << 8;
+	request.length = setup[6] | setup[7] << 8;
+	control_stage = CONTROL_IDLE;
+
+	bool handled = (request.request_type & USB_REQUEST_TYPE_MASK)
+			== USB_REQUEST_TYPE_STANDARD && StandardRequest();
+	if (!handled) {
+		handled = device_class->setup(&request);
+	}
+	/* A device-to-host request cannot take an OUT data stage */
+	if (!handled || ((request.request_type & USB_REQUEST_DEVICE_TO_HOST) != 0
+			&& control_stage == CONTROL_DATA_OUT)) {
+		ControlStall();
+	}
+}
+/**
+ * @brief  An OUT packet has arrived in the buffer given to receive() (USB
+ *         interrupt)
+ * @return None
+ */
+void UsbDevice_OnOut(uint8_t ep, uint16_t length) {
+	if (ep != 0x00) {
+		device_class->out(ep, length);
+		return;
+	}
+	if (control_stage == CONTROL_DATA_OUT) {
+		if (length >= request.length
+				&& device_class->control_out(&request, control_buffer,
+						length)) {
+			UsbDevice_ControlAcknowledge();
+		} else {
+			ControlStall();
+		}
+	} else {
+		control_stage = CONTROL_IDLE; // Status stage of an IN request
+	}
+}
+/**
+ * @brief  An IN transfer has been delivered to the host (USB interrupt)
+ * @return None
+ */
+void UsbDevice_OnInComplete(uint8_t ep) {
+	if (ep != 0x80) {
+		device_class->in_complete(ep);
+		return;
+	}
+	if (control_stage == CONTROL_DATA_IN) {
+		if (control_remaining > 0 || control_short_end) {
+			SendControlPacket();
+		} else {
+			control_stage = CONTROL_STATUS_OUT;
+			usb->receive(0x00, control_buffer, USB_EP0_PACKET_SIZE);
+		}
+	} else if (control_stage == CONTROL_STATUS_IN) {
+		control_stage = CONTROL_IDLE;
+	}
+}
+
+/**
+ * @brief  Controller the classes send and receive with
+ */
+const UsbDriver* UsbDevice_Driver(void) {
+	return usb;
+}
+/**
+ * @brief  Checks whether the host has selected the configuration
+ */
+bool UsbDevice_IsConfigured(void) {
+	return configuration != 0;
+}
+/**
+ * @brief  Answers the request in progress with an IN data stage. The reply
+ *         is cut to wLength; data must stay valid until the transfer ends.
+ * @return None
+ */
+void UsbDevice_ControlSend(const uint8_t *data, uint16_t length) {
+	control_data = data;
+	control_remaining = length < request.length ? length : request.length;
+	/* A reply shorter than requested ends with a short packet, which is a
+	 zero-length one when it fills its last packet exactly */
+	control_short_end = control_remaining < request.length;
+	control_stage = CONTROL_DATA_IN;
+	SendControlPacket();
+}
+/**
+ * @brief  Takes the OUT data stage of the request in progress (at most one
+ *         packet); the class gets it through its control_out hook
+ * @return None
+ */
+void UsbDevice_ControlReceive(void) {
+	control_stage = CONTROL_DATA_OUT;
+	usb->receive(0x00, control_buffer, USB_EP0_PACKET_SIZE);
+}
+/**
+ * @brief  Completes a request with a zero-length IN status stage
+ * @return None
+ */
+void UsbDevice_ControlAcknowledge(void) {
+	control_stage = CONTROL_STATUS_IN;
+	usb->transmit(0x80, nullptr, 0);
+}
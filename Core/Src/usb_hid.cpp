@@ -0,0 +1,267 @@
+/*
+ * @brief USB HID gamepad class
+ * The button edge interrupt only records the new mask and, for the first
+ * edge since the last report, its time. UsbHid_Poll() takes both and owns
+ * the report buffer until the USB interrupt clears report_busy.
+ */
+#include "usb_hid.h"
+
+// HID 1.11 class requests and descriptor types
+constexpr uint8_t GET_REPORT = 0x01;
+constexpr uint8_t GET_IDLE = 0x02;
+constexpr uint8_t GET_PROTOCOL = 0x03;
+constexpr uint8_t SET_REPORT = 0x09;
+constexpr uint8_t SET_IDLE = 0x0A;
+constexpr uint8_t SET_PROTOCOL = 0x0B;
+constexpr uint8_t GET_DESCRIPTOR = 0x06;
+constexpr uint8_t DESCRIPTOR_HID = 0x21;
+constexpr uint8_t DESCRIPTOR_REPORT = 0x22;
+constexpr uint8_t REPORT_TYPE_INPUT = 1;
+constexpr uint8_t REPORT_TYPE_OUTPUT = 2;
+constexpr uint8_t REPORT_PROTOCOL = 1;
+constexpr uint32_t IDLE_UNIT_US = 4000;
+
+// VID/PID of ST's joystick demo
+static const uint8_t DEVICE_DESCRIPTOR[] = { 18, USB_DESCRIPTOR_DEVICE, 0x00,
+		0x02, 0x00, 0x00, 0x00, USB_EP0_PACKET_SIZE, 0x83, 0x04, 0x10, 0x57,
+		0x00, 0x02, 1, 2, 3, 1 };
+
+static const uint8_t REPORT_DESCRIPTOR[] = {
+	0x05, 0x01, // Usage page: generic desktop
+	0x09, 0x05, // Usage: game pad
+	0xA1, 0x01, // Collection: application
+	0x05, 0x09, //   Usage page: button
+	0x19, 0x01, //   Usage minimum: 1
+	0x29, 0x08, //   Usage maximum: 8
+	0x15, 0x00, //   Logical minimum: 0
+	0x25, 0x01, //   Logical maximum: 1
+	0x75, 0x01, //   Report size: 1 bit
+	0x95, 0x08, //   Report count: 8
+	0x81, 0x02, //   Input: data, variable, absolute
+	0x05, 0x08, //   Usage page: LEDs
+	0x19, 0x01, //   Usage minimum: 1
+	0x29, 0x08, //   Usage maximum: 8
+	0x91, 0x02, //   Output: data, variable, absolute
+	0xC0 };     // End collection
+
+constexpr uint8_t HID_DESCRIPTOR_OFFSET = 18;
+static const uint8_t CONFIGURATION_DESCRIPTOR[] = {
+	/* Configuration: 1 interface, bus powered, 100 mA */
+	9, USB_DESCRIPTOR_CONFIGURATION, 41, 0, 1, 1, 0, 0x80, 50,
+	/* Interface 0: HID, no boot protocol */
+	9, 4, 0, 0, 2, 0x03, 0x00, 0x00, 0,
+	9, DESCRIPTOR_HID, 0x11, 0x01, 0, 1, DESCRIPTOR_REPORT,
+	sizeof(REPORT_DESCRIPTOR), 0,
+	7, 5, USB_HID_REPORT_EP, USB_EP_INTERRUPT, USB_HID_PACKET_SIZE, 0,
+	USB_HID_POLL_MS,
+	7, 5, USB_HID_OUTPUT_EP, USB_EP_INTERRUPT, USB_HID_PACKET_SIZE, 0,
+	USB_HID_POLL_MS };
+
+static_assert(sizeof(CONFIGURATION_DESCRIPTOR) == 41,
+		"wTotalLength of the configuration descriptor");
+
+UsbHidStats usb_hid_stats;
+
+static uint32_t (*clock_us)(void);
+static volatile uint8_t buttons;       // Debounced mask, from EXTI
+static volatile uint32_t change_us;    // First edge not yet reported
+static volatile bool change_pending;
+static volatile uint8_t leds;
+static uint8_t idle_rate;              // 4 ms units, 0: only on change
+
+static uint8_t report[1];              // Transfer buffer of the IN endpoint
+static uint32_t report_change_us;
+static bool report_is_change;          // Not an idle-rate repeat
+static bool reported_once;             // Since the configuration
+static uint32_t report_sent_us;
+static volatile bool report_busy;      // Main loop sets, interrupt clears
+static uint8_t output[USB_HID_PACKET_SIZE];
+static uint8_t reply[1];               // GET_REPORT, GET_IDLE, GET_PROTOCOL
+
+/**
+ * @brief  Forgets the last configuration (USB interrupt)
+ * @return None
+ */
+static void Reset(void) {
+	report_busy = false;
+	reported_once = false;
+	change_pending = false; // The first report carries the state anyway
+	idle_rate = 0;
+}
+/**
+ * @brief  Opens the endpoints; UsbHid_Poll() then reports the current state
+ *         (USB interrupt)
+ * @return None
+ */
+static void Configure(void) {
+	const UsbDriver *usb = UsbDevice_Driver();
+	usb->open(USB_HID_REPORT_EP, USB_EP_INTERRUPT, USB_HID_PACKET_SIZE);
+	usb->open(USB_HID_OUTPUT_EP, USB_EP_INTERRUPT, USB_HID_PACKET_SIZE);
+	usb->receive(USB_HID_OUTPUT_EP, output, sizeof(output));
+}
+/**
+ * @brief  HID descriptors and class requests (USB interrupt)
+ * @return false to stall
+ */
+static bool Setup(const UsbSetup *setup) {
+	if ((setup->request_type & USB_REQUEST_TYPE_MASK)
+			== USB_REQUEST_TYPE_STANDARD) {
+		if (setup->request != GET_DESCRIPTOR) {
+			return false;
+		}
+		switch (setup->value >> 8) {
+		case DESCRIPTOR_REPORT:
+			UsbDevice_ControlSend(REPORT_DESCRIPTOR, sizeof(REPORT_DESCRIPTOR));
+			return true;
+		case DESCRIPTOR_HID:
+			UsbDevice_ControlSend(
+					CONFIGURATION_DESCRIPTOR + HID_DESCRIPTOR_OFFSET, 9);
+			return true;
+		default:
+			return false;
+		}
+	}
+	if ((setup->request_type & USB_REQUEST_TYPE_MASK)
+			!= USB_REQUEST_TYPE_CLASS) {
+		return false;
+	}
+	switch (setup->request) {
+	case GET_REPORT:
+		if ((setup->value >> 8) == REPORT_TYPE_INPUT) {
+			reply[0] = buttons;
+		} else if ((setup->value >> 8) == REPORT_TYPE_OUTPUT) {
+			reply[0] = leds;
+		} else {
+			return false;
+		}
+		UsbDevice_ControlSend(reply, 1);
+		return true;
+	case GET_IDLE:
+		reply[0] = idle_rate;
+		UsbDevice_ControlSend(reply, 1);
+		return true;
+	case GET_PROTOCOL:
+		reply[0] = REPORT_PROTOCOL;
+		UsbDevice_ControlSend(reply, 1);
+		return true;
+	case SET_REPORT:
+		if ((setup->value >> 8) != REPORT_TYPE_OUTPUT) {
+			return false;
+		}
+		UsbDevice_ControlReceive();
+		return true;
+	case SET_IDLE:
+		idle_rate = setup->value >> 8;
+		UsbDevice_ControlAcknowledge();
+		return true;
+	case SET_PROTOCOL:
+		UsbDevice_ControlAcknowledge();
+		return true;
+	default:
+		return false;
+	}
+}
+/**
+ * @brief  Output report sent by SET_REPORT (USB interrupt)
+ * @return false to stall
+ */
+static bool ControlOut(const UsbSetup *setup, const uint8_t *data,
+		uint16_t length) {
+	if (setup->request != SET_REPORT || length < 1) {
+		return false;
+	}
+	leds = data[0];
+	return true;
+}
+/**
+ * @brief  Output report on the interrupt OUT endpoint (USB interrupt)
+ * @return None
+ */
+static void Out(uint8_t ep, uint16_t length) {
+	if (ep != USB_HID_OUTPUT_EP) {
+		return;
+	}
+	if (length >= 1) {
+		leds = output[0];
+	}
+	UsbDevice_Driver()->receive(USB_HID_OUTPUT_EP, output, sizeof(output));
+}
+/**
+ * @brief  The host has collected the input report (USB interrupt)
+ * @return None
+ */
+static void InComplete(uint8_t ep) {
+	if (ep != USB_HID_REPORT_EP) {
+		return;
+	}
+	report_sent_us = clock_us();
+	report_busy = false;
+	if (!report_is_change) {
+		return;
+	}
+	uint32_t latency_us = report_sent_us - report_change_us;
+	usb_hid_stats.latency_last_us = latency_us;
+	if (latency_us > usb_hid_stats.latency_max_us) {
+		usb_hid_stats.latency_max_us = latency_us;
+	}
+	usb_hid_stats.latency_sum_us += latency_us;
+	++usb_hid_stats.reports;
+}
+
+const UsbClass usb_hid_class = { DEVICE_DESCRIPTOR, CONFIGURATION_DESCRIPTOR,
+		sizeof(CONFIGURATION_DESCRIPTOR), "Simon Says", "Simon Says Gamepad",
+		Reset, Configure, Setup, ControlOut, Out, InComplete };
+
+/**
+ * @brief  Sets the microsecond clock for the latency statistics and the
+ *         idle rate
+ * @return None
+ */
+void UsbHid_SetClock(uint32_t (*now_us)(void)) {
+	clock_us = now_us;
+}
+/**
+ * @brief  Takes a new debounced button mask (EXTI context, or with
+ *         interrupts masked)
+ * @param  time_us: when the change happened
+ * @return None
+ */
+void UsbHid_OnButtons(uint8_t mask, uint32_t time_us) {
+	buttons = mask;
+	if (!change_pending) {
+		change_us = time_us;
+		change_pending = true;
+	}
+}
+/**
+ * @brief  Queues an input report when the buttons changed, or when the idle
+ *         rate asks for a repeat, and the last one has been collected
+ * @return None
+ */
+void UsbHid_Poll(void) {
+	if (!UsbDevice_IsConfigured() || report_busy) {
+		return;
+	}
+	if (change_pending) {
+		report_is_change = true;
+		report_change_us = change_us;
+		/* Cleared before the mask is read: an edge in between is in this
+		 report and at worst repeated in the next one */
+		change_pending = false;
+	} else if (!reported_once || (idle_rate != 0
+			&& clock_us() - report_sent_us >= idle_rate * IDLE_UNIT_US)) {
+		report_is_change = false; // First report, or an idle-rate repeat
+	} else {
+		return;
+	}
+	reported_once = true;
+	report[0] = buttons;
+	report_busy = true;
+	UsbDevice_Driver()->transmit(USB_HID_REPORT_EP, report, sizeof(report));
+}
+/**
+ * @brief  LED mask last set by the host
+ */
+uint8_t UsbHid_Leds(void) {
+	return leds;
+}
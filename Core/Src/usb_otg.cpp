@@ -0,0 +1,346 @@
+/*
+ * @brief OTG FS device driver
+ * The PCD/LL USB modules are not part of the project; the core is driven by
+ * registers like TIM1 and DMA2 in attract.cpp. The classes use endpoints 0
+ * to 2 only.
+ */
+#include "main.h"
+#include "usb_otg.h"
+#include <string.h>
+
+constexpr uint8_t ENDPOINTS = 4;
+constexpr uint32_t TURNAROUND_TIME = 6; // GUSBCFG.TRDT for an AHB above 32 MHz
+constexpr uint32_t DEVICE_SPEED_FULL = 3; // Full speed, internal PHY
+constexpr uint32_t RX_STATUS_OUT_DATA = 2;
+constexpr uint32_t RX_STATUS_SETUP_DATA = 6;
+constexpr uint32_t SETUP_PACKETS = 3; // Back-to-back SETUPs EP0 accepts
+
+/* FIFO RAM (320 words): shared RX FIFO, then one TX FIFO per IN endpoint.
+ * Endpoint 1 holds eight packets so a whole transmit buffer fits. */
+constexpr uint32_t RX_FIFO_WORDS = 128;
+constexpr uint32_t EP0_TX_FIFO_WORDS = 16;
+constexpr uint32_t EP1_TX_FIFO_WORDS = 128;
+constexpr uint32_t EP2_TX_FIFO_WORDS = 16;
+static_assert(RX_FIFO_WORDS + EP0_TX_FIFO_WORDS + EP1_TX_FIFO_WORDS
+		+ EP2_TX_FIFO_WORDS <= 320, "OTG FS FIFO RAM");
+
+#define USB_DEVICE ((USB_OTG_DeviceTypeDef *)(USB_OTG_FS_PERIPH_BASE \
+		+ USB_OTG_DEVICE_BASE))
+#define USB_IN(ep) ((USB_OTG_INEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE \
+		+ USB_OTG_IN_ENDPOINT_BASE + (ep) * USB_OTG_EP_REG_SIZE))
+#define USB_OUT(ep) ((USB_OTG_OUTEndpointTypeDef *)(USB_OTG_FS_PERIPH_BASE \
+		+ USB_OTG_OUT_ENDPOINT_BASE + (ep) * USB_OTG_EP_REG_SIZE))
+#define USB_FIFO(ep) (*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE \
+		+ USB_OTG_FIFO_BASE + (ep) * USB_OTG_FIFO_SIZE))
+#define USB_PCGCCTL (*(__IO uint32_t *)(USB_OTG_FS_PERIPH_BASE \
+		+ USB_OTG_PCGCCTL_BASE))
+
+/* Transfer in progress on one endpoint */
+typedef struct {
+	const uint8_t *in_data;  // Bytes not yet in the TX FIFO
+	uint16_t in_remaining;
+	uint16_t max_packet;
+	uint8_t *out_buffer;
+	uint16_t out_max;
+	uint16_t out_count;
+} Endpoint;
+
+static Endpoint endpoints[ENDPOINTS];
+static uint8_t setup_packet[8];
+
+/**
+ * @brief  Waits for a GRSTCTL operation to finish
+ * @return None
+ */
+static void WaitReset(uint32_t bits) {
+	while (USB_OTG_FS->GRSTCTL & bits) {
+	}
+}
+/**
+ * @brief  Copies FIFO words out, dropping what does not fit in the buffer
+ * @return None
+ */
+static void ReadFifo(uint8_t *buffer, uint16_t room, uint16_t length) {
+	for (uint16_t i = 0; i < length; i += 4) {
+		uint32_t word = USB_FIFO(0);
+		uint16_t bytes = length - i < 4 ? length - i : 4;
+		if (i + bytes <= room) {
+			memcpy(buffer + i, &word, bytes);
+		}
+	}
+}
+/**
+ * @brief  Moves whole packets of the current IN transfer into the TX FIFO
+ *         while they fit (interrupt context)
+ * @return None
+ */
+static void FillTxFifo(uint8_t ep) {
+	Endpoint &endpoint = endpoints[ep];
+	while (endpoint.in_remaining > 0) {
+		uint16_t length = endpoint.in_remaining < endpoint.max_packet ?
+				endpoint.in_remaining : endpoint.max_packet;
+		uint16_t words = (length + 3) / 4;
+		if ((USB_IN(ep)->DTXFSTS & USB_OTG_DTXFSTS_INEPTFSAV) < words) {
+			return; // TXFE fires again when the FIFO drains
+		}
+		for (uint16_t i = 0; i < length; i += 4) {
+			uint32_t word = 0;
+			memcpy(&word, endpoint.in_data + i, length - i < 4 ? length - i : 4);
+			USB_FIFO(ep) = word;
+		}
+		endpoint.in_data += length;
+		endpoint.in_remaining -= length;
+	}
+	USB_DEVICE->DIEPEMPMSK &= ~(1U << ep);
+}
+
+/**
+ * @brief  Activates a non-control endpoint; IN endpoint n uses TX FIFO n
+ * @return None
+ */
+static void Open(uint8_t ep, UsbEndpointType type, uint16_t max_packet) {
+	uint8_t number = ep & 0x7F;
+	endpoints[number].max_packet = max_packet;
+	uint32_t control = max_packet | type << USB_OTG_DIEPCTL_EPTYP_Pos
+			| USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP;
+	if (ep & 0x80) {
+		USB_IN(number)->DIEPCTL = control | USB_OTG_DIEPCTL_SNAK
+				| number << USB_OTG_DIEPCTL_TXFNUM_Pos;
+		USB_DEVICE->DAINTMSK |= 1U << (USB_OTG_DAINTMSK_IEPM_Pos + number);
+	} else {
+		USB_OUT(number)->DOEPCTL = control | USB_OTG_DOEPCTL_SNAK;
+		USB_DEVICE->DAINTMSK |= 1U << (USB_OTG_DAINTMSK_OEPM_Pos + number);
+	}
+}
+/**
+ * @brief  Starts an IN transfer; called from the main loop and the interrupt
+ * @return None
+ */
+static void Transmit(uint8_t ep, const uint8_t *data, uint16_t length) {
+	uint8_t number = ep & 0x7F;
+	Endpoint &endpoint = endpoints[number];
+	uint32_t packets = length == 0 ? 1 :
+			(length + endpoint.max_packet - 1) / endpoint.max_packet;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	endpoint.in_data = data;
+	endpoint.in_remaining = length;
+	USB_IN(number)->DIEPTSIZ = packets << USB_OTG_DIEPTSIZ_PKTCNT_Pos | length;
+	USB_IN(number)->DIEPCTL |= USB_OTG_DIEPCTL_EPENA | USB_OTG_DIEPCTL_CNAK;
+	if (length > 0) {
+		USB_DEVICE->DIEPEMPMSK |= 1U << number;
+	}
+	__set_PRIMASK(primask);
+}
+/**
+ * @brief  Accepts one OUT packet; called from the main loop and the interrupt
+ * @return None
+ */
+static void Receive(uint8_t ep, uint8_t *buffer, uint16_t max_length) {
+	uint8_t number = ep & 0x7F;
+	Endpoint &endpoint = endpoints[number];
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	endpoint.out_buffer = buffer;
+	endpoint.out_max = max_length;
+	endpoint.out_count = 0;
+	uint32_t size = 1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos | max_length;
+	if (number == 0) {
+		size |= SETUP_PACKETS << USB_OTG_DOEPTSIZ_STUPCNT_Pos;
+	}
+	USB_OUT(number)->DOEPTSIZ = size;
+	USB_OUT(number)->DOEPCTL |= USB_OTG_DOEPCTL_EPENA | USB_OTG_DOEPCTL_CNAK;
+	__set_PRIMASK(primask);
+}
+/**
+ * @brief  Answers STALL until the host clears it (EP0: until the next SETUP)
+ * @return None
+ */
+static void Stall(uint8_t ep) {
+	uint8_t number = ep & 0x7F;
+	if (ep & 0x80) {
+		USB_IN(number)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+	} else {
+		USB_OUT(number)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+	}
+}
+/**
+ * @brief  The OTG core takes the new address at once; it only answers on it
+ *         after the status stage completes
+ * @return None
+ */
+static void SetAddress(uint8_t address) {
+	USB_DEVICE->DCFG = (USB_DEVICE->DCFG & ~USB_OTG_DCFG_DAD)
+			| address << USB_OTG_DCFG_DAD_Pos;
+}
+
+const UsbDriver usb_otg_driver = { Open, Transmit, Receive, Stall, SetAddress };
+
+/**
+ * @brief  Bus reset: disables the endpoints and prepares EP0 for SETUP
+ * @return None
+ */
+static void OnBusReset(void) {
+	for (uint8_t ep = 0; ep < ENDPOINTS; ++ep) {
+		USB_IN(ep)->DIEPCTL = (USB_IN(ep)->DIEPCTL & USB_OTG_DIEPCTL_EPENA) ?
+				USB_OTG_DIEPCTL_EPDIS | USB_OTG_DIEPCTL_SNAK : 0;
+		USB_OUT(ep)->DOEPCTL = USB_OTG_DOEPCTL_SNAK;
+		USB_IN(ep)->DIEPINT = 0xFFFFFFFFU;
+		USB_OUT(ep)->DOEPINT = 0xFFFFFFFFU;
+		endpoints[ep].in_remaining = 0;
+		endpoints[ep].out_max = 0;
+	}
+	USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH
+			| 0x10U << USB_OTG_GRSTCTL_TXFNUM_Pos; // All TX FIFOs
+	WaitReset(USB_OTG_GRSTCTL_TXFFLSH);
+
+	USB_DEVICE->DCFG &= ~USB_OTG_DCFG_DAD;
+	USB_DEVICE->DAINTMSK = 1U << USB_OTG_DAINTMSK_IEPM_Pos
+			| 1U << USB_OTG_DAINTMSK_OEPM_Pos;
+	USB_DEVICE->DIEPMSK = USB_OTG_DIEPMSK_XFRCM;
+	USB_DEVICE->DOEPMSK = USB_OTG_DOEPMSK_XFRCM | USB_OTG_DOEPMSK_STUPM;
+	USB_DEVICE->DIEPEMPMSK = 0;
+
+	endpoints[0].max_packet = USB_EP0_PACKET_SIZE;
+	USB_OUT(0)->DOEPTSIZ = SETUP_PACKETS << USB_OTG_DOEPTSIZ_STUPCNT_Pos
+			| 1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos | SETUP_PACKETS * 8;
+	UsbDevice_OnReset();
+}
+
+/**
+ * @brief  Starts the core in device mode and connects to the bus
+ * @param  usb_class: the device the board presents
+ * @return None
+ */
+void UsbOtg_Init(const UsbClass *usb_class) {
+	/* Serial number: the unique device ID in hex */
+	char serial[25];
+	uint32_t uid[3] = { HAL_GetUIDw0(), HAL_GetUIDw1(), HAL_GetUIDw2() };
+	for (uint8_t i = 0; i < 24; ++i) {
+		serial[i] = "0123456789ABCDEF"[(uid[i / 8] >> (28 - 4 * (i % 8))) & 0xF];
+	}
+	serial[24] = '\0';
+	UsbDevice_Init(&usb_otg_driver, usb_class, serial);
+
+	GPIO_InitTypeDef GPIO_InitStruct = { 0 };
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	GPIO_InitStruct.Pin = GPIO_PIN_11 | GPIO_PIN_12;
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	GPIO_InitStruct.Alternate = GPIO_AF10_OTG_FS;
+	HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+	__HAL_RCC_USB_OTG_FS_CLK_ENABLE();
+
+	USB_OTG_FS->GUSBCFG |= USB_OTG_GUSBCFG_PHYSEL;
+	while (!(USB_OTG_FS->GRSTCTL & USB_OTG_GRSTCTL_AHBIDL)) {
+	}
+	USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_CSRST;
+	WaitReset(USB_OTG_GRSTCTL_CSRST);
+	USB_OTG_FS->GUSBCFG = USB_OTG_GUSBCFG_PHYSEL | USB_OTG_GUSBCFG_FDMOD
+			| TURNAROUND_TIME << USB_OTG_GUSBCFG_TRDT_Pos;
+	HAL_Delay(50); // Forcing device mode takes up to 25 ms
+
+	USB_OTG_FS->GCCFG = USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_NOVBUSSENS;
+	USB_PCGCCTL = 0;
+	USB_DEVICE->DCTL = USB_OTG_DCTL_SDIS; // Stay off the bus until ready
+	USB_DEVICE->DCFG = DEVICE_SPEED_FULL << USB_OTG_DCFG_DSPD_Pos;
+
+	USB_OTG_FS->GRXFSIZ = RX_FIFO_WORDS;
+	USB_OTG_FS->DIEPTXF0_HNPTXFSIZ = EP0_TX_FIFO_WORDS << 16 | RX_FIFO_WORDS;
+	USB_OTG_FS->DIEPTXF[0] = EP1_TX_FIFO_WORDS << 16
+			| (RX_FIFO_WORDS + EP0_TX_FIFO_WORDS);
+	USB_OTG_FS->DIEPTXF[1] = EP2_TX_FIFO_WORDS << 16
+			| (RX_FIFO_WORDS + EP0_TX_FIFO_WORDS + EP1_TX_FIFO_WORDS);
+	USB_OTG_FS->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+	WaitReset(USB_OTG_GRSTCTL_RXFFLSH);
+	OnBusReset();
+
+	USB_OTG_FS->GINTSTS = 0xFFFFFFFFU;
+	USB_OTG_FS->GINTMSK = USB_OTG_GINTSTS_USBRST | USB_OTG_GINTSTS_ENUMDNE
+			| USB_OTG_GINTSTS_RXFLVL | USB_OTG_GINTSTS_IEPINT
+			| USB_OTG_GINTSTS_OEPINT;
+	USB_OTG_FS->GAHBCFG = USB_OTG_GAHBCFG_GINT;
+	HAL_NVIC_SetPriority(OTG_FS_IRQn, USB_OTG_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+
+	USB_DEVICE->DCTL &= ~USB_OTG_DCTL_SDIS; // Pull-up on DP: the host sees us
+}
+/**
+ * @brief  OTG FS interrupt: passes controller events to the device core
+ * @return None
+ */
+void UsbOtg_IRQHandler(void) {
+	uint32_t status = USB_OTG_FS->GINTSTS & USB_OTG_FS->GINTMSK;
+
+	if (status & USB_OTG_GINTSTS_USBRST) {
+		USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_USBRST;
+		OnBusReset();
+	}
+	if (status & USB_OTG_GINTSTS_ENUMDNE) {
+		USB_OTG_FS->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+		USB_IN(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ; // 64-byte EP0
+		USB_DEVICE->DCTL |= USB_OTG_DCTL_CGINAK;
+	}
+
+	/* Received packets are popped one status entry at a time */
+	while (USB_OTG_FS->GINTSTS & USB_OTG_GINTSTS_RXFLVL) {
+		uint32_t entry = USB_OTG_FS->GRXSTSP;
+		uint8_t ep = entry & USB_OTG_GRXSTSP_EPNUM;
+		uint16_t length = (entry & USB_OTG_GRXSTSP_BCNT)
+				>> USB_OTG_GRXSTSP_BCNT_Pos;
+		uint32_t packet_status = (entry & USB_OTG_GRXSTSP_PKTSTS)
+				>> USB_OTG_GRXSTSP_PKTSTS_Pos;
+		if (packet_status == RX_STATUS_SETUP_DATA) {
+			ReadFifo(setup_packet, sizeof(setup_packet), length);
+		} else if (packet_status == RX_STATUS_OUT_DATA && ep < ENDPOINTS) {
+			Endpoint &endpoint = endpoints[ep];
+			uint16_t room = endpoint.out_max > endpoint.out_count ?
+					endpoint.out_max - endpoint.out_count : 0;
+			ReadFifo(endpoint.out_buffer + endpoint.out_count, room, length);
+			endpoint.out_count += length < room ? length : room;
+		}
+	}
+
+	if (status & USB_OTG_GINTSTS_OEPINT) {
+		uint32_t pending = USB_DEVICE->DAINT & USB_DEVICE->DAINTMSK;
+		for (uint8_t ep = 0; ep < ENDPOINTS; ++ep) {
+			if (!(pending & 1U << (USB_OTG_DAINTMSK_OEPM_Pos + ep))) {
+				continue;
+			}
+			uint32_t events = USB_OUT(ep)->DOEPINT;
+			USB_OUT(ep)->DOEPINT = events;
+			if (events & USB_OTG_DOEPINT_XFRC) {
+				UsbDevice_OnOut(ep, endpoints[ep].out_count);
+			}
+			if (events & USB_OTG_DOEPINT_STUP) {
+				endpoints[0].in_remaining = 0; // A SETUP aborts the last request
+				USB_DEVICE->DIEPEMPMSK &= ~1U;
+				USB_OUT(0)->DOEPTSIZ = SETUP_PACKETS
+						<< USB_OTG_DOEPTSIZ_STUPCNT_Pos
+						| 1U << USB_OTG_DOEPTSIZ_PKTCNT_Pos | SETUP_PACKETS * 8;
+				UsbDevice_OnSetup(setup_packet);
+			}
+		}
+	}
+
+	if (status & USB_OTG_GINTSTS_IEPINT) {
+		uint32_t pending = USB_DEVICE->DAINT & USB_DEVICE->DAINTMSK;
+		for (uint8_t ep = 0; ep < ENDPOINTS; ++ep) {
+			if (!(pending & 1U << (USB_OTG_DAINTMSK_IEPM_Pos + ep))) {
+				continue;
+			}
+			uint32_t events = USB_IN(ep)->DIEPINT;
+			if (events & USB_OTG_DIEPINT_XFRC) {
+				USB_IN(ep)->DIEPINT = USB_OTG_DIEPINT_XFRC;
+				UsbDevice_OnInComplete(ep | 0x80);
+			}
+			if ((events & USB_OTG_DIEPINT_TXFE)
+					&& (USB_DEVICE->DIEPEMPMSK & 1U << ep)) {
+				FillTxFifo(ep);
+			}
+		}
+	}
+}
@@ -0,0 +1,154 @@
+/*
+ * @brief Whack-a-mole game rules
+ * The moles' deadlines form a small timer set: one slot per LED, checked on
+ * every update, so no timer interrupt or callback is needed.
+ */
+#include "whack_core.h"
+#include <string.h>
+
+/**
+ * @brief  Advances the xorshift32 generator
+ * @return Next 32-bit value
+ */
+static uint32_t NextRandom(WhackGame *game) {
+	uint32_t x = game->rng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	game->rng_state = x;
+	return x;
+}
+/**
+ * @brief  Random value in [0, range) by multiply-shift
+ */
+static uint32_t RandomBelow(WhackGame *game, uint32_t range) {
+	return static_cast<uint32_t>((static_cast<uint64_t>(NextRandom(game))
+			* range) >> 32);
+}
+/**
+ * @brief  Wrap-safe check whether a deadline has passed
+ */
+static bool Reached(uint32_t now_ms, uint32_t deadline_ms) {
+	return static_cast<int32_t>(now_ms - deadline_ms) >= 0;
+}
+/**
+ * @brief  Retires the moles whose deadline millisecond is over by time_ms
+ *         as misses
+ * @return None
+ */
+static void Retire(WhackGame *game, uint32_t time_ms) {
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		if ((game->active & (1U << i))
+				&& Reached(time_ms, game->expiry_ms[i] + 1)) {
+			game->active &= ~(1U << i);
+			++game->misses;
+		}
+	}
+}
+/**
+ * @brief  Schedules the next spawn between 0.5 and 1.5 mean intervals away
+ * @return None
+ */
+static void ScheduleSpawn(WhackGame *game, uint32_t now_ms) {
+	game->next_spawn_ms = now_ms + game->spawn_ms / 2
+			+ RandomBelow(game, game->spawn_ms + 1);
+}
+
+/**
+ * @brief  Starts a round
+ * @param  seed: any value, the same seed and inputs replay the same round
+ * @param  window_ms: how long a mole stays up
+ * @param  spawn_ms: mean time between two moles
+ * @return None
+ */
+void WhackCore_Start(WhackGame *game, uint32_t seed, uint32_t now_ms,
+		uint16_t window_ms, uint16_t spawn_ms) {
+	memset(game, 0, sizeof(*game));
+	/* xorshift must never hold zero */
+	game->rng_state = seed ^ 0x9E3779B9U;
+	if (game->rng_state == 0) {
+		game->rng_state = 1;
+	}
+	game->window_ms = window_ms > 0 ? window_ms : 1;
+	game->spawn_ms = spawn_ms > 2 ? spawn_ms : 2; // Every spawn moves time on
+	game->end_ms = now_ms + WHACK_ROUND_MS;
+	ScheduleSpawn(game, now_ms);
+}
+/**
+ * @brief  Advances the round to now_ms
+ * @param  pressed: buttons that went down since the previous update
+ * @param  latency_ms: GAME_LED_COUNT entries receiving the latency of each
+ *         hit mole, or nullptr
+ * @return Mask of the moles hit by this update
+ */
+uint8_t WhackCore_Update(WhackGame *game, uint32_t now_ms, uint32_t pressed,
+		uint32_t *latency_ms) {
+	if (game->over) {
+		return 0;
+	}
+	const uint8_t all = (1U << GAME_LED_COUNT) - 1;
+	pressed &= all;
+
+	/* Hits first: a press in the same millisecond as the deadline counts,
+	 one after it does not, however late the update */
+	uint8_t hit = 0;
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		if ((pressed & game->active & (1U << i))
+				&& !Reached(now_ms, game->expiry_ms[i] + 1)) {
+			hit |= 1U << i;
+		}
+	}
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		if (hit & (1U << i)) {
+			uint32_t latency = now_ms - game->spawned_ms[i];
+			if (latency > game->window_ms) {
+				latency = game->window_ms;
+			}
+			game->score += WHACK_HIT_POINTS / 10
+					+ WHACK_HIT_POINTS * 9 / 10 * (game->window_ms - latency)
+							/ game->window_ms;
+			++game->hits;
+			if (latency_ms != nullptr) {
+				latency_ms[i] = latency;
+			}
+		}
+	}
+	game->wrong += __builtin_popcount(pressed & ~game->active);
+	game->active &= ~hit;
+
+	/* Catch up with every spawn that fell due since the last update, up to
+	 the end of the round, in the order they fell due */
+	while (Reached(now_ms, game->next_spawn_ms)
+			&& !Reached(game->next_spawn_ms, game->end_ms)) {
+		Retire(game, game->next_spawn_ms);
+		uint8_t free = all & ~game->active;
+		if (free != 0) {
+			/* Pick the n-th free LED */
+			uint32_t n = RandomBelow(game, __builtin_popcount(free));
+			uint8_t led = 0;
+			for (;; ++led) {
+				if ((free & (1U << led)) && n-- == 0) {
+					break;
+				}
+			}
+			game->active |= 1U << led;
+			game->spawned_ms[led] = game->next_spawn_ms;
+			game->expiry_ms[led] = game->next_spawn_ms + game->window_ms;
+		}
+		ScheduleSpawn(game, game->next_spawn_ms);
+	}
+	Retire(game, now_ms);
+
+	if (Reached(now_ms, game->end_ms)) {
+		game->misses += __builtin_popcount(game->active);
+		game->active = 0;
+		game->over = true;
+	}
+	return hit;
+}
+/**
+ * @brief  Checks whether the round has ended
+ */
+bool WhackCore_IsOver(const WhackGame *game) {
+	return game->over;
+}
@@ -0,0 +1,40 @@
+/**
+ * @file   check.h
+ * @brief  Checks for the host tests.
+ *
+ * A failed CHECK() prints its file, line and condition and the test goes
+ * on, so one run reports every failure. Check_Report() prints the verdict
+ * and gives the exit code for main().
+ */
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include <stdio.h>
+
+inline int check_failures;
+inline int check_count;
+
+#define CHECK(condition) do { \
+	++check_count; \
+	if (!(condition)) { \
+		++check_failures; \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+	} \
+} while (0)
+
+/**
+ * @brief  Prints the verdict of a test
+ * @param  name: test name
+ * @return Exit code, 0 if every check passed
+ */
+inline int Check_Report(const char *name) {
+	if (check_failures != 0) {
+		printf("%s: %d of %d checks failed\n", name, check_failures,
+				check_count);
+		return 1;
+	}
+	printf("%s: %d checks ok\n", name, check_count);
+	return 0;
+}
+
+#endif /* __CHECK_H */
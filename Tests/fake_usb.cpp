@@ -0,0 +1,178 @@
+/*
+ * @brief Fake USB controller
+ * One IN transfer and one armed OUT buffer per endpoint number, like the
+ * OTG core. A transfer the device starts while the previous one is still
+ * in flight, or an OUT packet longer than the armed buffer, is counted as
+ * a protocol error and fails the test.
+ */
+#include "fake_usb.h"
+#include "check.h"
+#include <string.h>
+
+constexpr uint8_t ENDPOINTS = 16;
+
+struct InEndpoint {
+	bool busy;
+	const uint8_t *data;
+	uint16_t length;
+};
+
+struct OutEndpoint {
+	uint8_t *buffer;
+	uint16_t max_length;
+	bool armed;
+};
+
+FakeUsbState fake_usb;
+
+static InEndpoint in[ENDPOINTS];
+static OutEndpoint out[ENDPOINTS];
+
+static void Open(uint8_t, UsbEndpointType, uint16_t) {
+	++fake_usb.opened;
+}
+static void Transmit(uint8_t ep, const uint8_t *data, uint16_t length) {
+	InEndpoint *endpoint = &in[ep & 0x7F];
+	CHECK(!endpoint->busy);
+	endpoint->busy = true;
+	endpoint->data = data;
+	endpoint->length = length;
+}
+static void Receive(uint8_t ep, uint8_t *buffer, uint16_t max_length) {
+	OutEndpoint *endpoint = &out[ep & 0x7F];
+	endpoint->buffer = buffer;
+	endpoint->max_length = max_length;
+	endpoint->armed = true;
+}
+static void Stall(uint8_t) {
+	++fake_usb.stalls;
+}
+static void SetAddress(uint8_t address) {
+	fake_usb.address = address;
+}
+
+const UsbDriver fake_usb_driver = { Open, Transmit, Receive, Stall,
+		SetAddress };
+
+/**
+ * @brief  Forgets all endpoint state, as after plugging in
+ * @return None
+ */
+void FakeUsb_Reset(void) {
+	memset(in, 0, sizeof(in));
+	memset(out, 0, sizeof(out));
+	fake_usb = { };
+	fake_usb.address = -1;
+}
+/**
+ * @brief  Checks whether an IN transfer waits for the host
+ */
+bool FakeUsb_InBusy(uint8_t ep) {
+	return in[ep & 0x7F].busy;
+}
+/**
+ * @brief  Length of the IN transfer waiting for the host
+ */
+uint16_t FakeUsb_InLength(uint8_t ep) {
+	return in[ep & 0x7F].length;
+}
+/**
+ * @brief  The host collects the IN transfer of an endpoint
+ * @return Its data, empty for a zero-length packet or no transfer
+ */
+Bytes FakeUsb_CompleteIn(uint8_t ep) {
+	InEndpoint *endpoint = &in[ep & 0x7F];
+	CHECK(endpoint->busy);
+	if (!endpoint->busy) {
+		return Bytes();
+	}
+	Bytes data(endpoint->data, endpoint->data + endpoint->length);
+	endpoint->busy = false;
+	UsbDevice_OnInComplete(ep | 0x80);
+	return data;
+}
+/**
+ * @brief  Checks whether an OUT endpoint has a buffer to receive into
+ */
+bool FakeUsb_OutArmed(uint8_t ep) {
+	return out[ep & 0x7F].armed;
+}
+/**
+ * @brief  The host sends one OUT packet
+ * @return false if the endpoint NAKed it (no buffer armed)
+ */
+bool FakeUsb_SendOut(uint8_t ep, const void *data, uint16_t length) {
+	OutEndpoint *endpoint = &out[ep & 0x7F];
+	if (!endpoint->armed) {
+		return false;
+	}
+	CHECK(length <= endpoint->max_length);
+	endpoint->armed = false;
+	if (length > 0) {
+		memcpy(endpoint->buffer, data, length);
+	}
+	UsbDevice_OnOut(ep & 0x7F, length);
+	return true;
+}
+/**
+ * @brief  Sends a SETUP packet
+ * @return false if the device stalled it
+ */
+static bool Setup(uint8_t request_type, uint8_t request, uint16_t value,
+		uint16_t index, uint16_t length) {
+	const uint8_t packet[8] = { request_type, request,
+			static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+			static_cast<uint8_t>(index), static_cast<uint8_t>(index >> 8),
+			static_cast<uint8_t>(length), static_cast<uint8_t>(length >> 8) };
+	int stalls = fake_usb.stalls;
+	UsbDevice_OnSetup(packet);
+	return fake_usb.stalls == stalls;
+}
+/**
+ * @brief  Runs a control read: SETUP, IN packets until a short one or the
+ *         requested length, then the zero-length status OUT
+ * @param  reply: receives the data stage
+ * @return false if the device stalled
+ */
+bool FakeUsb_ControlIn(uint8_t request_type, uint8_t request, uint16_t value,
+		uint16_t index, uint16_t length, Bytes *reply) {
+	reply->clear();
+	fake_usb.control_packets = 0;
+	if (!Setup(request_type, request, value, index, length)) {
+		return false;
+	}
+	while (FakeUsb_InBusy(0)) {
+		Bytes packet = FakeUsb_CompleteIn(0);
+		++fake_usb.control_packets;
+		CHECK(packet.size() <= USB_EP0_PACKET_SIZE);
+		reply->insert(reply->end(), packet.begin(), packet.end());
+		if (packet.size() < USB_EP0_PACKET_SIZE || reply->size() == length) {
+			break;
+		}
+	}
+	CHECK(!FakeUsb_InBusy(0));
+	CHECK(FakeUsb_OutArmed(0));
+	return FakeUsb_SendOut(0, nullptr, 0);
+}
+/**
+ * @brief  Runs a control write: SETUP, the OUT data stage if any, then the
+ *         zero-length status IN
+ * @return false if the device stalled
+ */
+bool FakeUsb_ControlOut(uint8_t request_type, uint8_t request,
+		uint16_t value, uint16_t index, const void *data, uint16_t length) {
+	if (!Setup(request_type, request, value, index, length)) {
+		return false;
+	}
+	if (length > 0) {
+		int stalls = fake_usb.stalls;
+		CHECK(FakeUsb_SendOut(0, data, length));
+		if (fake_usb.stalls != stalls) {
+			return false;
+		}
+	}
+	if (!FakeUsb_InBusy(0)) {
+		return false;
+	}
+	return FakeUsb_CompleteIn(0).empty();
+}
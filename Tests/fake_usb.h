@@ -0,0 +1,43 @@
+/**
+ * @file   fake_usb.h
+ * @brief  Fake USB device controller and host for the USB class tests.
+ *
+ * fake_usb_driver stands in for usb_otg.cpp: it records what the core and
+ * the class ask of the controller (endpoints opened, transfers started,
+ * OUT buffers armed, stalls, the address). The FakeUsb_* host side plays
+ * the other end of the cable: it finishes IN transfers, delivers OUT
+ * packets into the armed buffers and runs whole control transfers through
+ * UsbDevice_On*, the way the interrupt handler of the real controller does.
+ */
+#ifndef __FAKE_USB_H
+#define __FAKE_USB_H
+
+#include "usb_device.h"
+#include <vector>
+
+typedef std::vector<uint8_t> Bytes;
+
+extern const UsbDriver fake_usb_driver;
+
+/* What the device has done so far */
+struct FakeUsbState {
+	int opened;         // Endpoints opened
+	int stalls;
+	int address;        // -1 before SET_ADDRESS
+	int control_packets; // IN packets of the last control read
+};
+
+extern FakeUsbState fake_usb;
+
+void FakeUsb_Reset(void);
+bool FakeUsb_InBusy(uint8_t ep);
+uint16_t FakeUsb_InLength(uint8_t ep);
+Bytes FakeUsb_CompleteIn(uint8_t ep);
+bool FakeUsb_OutArmed(uint8_t ep);
+bool FakeUsb_SendOut(uint8_t ep, const void *data, uint16_t length);
+bool FakeUsb_ControlIn(uint8_t request_type, uint8_t request, uint16_t value,
+		uint16_t index, uint16_t length, Bytes *reply);
+bool FakeUsb_ControlOut(uint8_t request_type, uint8_t request,
+		uint16_t value, uint16_t index, const void *data, uint16_t length);
+
+#endif /* __FAKE_USB_H */
@@ -0,0 +1,200 @@
+/*
+ * @brief Host test of the battery monitor
+ * Replays supply voltage traces through battery.cpp as the VREFINT
+ * readings the scan interrupt would take, one every 2 ms, with ADC noise
+ * and the dip of the LEDs blinking. The main loop polls every 100 ms.
+ * Checks when the levels change and that a voltage hovering at a
+ * threshold changes them at most once.
+ */
+#include "check.h"
+#include "battery.h"
+#include <math.h>
+
+constexpr uint16_t VREFINT_CAL = 1500;   // Typical part
+constexpr uint32_t READINGS_PER_S = 500;
+constexpr uint32_t READINGS_PER_POLL = 50;
+constexpr double LED_DIP_V = 0.040;      // Lit half of every 500 ms
+constexpr int NOISE_COUNTS = 4;          // ADC noise, peak
+
+/* What a replay saw */
+struct Replay {
+	int changes;
+	double low_at_s;      // First change to each level, -1 if none
+	double critical_at_s;
+	double ok_at_s;
+};
+
+static uint32_t noise_state = 1;
+
+/**
+ * @brief  Triangular ADC noise of +-NOISE_COUNTS, the same on every run
+ */
+static int Noise(void) {
+	noise_state ^= noise_state << 13;
+	noise_state ^= noise_state >> 17;
+	noise_state ^= noise_state << 5;
+	int a = noise_state % (NOISE_COUNTS + 1);
+	int b = (noise_state >> 16) % (NOISE_COUNTS + 1);
+	return a - b;
+}
+/**
+ * @brief  Feeds a voltage trace to the monitor from a fresh start
+ * @param  trace: supply without the LED load at a time in s
+ * @param  seconds: length of the trace
+ * @return The level changes
+ */
+static Replay Run(double (*trace)(double), double seconds) {
+	Battery_Init(VREFINT_CAL);
+	Replay replay = { 0, -1, -1, -1 };
+	uint32_t readings = seconds * READINGS_PER_S;
+	for (uint32_t i = 0; i < readings; ++i) {
+		double t = static_cast<double>(i) / READINGS_PER_S;
+		double v = trace(t);
+		if (fmod(t, 0.5) < 0.25) {
+			v -= LED_DIP_V;
+		}
+		int reading = lround(VREFINT_CAL * 3.3 / v) + Noise();
+		Battery_OnVrefint(reading);
+		if (i % READINGS_PER_POLL != 0 || !Battery_Poll()) {
+			continue;
+		}
+		++replay.changes;
+		double *first = battery_stats.level == BATTERY_LOW ? &replay.low_at_s
+				: battery_stats.level == BATTERY_CRITICAL
+						? &replay.critical_at_s : &replay.ok_at_s;
+		if (*first < 0) {
+			*first = t;
+		}
+	}
+	return replay;
+}
+
+/* Two hours from full to empty: slow plateau, then the knee */
+static double Discharge(double t) {
+	double x = t / 7200;
+	return x < 0.8 ? 3.40 - 0.20 * x / 0.8 : 3.20 - (x - 0.8) / 0.2 * 0.6;
+}
+static double Steady(double) {
+	return 3.30;
+}
+static double Step(double t) {
+	return t < 60 ? 3.30 : 3.10;
+}
+/* 30 mV swings around the low level, then around the recover level */
+static double HoverLow(double t) {
+	return t < 60 ? 3.30 : 3.22 + 0.015 * sin(t / 5);
+}
+static double HoverRecover(double t) {
+	return t < 60 ? 3.15 : 3.27 + 0.015 * sin(t / 5);
+}
+/* A flat cell that is charged a bit, then swapped for a fresh one */
+static double Swap(double t) {
+	return t < 300 ? 3.00 : t < 600 ? 3.245 : 3.38;
+}
+
+/**
+ * @brief  The discharge curve and its ends
+ * @return None
+ */
+static void TestCurve(void) {
+	CHECK(Battery_PercentAt(3500) == 100 && Battery_PercentAt(3400) == 100);
+	CHECK(Battery_PercentAt(3300) == 70);
+	CHECK(Battery_PercentAt(3200) == BATTERY_LOW_PERCENT);
+	CHECK(Battery_PercentAt(3250) == BATTERY_RECOVER_PERCENT);
+	CHECK(Battery_PercentAt(3000) == BATTERY_CRITICAL_PERCENT);
+	CHECK(Battery_PercentAt(3100) == 15);
+	CHECK(Battery_PercentAt(2500) == 0 && Battery_PercentAt(0) == 0);
+	bool monotonic = true;
+	for (uint32_t mv = 2400; mv < 3500; ++mv) {
+		monotonic = monotonic
+				&& Battery_PercentAt(mv + 1) >= Battery_PercentAt(mv);
+	}
+	CHECK(monotonic);
+}
+/**
+ * @brief  VDD from the readings, and blocks the main loop missed
+ * @return None
+ */
+static void TestConversion(void) {
+	Battery_Init(VREFINT_CAL);
+	CHECK(!Battery_Poll());
+	for (uint32_t i = 0; i < BATTERY_BLOCK_SAMPLES; ++i) {
+		Battery_OnVrefint(VREFINT_CAL);
+	}
+	CHECK(Battery_Poll() == false && battery_stats.vdd_mv == BATTERY_CAL_MV);
+	CHECK(battery_stats.blocks == 1 && battery_stats.level == BATTERY_OK);
+	CHECK(!Battery_Poll()); // Nothing new
+
+	/* One count more in 8 of 64 readings still shows: 3 bits finer */
+	for (uint32_t i = 0; i < BATTERY_BLOCK_SAMPLES; ++i) {
+		Battery_OnVrefint(i < 8 ? 1501 : 1500);
+	}
+	Battery_Poll();
+	CHECK(battery_stats.block_mv == 3299);
+
+	/* Three blocks published between two polls: only the last counts */
+	for (uint32_t i = 0; i < 3 * BATTERY_BLOCK_SAMPLES; ++i) {
+		Battery_OnVrefint(i < 2 * BATTERY_BLOCK_SAMPLES ? 1000 : 1650);
+	}
+	Battery_Poll();
+	CHECK(battery_stats.blocks == 3 && battery_stats.block_mv == 3000);
+	CHECK(!Battery_Poll());
+}
+/**
+ * @brief  Levels along a whole discharge, and none on a steady supply
+ *         despite the LED load
+ * @return None
+ */
+static void TestDischarge(void) {
+	Replay replay = Run(Discharge, 7200);
+	CHECK(replay.changes == 2 && replay.ok_at_s < 0);
+	CHECK(battery_stats.level == BATTERY_CRITICAL);
+	/* Declared where the mean supply (half the dip off) crosses 3.2 V and
+	 3.0 V, within the filter delay */
+	double low_v = Discharge(replay.low_at_s) - LED_DIP_V / 2;
+	double critical_v = Discharge(replay.critical_at_s) - LED_DIP_V / 2;
+	CHECK(low_v > 3.19 && low_v <= 3.21);
+	CHECK(critical_v > 2.98 && critical_v <= 3.03);
+
+	replay = Run(Steady, 600);
+	CHECK(replay.changes == 0 && battery_stats.level == BATTERY_OK);
+	CHECK(battery_stats.vdd_mv >= 3275 && battery_stats.vdd_mv <= 3285);
+}
+/**
+ * @brief  A step down to 15 % is low after the filter delay, not at the
+ *         first block below
+ * @return None
+ */
+static void TestStep(void) {
+	Replay replay = Run(Step, 120);
+	CHECK(replay.changes == 1);
+	CHECK(replay.low_at_s > 60 + 3 && replay.low_at_s < 60 + 10);
+}
+/**
+ * @brief  Hysteresis: swings around either threshold change the level once
+ * @return None
+ */
+static void TestHysteresis(void) {
+	Replay replay = Run(HoverLow, 1800);
+	CHECK(replay.changes == 1 && battery_stats.level == BATTERY_LOW);
+
+	replay = Run(HoverRecover, 1800);
+	CHECK(replay.changes == 2 && replay.low_at_s >= 0);
+	CHECK(battery_stats.level == BATTERY_OK);
+
+	/* Critical stays on below the recover level, then a fresh cell ends it */
+	replay = Run(Swap, 900);
+	CHECK(replay.changes == 2 && replay.low_at_s < 0);
+	CHECK(replay.critical_at_s >= 0 && replay.critical_at_s < 1);
+	CHECK(replay.ok_at_s > 600 && replay.ok_at_s < 610);
+	CHECK(battery_stats.level == BATTERY_OK && battery_stats.percent > 90);
+}
+
+int main(void) {
+	TestCurve();
+	TestConversion();
+	TestDischarge();
+	TestStep();
+	TestHysteresis();
+	return Check_Report("battery");
+}
@@ -0,0 +1,286 @@
+/*
+ * @brief Host test of the automated player detector
+ * Simulated sessions are fed edge by edge through a debouncer that works
+ * like Reaction_OnEdge(): an edge within REACTION_DEBOUNCE_US of the last
+ * one on its button is a bounce. Human players press with log-normal
+ * intervals and hold times on switches that bounce on some, most or all
+ * presses. Bots press on a fixed delay or on a millisecond timer through a
+ * transistor, or with a solenoid on the mechanical switch. The false
+ * positive bound the README quotes is checked over every human session.
+ */
+#include "check.h"
+#include "bot_detector.h"
+#include "reaction.h"
+#include <math.h>
+#include <initializer_list>
+
+constexpr uint32_t HUMAN_SESSIONS = 20000;
+constexpr uint32_t BOT_SESSIONS = 2000;
+constexpr uint32_t MAX_PRESSES = 400;
+
+static uint32_t random_state = 362436069;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static double Uniform(void) {
+	return (Random() + 0.5) / 4294967296.0;
+}
+/**
+ * @brief  Standard normal deviate by Box-Muller
+ */
+static double Normal(void) {
+	return sqrt(-2 * log(Uniform())) * cos(2 * M_PI * Uniform());
+}
+
+/* How a player presses */
+struct Player {
+	double interval_ms;     // Median gap between presses
+	double interval_sigma;  // Log-normal spread, 0 for a fixed delay
+	double hold_ms;
+	double hold_sigma;
+	uint32_t tick_us;       // Times rounded to a timer tick, 0 for none
+	uint32_t jitter_us;     // Uniform noise on top, +-
+	double bounce;          // Probability that an edge bounces
+	bool paced;
+};
+
+/* One session on one station, and the debouncer in front of it */
+struct Session {
+	BotDetector detector;
+	uint32_t last_edge_us[BOT_BUTTONS];
+	uint32_t now_us;
+	uint32_t next_interval_us; // Gap before the next press, 0 until drawn
+	uint32_t presses;
+	uint32_t flagged_at;    // Press that first flagged it, 0 if none
+
+	Session(bool paced) :
+			detector(), last_edge_us(), now_us(Random()), next_interval_us(0),
+			presses(0), flagged_at(0) {
+		BotDetector_Reset(&detector, paced);
+		for (uint32_t &edge : last_edge_us) {
+			edge = now_us - REACTION_DEBOUNCE_US;
+		}
+	}
+};
+
+/**
+ * @brief  One edge through the debouncer into the detector
+ * @return None
+ */
+static void Edge(Session *session, uint8_t button, bool pressed,
+		uint32_t time_us) {
+	bool quiet = time_us - session->last_edge_us[button]
+			>= REACTION_DEBOUNCE_US;
+	session->last_edge_us[button] = time_us;
+	if (!quiet) {
+		BotDetector_OnBounce(&session->detector);
+	} else if (pressed) {
+		BotDetector_OnPress(&session->detector, button, time_us);
+	} else {
+		BotDetector_OnRelease(&session->detector, button, time_us);
+	}
+}
+/**
+ * @brief  An edge and, if the contact bounces, one to five more a fraction
+ *         of a millisecond to 3 ms apart
+ * @return None
+ */
+static void Contact(Session *session, const Player &player, uint8_t button,
+		bool pressed, uint32_t time_us) {
+	Edge(session, button, pressed, time_us);
+	if (Uniform() < player.bounce) {
+		uint32_t edges = 2 * (1 + Random() % 5);
+		for (uint32_t i = 1; i <= edges; ++i) {
+			time_us += 100 + Random() % 2900;
+			Edge(session, button, pressed == (i % 2 == 0), time_us);
+		}
+	}
+}
+/**
+ * @brief  A duration as the player produces it
+ * @return Microseconds
+ */
+static uint32_t Duration(const Player &player, double median_ms,
+		double sigma) {
+	double us = median_ms * 1000 * exp(sigma * Normal());
+	if (player.tick_us > 0) {
+		us = round(us / player.tick_us) * player.tick_us;
+	}
+	if (player.jitter_us > 0) {
+		us += static_cast<int32_t>(Random() % (2 * player.jitter_us + 1))
+				- static_cast<int32_t>(player.jitter_us);
+	}
+	return static_cast<uint32_t>(us);
+}
+/**
+ * @brief  Plays a session of the given number of presses, noting the press
+ *         at which it was first flagged
+ * @return None
+ */
+static void Play(Session *session, const Player &player, uint32_t presses) {
+	for (uint32_t n = 0; n < presses; ++n) {
+		if (session->next_interval_us == 0) {
+			session->next_interval_us = Duration(player, player.interval_ms,
+					player.interval_sigma);
+		}
+		session->now_us += session->next_interval_us;
+		session->next_interval_us = Duration(player, player.interval_ms,
+				player.interval_sigma);
+		/* Released, bounces and all, before the next press of any button */
+		uint32_t hold = Duration(player, player.hold_ms, player.hold_sigma);
+		uint32_t longest = session->next_interval_us - 2 * REACTION_DEBOUNCE_US;
+		hold = hold < longest ? hold : longest;
+		hold = hold > 2 * REACTION_DEBOUNCE_US ? hold
+				: 2 * REACTION_DEBOUNCE_US;
+		uint8_t button = Random() % BOT_BUTTONS;
+		Contact(session, player, button, true, session->now_us);
+		Contact(session, player, button, false, session->now_us + hold);
+		++session->presses;
+		if (session->flagged_at == 0
+				&& BotDetector_IsAutomated(&session->detector)) {
+			session->flagged_at = session->presses;
+		}
+	}
+}
+/**
+ * @brief  A human: median gap 0.3 to 1.5 s, hold 60 to 200 ms, spreads of
+ *         0.15 to 0.5, and switches bouncing on 0 to 100 % of the edges
+ */
+static Player Human(bool paced) {
+	Player player = { };
+	player.interval_ms = 300 + Uniform() * 1200;
+	/* In rhythm mode the beat sets the gaps, off by a few tens of ms */
+	player.interval_sigma = paced ? 0.03 + Uniform() * 0.07
+			: 0.15 + Uniform() * 0.35;
+	player.hold_ms = 60 + Uniform() * 140;
+	player.hold_sigma = 0.15 + Uniform() * 0.35;
+	player.bounce = Uniform();
+	player.paced = paced;
+	return player;
+}
+
+/**
+ * @brief  The README's bound: no human session of BOT_MIN_PRESSES presses
+ *         or more is flagged at any point, in free or paced play, whether
+ *         the switches bounce always, sometimes or never; and no session of
+ *         fewer presses is judged at all
+ * @return None
+ */
+static void TestHumans(void) {
+	uint32_t flagged = 0;
+	uint32_t judged_early = 0;
+	uint32_t single_signs = 0;
+	bool consistent = true;
+	for (uint32_t n = 0; n < HUMAN_SESSIONS; ++n) {
+		Player player = Human(n % 4 == 0);
+		Session session(player.paced);
+		Play(&session, player, BOT_MIN_PRESSES - 1);
+		judged_early += BotDetector_Signals(&session.detector) != 0;
+		Play(&session, player, BOT_MIN_PRESSES - 1 + Random() % MAX_PRESSES);
+		flagged += session.flagged_at != 0;
+		single_signs += BotDetector_Signals(&session.detector) != 0;
+		consistent = consistent && BotDetector_IsConsistent(&session.detector);
+	}
+	printf("bot_detector: %u human sessions, %u flagged, %u with one sign\n",
+			HUMAN_SESSIONS, flagged, single_signs);
+	CHECK(flagged == 0);
+	CHECK(judged_early == 0);
+	CHECK(consistent);
+	/* The clean switches alone give a sign; one is never enough */
+	CHECK(single_signs > 0);
+}
+/**
+ * @brief  Plays bot sessions of MAX_PRESSES presses
+ * @param  by_press: adds the sessions caught by this press to *on_time
+ * @return The number caught
+ */
+static uint32_t Catch(const Player &player, uint32_t by_press,
+		uint32_t *on_time) {
+	uint32_t caught = 0;
+	for (uint32_t n = 0; n < BOT_SESSIONS; ++n) {
+		Session session(player.paced);
+		Play(&session, player, MAX_PRESSES);
+		caught += session.flagged_at != 0;
+		*on_time += session.flagged_at != 0 && session.flagged_at <= by_press;
+	}
+	return caught;
+}
+/**
+ * @brief  A solenoid on the mechanical switch: it bounces, but the plunger's
+ *         timing is steady to a fraction of a millisecond
+ */
+static Player Solenoid(bool paced) {
+	Player solenoid = { };
+	solenoid.interval_ms = 400;
+	solenoid.hold_ms = 80;
+	solenoid.jitter_us = 500;
+	solenoid.bounce = 0.9;
+	solenoid.paced = paced;
+	return solenoid;
+}
+
+/**
+ * @brief  Fixed-delay bots and ms-timer bots with human-like spreads are
+ *         caught in free and in paced play, solenoid rigs in free play.
+ *         Steady timing shows at press BOT_MIN_PRESSES, the timer's tick
+ *         once BOT_MIN_RESIDUES intervals are in. Each pause of more than
+ *         BOT_MAX_INTERVAL_US in the timer bot's gaps delays it a press.
+ * @return None
+ */
+static void TestBots(void) {
+	uint32_t sessions = 0;
+	uint32_t on_time = 0;
+	for (bool paced : { false, true }) {
+		/* A fixed delay through a transistor, with interrupt jitter */
+		Player fixed = { };
+		fixed.interval_ms = 250;
+		fixed.hold_ms = 50;
+		fixed.jitter_us = 30;
+		fixed.paced = paced;
+		CHECK(Catch(fixed, BOT_MIN_PRESSES, &on_time) == BOT_SESSIONS);
+
+		/* Random whole milliseconds as spread as a human's */
+		Player timer = { };
+		timer.interval_ms = 600;
+		timer.interval_sigma = 0.4;
+		timer.hold_ms = 120;
+		timer.hold_sigma = 0.4;
+		timer.tick_us = 1000;
+		timer.jitter_us = 20;
+		timer.paced = paced;
+		CHECK(Catch(timer, BOT_MIN_RESIDUES + 3, &on_time) == BOT_SESSIONS);
+		sessions += 2 * BOT_SESSIONS;
+	}
+	CHECK(Catch(Solenoid(false), BOT_MIN_PRESSES, &on_time) == BOT_SESSIONS);
+	sessions += BOT_SESSIONS;
+	printf("bot_detector: %u bot sessions caught, %u as soon as they could "
+			"be\n", sessions, on_time);
+	CHECK(on_time >= sessions * 99 / 100);
+}
+/**
+ * @brief  The documented blind spots: a bot that draws human-like timing in
+ *         microseconds and presses real, bouncing contacts shows no sign,
+ *         and in rhythm mode, where the gaps do not count, a solenoid rig
+ *         shows only its steady holds
+ * @return None
+ */
+static void TestBlindSpots(void) {
+	Player mimic = Human(false);
+	mimic.interval_ms = 700;
+	mimic.interval_sigma = 0.3;
+	mimic.bounce = 0.8;
+	uint32_t on_time = 0;
+	CHECK(Catch(mimic, MAX_PRESSES, &on_time) == 0);
+	CHECK(Catch(Solenoid(true), MAX_PRESSES, &on_time) == 0);
+}
+
+int main(void) {
+	TestHumans();
+	TestBots();
+	TestBlindSpots();
+	return Check_Report("bot_detector");
+}
@@ -0,0 +1,204 @@
+/*
+ * @brief Host test and benchmark of the batched game kernel
+ * Plays the same games with GameBatch_Step() and with GameCore_Press(),
+ * and compares every field of every game and every result after each
+ * step. Then plays as many games as it can for a while both ways and
+ * reports games per second on one core. The simulated player knows the
+ * sequence and presses a wrong button one time in sixteen, so games run
+ * through all levels and end both ways.
+ */
+#include "check.h"
+#include "game_batch.h"
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+constexpr uint32_t GAMES = 4096;
+constexpr uint32_t STEPS = 2000;
+constexpr double BENCHMARK_S = 1.0;
+
+/* The lanes of a batch, owned by the test */
+struct BatchStorage {
+	std::vector<uint32_t> rng_state;
+	std::vector<uint32_t> sequence[GAME_MAX_LEVEL];
+	std::vector<uint32_t> current_level;
+	std::vector<uint32_t> index;
+	std::vector<uint32_t> state;
+	GameBatch batch;
+
+	explicit BatchStorage(uint32_t count) :
+			rng_state(count), current_level(count), index(count),
+			state(count), batch() {
+		batch.count = count;
+		batch.rng_state = rng_state.data();
+		for (uint8_t k = 0; k < GAME_MAX_LEVEL; ++k) {
+			sequence[k].resize(count);
+			batch.sequence[k] = sequence[k].data();
+		}
+		batch.current_level = current_level.data();
+		batch.index = index.data();
+		batch.state = state.data();
+	}
+};
+
+static uint32_t random_state = 12345;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+/**
+ * @brief  The simulated player's press: right unless the dice say no
+ * @param  expected: the button the sequence asks for
+ */
+static uint8_t PlayerPress(uint32_t expected) {
+	uint32_t dice = Random();
+	return (dice & 15) != 0 ? expected : (expected + 1 + (dice >> 4) % 3) % 4;
+}
+/**
+ * @brief  One press on a scalar game, the way GameEnv_Step() does it
+ */
+static GameStepResult ScalarStep(GameCore *game, uint8_t action) {
+	GameStepResult result = GameCore_Press(game, action);
+	if (result == GAME_STEP_LEVEL_UP) {
+		GameCore_BeginInput(game);
+	}
+	return result;
+}
+static bool Finished(uint8_t result) {
+	return result == GAME_STEP_WIN || result == GAME_STEP_FAIL;
+}
+static bool Same(const GameCore &a, const GameCore &b) {
+	return a.rng_state == b.rng_state && a.current_level == b.current_level
+			&& a.index == b.index && a.state == b.state
+			&& memcmp(a.sequence, b.sequence, sizeof(a.sequence)) == 0;
+}
+static double Seconds(void) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief  Step by step equivalence with GameCore_Press(), finished games
+ *         restarted with new seeds, and presses on finished games ignored
+ * @return None
+ */
+static void TestEquivalence(void) {
+	BatchStorage storage(GAMES);
+	GameBatch *batch = &storage.batch;
+	std::vector<GameCore> games(GAMES);
+	std::vector<uint8_t> actions(GAMES);
+	std::vector<uint8_t> results(GAMES);
+	uint32_t seed = 1;
+	for (uint32_t n = 0; n < GAMES; ++n) {
+		GameBatch_Start(batch, n, seed);
+		GameCore_Start(&games[n], seed++);
+		GameCore_BeginInput(&games[n]);
+	}
+	bool same = true;
+	uint32_t counts[5] = { };
+	for (uint32_t step = 0; step < STEPS; ++step) {
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			const GameCore &game = games[n];
+			actions[n] = PlayerPress(game.sequence[game.index]);
+		}
+		GameBatch_Step(batch, actions.data(), results.data());
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			GameStepResult expected = ScalarStep(&games[n], actions[n]);
+			GameCore lane;
+			GameBatch_Get(batch, n, &lane);
+			same = same && results[n] == expected && Same(lane, games[n]);
+			++counts[results[n] % 5];
+			/* Every third finished game is left over to be ignored */
+			if (Finished(expected) && n % 3 != 0) {
+				GameBatch_Start(batch, n, seed);
+				GameCore_Start(&games[n], seed++);
+				GameCore_BeginInput(&games[n]);
+			}
+		}
+	}
+	CHECK(same);
+	/* Every result turned up many times */
+	for (uint32_t result = 0; result < 5; ++result) {
+		CHECK(counts[result] > 1000);
+	}
+}
+/**
+ * @brief  Games per second, scalar and batched, on one core. Only the time
+ *         in the step counts; the player's presses and the restarts of
+ *         finished games are the same work both ways and are left out.
+ * @return None
+ */
+static void Benchmark(void) {
+	BatchStorage storage(GAMES);
+	GameBatch *batch = &storage.batch;
+	std::vector<GameCore> games(GAMES);
+	std::vector<uint8_t> actions(GAMES);
+	std::vector<uint8_t> results(GAMES);
+	for (uint32_t n = 0; n < GAMES; ++n) {
+		GameBatch_Start(batch, n, n);
+		GameCore_Start(&games[n], n);
+		GameCore_BeginInput(&games[n]);
+	}
+
+	uint64_t scalar_games = 0;
+	double scalar_s = 0;
+	while (scalar_s < BENCHMARK_S) {
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			actions[n] = PlayerPress(games[n].sequence[games[n].index]);
+		}
+		double start = Seconds();
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			results[n] = ScalarStep(&games[n], actions[n]);
+		}
+		scalar_s += Seconds() - start;
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			if (Finished(results[n])) {
+				GameCore_Start(&games[n], n + scalar_games);
+				GameCore_BeginInput(&games[n]);
+				++scalar_games;
+			}
+		}
+	}
+
+	uint64_t batch_games = 0;
+	double batch_s = 0;
+	while (batch_s < BENCHMARK_S) {
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			actions[n] = PlayerPress(batch->sequence[batch->index[n]][n]);
+		}
+		double start = Seconds();
+		GameBatch_Step(batch, actions.data(), results.data());
+		batch_s += Seconds() - start;
+		for (uint32_t n = 0; n < GAMES; ++n) {
+			if (Finished(results[n])) {
+				GameBatch_Start(batch, n, n + batch_games);
+				++batch_games;
+			}
+		}
+	}
+	CHECK(scalar_games > 0 && batch_games > 0);
+	double scalar_rate = scalar_games / scalar_s;
+	double batch_rate = batch_games / batch_s;
+	printf("game_batch benchmark (%s): %.1f M games/s scalar, %.1f M games/s "
+			"batched, x%.1f, one core\n",
+#if defined(__AVX2__)
+			"AVX2",
+#else
+			"portable",
+#endif
+			scalar_rate / 1e6, batch_rate / 1e6, batch_rate / scalar_rate);
+}
+
+int main(void) {
+	TestEquivalence();
+	Benchmark();
+#if defined(__AVX2__)
+	return Check_Report("game_batch (AVX2)");
+#else
+	return Check_Report("game_batch");
+#endif
+}
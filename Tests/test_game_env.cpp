@@ -0,0 +1,269 @@
+/*
+ * @brief Host test and benchmark of the batched environment in libsimon.so
+ * Links the shared library the Makefile builds from game_core.cpp, the way
+ * an automated player would, and checks that GameEnv_Reset() and
+ * GameEnv_Step() give the same games for the same seeds and the documented
+ * observations, rewards and done flags. Then steps a batch for a while on
+ * one thread and on several threads, each with its own slice of the batch,
+ * and reports steps per second.
+ */
+#include "check.h"
+#include "game_core.h"
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+constexpr uint32_t GAMES = 4096;
+constexpr uint32_t STEPS = 1000;
+constexpr uint32_t BENCHMARK_STEPS = 500;
+
+/* A batch of games and the buffers the environment writes */
+struct Env {
+	std::vector<GameCore> games;
+	std::vector<uint32_t> seeds;
+	std::vector<uint8_t> actions;
+	std::vector<uint8_t> obs;
+	std::vector<int8_t> rewards;
+	std::vector<uint8_t> dones;
+
+	explicit Env(uint32_t count) :
+			games(count), seeds(count), actions(count),
+			obs(count * GAME_OBS_SIZE), rewards(count), dones(count) {
+	}
+};
+
+/**
+ * @brief  xorshift32, a separate state per caller so threads do not share
+ */
+static uint32_t Random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+/**
+ * @brief  Presses the step the observation asks for, or a random button one
+ *         time in eight
+ * @return None
+ */
+static void ChooseActions(Env *env, uint32_t first, uint32_t count,
+		uint32_t *random_state) {
+	for (uint32_t n = first; n < first + count; ++n) {
+		const uint8_t *obs = &env->obs[n * GAME_OBS_SIZE];
+		uint32_t dice = Random(random_state);
+		env->actions[n] = (dice & 7) != 0 ? obs[obs[GAME_MAX_LEVEL + 1]]
+				: (dice >> 3) % GAME_LED_COUNT;
+	}
+}
+/**
+ * @brief  Resets the finished games of a slice with new seeds
+ * @return None
+ */
+static void ResetDone(Env *env, uint32_t first, uint32_t count,
+		uint32_t *next_seed) {
+	for (uint32_t n = first; n < first + count; ++n) {
+		if (env->dones[n]) {
+			env->seeds[n] = (*next_seed)++;
+			GameEnv_Reset(&env->games[n], 1, &env->seeds[n],
+					&env->obs[n * GAME_OBS_SIZE]);
+		}
+	}
+}
+static double Seconds(void) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief  Two batches with the same seeds and the same presses stay equal
+ *         step for step, and the first step of every game is the one
+ *         GameCore_PreviewSequence() predicts for its seed
+ * @return None
+ */
+static void TestDeterminism(void) {
+	Env a(GAMES);
+	Env b(GAMES);
+	for (uint32_t n = 0; n < GAMES; ++n) {
+		a.seeds[n] = b.seeds[n] = n * 2654435761U;
+	}
+	GameEnv_Reset(a.games.data(), GAMES, a.seeds.data(), a.obs.data());
+	GameEnv_Reset(b.games.data(), GAMES, b.seeds.data(), b.obs.data());
+	CHECK(a.obs == b.obs);
+	bool previewed = true;
+	for (uint32_t n = 0; n < GAMES; ++n) {
+		uint8_t steps[GAME_MAX_LEVEL];
+		GameCore_PreviewSequence(a.seeds[n], steps, GAME_MAX_LEVEL);
+		previewed = previewed && a.obs[n * GAME_OBS_SIZE] == steps[0];
+	}
+	CHECK(previewed);
+
+	uint32_t random_state = 2463534242U;
+	uint32_t seed_a = GAMES;
+	uint32_t seed_b = GAMES;
+	bool same = true;
+	uint32_t wins = 0;
+	for (uint32_t step = 0; step < STEPS; ++step) {
+		ChooseActions(&a, 0, GAMES, &random_state);
+		b.actions = a.actions;
+		GameEnv_Step(a.games.data(), GAMES, a.actions.data(), a.obs.data(),
+				a.rewards.data(), a.dones.data());
+		GameEnv_Step(b.games.data(), GAMES, b.actions.data(), b.obs.data(),
+				b.rewards.data(), b.dones.data());
+		same = same && a.obs == b.obs && a.rewards == b.rewards
+				&& a.dones == b.dones;
+		wins += std::count(a.rewards.begin(), a.rewards.end(),
+				GAME_REWARD_WIN);
+		ResetDone(&a, 0, GAMES, &seed_a);
+		ResetDone(&b, 0, GAMES, &seed_b);
+	}
+	CHECK(same);
+	CHECK(wins > 1000);
+
+	/* A different seed gives a different game */
+	uint32_t differ = 0;
+	for (uint32_t seed = 0; seed < 1000; ++seed) {
+		uint8_t first[GAME_MAX_LEVEL];
+		uint8_t second[GAME_MAX_LEVEL];
+		GameCore_PreviewSequence(seed, first, GAME_MAX_LEVEL);
+		GameCore_PreviewSequence(seed + 1, second, GAME_MAX_LEVEL);
+		differ += memcmp(first, second, GAME_MAX_LEVEL) != 0;
+	}
+	CHECK(differ > 990);
+}
+/**
+ * @brief  Observations, rewards and done flags of a won game, a lost game
+ *         and presses after the end
+ * @return None
+ */
+static void TestRewards(void) {
+	Env env(2);
+	env.seeds = { 7, 7 };
+	GameEnv_Reset(env.games.data(), 2, env.seeds.data(), env.obs.data());
+	const uint8_t *obs = env.obs.data();
+	bool hidden = true;
+	for (int i = 1; i < GAME_MAX_LEVEL; ++i) {
+		hidden = hidden && obs[i] == GAME_OBS_HIDDEN;
+	}
+	CHECK(hidden && obs[0] < GAME_LED_COUNT);
+	CHECK(obs[GAME_MAX_LEVEL] == 0 && obs[GAME_MAX_LEVEL + 1] == 0
+			&& obs[GAME_MAX_LEVEL + 2] == PLAYER_SAYS);
+
+	/* Game 0 plays perfectly, game 1 misses the third press of level 2 */
+	int total = 0;
+	int steps = 0;
+	bool rewards_ok = true;
+	bool lost = false;
+	while (!env.dones[0]) {
+		uint8_t level = obs[GAME_MAX_LEVEL];
+		uint8_t index = obs[GAME_MAX_LEVEL + 1];
+		bool last = level == GAME_MAX_LEVEL - 1 && index == level;
+		env.actions[0] = obs[index];
+		env.actions[1] = obs[GAME_OBS_SIZE + obs[GAME_OBS_SIZE
+				+ GAME_MAX_LEVEL + 1]];
+		bool miss = !lost && level == 2 && index == 2;
+		if (miss) {
+			env.actions[1] = (env.actions[1] + 1) % GAME_LED_COUNT;
+		}
+		GameEnv_Step(env.games.data(), 2, env.actions.data(), env.obs.data(),
+				env.rewards.data(), env.dones.data());
+		rewards_ok = rewards_ok && env.rewards[0]
+				== (last ? GAME_REWARD_WIN : GAME_REWARD_CORRECT)
+				&& env.dones[0] == last;
+		if (miss) {
+			CHECK(env.rewards[1] == GAME_REWARD_FAIL && env.dones[1] == 1);
+			CHECK(obs[GAME_OBS_SIZE + GAME_MAX_LEVEL + 2] == GAME_OVER);
+			lost = true;
+		} else if (lost) {
+			rewards_ok = rewards_ok && env.rewards[1] == 0 && env.dones[1];
+		} else {
+			rewards_ok = rewards_ok && env.rewards[1] == env.rewards[0]
+					&& env.dones[1] == env.dones[0];
+		}
+		total += env.rewards[0];
+		++steps;
+	}
+	CHECK(rewards_ok && lost);
+	/* One press per step shown: 1 + 2 + ... + GAME_MAX_LEVEL */
+	CHECK(steps == GAME_MAX_LEVEL * (GAME_MAX_LEVEL + 1) / 2);
+	CHECK(total == (steps - 1) * GAME_REWARD_CORRECT + GAME_REWARD_WIN);
+	CHECK(obs[GAME_MAX_LEVEL + 2] == WIN);
+	bool shown = true;
+	for (int i = 0; i < GAME_MAX_LEVEL; ++i) {
+		shown = shown && obs[i] < GAME_LED_COUNT;
+	}
+	CHECK(shown);
+
+	/* A finished game stays finished and its observation does not move */
+	std::vector<uint8_t> before = env.obs;
+	for (uint8_t button = 0; button < GAME_LED_COUNT; ++button) {
+		env.actions = { button, button };
+		GameEnv_Step(env.games.data(), 2, env.actions.data(), env.obs.data(),
+				env.rewards.data(), env.dones.data());
+		CHECK(env.rewards[0] == 0 && env.rewards[1] == 0);
+		CHECK(env.dones[0] == 1 && env.dones[1] == 1);
+	}
+	CHECK(env.obs == before);
+}
+/**
+ * @brief  Steps one slice of the batch, resetting finished games
+ * @return None
+ */
+static void StepSlice(Env *env, uint32_t first, uint32_t count,
+		uint32_t random_state) {
+	uint32_t next_seed = random_state;
+	for (uint32_t step = 0; step < BENCHMARK_STEPS; ++step) {
+		ChooseActions(env, first, count, &random_state);
+		GameEnv_Step(&env->games[first], count, &env->actions[first],
+				&env->obs[first * GAME_OBS_SIZE], &env->rewards[first],
+				&env->dones[first]);
+		ResetDone(env, first, count, &next_seed);
+	}
+}
+/**
+ * @brief  Steps per second on one thread and on several threads
+ * @param  threads: each steps GAMES / threads games
+ * @return Steps per second
+ */
+static double StepsPerSecond(uint32_t threads) {
+	Env env(GAMES);
+	for (uint32_t n = 0; n < GAMES; ++n) {
+		env.seeds[n] = n;
+	}
+	GameEnv_Reset(env.games.data(), GAMES, env.seeds.data(), env.obs.data());
+	uint32_t slice = GAMES / threads;
+	double start = Seconds();
+	std::vector<std::thread> workers;
+	for (uint32_t t = 0; t < threads; ++t) {
+		workers.emplace_back(StepSlice, &env, t * slice, slice, t + 1);
+	}
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+	double seconds = Seconds() - start;
+	CHECK(GameCore_IsValid(&env.games[0]) && GameCore_IsValid(&env.games[
+			GAMES - 1]));
+	return static_cast<double>(slice) * threads * BENCHMARK_STEPS / seconds;
+}
+/**
+ * @brief  The throughput the README quotes
+ * @return None
+ */
+static void Benchmark(void) {
+	uint32_t cores = std::max(std::thread::hardware_concurrency(), 1U);
+	uint32_t threads = std::max(cores, 2U);
+	double one = StepsPerSecond(1);
+	double many = StepsPerSecond(threads);
+	printf("game_env benchmark: %.1f M steps/s on 1 thread, %.1f M steps/s "
+			"on %u threads, x%.1f, %u cores\n", one / 1e6, many / 1e6,
+			threads, many / one, cores);
+}
+
+int main(void) {
+	TestDeterminism();
+	TestRewards();
+	Benchmark();
+	return Check_Report("game_env");
+}
@@ -0,0 +1,163 @@
+/*
+ * @brief Host test of the LED slot tables
+ * Builds the table of every one of the 256 sets of lit LEDs on PA3..PA10,
+ * the way brightness.cpp does, at every on-time from dark to more than
+ * the lit part holds, and decodes each MODER word it holds: which LED pins
+ * are outputs, and whether every other pin kept its mode.
+ */
+#include "check.h"
+#include "led_slots.h"
+
+constexpr uint8_t FIRST_PIN = 3;  // As brightness.cpp: PA3..PA10
+constexpr uint8_t LED_COUNT = 8;
+constexpr uint32_t SETS = 1U << LED_COUNT;
+constexpr uint32_t UNWRITTEN = 0xDEADBEEF;
+constexpr uint32_t MODE_OUTPUT = 1;
+constexpr uint32_t MODE_ANALOG = 3;
+
+/**
+ * @brief  A MODER word for the pins that are not LEDs: PA0 analog, PA1 and
+ *         PA2 outputs, PA11..PA14 alternate (USB, SWD), the LED pins 0
+ */
+static LedSlotPins Pins(void) {
+	LedSlotPins pins = { };
+	pins.input_word = (3U << 0) | (1U << 2) | (1U << 4) | (2U << 22)
+			| (2U << 24) | (2U << 26) | (2U << 28);
+	pins.first_pin = FIRST_PIN;
+	pins.count = LED_COUNT;
+	return pins;
+}
+static uint32_t Mode(uint32_t word, uint8_t pin) {
+	return (word >> (pin * 2)) & 3;
+}
+/**
+ * @brief  The word with the LED pins masked out
+ */
+static uint32_t OtherPins(uint32_t word) {
+	uint32_t led_modes = 0;
+	for (uint8_t i = 0; i < LED_COUNT; ++i) {
+		led_modes |= 3U << ((FIRST_PIN + i) * 2);
+	}
+	return word & ~led_modes;
+}
+
+/**
+ * @brief  The blank word: every LED pin analog, the rest as configured
+ * @return None
+ */
+static void TestBlankWord(void) {
+	LedSlotPins pins = Pins();
+	uint32_t blank = LedSlots_BlankWord(&pins);
+	bool analog = true;
+	for (uint8_t i = 0; i < LED_COUNT; ++i) {
+		analog = analog && Mode(blank, FIRST_PIN + i) == MODE_ANALOG;
+	}
+	CHECK(analog);
+	CHECK(OtherPins(blank) == pins.input_word);
+}
+/**
+ * @brief  Every lit set at every on-time: the table is written in full and
+ *         opens with the blank, no tick has more than LED_SLOTS_MAX_LIT LEDs
+ *         on and the peak is the one reported, every lit LED is on for the
+ *         same granted time and a dark one never, the time granted is the
+ *         one asked for while the slots fit, and the other pins never move
+ * @return None
+ */
+static void TestAllSets(void) {
+	LedSlotPins pins = Pins();
+	uint32_t blank = LedSlots_BlankWord(&pins);
+	bool written = true;
+	bool blanked = true;
+	bool within_peak = true;
+	bool peak_reported = true;
+	bool equal_on_time = true;
+	bool dark_stay_dark = true;
+	bool granted = true;
+	bool others_kept = true;
+	uint32_t most_lit = 0;
+	for (uint32_t lit = 0; lit < SETS; ++lit) {
+		uint32_t count = __builtin_popcount(lit);
+		uint32_t slots = (count + LED_SLOTS_MAX_LIT - 1) / LED_SLOTS_MAX_LIT;
+		for (uint32_t on = 0; on <= LED_SLOTS_LIT_TICKS + 10; ++on) {
+			uint32_t table[LED_SLOTS_TICKS + 1];
+			for (uint32_t &word : table) {
+				word = UNWRITTEN;
+			}
+			LedSlotPlan plan = LedSlots_Build(table, &pins, lit, on);
+			written = written && table[LED_SLOTS_TICKS] == UNWRITTEN;
+			uint32_t fits = slots > 0 ? LED_SLOTS_LIT_TICKS / slots : 0;
+			granted = granted && plan.slots == slots
+					&& plan.on_ticks == (on < fits ? on : fits);
+
+			uint32_t on_ticks[LED_COUNT] = { };
+			uint32_t peak = 0;
+			for (uint32_t tick = 0; tick < LED_SLOTS_TICKS; ++tick) {
+				uint32_t word = table[tick];
+				written = written && word != UNWRITTEN;
+				if (tick < LED_SLOTS_BLANK_TICKS) {
+					blanked = blanked && word == blank;
+					continue;
+				}
+				others_kept = others_kept && OtherPins(word) == pins.input_word;
+				uint32_t conducting = 0;
+				for (uint8_t i = 0; i < LED_COUNT; ++i) {
+					uint32_t mode = Mode(word, FIRST_PIN + i);
+					others_kept = others_kept && (mode == 0
+							|| mode == MODE_OUTPUT);
+					if (mode == MODE_OUTPUT) {
+						++on_ticks[i];
+						++conducting;
+					}
+				}
+				peak = conducting > peak ? conducting : peak;
+			}
+			within_peak = within_peak && peak <= LED_SLOTS_MAX_LIT;
+			peak_reported = peak_reported && (plan.on_ticks == 0
+					|| peak == plan.peak_lit);
+			for (uint8_t i = 0; i < LED_COUNT; ++i) {
+				if ((lit >> i) & 1) {
+					equal_on_time = equal_on_time
+							&& on_ticks[i] == plan.on_ticks;
+				} else {
+					dark_stay_dark = dark_stay_dark && on_ticks[i] == 0;
+				}
+			}
+			most_lit = peak > most_lit ? peak : most_lit;
+		}
+	}
+	CHECK(written);
+	CHECK(blanked);
+	CHECK(within_peak && most_lit == LED_SLOTS_MAX_LIT);
+	CHECK(peak_reported);
+	CHECK(equal_on_time);
+	CHECK(dark_stay_dark);
+	CHECK(granted);
+	CHECK(others_kept);
+}
+/**
+ * @brief  The worst cases spelled out: all eight LEDs at full on-time take
+ *         two slots of half the lit part, four at most conducting, and a
+ *         station's four fit one slot at the on-time asked for
+ * @return None
+ */
+static void TestWorstCase(void) {
+	LedSlotPins pins = Pins();
+	uint32_t table[LED_SLOTS_TICKS];
+	LedSlotPlan plan = LedSlots_Build(table, &pins, SETS - 1,
+			LED_SLOTS_LIT_TICKS);
+	CHECK(plan.slots == 2 && plan.peak_lit == LED_SLOTS_MAX_LIT);
+	CHECK(plan.on_ticks == LED_SLOTS_LIT_TICKS / 2);
+	CHECK(plan.peak_lit * LED_SLOTS_LED_MA == 24); // The README's worst case
+	plan = LedSlots_Build(table, &pins, 0x0F, 40);
+	CHECK(plan.slots == 1 && plan.peak_lit == 4 && plan.on_ticks == 40);
+	plan = LedSlots_Build(table, &pins, 0, LED_SLOTS_LIT_TICKS);
+	CHECK(plan.slots == 0 && plan.peak_lit == 0 && plan.on_ticks == 0);
+	CHECK(table[LED_SLOTS_TICKS - 1] == pins.input_word);
+}
+
+int main(void) {
+	TestBlankWord();
+	TestAllSets();
+	TestWorstCase();
+	return Check_Report("led_slots");
+}
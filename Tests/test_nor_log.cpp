@@ -0,0 +1,279 @@
+/*
+ * @brief Host test and benchmark of the NOR flash log
+ * Runs nor_log.cpp against a RAM image of a W25Q32 with its timings: 24 MHz
+ * SPI, 0.7 ms page program and 45 ms sector erase. The fake clock advances
+ * by the bus time of every command and by 5 us per main-loop pass. The
+ * fake fails the test if the log reads or starts a command while the chip
+ * is busy, programs across a page or sets a bit that is not erased.
+ * The benchmark line is what the README quotes.
+ */
+#include "check.h"
+#include "nor_log.h"
+#include <string.h>
+#include <vector>
+
+constexpr uint32_t CHIP_SIZE = 4U << 20;
+constexpr double BYTE_US = 8.0 / 24;   // 24 MHz SPI
+constexpr double COMMAND_US = 1;       // Chip select and setup
+constexpr double PROGRAM_US = 700;
+constexpr double ERASE_US = 45000;
+constexpr double LOOP_US = 5;          // Rest of a main-loop pass
+
+/* The chip */
+struct FakeNor {
+	std::vector<uint8_t> memory;
+	double now_us;
+	double busy_until_us;
+	uint32_t programs;
+	uint32_t erases;
+	uint32_t protocol_errors;
+	long cut_program;     // This program stops halfway, -1 for none
+	bool cut_erase;       // The next erase is the last command
+	bool dead;            // Power is gone: commands are ignored
+};
+
+static FakeNor nor;
+
+/* An entry as the log stores it: a number, then filler */
+struct Entry {
+	uint32_t number;
+	uint8_t filler[NOR_LOG_ENTRY_SIZE - 4];
+};
+static_assert(sizeof(Entry) == NOR_LOG_ENTRY_SIZE, "one log entry");
+
+static bool Busy(void) {
+	nor.now_us += 2 * BYTE_US + COMMAND_US; // Read status register
+	return nor.now_us < nor.busy_until_us;
+}
+static void Program(uint32_t address, const void *data, uint32_t length) {
+	if (nor.dead) {
+		return;
+	}
+	if (nor.now_us < nor.busy_until_us || address % NOR_LOG_PAGE_SIZE
+			+ length > NOR_LOG_PAGE_SIZE) {
+		++nor.protocol_errors;
+		return;
+	}
+	const uint8_t *bytes = static_cast<const uint8_t*>(data);
+	uint32_t programmed = length;
+	if (nor.cut_program == static_cast<long>(nor.programs)) {
+		programmed = length / 2;
+		nor.dead = true;
+	}
+	for (uint32_t i = 0; i < programmed; ++i) {
+		if ((nor.memory[address + i] & bytes[i]) != bytes[i]) {
+			++nor.protocol_errors; // Would need an erase
+		}
+		nor.memory[address + i] &= bytes[i];
+	}
+	++nor.programs;
+	nor.now_us += (4 + length) * BYTE_US + 2 * COMMAND_US;
+	nor.busy_until_us = nor.now_us + PROGRAM_US;
+}
+static void Erase(uint32_t address) {
+	if (nor.dead) {
+		return;
+	}
+	if (nor.now_us < nor.busy_until_us || address % NOR_LOG_SEGMENT_SIZE) {
+		++nor.protocol_errors;
+		return;
+	}
+	memset(&nor.memory[address], 0xFF, NOR_LOG_SEGMENT_SIZE);
+	++nor.erases;
+	nor.dead = nor.cut_erase;
+	nor.now_us += 4 * BYTE_US + 2 * COMMAND_US;
+	nor.busy_until_us = nor.now_us + ERASE_US;
+}
+static void Read(uint32_t address, void *data, uint32_t length) {
+	if (nor.now_us < nor.busy_until_us) {
+		++nor.protocol_errors;
+	}
+	memcpy(data, &nor.memory[address], length);
+	nor.now_us += (4 + length) * BYTE_US + COMMAND_US;
+}
+static uint32_t NowUs(void) {
+	return nor.now_us;
+}
+
+static const NorDevice fake_nor = { Busy, Program, Erase, Read, NowUs };
+
+/**
+ * @brief  Powers the chip back up, its contents kept, and mounts the log
+ * @return None
+ */
+static void Reboot(uint32_t size) {
+	nor.busy_until_us = nor.now_us;
+	nor.cut_program = -1;
+	nor.cut_erase = false;
+	nor.dead = false;
+	NorLog_Init(&fake_nor, size);
+}
+/**
+ * @brief  A blank chip of the given size
+ * @return None
+ */
+static void Blank(uint32_t size) {
+	nor.memory.assign(CHIP_SIZE, 0xFF);
+	Reboot(size);
+}
+/**
+ * @brief  Appends entries numbered from first, running the main loop until
+ *         all of them are programmed
+ * @return None
+ */
+static void AppendAll(uint32_t first, uint32_t count) {
+	uint32_t target = nor_log_stats.appended + count;
+	uint32_t number = first;
+	while (nor_log_stats.appended < target && !nor.dead) {
+		Entry entry;
+		memset(&entry, 0x5A, sizeof(entry));
+		entry.number = number;
+		if (number < first + count && NorLog_Append(&entry)) {
+			++number;
+		}
+		NorLog_Poll();
+		nor.now_us += LOOP_US;
+	}
+}
+/**
+ * @brief  Reads an entry back, waiting while the chip is busy
+ * @return Its number, or ~0 if it is missing
+ */
+static uint32_t NumberAt(uint32_t age) {
+	Entry entry;
+	NorLogRead result;
+	while ((result = NorLog_ReadLatest(age, &entry)) == NOR_LOG_BUSY) {
+		nor.now_us += 100;
+	}
+	return result == NOR_LOG_FOUND ? entry.number : ~0U;
+}
+/**
+ * @brief  Checks that the newest entries are newest..newest - count + 1
+ * @return None
+ */
+static void CheckLatest(uint32_t newest, uint32_t count) {
+	bool in_order = true;
+	for (uint32_t age = 0; age < count; ++age) {
+		in_order = in_order && NumberAt(age) == newest - age;
+	}
+	CHECK(in_order);
+}
+
+/**
+ * @brief  Mounting a blank chip, the queue and the ring on a small chip
+ * @return None
+ */
+static void TestRing(void) {
+	constexpr uint32_t SEGMENTS = 8;
+	constexpr uint32_t SIZE = SEGMENTS * NOR_LOG_SEGMENT_SIZE;
+	Blank(SIZE);
+	CHECK(nor_log_stats.segments == SEGMENTS && nor_log_stats.entries == 0);
+	CHECK(nor_log_stats.mount_reads == SEGMENTS);
+	CHECK(NumberAt(0) == ~0U);
+
+	/* The queue takes four, then drops until the loop drains it */
+	Entry entry = { };
+	for (int i = 0; i < 5; ++i) {
+		NorLog_Append(&entry);
+	}
+	CHECK(nor_log_stats.dropped == 1);
+	while (nor_log_stats.appended < 4 && nor.now_us < 1e6) {
+		NorLog_Poll();
+		nor.now_us += LOOP_US;
+	}
+	CHECK(nor_log_stats.appended == 4 && nor_log_stats.entries == 4);
+
+	/* Three laps: the oldest segment is given up, the wear stays level */
+	Blank(SIZE);
+	uint32_t total = 3 * SEGMENTS * NOR_LOG_ENTRIES_PER_SEGMENT + 10;
+	AppendAll(0, total);
+	CHECK(nor_log_stats.entries
+			== (SEGMENTS - 1) * NOR_LOG_ENTRIES_PER_SEGMENT + 10);
+	CHECK(nor_log_stats.max_erase_count == 4 && nor_log_stats.erases == 25);
+	CheckLatest(total - 1, nor_log_stats.entries);
+	CHECK(NumberAt(nor_log_stats.entries) == ~0U);
+
+	/* A reboot finds the same log */
+	uint32_t entries = nor_log_stats.entries;
+	Reboot(SIZE);
+	CHECK(nor_log_stats.entries == entries);
+	CHECK(nor_log_stats.max_erase_count == 4);
+	CheckLatest(total - 1, entries);
+	AppendAll(total, 1);
+	CheckLatest(total, entries + 1);
+	CHECK(nor.protocol_errors == 0);
+}
+/**
+ * @brief  Power lost while an entry is programmed, and between the erase
+ *         of a segment and its header
+ * @return None
+ */
+static void TestPowerCuts(void) {
+	constexpr uint32_t SIZE = 8 * NOR_LOG_SEGMENT_SIZE;
+	Blank(SIZE);
+	AppendAll(0, 100);
+
+	/* The torn entry is read as it is, for the caller's CRC to reject */
+	nor.cut_program = nor.programs;
+	AppendAll(100, 1);
+	Reboot(SIZE);
+	CHECK(nor_log_stats.entries == 101);
+	CHECK(NumberAt(0) == 100 && NumberAt(1) == 99);
+	AppendAll(101, 1);
+	CHECK(NumberAt(0) == 101 && NumberAt(2) == 99);
+
+	/* Fill the newest segment, then lose power right after the erase that
+	 opens the next one: that segment is blank, the log is intact */
+	uint32_t next = 102;
+	while (nor_log_stats.entries % NOR_LOG_ENTRIES_PER_SEGMENT != 0) {
+		AppendAll(next++, 1);
+	}
+	uint32_t entries = nor_log_stats.entries;
+	nor.cut_erase = true;
+	AppendAll(next, 1);
+	Reboot(SIZE);
+	CHECK(nor_log_stats.entries == entries);
+	CHECK(NumberAt(0) == next - 1);
+	AppendAll(next, 2);
+	CHECK(nor_log_stats.entries == entries + 2);
+	CheckLatest(next + 1, entries + 2);
+	CHECK(nor.protocol_errors == 0);
+}
+/**
+ * @brief  Throughput, boot time and wear on the whole 4 MB chip
+ * @return None
+ */
+static void Benchmark(void) {
+	constexpr uint32_t TOTAL = 200000;
+	Blank(CHIP_SIZE);
+	CHECK(nor_log_stats.segments == NOR_LOG_MAX_SEGMENTS);
+	double start_us = nor.now_us;
+	AppendAll(0, TOTAL);
+	double seconds = (nor.now_us - start_us) / 1e6;
+	CHECK(nor_log_stats.appended == TOTAL);
+	CheckLatest(TOTAL - 1, nor_log_stats.entries);
+	double laps = static_cast<double>(nor_log_stats.erases)
+			/ NOR_LOG_MAX_SEGMENTS;
+
+	Reboot(CHIP_SIZE);
+	double read_start_us = nor.now_us;
+	CheckLatest(TOTAL - 1, 16);
+	double read_us = nor.now_us - read_start_us;
+	CHECK(nor_log_stats.mount_reads < NOR_LOG_MAX_SEGMENTS + 8);
+	CHECK(nor_log_stats.max_erase_count <= laps + 1);
+	CHECK(nor.protocol_errors == 0);
+
+	printf("nor_log benchmark: %.0f records/s (%.1f KB/s), boot %u reads "
+			"%.1f ms, latest 16 in %.1f ms, max erase count %u after %.1f "
+			"laps\n", TOTAL / seconds,
+			TOTAL * NOR_LOG_ENTRY_SIZE / seconds / 1024,
+			nor_log_stats.mount_reads, nor_log_stats.mount_us / 1000.0,
+			read_us / 1000, nor_log_stats.max_erase_count, laps);
+}
+
+int main(void) {
+	TestRing();
+	TestPowerCuts();
+	Benchmark();
+	return Check_Report("nor_log");
+}
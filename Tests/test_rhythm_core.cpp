@@ -0,0 +1,248 @@
+/*
+ * @brief Host test of the rhythm rules
+ * Presses at chosen timing errors probe each grade window from both sides,
+ * then simulated players with a fixed input latency and some jitter play
+ * whole rounds at several tempos: skipping beats, pressing the wrong button
+ * and pressing twice. The microsecond clock wraps inside every round.
+ */
+#include "check.h"
+#include "rhythm_core.h"
+#include <stdlib.h>
+#include <initializer_list>
+
+constexpr uint32_t START_US = 0xFFF00000U; // Wraps after about a second
+constexpr uint32_t PERIOD_US = 500000;     // 120 BPM
+constexpr uint32_t SCORED_BEAT = RHYTHM_COUNT_IN_BEATS;
+
+static uint32_t random_state = 521288629;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+/**
+ * @brief  Time of a beat, plus an error
+ */
+static uint32_t BeatUs(const RhythmGame &game, uint32_t beat,
+		int32_t error_us) {
+	return game.start_us + beat * game.period_us + game.offset_us + error_us;
+}
+/**
+ * @brief  A round whose count-in was hit exactly on the beats
+ */
+static RhythmGame Calibrated(int32_t offset_us) {
+	RhythmGame game;
+	RhythmCore_Start(&game, 5, START_US, PERIOD_US, offset_us);
+	for (uint32_t beat = 0; beat < RHYTHM_COUNT_IN_BEATS; ++beat) {
+		RhythmCore_Press(&game, 0, START_US + beat * PERIOD_US + offset_us,
+				nullptr);
+	}
+	return game;
+}
+static uint32_t Judged(const RhythmGame &game) {
+	return game.grades[RHYTHM_MISS] + game.grades[RHYTHM_OK]
+			+ game.grades[RHYTHM_GOOD] + game.grades[RHYTHM_PERFECT];
+}
+
+/**
+ * @brief  Every grade limit from both sides, early and late, with and
+ *         without a calibration offset: the limit itself is in the window,
+ *         one microsecond more is in the next, and past the ok window the
+ *         press is a miss that takes the beat
+ * @return None
+ */
+static void TestGrades(void) {
+	static const struct {
+		int32_t error_us;
+		RhythmGrade grade;
+	} CASES[] = {
+		{ 0, RHYTHM_PERFECT },
+		{ RHYTHM_PERFECT_US, RHYTHM_PERFECT },
+		{ RHYTHM_PERFECT_US + 1, RHYTHM_GOOD },
+		{ RHYTHM_GOOD_US, RHYTHM_GOOD },
+		{ RHYTHM_GOOD_US + 1, RHYTHM_OK },
+		{ RHYTHM_OK_US, RHYTHM_OK },
+		{ RHYTHM_OK_US + 1, RHYTHM_MISS },
+		{ PERIOD_US / 2 - 1, RHYTHM_MISS },
+	};
+	bool graded = true;
+	bool reported = true;
+	bool counted = true;
+	bool taken = true;
+	for (int32_t offset : { 0, 70000, -30000 }) {
+		RhythmGame start = Calibrated(offset);
+		graded = graded && start.offset_us == offset;
+		for (const auto &c : CASES) {
+			for (int32_t sign : { 1, -1 }) {
+				RhythmGame game = start;
+				int32_t error = 0;
+				uint8_t button = game.pattern[SCORED_BEAT];
+				RhythmGrade grade = RhythmCore_Press(&game, button,
+						BeatUs(game, SCORED_BEAT, sign * c.error_us), &error);
+				graded = graded && grade == c.grade;
+				reported = reported && error == sign * c.error_us;
+				counted = counted && game.grades[grade] == 1
+						&& Judged(game) == 1
+						&& game.score == static_cast<uint32_t>(grade);
+				/* Hit or miss, the beat is taken: a second press is stray */
+				grade = RhythmCore_Press(&game, button,
+						BeatUs(game, SCORED_BEAT, 0), nullptr);
+				taken = taken && grade == RHYTHM_MISS && game.stray == 1
+						&& Judged(game) == 1;
+			}
+		}
+	}
+	CHECK(graded);
+	CHECK(reported);
+	CHECK(counted);
+	CHECK(taken);
+
+	/* The wrong button on the beat is a miss, and adds nothing */
+	RhythmGame game = Calibrated(0);
+	uint8_t wrong = (game.pattern[SCORED_BEAT] + 1) % GAME_LED_COUNT;
+	CHECK(RhythmCore_Press(&game, wrong, BeatUs(game, SCORED_BEAT, 0),
+			nullptr) == RHYTHM_MISS);
+	CHECK(game.grades[RHYTHM_MISS] == 1 && game.score == 0);
+	CHECK(RhythmCore_MeanAbsErrorUs(&game) == 0);
+}
+/**
+ * @brief  The edges of a beat's window: half a beat after it a press goes
+ *         to the next beat and an update closes it, half a beat before beat
+ *         0 and after the last beat presses match nothing
+ * @return None
+ */
+static void TestWindowEdge(void) {
+	RhythmGame start = Calibrated(40000);
+	uint32_t beat = SCORED_BEAT;
+	uint32_t edge = BeatUs(start, beat, PERIOD_US / 2);
+
+	/* One microsecond before the edge the press is still this beat's */
+	RhythmGame game = start;
+	int32_t error = 0;
+	RhythmCore_Press(&game, game.pattern[beat], edge - 1, &error);
+	CHECK(error == static_cast<int32_t>(PERIOD_US / 2) - 1);
+	CHECK((game.judged >> beat) & 1);
+	CHECK(!((game.judged >> (beat + 1)) & 1));
+
+	/* On the edge it is the next beat's, half a beat early */
+	game = start;
+	RhythmCore_Press(&game, game.pattern[beat + 1], edge, &error);
+	CHECK(error == -static_cast<int32_t>(PERIOD_US / 2));
+	CHECK(!((game.judged >> beat) & 1) && ((game.judged >> (beat + 1)) & 1));
+
+	/* An update closes the beat on the edge, not before: an ok press at
+	 the last microsecond of the ok window is not cut off by it */
+	game = start;
+	RhythmCore_Update(&game, BeatUs(game, beat, RHYTHM_OK_US));
+	CHECK(Judged(game) == 0);
+	CHECK(RhythmCore_Press(&game, game.pattern[beat], BeatUs(game, beat,
+			RHYTHM_OK_US), nullptr) == RHYTHM_OK);
+	game = start;
+	RhythmCore_Update(&game, edge - 1);
+	CHECK(Judged(game) == 0);
+	RhythmCore_Update(&game, edge);
+	CHECK(game.grades[RHYTHM_MISS] == 1 && ((game.judged >> beat) & 1));
+	RhythmCore_Update(&game, edge);
+	CHECK(game.grades[RHYTHM_MISS] == 1);
+	CHECK(RhythmCore_Press(&game, game.pattern[beat], edge - 1, nullptr)
+			== RHYTHM_MISS && game.stray == 1);
+
+	/* Before the first beat and after the last one */
+	RhythmCore_Start(&game, 5, START_US, PERIOD_US, start.offset_us);
+	int32_t half = PERIOD_US / 2;
+	RhythmCore_Press(&game, 0, BeatUs(game, 0, -half) - 1, nullptr);
+	CHECK(game.stray == 1 && game.judged == 0);
+	RhythmCore_Press(&game, 0, BeatUs(game, RHYTHM_BEATS - 1, half), nullptr);
+	CHECK(game.stray == 2 && game.judged == 0);
+}
+/**
+ * @brief  Whole rounds: whatever the player does, every scored beat is
+ *         graded exactly once, the round is over once the last beat is
+ *         pressed or its window closes, the cue shows every beat once, and the
+ *         count-in takes out the player's latency
+ * @return None
+ */
+static void TestBeatCount(void) {
+	static const uint32_t PERIODS[] = { 300000, 500000, 750000 };
+	bool once = true;
+	bool over = true;
+	bool cued = true;
+	bool calibrated = true;
+	uint32_t perfect = 0;
+	uint32_t scored = 0;
+	for (uint32_t seed = 0; seed < 100; ++seed) {
+		uint32_t period = PERIODS[seed % 3];
+		int32_t latency = Random() % 100000; // Within the shortest half beat
+		RhythmGame game;
+		RhythmCore_Start(&game, seed, START_US, period, 0);
+
+		/* The cue, sampled every millisecond: one lit stretch per beat,
+		 all LEDs on the count-in, the beat's own LED after it */
+		uint32_t cues = 0;
+		uint8_t previous = 0;
+		for (uint32_t t = 0; t < (RHYTHM_BEATS + 1) * period; t += 1000) {
+			uint8_t mask = RhythmCore_CueMask(&game, START_US - period + t);
+			if (mask != 0 && previous == 0) {
+				uint8_t expected = cues < RHYTHM_COUNT_IN_BEATS
+						? (1U << GAME_LED_COUNT) - 1
+						: 1U << game.pattern[cues];
+				cued = cued && mask == expected;
+				++cues;
+			}
+			previous = mask;
+		}
+		cued = cued && cues == RHYTHM_BEATS;
+
+		/* The player: jitter of +-20 ms, skips one beat in eight, presses
+		 the wrong button one in sixteen and twice one in sixteen */
+		for (uint32_t beat = 0; beat < RHYTHM_BEATS; ++beat) {
+			uint32_t beat_us = START_US + beat * period;
+			RhythmCore_Update(&game, beat_us);
+			over = over && !RhythmCore_IsOver(&game);
+			uint32_t dice = Random();
+			if ((dice & 7) == 0 && beat >= RHYTHM_COUNT_IN_BEATS) {
+				continue;
+			}
+			uint8_t button = beat < RHYTHM_COUNT_IN_BEATS ? 0
+					: game.pattern[beat];
+			if (((dice >> 3) & 15) == 0) {
+				button = (button + 1) % GAME_LED_COUNT;
+			}
+			int32_t jitter = static_cast<int32_t>(Random() % 40001) - 20000;
+			uint32_t press_us = beat_us + latency + jitter;
+			RhythmGrade grade = RhythmCore_Press(&game, button, press_us,
+					nullptr);
+			perfect += grade == RHYTHM_PERFECT;
+			scored += beat >= RHYTHM_COUNT_IN_BEATS;
+			if (((dice >> 7) & 15) == 0) {
+				RhythmCore_Press(&game, button, press_us + 1000, nullptr);
+			}
+		}
+		calibrated = calibrated && abs(game.offset_us - latency) <= 20000;
+		uint32_t last_edge = START_US + (RHYTHM_BEATS - 1) * period
+				+ period / 2 + game.offset_us;
+		RhythmCore_Update(&game, last_edge - 1);
+		bool last_pressed = (game.judged >> (RHYTHM_BEATS - 1)) & 1;
+		over = over && RhythmCore_IsOver(&game) == last_pressed;
+		RhythmCore_Update(&game, last_edge);
+		over = over && RhythmCore_IsOver(&game);
+		once = once && Judged(game) == RHYTHM_SCORED_BEATS;
+		RhythmCore_Update(&game, last_edge + 10 * period);
+		once = once && Judged(game) == RHYTHM_SCORED_BEATS;
+	}
+	CHECK(once);
+	CHECK(over);
+	CHECK(cued);
+	CHECK(calibrated);
+	/* +-20 ms of jitter after calibration: nearly every hit is perfect */
+	CHECK(perfect > scored * 8 / 10);
+}
+
+int main(void) {
+	TestGrades();
+	TestWindowEdge();
+	TestBeatCount();
+	return Check_Report("rhythm_core");
+}
@@ -0,0 +1,481 @@
+/*
+ * @brief Host test and benchmark of the SD card archive
+ * Runs sd_archive.cpp against a FAT32 disk image in RAM, built here the
+ * way a PC formats a card: an MBR partition at block 2048, 4 KB clusters,
+ * two FATs and a root directory of two clusters that are not adjacent.
+ * The card model reads a block in 0.3 ms. A write sends each block in
+ * 171 us (24 MHz SPI) and programs it in 0.5 ms, and the card is busy
+ * 0.5 ms more after the last one. Blocks land on the image as their time
+ * comes, so a power cut keeps the ones already programmed. The benchmark
+ * line is what the README quotes.
+ */
+#include "check.h"
+#include "sd_archive.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+constexpr uint32_t IMAGE_BLOCKS = 32768;    // 16 MB
+constexpr uint32_t PARTITION_START = 2048;
+constexpr uint32_t CLUSTER_BLOCKS = 8;
+constexpr uint32_t RESERVED_BLOCKS = 32;
+constexpr uint32_t ROOT_SECOND_CLUSTER = 10;
+constexpr uint32_t FILE_CLUSTER = 11;
+constexpr uint32_t READ_US = 300;
+constexpr uint32_t BLOCK_US = 171 + 500;    // Send, then program
+constexpr uint32_t LOOP_US = 20;            // Main-loop pass
+
+/* What the test expects of the image */
+struct ImageOptions {
+	uint32_t file_blocks;
+	bool fragmented;    // The second half of the file is one cluster further
+	bool superfloppy;   // No partition table, the volume starts at block 0
+	const char *name;   // 8.3 directory entry form
+};
+
+/* The card */
+struct FakeCard {
+	std::vector<uint8_t> image;
+	uint64_t now_us;
+	bool present;
+	uint32_t pause_every;      // Garbage collection, 20 ms every n blocks
+	uint32_t fail_writes;      // Writes to report as failed
+	/* The write in flight */
+	bool writing;
+	uint32_t block;
+	uint32_t count;
+	uint32_t programmed;
+	uint64_t start_us;
+	std::vector<uint8_t> data;
+};
+
+static FakeCard card;
+
+/* An entry: a number, filler derived from it, and a check */
+struct Entry {
+	uint32_t number;
+	uint32_t filler[(SD_ARCHIVE_ENTRY_SIZE - 8) / 4];
+	uint32_t check;
+};
+static_assert(sizeof(Entry) == SD_ARCHIVE_ENTRY_SIZE, "one archive entry");
+
+/* What a PC would dump from the file */
+struct Dump {
+	bool consistent;    // Valid blocks form one run, entries check out
+	uint32_t entries;
+	uint32_t first;     // Numbers of the oldest and newest entry
+	uint32_t last;
+};
+
+static uint32_t random_state = 7;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static void Put16(uint32_t offset, uint16_t value) {
+	memcpy(&card.image[offset], &value, sizeof(value));
+}
+static void Put32(uint32_t offset, uint32_t value) {
+	memcpy(&card.image[offset], &value, sizeof(value));
+}
+static uint32_t Get32(const uint8_t *bytes) {
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+/**
+ * @brief  Formats the image and creates the archive file on it
+ * @return None
+ */
+static void BuildImage(const ImageOptions &options) {
+	card.image.assign(IMAGE_BLOCKS * SD_ARCHIVE_BLOCK_SIZE, 0);
+	uint32_t start = options.superfloppy ? 0 : PARTITION_START;
+	uint32_t total = IMAGE_BLOCKS - start;
+	uint32_t fat_blocks = total / CLUSTER_BLOCKS * 4 / SD_ARCHIVE_BLOCK_SIZE
+			+ 1;
+	if (!options.superfloppy) {
+		card.image[446 + 4] = 0x0C; // FAT32 LBA
+		Put32(446 + 8, start);
+		Put32(446 + 12, total);
+		Put16(510, 0xAA55);
+	}
+	uint32_t boot = start * SD_ARCHIVE_BLOCK_SIZE;
+	const uint8_t jump[3] = { 0xEB, 0x58, 0x90 };
+	memcpy(&card.image[boot], jump, sizeof(jump));
+	Put16(boot + 11, SD_ARCHIVE_BLOCK_SIZE);
+	card.image[boot + 13] = CLUSTER_BLOCKS;
+	Put16(boot + 14, RESERVED_BLOCKS);
+	card.image[boot + 16] = 2;
+	card.image[boot + 21] = 0xF8;
+	Put32(boot + 32, total);
+	Put32(boot + 36, fat_blocks);
+	Put32(boot + 44, 2);
+	Put16(boot + 510, 0xAA55);
+
+	uint32_t fat = start + RESERVED_BLOCKS;
+	uint32_t data = fat + 2 * fat_blocks;
+	auto set_fat = [&](uint32_t cluster, uint32_t next) {
+		for (uint32_t copy = 0; copy < 2; ++copy) {
+			Put32((fat + copy * fat_blocks) * SD_ARCHIVE_BLOCK_SIZE
+					+ cluster * 4, next);
+		}
+	};
+	set_fat(0, 0x0FFFFFF8);
+	set_fat(1, 0x0FFFFFFF);
+	set_fat(2, ROOT_SECOND_CLUSTER);
+	set_fat(ROOT_SECOND_CLUSTER, 0x0FFFFFFF);
+	uint32_t clusters = (options.file_blocks + CLUSTER_BLOCKS - 1)
+			/ CLUSTER_BLOCKS;
+	std::vector<uint32_t> chain;
+	for (uint32_t i = 0; i < clusters; ++i) {
+		chain.push_back(FILE_CLUSTER + i
+				+ (options.fragmented && i >= clusters / 2));
+	}
+	for (uint32_t i = 0; i + 1 < clusters; ++i) {
+		set_fat(chain[i], chain[i + 1]);
+	}
+	set_fat(chain.back(), 0x0FFFFFFF);
+
+	/* Cluster 2 of the root is full of entries to skip: the volume label,
+	 deleted files, long names and other files */
+	auto entry = [&](uint32_t cluster, uint32_t index, const char *name,
+			uint8_t attribute, uint32_t first, uint32_t size) {
+		uint32_t offset = (data + (cluster - 2) * CLUSTER_BLOCKS)
+				* SD_ARCHIVE_BLOCK_SIZE + index * 32;
+		memcpy(&card.image[offset], name, 11);
+		card.image[offset + 11] = attribute;
+		Put16(offset + 20, first >> 16);
+		Put16(offset + 26, first & 0xFFFF);
+		Put32(offset + 28, size);
+	};
+	entry(2, 0, "SIMON      ", 0x08, 0, 0);
+	for (uint32_t i = 1; i < CLUSTER_BLOCKS * SD_ARCHIVE_BLOCK_SIZE / 32; ++i) {
+		if (i % 3 == 0) {
+			entry(2, i, "\xE5" "ESSIONSBIN", 0x20, 5, 100);
+		} else if (i % 3 == 1) {
+			entry(2, i, "ASESSIONSBI", 0x0F, 0, 0);
+		} else {
+			entry(2, i, "OTHER   TXT", 0x20, 0, 0);
+		}
+	}
+	entry(ROOT_SECOND_CLUSTER, 0, options.name, 0x20, FILE_CLUSTER,
+			options.file_blocks * SD_ARCHIVE_BLOCK_SIZE);
+}
+/**
+ * @brief  Block of the image where the archive file starts
+ */
+static uint32_t FileBlock(void) {
+	uint32_t fat_blocks = (IMAGE_BLOCKS - PARTITION_START) / CLUSTER_BLOCKS
+			* 4 / SD_ARCHIVE_BLOCK_SIZE + 1;
+	return PARTITION_START + RESERVED_BLOCKS + 2 * fat_blocks
+			+ (FILE_CLUSTER - 2) * CLUSTER_BLOCKS;
+}
+
+/**
+ * @brief  When block i of the write in flight is programmed
+ */
+static uint64_t ProgrammedUs(uint32_t i) {
+	uint64_t t = card.start_us + 20;
+	for (uint32_t k = 0; k <= i; ++k) {
+		t += BLOCK_US;
+		if (card.pause_every != 0 && (card.block + k) % card.pause_every == 0) {
+			t += 20000;
+		}
+	}
+	return t;
+}
+/**
+ * @brief  Puts the blocks whose time has come on the image
+ * @return None
+ */
+static void Program(void) {
+	while (card.writing && card.programmed < card.count
+			&& ProgrammedUs(card.programmed) <= card.now_us) {
+		memcpy(&card.image[(card.block + card.programmed)
+				* SD_ARCHIVE_BLOCK_SIZE],
+				&card.data[card.programmed * SD_ARCHIVE_BLOCK_SIZE],
+				SD_ARCHIVE_BLOCK_SIZE);
+		++card.programmed;
+	}
+}
+static bool Read(uint32_t block, void *data) {
+	if (!card.present) {
+		return false;
+	}
+	memcpy(data, &card.image[block * SD_ARCHIVE_BLOCK_SIZE],
+			SD_ARCHIVE_BLOCK_SIZE);
+	card.now_us += READ_US;
+	return true;
+}
+static void Write(uint32_t block, const void *data, uint32_t count) {
+	CHECK(!card.writing);
+	CHECK(block >= FileBlock() && count <= SD_ARCHIVE_BUFFER_BLOCKS);
+	const uint8_t *bytes = static_cast<const uint8_t*>(data);
+	card.data.assign(bytes, bytes + count * SD_ARCHIVE_BLOCK_SIZE);
+	card.block = block;
+	card.count = count;
+	card.programmed = 0;
+	card.start_us = card.now_us;
+	card.writing = true;
+	card.now_us += 15;
+}
+static SdDeviceStatus Status(void) {
+	card.now_us += 2;
+	if (!card.writing) {
+		return SD_DEVICE_READY;
+	}
+	Program();
+	if (card.programmed < card.count
+			|| card.now_us < ProgrammedUs(card.count - 1) + 500) {
+		return SD_DEVICE_BUSY;
+	}
+	card.writing = false;
+	if (card.fail_writes != 0) {
+		--card.fail_writes;
+		return SD_DEVICE_FAILED;
+	}
+	return SD_DEVICE_READY;
+}
+static uint32_t NowUs(void) {
+	return card.now_us;
+}
+
+static const SdBlockDevice fake_card = { Read, Write, Status, NowUs };
+
+/**
+ * @brief  Powers the card up again, whatever it was doing, and mounts
+ * @return None
+ */
+static void Reboot(void) {
+	card.writing = false;
+	card.present = true;
+	card.pause_every = 0;
+	card.fail_writes = 0;
+	SdArchive_Init(&fake_card);
+}
+/**
+ * @brief  Runs the main loop for a while
+ * @return None
+ */
+static void RunFor(uint64_t us) {
+	uint64_t until = card.now_us + us;
+	while (card.now_us < until) {
+		SdArchive_Poll();
+		card.now_us += LOOP_US;
+	}
+}
+/**
+ * @brief  Appends an entry with the given number
+ * @return Whether the archive took it
+ */
+static bool Append(uint32_t number) {
+	Entry entry;
+	entry.number = number;
+	for (uint32_t &word : entry.filler) {
+		word = number * 2654435761U;
+	}
+	entry.check = ~number;
+	return SdArchive_Append(&entry);
+}
+/**
+ * @brief  Reads the archive file off the image the way the dump tool does:
+ *         valid blocks by sequence number, then their entries
+ * @return The entries found
+ */
+static Dump DumpFile(void) {
+	Dump dump = { true, 0, 0, 0 };
+	std::vector<std::pair<uint32_t, uint32_t>> blocks; // Sequence, position
+	for (uint32_t i = 0; i < sd_archive_stats.blocks; ++i) {
+		const uint8_t *block = &card.image[(sd_archive_stats.first_block + i)
+				* SD_ARCHIVE_BLOCK_SIZE];
+		uint32_t sequence = Get32(block);
+		uint16_t entries = block[4] | block[5] << 8;
+		if (block[6] == 0x53 && block[7] == 0x41 && sequence != 0
+				&& (sequence - 1) % sd_archive_stats.blocks == i
+				&& entries >= 1 && entries <= SD_ARCHIVE_ENTRIES_PER_BLOCK) {
+			blocks.push_back( { sequence, i });
+		}
+	}
+	std::sort(blocks.begin(), blocks.end());
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		dump.consistent = dump.consistent
+				&& (i == 0 || blocks[i].first == blocks[i - 1].first + 1);
+		const uint8_t *block = &card.image[(sd_archive_stats.first_block
+				+ blocks[i].second) * SD_ARCHIVE_BLOCK_SIZE];
+		uint16_t entries = block[4] | block[5] << 8;
+		for (uint16_t k = 0; k < entries; ++k) {
+			Entry entry;
+			memcpy(&entry, block + SD_ARCHIVE_HEADER_SIZE
+					+ k * SD_ARCHIVE_ENTRY_SIZE, sizeof(entry));
+			dump.consistent = dump.consistent && entry.check == ~entry.number
+					&& entry.filler[0] == entry.number * 2654435761U
+					&& (dump.entries == 0 || entry.number == dump.last + 1);
+			dump.first = dump.entries == 0 ? entry.number : dump.first;
+			dump.last = entry.number;
+			++dump.entries;
+		}
+		/* Only the newest block may be partly filled */
+		dump.consistent = dump.consistent && (i + 1 == blocks.size()
+				|| entries == SD_ARCHIVE_ENTRIES_PER_BLOCK);
+	}
+	return dump;
+}
+
+/**
+ * @brief  Mounting: the file on a partition or a superfloppy, and each
+ *         reason there is no archive
+ * @return None
+ */
+static void TestMount(void) {
+	BuildImage( { 4096, false, false, SD_ARCHIVE_FILE_NAME });
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_READY);
+	CHECK(sd_archive_stats.first_block == FileBlock());
+	CHECK(sd_archive_stats.blocks == 4096 && sd_archive_stats.sequence == 0);
+	CHECK(sd_archive_stats.mount_reads < 40);
+
+	BuildImage( { 64, false, true, SD_ARCHIVE_FILE_NAME });
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_READY);
+	CHECK(sd_archive_stats.blocks == 64);
+
+	card.present = false;
+	SdArchive_Init(&fake_card);
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_NO_CARD);
+	CHECK(!Append(0) && sd_archive_stats.dropped == 1);
+
+	card.image.assign(IMAGE_BLOCKS * SD_ARCHIVE_BLOCK_SIZE, 0);
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_NO_FAT32);
+
+	BuildImage( { 64, false, false, "SESSIONSDAT" });
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_NO_FILE);
+
+	BuildImage( { 64, true, false, SD_ARCHIVE_FILE_NAME });
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_FRAGMENTED);
+	CHECK(sd_archive_stats.blocks == 0);
+}
+/**
+ * @brief  A session every 3 s and five reboots on a 64-block file, which
+ *         wraps: each entry is on the card about a millisecond after it
+ *         was appended, and the file always reads back in one run
+ * @return None
+ */
+static void TestSteady(void) {
+	BuildImage( { 64, false, false, SD_ARCHIVE_FILE_NAME });
+	uint32_t number = 0;
+	for (int boot = 0; boot < 5; ++boot) {
+		Reboot();
+		CHECK(sd_archive_stats.state == SD_ARCHIVE_READY);
+		uint32_t sessions = 20 + Random() % 200;
+		bool on_time = true;
+		for (uint32_t i = 0; i < sessions; ++i) {
+			on_time = on_time && Append(number++);
+			RunFor(1300);
+			on_time = on_time && !card.writing
+					&& DumpFile().last == number - 1;
+			RunFor(3000000);
+		}
+		CHECK(on_time);
+		CHECK(sd_archive_stats.dropped == 0);
+		CHECK(sd_archive_stats.max_write_us < 1300);
+		Dump dump = DumpFile();
+		CHECK(dump.consistent && dump.last == number - 1);
+	}
+	/* The ring keeps at least all blocks but the last buffer's worth */
+	Dump dump = DumpFile();
+	CHECK(dump.entries >= (64 - SD_ARCHIVE_BUFFER_BLOCKS)
+			* SD_ARCHIVE_ENTRIES_PER_BLOCK);
+}
+/**
+ * @brief  200 power cuts at random points while entries arrive at random
+ *         intervals: the archive always mounts again, reads back in one
+ *         run and loses at most what was not on the card yet
+ * @return None
+ */
+static void TestPowerCuts(void) {
+	BuildImage( { 64, false, false, SD_ARCHIVE_FILE_NAME });
+	Reboot();
+	uint32_t number = 0;
+	bool mounted = true;
+	bool consistent = true;
+	bool bounded = true;
+	for (int cut = 0; cut < 200; ++cut) {
+		uint64_t until = card.now_us + Random() % 3000000;
+		while (card.now_us < until) {
+			if (Random() % 1000 == 0 && Append(number)) {
+				++number;
+			}
+			SdArchive_Poll();
+			card.now_us += LOOP_US;
+		}
+		Program();
+		Reboot();
+		Dump dump = DumpFile();
+		mounted = mounted && sd_archive_stats.state == SD_ARCHIVE_READY;
+		consistent = consistent && dump.consistent;
+		/* At most both buffers were not on the card yet */
+		uint32_t next = dump.entries != 0 ? dump.last + 1 : 0;
+		bounded = bounded && number - next <= 2 * SD_ARCHIVE_BUFFER_BLOCKS
+				* SD_ARCHIVE_ENTRIES_PER_BLOCK;
+		number = next;
+	}
+	CHECK(mounted && consistent && bounded);
+	CHECK(DumpFile().entries > 300);
+}
+/**
+ * @brief  Entries as fast as the main loop takes them, on a 2 MB file,
+ *         with three rejected writes and then with garbage-collection
+ *         pauses
+ * @return Entries archived per second
+ */
+static double Burst(uint32_t pause_every) {
+	BuildImage( { 4096, false, false, SD_ARCHIVE_FILE_NAME });
+	Reboot();
+	card.pause_every = pause_every;
+	card.fail_writes = 3;
+	uint32_t number = 0;
+	uint64_t start_us = card.now_us;
+	while (card.now_us - start_us < 10000000) {
+		if (Append(number)) {
+			++number;
+		}
+		SdArchive_Poll();
+		card.now_us += LOOP_US;
+	}
+	RunFor(100000);
+	Dump dump = DumpFile();
+	CHECK(dump.consistent && dump.last == number - 1);
+	CHECK(sd_archive_stats.write_errors == 3);
+	CHECK(sd_archive_stats.blocks_written
+			> 3.9 * sd_archive_stats.writes);
+	return number / 10.0;
+}
+/**
+ * @brief  Throughput and boot time
+ * @return None
+ */
+static void Benchmark(void) {
+	double rate = Burst(0);
+	double paused_rate = Burst(8);
+	Reboot();
+	CHECK(sd_archive_stats.state == SD_ARCHIVE_READY);
+	printf("sd_archive benchmark: %.0f records/s (%.0f KB/s), %.0f/s with "
+			"a 20 ms pause every 8 blocks, boot %u reads %.1f ms\n", rate,
+			rate * SD_ARCHIVE_ENTRY_SIZE / 1024, paused_rate,
+			sd_archive_stats.mount_reads, sd_archive_stats.mount_us / 1000.0);
+}
+
+int main(void) {
+	TestMount();
+	TestSteady();
+	TestPowerCuts();
+	Benchmark();
+	return Check_Report("sd_archive");
+}
@@ -0,0 +1,232 @@
+/*
+ * @brief Host test of SHA-256 and HMAC-SHA-256
+ * The FIPS 180-4 examples, messages whose padding ends exactly at or just
+ * past a block boundary, and the seven RFC 4231 HMAC cases. Every message
+ * is hashed in one piece, byte by byte and in random pieces, which must
+ * all agree, because Sha256_Update() takes a different path for a partial
+ * block, a block straight from the caller's buffer and a block completed
+ * from both. The digests of the boundary messages come from Python's
+ * hashlib.
+ */
+#include "check.h"
+#include "sha256.h"
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+constexpr uint32_t MILLION = 1000000;
+constexpr double BENCHMARK_S = 0.5;
+
+static uint32_t random_state = 1013904223;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+/**
+ * @brief  Compares a digest with its hex spelling, or with its first
+ *         characters for a truncated MAC
+ */
+static bool Matches(const uint8_t *digest, const char *hex) {
+	char spelled[2 * SHA256_DIGEST_SIZE + 1];
+	for (uint32_t i = 0; i < SHA256_DIGEST_SIZE; ++i) {
+		snprintf(spelled + 2 * i, 3, "%02x", digest[i]);
+	}
+	return strncmp(spelled, hex, strlen(hex)) == 0;
+}
+/**
+ * @brief  Hashes a message in pieces of the given size, 0 for random ones
+ */
+static void Hash(const uint8_t *message, size_t length, size_t piece,
+		uint8_t digest[SHA256_DIGEST_SIZE]) {
+	Sha256 sha;
+	Sha256_Init(&sha);
+	for (size_t done = 0; done < length;) {
+		size_t take = piece > 0 ? piece : Random() % 150;
+		take = take < length - done ? take : length - done;
+		Sha256_Update(&sha, message + done, take);
+		done += take;
+	}
+	Sha256_Final(&sha, digest);
+}
+/**
+ * @brief  Checks that a message hashes to a digest whole, byte by byte and
+ *         in random pieces
+ */
+static bool HashesTo(const void *message, size_t length, const char *hex) {
+	const uint8_t *bytes = static_cast<const uint8_t*>(message);
+	uint8_t whole[SHA256_DIGEST_SIZE];
+	uint8_t single[SHA256_DIGEST_SIZE];
+	uint8_t pieces[SHA256_DIGEST_SIZE];
+	Hash(bytes, length, length > 0 ? length : 1, whole);
+	Hash(bytes, length, 1, single);
+	Hash(bytes, length, 0, pieces);
+	return Matches(whole, hex)
+			&& memcmp(whole, single, sizeof(whole)) == 0
+			&& memcmp(whole, pieces, sizeof(whole)) == 0;
+}
+
+/**
+ * @brief  FIPS 180-4 (and its NIST examples): the one-block "abc", the
+ *         448-bit two-block message, the 896-bit one, the empty message
+ *         and one million times 'a'
+ * @return None
+ */
+static void TestFips(void) {
+	CHECK(HashesTo("abc", 3, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9c"
+			"b410ff61f20015ad"));
+	static const char TWO_BLOCK[] =
+			"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	CHECK(HashesTo(TWO_BLOCK, strlen(TWO_BLOCK), "248d6a61d20638b8e5c026930c3e"
+			"6039a33ce45964ff2167f6ecedd419db06c1"));
+	static const char LONG[] = "abcdefghbcdefghicdefghijdefghijkefghijklfghijk"
+			"lmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+	CHECK(HashesTo(LONG, strlen(LONG), "cf5b16a778af8380036ce59e7b0492370b249b"
+			"11e8f07a51afac45037afee9d1"));
+	CHECK(HashesTo("", 0, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca4"
+			"95991b7852b855"));
+	std::vector<uint8_t> million(MILLION, 'a');
+	CHECK(HashesTo(million.data(), MILLION, "cdc76e5c9914fb9281a1c7e284d73e67"
+			"f1809a48a497200e046d39ccc7112cd0"));
+}
+/**
+ * @brief  Lengths around the block boundary: 55 bytes leave just room for
+ *         the padding, 56 push the length into a second block, 64 end a
+ *         block exactly, and so on one block further
+ * @return None
+ */
+static void TestBoundaries(void) {
+	static const struct {
+		size_t length;
+		const char *digest;
+	} CASES[] = {
+		{ 55, "e7313d333c272e639f790978283f9eb3"
+				"92e843d0f29b7016828bb1daa4aac70b" },
+		{ 56, "4324d65f3c103567f5589c710bc08f85"
+				"23f929a9272e3af36fc968e52abc6c27" },
+		{ 63, "81c80242132f230c3bd41b3e63bbcff1"
+				"6107339549214a99614ff26664625055" },
+		{ 64, "39e3d7b6b5d075d37d053ad89b24b41b"
+				"ef4f3c29760c84447cab3f3be1882241" },
+		{ 65, "aacca6ff74fdbb296d165a45cecfa04e"
+				"5127bc008770fbbdd48006f2d2fae95e" },
+		{ 119, "9ce7368e4daf32341631b492e80359dc"
+				"9f594b48453cd0dd5bf0b19279cc177e" },
+		{ 120, "7836b787757e95e58b3ca5aec90b1b00"
+				"4e8deba1e50e9675af9cabf1a13a04b5" },
+		{ 128, "d2742f1f4ac6bb7ca2b239ee18402ba8"
+				"b3f9f8e652d2a72973c2b9ba11c08cf6" },
+	};
+	uint8_t message[128];
+	for (uint32_t i = 0; i < sizeof(message); ++i) {
+		message[i] = i * 7 + 3;
+	}
+	for (const auto &c : CASES) {
+		CHECK(HashesTo(message, c.length, c.digest));
+	}
+}
+/**
+ * @brief  RFC 4231 test cases 1 to 7: short, long and block-sized keys,
+ *         keys longer than a block, and case 5 truncated to 128 bits
+ * @return None
+ */
+static void TestHmac(void) {
+	static const char LARGE_DATA[] = "This is a test using a larger than "
+			"block-size key and a larger than block-size data. The key needs "
+			"to be hashed before being used by the HMAC algorithm.";
+	uint8_t key_0b[20];
+	uint8_t key_aa[131];
+	uint8_t key_01[25];
+	uint8_t key_0c[20];
+	uint8_t data_dd[50];
+	uint8_t data_cd[50];
+	memset(key_0b, 0x0b, sizeof(key_0b));
+	memset(key_aa, 0xaa, sizeof(key_aa));
+	for (uint8_t i = 0; i < sizeof(key_01); ++i) {
+		key_01[i] = i + 1;
+	}
+	memset(key_0c, 0x0c, sizeof(key_0c));
+	memset(data_dd, 0xdd, sizeof(data_dd));
+	memset(data_cd, 0xcd, sizeof(data_cd));
+	static const char *MAC[] = {
+		"b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+		"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+		"773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe",
+		"82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b",
+		"a3b6167473100ee06e0c796c2955552b",
+		"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+		"9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2",
+	};
+	const struct {
+		const void *key;
+		size_t key_length;
+		const void *data;
+		size_t data_length;
+	} CASES[] = {
+		{ key_0b, 20, "Hi There", 8 },
+		{ "Jefe", 4, "what do ya want for nothing?", 28 },
+		{ key_aa, 20, data_dd, sizeof(data_dd) },
+		{ key_01, sizeof(key_01), data_cd, sizeof(data_cd) },
+		{ key_0c, sizeof(key_0c), "Test With Truncation", 20 },
+		{ key_aa, sizeof(key_aa),
+				"Test Using Larger Than Block-Size Key - Hash Key First", 54 },
+		{ key_aa, sizeof(key_aa), LARGE_DATA, strlen(LARGE_DATA) },
+	};
+	for (uint32_t i = 0; i < sizeof(MAC) / sizeof(MAC[0]); ++i) {
+		uint8_t mac[SHA256_DIGEST_SIZE];
+		HmacSha256 hmac;
+		HmacSha256_Init(&hmac, CASES[i].key, CASES[i].key_length);
+		HmacSha256_Update(&hmac, CASES[i].data, CASES[i].data_length);
+		HmacSha256_Final(&hmac, mac);
+		CHECK(Matches(mac, MAC[i]));
+
+		/* The data in two parts, and the context wiped after use */
+		const uint8_t *data = static_cast<const uint8_t*>(CASES[i].data);
+		size_t split = CASES[i].data_length / 3;
+		HmacSha256_Init(&hmac, CASES[i].key, CASES[i].key_length);
+		HmacSha256_Update(&hmac, data, split);
+		HmacSha256_Update(&hmac, data + split, CASES[i].data_length - split);
+		HmacSha256_Final(&hmac, mac);
+		static const HmacSha256 WIPED = { };
+		CHECK(Matches(mac, MAC[i])
+				&& memcmp(&hmac, &WIPED, sizeof(hmac)) == 0);
+	}
+	CHECK(Sha256_SelfTest());
+}
+/**
+ * @brief  Throughput of the compression function on this machine, for
+ *         comparison with the cycles per block `stats` reports on the MCU
+ * @return None
+ */
+static void Benchmark(void) {
+	uint8_t block[SHA256_BLOCK_SIZE] = { };
+	Sha256 sha;
+	Sha256_Init(&sha);
+	uint64_t blocks = 0;
+	timespec start;
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double seconds = 0;
+	while (seconds < BENCHMARK_S) {
+		for (uint32_t i = 0; i < 10000; ++i) {
+			Sha256_Compress(sha.state, block);
+		}
+		blocks += 10000;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		seconds = now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec)
+				/ 1e9;
+	}
+	CHECK(sha.state[0] != 0x6a09e667);
+	printf("sha256 benchmark: %.0f ns per block, %.0f MB/s\n",
+			seconds * 1e9 / blocks, blocks * SHA256_BLOCK_SIZE / seconds / 1e6);
+}
+
+int main(void) {
+	TestFips();
+	TestBoundaries();
+	TestHmac();
+	Benchmark();
+	return Check_Report("sha256");
+}
@@ -0,0 +1,234 @@
+/*
+ * @brief Host test of the player skill model
+ * Simulated players of known memory span play classic games: a press at
+ * step i of the sequence is right with the logistic probability the model
+ * assumes, 1 / (1 + e^-(span - (i + 1))), and a game ends at the first
+ * miss or after the last level. Reaction times are drawn around a known
+ * mean. The signed flash store is a map in RAM.
+ */
+#include "check.h"
+#include "game_core.h"
+#include "record_auth.h"
+#include "skill.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+constexpr uint32_t PLAYERS = 200;   // Per span
+constexpr uint32_t GAMES = 40;      // The N games the estimate must settle in
+constexpr double TOLERANCE = 0.75;  // Steps
+constexpr uint32_t BENCHMARK_UPDATES = 20000000;
+
+static std::map<uint16_t, std::vector<uint8_t>> store;
+
+bool RecordAuth_Read(uint16_t key, void *data, uint16_t length) {
+	auto record = store.find(key);
+	if (record == store.end() || record->second.size() != length) {
+		return false;
+	}
+	memcpy(data, record->second.data(), length);
+	return true;
+}
+bool RecordAuth_Write(uint16_t key, const void *data, uint16_t length) {
+	const uint8_t *bytes = static_cast<const uint8_t*>(data);
+	store[key].assign(bytes, bytes + length);
+	return true;
+}
+
+static uint32_t random_state = 88172645;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+static double Uniform(void) {
+	return (Random() + 0.5) / 4294967296.0;
+}
+static double Span(const SkillModel &model) {
+	return model.span_q8 / 256.0;
+}
+/**
+ * @brief  One classic game of a simulated player
+ * @param  span: the player's true span in steps
+ * @param  reaction_ms: mean reaction time, each press within +-25 %
+ * @return None
+ */
+static void PlayGame(SkillModel *model, double span, uint32_t reaction_ms) {
+	for (uint8_t level = 0; level < GAME_MAX_LEVEL; ++level) {
+		for (uint8_t position = 0; position <= level; ++position) {
+			bool correct = Uniform() < 1 / (1 + exp(position + 1 - span));
+			uint32_t ms = reaction_ms * (75 + Random() % 51) / 100;
+			Skill_Observe(model, position, correct, ms);
+			if (!correct) {
+				return;
+			}
+		}
+	}
+}
+
+/**
+ * @brief  The prior, and a profile saved and loaded through the store
+ * @return None
+ */
+static void TestPrior(void) {
+	SkillModel model;
+	Skill_Load(&model, 2);
+	CHECK(model.span_q8 == 3 * 256 && model.reaction_q4 == 500 * 16
+			&& model.observations == 0);
+	PlayGame(&model, 4, 400);
+	CHECK(Skill_Save(&model, 2));
+	SkillModel loaded;
+	Skill_Load(&loaded, 2);
+	CHECK(memcmp(&loaded, &model, sizeof(model)) == 0);
+	Skill_Load(&loaded, 3);
+	CHECK(loaded.observations == 0);
+}
+/**
+ * @brief  Players of spans 1.5 to 4.5 steps, starting from the prior of 3:
+ *         nine in ten are within TOLERANCE of their span by game GAMES and
+ *         stay there, the average ends within half a step, and the
+ *         averages come out in the players' order
+ * @return None
+ */
+static void TestConvergence(void) {
+	static const double SPANS[] = { 1.5, 2.5, 3.5, 4.5 };
+	double previous = -1;
+	for (double span : SPANS) {
+		uint32_t within[GAMES] = { };
+		double sum = 0;
+		for (uint32_t player = 0; player < PLAYERS; ++player) {
+			SkillModel model;
+			Skill_Reset(&model);
+			for (uint32_t game = 0; game < GAMES; ++game) {
+				PlayGame(&model, span, 400);
+				within[game] += fabs(Span(model) - span) <= TOLERANCE;
+			}
+			sum += Span(model);
+		}
+		/* The first game after which nine in ten stay within */
+		uint32_t settled = GAMES;
+		while (settled > 0 && within[settled - 1] >= PLAYERS * 9 / 10) {
+			--settled;
+		}
+		double mean = sum / PLAYERS;
+		printf("skill: span %.1f, 90 %% within %.2f from game %u, estimate "
+				"%.2f after %u\n", span, TOLERANCE, settled + 1, mean, GAMES);
+		CHECK(settled < GAMES);
+		CHECK(fabs(mean - span) <= 0.5);
+		CHECK(mean > previous);
+		previous = mean;
+	}
+}
+/**
+ * @brief  A player who gets better is followed: the estimate of a player
+ *         whose span goes from 2 to 4 catches up within GAMES games,
+ *         although the learning rate has decayed by then
+ * @return None
+ */
+static void TestTracking(void) {
+	uint32_t within = 0;
+	for (uint32_t player = 0; player < PLAYERS; ++player) {
+		SkillModel model;
+		Skill_Reset(&model);
+		for (uint32_t game = 0; game < 5 * GAMES; ++game) {
+			PlayGame(&model, 2, 400);
+		}
+		for (uint32_t game = 0; game < GAMES; ++game) {
+			PlayGame(&model, 4, 400);
+		}
+		within += fabs(Span(model) - 4) <= TOLERANCE;
+	}
+	CHECK(within >= PLAYERS * 9 / 10);
+}
+/**
+ * @brief  Reaction times: the average follows the player's, only correct
+ *         presses count, and the tempo is clamped
+ * @return None
+ */
+static void TestReaction(void) {
+	SkillModel model;
+	Skill_Reset(&model);
+	for (uint32_t game = 0; game < 10; ++game) {
+		PlayGame(&model, 6, 300);
+	}
+	uint32_t ms = model.reaction_q4 / 16;
+	CHECK(ms >= 270 && ms <= 330);
+	SkillModel before = model;
+	Skill_Observe(&model, 0, false, 5000);
+	CHECK(model.reaction_q4 == before.reaction_q4);
+	CHECK(Skill_TempoMs(&model, 250, 500) == ms);
+	model.reaction_q4 = 100 * 16;
+	CHECK(Skill_TempoMs(&model, 250, 500) == 250);
+	model.reaction_q4 = 900 * 16;
+	CHECK(Skill_TempoMs(&model, 250, 500) == 500);
+}
+/**
+ * @brief  The state stays bounded whatever the presses: the span within
+ *         0..16 steps, the count saturating, the percentile within 0..100
+ * @return None
+ */
+static void TestBounds(void) {
+	SkillModel model;
+	Skill_Reset(&model);
+	bool bounded = true;
+	for (uint32_t i = 0; i < 100000; ++i) {
+		Skill_Observe(&model, 0, false, 60000);
+		bounded = bounded && model.span_q8 >= 0;
+	}
+	CHECK(bounded && model.span_q8 == 0);
+	CHECK(Skill_TargetPercentile(&model) == 0);
+	for (uint32_t i = 0; i < 100000; ++i) {
+		Skill_Observe(&model, 255, true, 1);
+		bounded = bounded && model.span_q8 <= 16 * 256;
+	}
+	CHECK(bounded && Skill_TargetPercentile(&model) == 100);
+	model.observations = UINT32_MAX - 1;
+	Skill_Observe(&model, 0, true, 400);
+	Skill_Observe(&model, 0, true, 400);
+	CHECK(model.observations == UINT32_MAX);
+	CHECK(sizeof(SkillModel) == 12);
+}
+/**
+ * @brief  Nanoseconds per update with a fresh profile and with one that
+ *         has seen four billion presses: the update is a fixed amount of
+ *         work, it must not grow with the history
+ * @return Nanoseconds per update
+ */
+static double UpdateNs(uint32_t observations) {
+	SkillModel model;
+	Skill_Reset(&model);
+	timespec start;
+	timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32_t i = 0; i < BENCHMARK_UPDATES; ++i) {
+		model.observations = observations;
+		Skill_Observe(&model, i % GAME_MAX_LEVEL, (i & 7) != 0,
+				300 + (i & 255));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	CHECK(model.span_q8 >= 0 && model.span_q8 <= 16 * 256);
+	return ((end.tv_sec - start.tv_sec) * 1e9 + end.tv_nsec - start.tv_nsec)
+			/ BENCHMARK_UPDATES;
+}
+static void Benchmark(void) {
+	double fresh_ns = UpdateNs(0);
+	double seasoned_ns = UpdateNs(UINT32_MAX - 1);
+	CHECK(seasoned_ns < 2 * fresh_ns + 1);
+	printf("skill benchmark: %.1f ns per update fresh, %.1f ns after 4e9 "
+			"presses, state %u bytes\n", fresh_ns, seasoned_ns,
+			static_cast<unsigned>(sizeof(SkillModel)));
+}
+
+int main(void) {
+	TestPrior();
+	TestConvergence();
+	TestTracking();
+	TestReaction();
+	TestBounds();
+	Benchmark();
+	return Check_Report("skill");
+}
@@ -0,0 +1,253 @@
+/*
+ * @brief Host test of the USB device core and the CDC-ACM class
+ * Enumerates the device on the fake controller the way a host does, then
+ * runs the CDC class requests and both data directions.
+ */
+#include "check.h"
+#include "fake_usb.h"
+#include "usb_cdc.h"
+#include <string.h>
+
+// Requests as a host sends them
+constexpr uint8_t STANDARD_IN = 0x80;
+constexpr uint8_t STANDARD_OUT = 0x00;
+constexpr uint8_t CLASS_IN = 0xA1;
+constexpr uint8_t CLASS_OUT = 0x21;
+constexpr uint8_t SET_ADDRESS = 0x05;
+constexpr uint8_t GET_DESCRIPTOR = 0x06;
+constexpr uint8_t GET_CONFIGURATION = 0x08;
+constexpr uint8_t SET_CONFIGURATION = 0x09;
+constexpr uint8_t SET_LINE_CODING = 0x20;
+constexpr uint8_t GET_LINE_CODING = 0x21;
+constexpr uint8_t SET_CONTROL_LINE_STATE = 0x22;
+constexpr uint16_t DEVICE = USB_DESCRIPTOR_DEVICE << 8;
+constexpr uint16_t CONFIGURATION = USB_DESCRIPTOR_CONFIGURATION << 8;
+constexpr uint16_t STRING = USB_DESCRIPTOR_STRING << 8;
+constexpr uint16_t DEVICE_QUALIFIER = 6 << 8;
+constexpr uint16_t LANGUAGE_EN_US = 0x0409;
+constexpr char SERIAL[] = "0123456789ABCDEF01234567";
+
+static int opens;
+
+static void OnOpen(void) {
+	++opens;
+}
+/**
+ * @brief  Pseudo-random numbers, the same in every run
+ */
+static uint32_t Next(uint32_t *seed) {
+	*seed = *seed * 1103515245U + 12345U;
+	return *seed >> 8;
+}
+
+/**
+ * @brief  Descriptors, address and configuration as a host enumerates
+ * @return None
+ */
+static void TestEnumeration(void) {
+	Bytes reply;
+	/* Windows asks for 64 bytes of the device descriptor first */
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, DEVICE, 0, 64,
+			&reply));
+	CHECK(reply.size() == 18 && reply[0] == 18 && reply[1] == DEVICE >> 8);
+	CHECK(reply[7] == USB_EP0_PACKET_SIZE);
+	CHECK(reply[4] == 0x02); // Communication device class
+
+	CHECK(FakeUsb_ControlOut(STANDARD_OUT, SET_ADDRESS, 7, 0, nullptr, 0));
+	CHECK(fake_usb.address == 7);
+
+	/* Header first, then the whole configuration in two packets */
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, CONFIGURATION, 0, 9,
+			&reply));
+	CHECK(reply.size() == 9);
+	uint16_t total = reply[2] | reply[3] << 8;
+	CHECK(total == 67 && reply[4] == 2);
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, CONFIGURATION, 0,
+			255, &reply));
+	CHECK(reply.size() == total && fake_usb.control_packets == 2);
+	/* Descriptors chain up to exactly wTotalLength */
+	uint16_t offset = 0;
+	while (offset < reply.size() && reply[offset] != 0) {
+		offset += reply[offset];
+	}
+	CHECK(offset == total);
+
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, STRING, 0, 255,
+			&reply));
+	CHECK(reply.size() == 4 && reply[2] == 0x09 && reply[3] == 0x04);
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, STRING | 3,
+			LANGUAGE_EN_US, 255, &reply));
+	CHECK(reply.size() == 2 + 2 * strlen(SERIAL));
+	bool serial_matches = true;
+	for (size_t i = 0; i < strlen(SERIAL) && i * 2 + 3 < reply.size(); ++i) {
+		serial_matches = serial_matches && reply[2 + 2 * i] == SERIAL[i]
+				&& reply[3 + 2 * i] == 0;
+	}
+	CHECK(serial_matches);
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, STRING | 2,
+			LANGUAGE_EN_US, 255, &reply));
+	CHECK(reply.size() == 2 + 2 * strlen("Simon Says Telemetry"));
+
+	/* Full-speed only: no device qualifier */
+	CHECK(!FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, DEVICE_QUALIFIER, 0,
+			10, &reply));
+
+	/* Nothing goes out before the configuration is set */
+	CHECK(!UsbDevice_IsConfigured());
+	CHECK(UsbCdc_Write("x", 1) == 0 && UsbCdc_WriteSpace() == 0);
+	CHECK(FakeUsb_ControlOut(STANDARD_OUT, SET_CONFIGURATION, 1, 0, nullptr,
+			0));
+	CHECK(UsbDevice_IsConfigured());
+	CHECK(fake_usb.opened == 3);
+	CHECK(FakeUsb_OutArmed(USB_CDC_DATA_OUT_EP));
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_CONFIGURATION, 0, 0, 1,
+			&reply));
+	CHECK(reply.size() == 1 && reply[0] == 1);
+}
+/**
+ * @brief  Line coding and line state, as a terminal opens the port
+ * @return None
+ */
+static void TestClassRequests(void) {
+	Bytes reply;
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_LINE_CODING, 0, 0, 7, &reply));
+	CHECK(reply.size() == 7 && reply[0] == 0x00 && reply[1] == 0xC2
+			&& reply[2] == 0x01 && reply[6] == 8); // 115200 8N1
+
+	const uint8_t coding[7] = { 0x80, 0x25, 0, 0, 2, 1, 7 }; // 9600 7O2
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_LINE_CODING, 0, 0, coding, 7));
+	const UsbCdcLineCoding *line = UsbCdc_LineCoding();
+	CHECK(line->baud_rate == 9600 && line->stop_bits == 2
+			&& line->parity == 1 && line->data_bits == 7);
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_LINE_CODING, 0, 0, 7, &reply));
+	CHECK(reply == Bytes(coding, coding + 7));
+	CHECK(!FakeUsb_ControlOut(CLASS_OUT, SET_LINE_CODING, 0, 0, coding, 3));
+
+	/* DTR rising opens the port and calls the handler once */
+	CHECK(!UsbCdc_IsConnected());
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_CONTROL_LINE_STATE, 0x03, 0,
+			nullptr, 0));
+	CHECK(UsbCdc_IsConnected() && opens == 1);
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_CONTROL_LINE_STATE, 0x01, 0,
+			nullptr, 0));
+	CHECK(UsbCdc_IsConnected() && opens == 1);
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_CONTROL_LINE_STATE, 0x00, 0,
+			nullptr, 0));
+	CHECK(!UsbCdc_IsConnected());
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_CONTROL_LINE_STATE, 0x01, 0,
+			nullptr, 0));
+	CHECK(UsbCdc_IsConnected() && opens == 2);
+
+	/* Unknown requests stall */
+	CHECK(!FakeUsb_ControlOut(CLASS_OUT, 0x7F, 0, 0, nullptr, 0));
+	CHECK(!FakeUsb_ControlIn(CLASS_IN, 0x7F, 0, 0, 4, &reply));
+}
+/**
+ * @brief  Writes of random sizes reach the host complete and in order
+ * @return None
+ */
+static void TestTransmit(void) {
+	Bytes sent;
+	Bytes received;
+	uint32_t seed = 1;
+	uint32_t transfers = 0;
+	const uint32_t total = 100000;
+	while (received.size() < total) {
+		for (uint8_t k = 0; k < 5 && sent.size() < total; ++k) {
+			uint8_t chunk[100];
+			uint32_t length = Next(&seed) % sizeof(chunk) + 1;
+			if (sent.size() + length > total) {
+				length = total - sent.size();
+			}
+			for (uint32_t i = 0; i < length; ++i) {
+				chunk[i] = static_cast<uint8_t>(sent.size() + i);
+			}
+			uint32_t accepted = UsbCdc_Write(chunk, length);
+			sent.insert(sent.end(), chunk, chunk + accepted);
+		}
+		UsbCdc_Poll();
+		if (FakeUsb_InBusy(USB_CDC_DATA_IN_EP)) {
+			Bytes transfer = FakeUsb_CompleteIn(USB_CDC_DATA_IN_EP);
+			CHECK(transfer.size() <= USB_CDC_TX_BUFFER_SIZE);
+			received.insert(received.end(), transfer.begin(), transfer.end());
+			++transfers;
+		}
+	}
+	CHECK(received == sent);
+	/* Under load the buffers go out (nearly) full */
+	CHECK(total / transfers > USB_CDC_TX_BUFFER_SIZE / 2);
+
+	/* A transfer of whole packets is ended by a zero-length packet */
+	UsbCdc_Poll();
+	CHECK(!FakeUsb_InBusy(USB_CDC_DATA_IN_EP));
+	Bytes block(2 * USB_CDC_PACKET_SIZE, 0x55);
+	CHECK(UsbCdc_Write(block.data(), block.size()) == block.size());
+	UsbCdc_Poll();
+	CHECK(FakeUsb_CompleteIn(USB_CDC_DATA_IN_EP) == block);
+	UsbCdc_Poll();
+	CHECK(FakeUsb_InBusy(USB_CDC_DATA_IN_EP)
+			&& FakeUsb_InLength(USB_CDC_DATA_IN_EP) == 0);
+	FakeUsb_CompleteIn(USB_CDC_DATA_IN_EP);
+	UsbCdc_Poll();
+	CHECK(!FakeUsb_InBusy(USB_CDC_DATA_IN_EP));
+}
+/**
+ * @brief  Packets from the host arrive complete and in order, and the
+ *         endpoint only NAKs while both buffers are full
+ * @return None
+ */
+static void TestReceive(void) {
+	Bytes sent;
+	Bytes read;
+	uint32_t seed = 7;
+	uint32_t naks = 0;
+	for (uint32_t round = 0; round < 2000; ++round) {
+		uint8_t packet[USB_CDC_PACKET_SIZE];
+		uint32_t length = Next(&seed) % sizeof(packet) + 1;
+		for (uint32_t i = 0; i < length; ++i) {
+			packet[i] = static_cast<uint8_t>(sent.size() + i);
+		}
+		if (FakeUsb_SendOut(USB_CDC_DATA_OUT_EP, packet, length)) {
+			sent.insert(sent.end(), packet, packet + length);
+		} else {
+			++naks;
+		}
+		if (round % 3 == 0) {
+			uint8_t data[50];
+			uint32_t count = UsbCdc_Read(data, Next(&seed) % sizeof(data) + 1);
+			read.insert(read.end(), data, data + count);
+		}
+	}
+	uint8_t data[USB_CDC_PACKET_SIZE];
+	uint32_t count;
+	while ((count = UsbCdc_Read(data, sizeof(data))) > 0) {
+		read.insert(read.end(), data, data + count);
+	}
+	CHECK(read == sent);
+	CHECK(naks > 0); // The reader was slower than the host
+	CHECK(FakeUsb_OutArmed(USB_CDC_DATA_OUT_EP));
+}
+/**
+ * @brief  A bus reset closes the port
+ * @return None
+ */
+static void TestBusReset(void) {
+	UsbDevice_OnReset();
+	CHECK(!UsbDevice_IsConfigured() && !UsbCdc_IsConnected());
+	CHECK(UsbCdc_Write("x", 1) == 0);
+	UsbCdc_Poll();
+	CHECK(!FakeUsb_InBusy(USB_CDC_DATA_IN_EP));
+}
+
+int main(void) {
+	FakeUsb_Reset();
+	UsbCdc_SetOpenHandler(OnOpen);
+	UsbDevice_Init(&fake_usb_driver, &usb_cdc_class, SERIAL);
+	UsbDevice_OnReset();
+	TestEnumeration();
+	TestClassRequests();
+	TestTransmit();
+	TestReceive();
+	TestBusReset();
+	return Check_Report("usb_cdc");
+}
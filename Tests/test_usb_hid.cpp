@@ -0,0 +1,266 @@
+/*
+ * @brief Host test of the USB HID gamepad class
+ * Reads the descriptors through the device core on the fake controller,
+ * parses the report descriptor to check that it describes the one-byte
+ * reports the class sends and takes, and follows button changes to the
+ * report the host collects.
+ */
+#include "check.h"
+#include "fake_usb.h"
+#include "usb_hid.h"
+
+constexpr uint8_t STANDARD_IN = 0x80;
+constexpr uint8_t STANDARD_OUT = 0x00;
+constexpr uint8_t INTERFACE_IN = 0x81;
+constexpr uint8_t CLASS_IN = 0xA1;
+constexpr uint8_t CLASS_OUT = 0x21;
+constexpr uint8_t GET_DESCRIPTOR = 0x06;
+constexpr uint8_t SET_CONFIGURATION = 0x09;
+constexpr uint8_t GET_REPORT = 0x01;
+constexpr uint8_t GET_IDLE = 0x02;
+constexpr uint8_t GET_PROTOCOL = 0x03;
+constexpr uint8_t SET_REPORT = 0x09;
+constexpr uint8_t SET_IDLE = 0x0A;
+constexpr uint16_t DEVICE = USB_DESCRIPTOR_DEVICE << 8;
+constexpr uint16_t CONFIGURATION = USB_DESCRIPTOR_CONFIGURATION << 8;
+constexpr uint16_t DEVICE_QUALIFIER = 6 << 8;
+constexpr uint16_t HID = 0x21 << 8;
+constexpr uint16_t REPORT = 0x22 << 8;
+constexpr uint16_t INPUT_REPORT = 1 << 8;
+constexpr uint16_t OUTPUT_REPORT = 2 << 8;
+
+/* Report layout found in the report descriptor */
+struct ReportLayout {
+	uint32_t input_bits;
+	uint32_t output_bits;
+	uint32_t button_usages;   // Usage maximum - minimum + 1 on the button page
+	uint32_t led_usages;
+	bool balanced;            // Every collection is closed
+	bool well_formed;         // Short items only, none cut off
+};
+
+static uint32_t now_us;
+
+static uint32_t NowUs(void) {
+	return now_us;
+}
+/**
+ * @brief  Walks the short items of a report descriptor (HID 1.11, 6.2.2)
+ * @return The report sizes and usages it declares
+ */
+static ReportLayout ParseReportDescriptor(const Bytes &descriptor) {
+	ReportLayout layout = { };
+	layout.well_formed = true;
+	uint32_t usage_page = 0;
+	uint32_t usage_minimum = 0;
+	uint32_t report_size = 0;
+	uint32_t report_count = 0;
+	int depth = 0;
+	size_t i = 0;
+	while (i < descriptor.size()) {
+		uint8_t prefix = descriptor[i];
+		uint8_t size = prefix & 0x03;
+		size = size == 3 ? 4 : size;
+		if (prefix == 0xFE || i + 1 + size > descriptor.size()) {
+			layout.well_formed = false; // Long item, or cut off
+			break;
+		}
+		uint32_t data = 0;
+		for (uint8_t k = 0; k < size; ++k) {
+			data |= descriptor[i + 1 + k] << (8 * k);
+		}
+		switch (prefix & 0xFC) {
+		case 0x04: usage_page = data; break;
+		case 0x74: report_size = data; break;
+		case 0x94: report_count = data; break;
+		case 0x18: usage_minimum = data; break;
+		case 0x28:
+			if (usage_page == 0x09) {
+				layout.button_usages = data - usage_minimum + 1;
+			} else if (usage_page == 0x08) {
+				layout.led_usages = data - usage_minimum + 1;
+			}
+			break;
+		case 0x80: layout.input_bits += report_size * report_count; break;
+		case 0x90: layout.output_bits += report_size * report_count; break;
+		case 0xA0: ++depth; break;
+		case 0xC0: --depth; break;
+		default: break;
+		}
+		i += 1 + size;
+	}
+	layout.balanced = depth == 0;
+	return layout;
+}
+
+/**
+ * @brief  Device, configuration, HID and report descriptors
+ * @return None
+ */
+static void TestDescriptors(void) {
+	Bytes reply;
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, DEVICE, 0, 18,
+			&reply));
+	CHECK(reply.size() == 18 && reply[0] == 18);
+	CHECK(reply[4] == 0x00); // Class defined by the interface
+	CHECK(reply[7] == USB_EP0_PACKET_SIZE);
+
+	CHECK(FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, CONFIGURATION, 0,
+			255, &reply));
+	uint16_t total = reply.size() >= 4 ? reply[2] | reply[3] << 8 : 0;
+	CHECK(total == 41 && reply.size() == total);
+	/* Walk the chain: interface, HID, then the two interrupt endpoints */
+	Bytes hid_in_configuration;
+	uint8_t endpoints = 0;
+	uint16_t report_length = 0;
+	for (size_t offset = 0; offset + 1 < reply.size() && reply[offset] != 0;
+			offset += reply[offset]) {
+		const uint8_t *descriptor = &reply[offset];
+		if (descriptor[1] == 4) {
+			CHECK(descriptor[5] == 0x03 && descriptor[4] == 2); // HID, 2 EPs
+		} else if (descriptor[1] == HID >> 8) {
+			hid_in_configuration.assign(descriptor, descriptor + 9);
+			CHECK(descriptor[6] == REPORT >> 8);
+			report_length = descriptor[7] | descriptor[8] << 8;
+		} else if (descriptor[1] == 5) {
+			++endpoints;
+			CHECK(descriptor[3] == USB_EP_INTERRUPT);
+			CHECK(descriptor[4] == USB_HID_PACKET_SIZE);
+			CHECK(descriptor[6] == USB_HID_POLL_MS);
+			CHECK(descriptor[2] == USB_HID_REPORT_EP
+					|| descriptor[2] == USB_HID_OUTPUT_EP);
+		}
+	}
+	CHECK(endpoints == 2);
+
+	/* The HID descriptor alone matches the copy in the configuration */
+	CHECK(FakeUsb_ControlIn(INTERFACE_IN, GET_DESCRIPTOR, HID, 0, 9, &reply));
+	CHECK(reply == hid_in_configuration);
+
+	CHECK(FakeUsb_ControlIn(INTERFACE_IN, GET_DESCRIPTOR, REPORT, 0, 255,
+			&reply));
+	CHECK(reply.size() == report_length);
+	ReportLayout layout = ParseReportDescriptor(reply);
+	CHECK(layout.well_formed && layout.balanced);
+	CHECK(layout.input_bits == 8 && layout.button_usages == 8);
+	CHECK(layout.output_bits == 8 && layout.led_usages == 8);
+
+	CHECK(!FakeUsb_ControlIn(STANDARD_IN, GET_DESCRIPTOR, DEVICE_QUALIFIER, 0,
+			10, &reply));
+}
+/**
+ * @brief  Button changes become one-byte reports, bit i for button i, with
+ *         their latency measured from the first edge
+ * @return None
+ */
+static void TestReports(void) {
+	/* Nothing before the configuration */
+	UsbHid_Poll();
+	CHECK(!FakeUsb_InBusy(USB_HID_REPORT_EP));
+	CHECK(FakeUsb_ControlOut(STANDARD_OUT, SET_CONFIGURATION, 1, 0, nullptr,
+			0));
+	CHECK(fake_usb.opened == 2 && FakeUsb_OutArmed(USB_HID_OUTPUT_EP));
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_IDLE, 0, 0, nullptr, 0));
+
+	/* The first report carries the current state without a latency */
+	UsbHid_Poll();
+	CHECK(FakeUsb_InBusy(USB_HID_REPORT_EP)
+			&& FakeUsb_InLength(USB_HID_REPORT_EP) == 1);
+	CHECK(FakeUsb_CompleteIn(USB_HID_REPORT_EP) == Bytes { 0x00 });
+	CHECK(usb_hid_stats.reports == 0);
+	UsbHid_Poll();
+	CHECK(!FakeUsb_InBusy(USB_HID_REPORT_EP));
+
+	/* Each button lands on its own bit */
+	for (uint8_t button = 0; button < 8; ++button) {
+		uint8_t mask = 1U << button;
+		now_us += 1000;
+		UsbHid_OnButtons(mask, now_us);
+		UsbHid_Poll();
+		now_us += 400;
+		CHECK(FakeUsb_CompleteIn(USB_HID_REPORT_EP) == Bytes { mask });
+		CHECK(usb_hid_stats.latency_last_us == 400);
+	}
+	CHECK(usb_hid_stats.reports == 8);
+
+	/* A change while a report is in flight goes out next, timed from its
+	 own first edge */
+	now_us += 1000;
+	UsbHid_OnButtons(0x05, now_us);
+	UsbHid_Poll();
+	now_us += 500;
+	UsbHid_OnButtons(0x04, now_us);
+	uint32_t second_edge_us = now_us;
+	now_us += 400;
+	CHECK(FakeUsb_CompleteIn(USB_HID_REPORT_EP) == Bytes { 0x05 });
+	CHECK(usb_hid_stats.latency_last_us == 900);
+	UsbHid_Poll();
+	now_us += 300;
+	CHECK(FakeUsb_CompleteIn(USB_HID_REPORT_EP) == Bytes { 0x04 });
+	CHECK(usb_hid_stats.latency_last_us == now_us - second_edge_us);
+	CHECK(usb_hid_stats.latency_max_us == 900);
+	UsbHid_Poll();
+	CHECK(!FakeUsb_InBusy(USB_HID_REPORT_EP));
+}
+/**
+ * @brief  LEDs from the host, GET_REPORT and the idle rate
+ * @return None
+ */
+static void TestClassRequests(void) {
+	Bytes reply;
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_REPORT, INPUT_REPORT, 0, 1,
+			&reply));
+	CHECK(reply == Bytes { 0x04 });
+
+	const uint8_t leds = 0x81;
+	CHECK(FakeUsb_SendOut(USB_HID_OUTPUT_EP, &leds, 1));
+	CHECK(UsbHid_Leds() == 0x81 && FakeUsb_OutArmed(USB_HID_OUTPUT_EP));
+	const uint8_t other_leds = 0x3C;
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_REPORT, OUTPUT_REPORT, 0,
+			&other_leds, 1));
+	CHECK(UsbHid_Leds() == 0x3C);
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_REPORT, OUTPUT_REPORT, 0, 1,
+			&reply));
+	CHECK(reply == Bytes { 0x3C });
+	CHECK(!FakeUsb_ControlOut(CLASS_OUT, SET_REPORT, INPUT_REPORT, 0,
+			&other_leds, 1));
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_PROTOCOL, 0, 0, 1, &reply));
+	CHECK(reply == Bytes { 1 });
+
+	/* Idle rate 10 (40 ms): the state repeats, not counted as a change */
+	CHECK(FakeUsb_ControlOut(CLASS_OUT, SET_IDLE, 10 << 8, 0, nullptr, 0));
+	CHECK(FakeUsb_ControlIn(CLASS_IN, GET_IDLE, 0, 0, 1, &reply));
+	CHECK(reply == Bytes { 10 });
+	uint32_t reports = usb_hid_stats.reports;
+	uint32_t sent_us = now_us;
+	now_us = sent_us + 39999;
+	UsbHid_Poll();
+	CHECK(!FakeUsb_InBusy(USB_HID_REPORT_EP));
+	now_us = sent_us + 40000;
+	UsbHid_Poll();
+	CHECK(FakeUsb_CompleteIn(USB_HID_REPORT_EP) == Bytes { 0x04 });
+	CHECK(usb_hid_stats.reports == reports);
+	CHECK(!FakeUsb_ControlOut(CLASS_OUT, 0x7F, 0, 0, nullptr, 0));
+}
+/**
+ * @brief  After a bus reset no report goes out until the next configuration
+ * @return None
+ */
+static void TestBusReset(void) {
+	UsbDevice_OnReset();
+	UsbHid_OnButtons(0x01, now_us);
+	UsbHid_Poll();
+	CHECK(!FakeUsb_InBusy(USB_HID_REPORT_EP));
+}
+
+int main(void) {
+	FakeUsb_Reset();
+	UsbHid_SetClock(NowUs);
+	UsbDevice_Init(&fake_usb_driver, &usb_hid_class, "SER");
+	UsbDevice_OnReset();
+	TestDescriptors();
+	TestReports();
+	TestClassRequests();
+	TestBusReset();
+	return Check_Report("usb_hid");
+}
@@ -0,0 +1,296 @@
+/*
+ * @brief Host test of the whack-a-mole rules at high spawn rates
+ * Rounds with a mole due every 2 to 8 ms keep all four LEDs busy, so moles
+ * expire together, several are hit in the same millisecond and hits race
+ * their deadlines. Every round is also played with updates far apart,
+ * which must not change its outcome.
+ */
+#include "check.h"
+#include "whack_core.h"
+#include <string.h>
+#include <algorithm>
+#include <initializer_list>
+
+constexpr uint32_t START_MS = 0xFFFFF000U; // The counter wraps mid-round
+constexpr uint8_t ALL = (1U << GAME_LED_COUNT) - 1;
+
+static uint32_t random_state = 2463534242U;
+
+static uint32_t Random(void) {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+/**
+ * @brief  Moles that popped up in an update: newly lit, or lit again with
+ *         a new spawn time
+ * @return Number of spawns seen
+ */
+static uint32_t Spawns(const WhackGame &before, const WhackGame &after) {
+	uint32_t spawns = 0;
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		spawns += (after.active & (1U << i))
+				&& (!(before.active & (1U << i))
+						|| after.spawned_ms[i] != before.spawned_ms[i]);
+	}
+	return spawns;
+}
+/**
+ * @brief  Updates every millisecond until a mole is up
+ * @return The time of the last update
+ */
+static uint32_t UntilMole(WhackGame *game, uint32_t now_ms) {
+	while (game->active == 0) {
+		WhackCore_Update(game, ++now_ms, 0, nullptr);
+	}
+	return now_ms;
+}
+/**
+ * @brief  Lowest LED of a mask
+ */
+static uint8_t Lowest(uint8_t mask) {
+	return __builtin_ctz(mask);
+}
+/**
+ * @brief  Wrap-safe a > b
+ */
+static bool Later(uint32_t a_ms, uint32_t b_ms) {
+	return static_cast<int32_t>(a_ms - b_ms) > 0;
+}
+
+/**
+ * @brief  A press in the deadline millisecond hits with the lowest score,
+ *         one a millisecond later misses, even when no update came between
+ * @return None
+ */
+static void TestDeadline(void) {
+	WhackGame start;
+	WhackCore_Start(&start, 7, START_MS, 100, 400);
+	uint32_t now = UntilMole(&start, START_MS);
+	uint8_t led = Lowest(start.active);
+	uint32_t deadline = start.expiry_ms[led];
+	CHECK(deadline == start.spawned_ms[led] + 100);
+
+	/* In the deadline millisecond: a hit at the full window */
+	WhackGame game = start;
+	uint32_t latency[GAME_LED_COUNT] = { };
+	uint8_t hit = WhackCore_Update(&game, deadline, 1U << led, latency);
+	CHECK(hit == 1U << led && latency[led] == 100);
+	CHECK(game.hits == 1 && game.score == WHACK_HIT_POINTS / 10);
+	CHECK(game.misses == 0 && game.wrong == 0);
+
+	/* One millisecond before: 1 % of the window left */
+	game = start;
+	WhackCore_Update(&game, deadline - 1, 1U << led, latency);
+	CHECK(game.hits == 1 && latency[led] == 99);
+	CHECK(game.score == WHACK_HIT_POINTS / 10 + WHACK_HIT_POINTS * 9 / 10
+			/ 100);
+
+	/* Updated every millisecond the mole is still up in its deadline
+	 millisecond, and a second update in it may still hit */
+	game = start;
+	for (uint32_t t = now + 1; t <= deadline; ++t) {
+		WhackCore_Update(&game, t, 0, nullptr);
+	}
+	CHECK(game.misses == 0 && (game.active & (1U << led)));
+	WhackGame second = game;
+	CHECK(WhackCore_Update(&second, deadline, 1U << led, nullptr)
+			== 1U << led);
+
+	/* One millisecond late: a miss, and not a wrong press, the LED was
+	 lit, whether or not updates came in between */
+	hit = WhackCore_Update(&game, deadline + 1, 1U << led, nullptr);
+	CHECK(hit == 0 && game.hits == 0 && game.score == 0);
+	CHECK(game.misses == 1 && game.wrong == 0);
+	CHECK(!(game.active & (1U << led)));
+	game = start;
+	hit = WhackCore_Update(&game, deadline + 1, 1U << led, nullptr);
+	CHECK(hit == 0 && game.hits == 0 && game.score == 0);
+	CHECK(game.misses >= 1 && game.wrong == 0);
+}
+/**
+ * @brief  All four moles hit in one millisecond, in one update or in
+ *         several, in any order, score the same; a press with no mole up in
+ *         the same update counts as wrong and takes nothing away
+ * @return None
+ */
+static void TestSameMillisecond(void) {
+	WhackGame start;
+	WhackCore_Start(&start, 11, START_MS, 1000, 2);
+	uint32_t now = START_MS;
+	while (start.active != ALL) {
+		WhackCore_Update(&start, ++now, 0, nullptr);
+	}
+	uint32_t expected = 0;
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		uint32_t latency = now - start.spawned_ms[i];
+		expected += WHACK_HIT_POINTS / 10 + WHACK_HIT_POINTS * 9 / 10
+				* (1000 - latency) / 1000;
+	}
+
+	WhackGame together = start;
+	uint32_t latency[GAME_LED_COUNT] = { };
+	CHECK(WhackCore_Update(&together, now, ALL, latency) == ALL);
+	CHECK(together.hits == 4 && together.score == expected);
+	bool latencies = true;
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		latencies = latencies && latency[i] == now - start.spawned_ms[i];
+	}
+	CHECK(latencies);
+
+	/* The 24 orders of four single presses in the same millisecond */
+	uint8_t order[GAME_LED_COUNT] = { 0, 1, 2, 3 };
+	bool same = true;
+	do {
+		WhackGame game = start;
+		for (uint8_t led : order) {
+			WhackCore_Update(&game, now, 1U << led, nullptr);
+		}
+		same = same && game.score == expected && game.hits == 4
+				&& game.wrong == 0
+				&& memcmp(&game, &together, sizeof(game)) == 0;
+	} while (std::next_permutation(order, order + GAME_LED_COUNT));
+	CHECK(same);
+
+	/* A second press of a mole already hit this millisecond is wrong */
+	WhackGame twice = together;
+	WhackCore_Update(&twice, now, ALL & ~twice.active, nullptr);
+	CHECK(twice.hits == 4 && twice.score == expected);
+	CHECK(twice.wrong == __builtin_popcount(ALL & ~together.active));
+}
+/**
+ * @brief  Four moles whose deadlines all pass before one update are all
+ *         missed by it, and the slots they free are refilled at the times
+ *         the spawns fell due
+ * @return None
+ */
+static void TestExpireTogether(void) {
+	WhackGame game;
+	WhackCore_Start(&game, 3, START_MS, 50, 2);
+	uint32_t now = START_MS;
+	while (game.active != ALL) {
+		WhackCore_Update(&game, ++now, 0, nullptr);
+	}
+	uint32_t last_deadline = game.expiry_ms[0];
+	for (uint8_t i = 1; i < GAME_LED_COUNT; ++i) {
+		if (Later(game.expiry_ms[i], last_deadline)) {
+			last_deadline = game.expiry_ms[i];
+		}
+	}
+	WhackGame before = game;
+	WhackCore_Update(&game, last_deadline, 0, nullptr);
+	CHECK(game.misses < 4);
+	game = before;
+	WhackCore_Update(&game, last_deadline + 1, 0, nullptr);
+	CHECK(game.misses >= 4);
+	bool refilled = true;
+	for (uint8_t i = 0; i < GAME_LED_COUNT; ++i) {
+		refilled = refilled && (!(game.active & (1U << i))
+				|| game.spawned_ms[i] != before.spawned_ms[i]);
+		refilled = refilled && (!(game.active & (1U << i))
+				|| Later(game.expiry_ms[i], last_deadline + 1));
+	}
+	CHECK(refilled);
+}
+/**
+ * @brief  Plays a round without presses with updates step_ms apart
+ * @return The finished round
+ */
+static WhackGame IdleRound(uint32_t seed, uint16_t window_ms,
+		uint16_t spawn_ms, uint32_t step_ms) {
+	WhackGame game;
+	WhackCore_Start(&game, seed, START_MS, window_ms, spawn_ms);
+	uint32_t now = START_MS;
+	while (!WhackCore_IsOver(&game)) {
+		now += step_ms;
+		WhackCore_Update(&game, now, 0, nullptr);
+	}
+	return game;
+}
+/**
+ * @brief  At high spawn rates every mole that pops up is hit or missed
+ *         exactly once, and a round without presses ends the same whether
+ *         it is updated every millisecond, now and then, or once at the end
+ * @return None
+ */
+static void TestHighRates(void) {
+	static const uint16_t WINDOWS[] = { 3, 10, 50, 400 };
+	static const uint16_t SPAWNS[] = { 2, 3, 5, 8 };
+	bool counted = true;
+	bool same = true;
+	bool scored = true;
+	uint32_t total_hits = 0;
+	uint32_t total_misses = 0;
+	for (uint32_t seed = 1; seed <= 8; ++seed) {
+		for (uint16_t window : WINDOWS) {
+			for (uint16_t spawn : SPAWNS) {
+				/* Presses at random every millisecond */
+				WhackGame game;
+				WhackCore_Start(&game, seed, START_MS, window, spawn);
+				uint32_t now = START_MS;
+				uint32_t spawns = 0;
+				uint32_t presses = 0;
+				while (!WhackCore_IsOver(&game)) {
+					WhackGame before = game;
+					uint8_t pressed = Random() % 4 == 0 ? Random() & ALL : 0;
+					presses += __builtin_popcount(pressed);
+					uint8_t hit = WhackCore_Update(&game, ++now, pressed,
+							nullptr);
+					spawns += Spawns(before, game);
+					scored = scored && (hit & ~before.active) == 0
+							&& (hit & ~pressed) == 0;
+				}
+				counted = counted && game.active == 0
+						&& game.hits + game.misses == spawns
+						&& game.hits + game.wrong <= presses
+						&& game.score >= game.hits * WHACK_HIT_POINTS / 10
+						&& game.score <= game.hits * WHACK_HIT_POINTS;
+				total_hits += game.hits;
+				total_misses += game.misses;
+
+				WhackGame every_ms = IdleRound(seed, window, spawn, 1);
+				for (uint32_t step : { 7U, 37U, 1000U, WHACK_ROUND_MS }) {
+					WhackGame sparse = IdleRound(seed, window, spawn, step);
+					same = same && sparse.misses == every_ms.misses
+							&& sparse.rng_state == every_ms.rng_state;
+				}
+			}
+		}
+	}
+	CHECK(counted);
+	CHECK(same);
+	CHECK(scored);
+	CHECK(total_hits > 10000 && total_misses > 10000);
+}
+/**
+ * @brief  The same seed and presses replay the same round
+ * @return None
+ */
+static void TestReplay(void) {
+	WhackGame a;
+	WhackGame b;
+	WhackCore_Start(&a, 99, START_MS, 700, 300);
+	WhackCore_Start(&b, 99, START_MS, 700, 300);
+	uint32_t now = START_MS;
+	bool same = true;
+	while (!WhackCore_IsOver(&a)) {
+		uint8_t pressed = Random() & Random() & ALL;
+		now += 1 + Random() % 20;
+		WhackCore_Update(&a, now, pressed, nullptr);
+		WhackCore_Update(&b, now, pressed, nullptr);
+		same = same && memcmp(&a, &b, sizeof(a)) == 0;
+	}
+	CHECK(same && WhackCore_IsOver(&b));
+	CHECK(WhackCore_Update(&a, now + 1, ALL, nullptr) == 0);
+	CHECK(memcmp(&a, &b, sizeof(a)) == 0);
+}
+
+int main(void) {
+	TestDeadline();
+	TestSameMillisecond();
+	TestExpireTogether();
+	TestHighRates();
+	TestReplay();
+	return Check_Report("whack_core");
+}
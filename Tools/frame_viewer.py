@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+Reference terminal viewer for the firmware LED frame ring (Core/Inc/frame_ring.h).
+
+Reads the ring over SWD while the game keeps running; the firmware never waits
+for the viewer, so any number of viewers can attach. Frames that were
+overwritten before the viewer got to them are counted as dropped.
+
+Requires: pip install pyocd pyelftools
+
+    python3 Tools/frame_viewer.py Debug/Simon_Says.elf
+"""
+import struct
+import sys
+import time
+
+from elftools.elf.elffile import ELFFile
+from pyocd.core.helpers import ConnectHelper
+
+MAGIC = 0x46524D32
+HEADER = struct.Struct("<IHHI")    # magic, capacity, frame_size, head
+# seq, tick, leds, buttons, state[2], level[2], index[2], reserved
+FRAME = struct.Struct("<IIHH2B2B2BH")
+STATIONS = 2
+LEDS_PER_STATION = 4
+STATES = ["IDLE", "SIMON_SAYS", "PLAYER_SAYS", "GAME_OVER", "WIN"]
+
+
+def ring_address(elf_path):
+    with open(elf_path, "rb") as f:
+        symtab = ELFFile(f).get_section_by_name(".symtab")
+        symbols = symtab.get_symbol_by_name("frame_ring")
+        if not symbols:
+            sys.exit("frame_ring not found in " + elf_path)
+        return symbols[0]["st_value"]
+
+
+def render_station(frame, station):
+    leds, buttons = frame[2], frame[3]
+    state, level, index = frame[4 + station], frame[6 + station], frame[8 + station]
+    first = station * LEDS_PER_STATION
+    bits = range(first, first + LEDS_PER_STATION)
+    lamps = " ".join("(#)" if leds & (1 << i) else "( )" for i in bits)
+    keys = " ".join("[v]" if buttons & (1 << i) else "[ ]" for i in bits)
+    name = STATES[state] if state < len(STATES) else str(state)
+    return f"{lamps}  {keys}  {name:<11} level {level:>2} step {index:>2}"
+
+
+def render(frame):
+    stations = " | ".join(render_station(frame, i) for i in range(STATIONS))
+    return f"{frame[1]:>10} ms  {stations}"
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    address = ring_address(sys.argv[1])
+
+    with ConnectHelper.session_with_chosen_probe() as session:
+        target = session.target
+        magic, capacity, frame_size, head = HEADER.unpack(
+            bytes(target.read_memory_block8(address, HEADER.size)))
+        if magic != MAGIC or frame_size != FRAME.size:
+            sys.exit("frame ring not initialised or layout mismatch")
+        frames = address + HEADER.size
+        position = head
+        dropped = 0
+
+        while True:
+            head = HEADER.unpack(
+                bytes(target.read_memory_block8(address, HEADER.size)))[3]
+            if head - position > capacity:
+                dropped += head - capacity - position
+                position = head - capacity
+            while position < head:
+                slot = frames + (position % capacity) * frame_size
+                frame = FRAME.unpack(
+                    bytes(target.read_memory_block8(slot, frame_size)))
+                expected = 2 * position + 2
+                # Re-read seq: the producer may have started rewriting the slot
+                if frame[0] == expected and target.read32(slot) == expected:
+                    print(render(frame))
+                elif frame[0] > expected:
+                    dropped += 1
+                else:
+                    break  # still being written, retry on the next poll
+                position += 1
+            if dropped:
+                print(f"-- {dropped} frames dropped", file=sys.stderr)
+                dropped = 0
+            time.sleep(0.01)
+
+
+if __name__ == "__main__":
+    main()
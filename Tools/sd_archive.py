@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+"""
+Prepares and reads the SD card session archive (Core/Inc/sd_archive.h).
+
+create: makes SESSIONS.BIN on a freshly formatted FAT32 card (or a mounted
+        disk image), zero-filled and written in one go so it stays in one
+        piece. The firmware never changes its size.
+dump:   prints the records of a copied SESSIONS.BIN, oldest first, one CSV
+        line each, and checks their CRC.
+
+    python3 Tools/sd_archive.py create /media/SDCARD 1024   # size in MB
+    python3 Tools/sd_archive.py dump SESSIONS.BIN > sessions.csv
+"""
+import os
+import struct
+import sys
+
+BLOCK_SIZE = 512
+MAGIC = 0x4153
+BLOCK_HEADER = struct.Struct("<IHH")  # sequence, entries, magic
+ENTRIES_PER_BLOCK = 6
+RECORD_MAGIC = 0x53455332
+# magic, uid[3], session, start_tick, seed, result, levels, presses, mode,
+# reaction_ms[15], flags, tag[16], crc
+RECORD = struct.Struct("<I3IIIIBBBB15HH16sI")
+RESULTS = ["aborted", "lost", "won"]
+MODES = ["classic", "reaction", "whack", "rhythm"]
+
+
+def crc32_mpeg2(data):
+    crc = 0xFFFFFFFF
+    for (word,) in struct.iter_unpack("<I", data):
+        crc ^= word
+        for _ in range(32):
+            crc = (crc << 1) ^ 0x04C11DB7 if crc & 0x80000000 else crc << 1
+            crc &= 0xFFFFFFFF
+    return crc
+
+
+def create(directory, megabytes):
+    path = os.path.join(directory, "SESSIONS.BIN")
+    chunk = bytes(1 << 20)
+    with open(path, "wb") as f:
+        for _ in range(megabytes):
+            f.write(chunk)
+        f.flush()
+        os.fsync(f.fileno())
+    print(f"{path}: {megabytes * 2048} blocks")
+
+
+def dump(path):
+    blocks = []
+    with open(path, "rb") as f:
+        while True:
+            block = f.read(BLOCK_SIZE)
+            if len(block) < BLOCK_SIZE:
+                break
+            sequence, entries, magic = BLOCK_HEADER.unpack_from(block)
+            if magic == MAGIC and sequence and 0 < entries <= ENTRIES_PER_BLOCK:
+                blocks.append((sequence, entries, block))
+    print("session,uid,start_tick,seed,mode,result,levels,flags,crc,reaction_ms")
+    bad = 0
+    for sequence, entries, block in sorted(blocks):
+        for i in range(entries):
+            offset = BLOCK_HEADER.size + i * RECORD.size
+            raw = block[offset:offset + RECORD.size]
+            fields = RECORD.unpack(raw)
+            magic, uid, (session, tick, seed) = fields[0], fields[1:4], fields[4:7]
+            result, levels, presses, mode = fields[7:11]
+            reaction = fields[11:26][:presses]
+            flags, crc = fields[26], fields[28]
+            ok = magic == RECORD_MAGIC and crc32_mpeg2(raw[:-4]) == crc
+            bad += not ok
+            print(",".join(str(x) for x in (
+                session, "%08X%08X%08X" % uid, tick, seed,
+                MODES[mode] if mode < len(MODES) else mode,
+                RESULTS[result] if result < len(RESULTS) else result,
+                levels, "0x%04X" % flags, "ok" if ok else "BAD",
+                " ".join(map(str, reaction)))))
+    if bad:
+        print(f"-- {bad} records failed their check", file=sys.stderr)
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == "create":
+        create(sys.argv[2], int(sys.argv[3]))
+    elif len(sys.argv) == 3 and sys.argv[1] == "dump":
+        dump(sys.argv[2])
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1259 @@
+/*
+ * @brief Fleet session archive
+ * Merges session dumps from any number of units into one archive file and
+ * answers questions about it. A dump is a capture of the telemetry port
+ * ("R" lines from `sessions` or `history N`) or a copy of an SD card's
+ * SESSIONS.BIN. Dumps are cut into chunks that worker threads parse in
+ * parallel. A record is kept if it has the SES2 magic and a good
+ * CRC-32/MPEG-2. Given the fleet secret (-k), a signed record must also
+ * carry its unit's HMAC tag. The same record dumped twice is kept once.
+ *
+ * The archive is columnar: each field of every record is one array, and
+ * the press times of the whole fleet are one more. The file is used
+ * through mmap, with nothing to parse. Records are stored in UID order,
+ * so the UID columns are their own index. Two more arrays list the records
+ * in date order and in seed order. The firmware keeps no calendar, so the
+ * date of a record is the day its dump was taken: the dump file's
+ * modification time, or -d.
+ *
+ *   make -C Tools/session_ingest
+ *   session_ingest ingest [-j threads] [-k secret_file] [-d YYYY-MM-DD]
+ *           [--signed-only] fleet.sia dump...
+ *   session_ingest p95 fleet.sia
+ *   session_ingest find fleet.sia uid|date|seed value
+ *   session_ingest synth dir units sessions secret_file
+ */
+#include "sd_archive.h"
+#include "session_log.h"
+#include "sha256.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+constexpr uint32_t ARCHIVE_MAGIC = 0x31414953U; // "SIA1", bump on changes
+constexpr uint16_t BLOCK_MAGIC = 0x4153;      // "SA", sd_archive.cpp
+constexpr size_t BLOCK_HEADER_SIZE = SD_ARCHIVE_HEADER_SIZE;
+constexpr size_t CHUNK_SIZE = 4U << 20;       // Multiple of the block size
+constexpr size_t RECORD_HEX = 2 * sizeof(SessionRecord);
+constexpr size_t SNIFF_SIZE = 4096;           // Bytes that tell text from blocks
+constexpr uint8_t NO_LEVEL = 0xFF;            // Press of a mode without levels
+constexpr uint32_t MS_RANGE = UINT16_MAX + 1;
+constexpr uint32_t SECONDS_PER_DAY = 86400;
+constexpr uint32_t CAPTURED_RECORDS = 16;     // synth: a `sessions` dump
+constexpr char KEY_LABEL[] = "SIMON-RECORD-KEY";
+static_assert(sizeof(SessionRecord) == SD_ARCHIVE_ENTRY_SIZE,
+		"SESSIONS.BIN holds session records");
+static_assert(CHUNK_SIZE % SD_ARCHIVE_BLOCK_SIZE == 0, "whole blocks");
+
+static const char *const RESULTS[] = { "aborted", "lost", "won" };
+static const char *const MODES[] = { "classic", "reaction", "whack", "rhythm" };
+
+/* A record as the archive keeps it: checked, without magic, tag and CRC */
+struct Row {
+	uint32_t uid[3];
+	uint32_t day;          // Days since 1970-01-01 when it was dumped
+	uint32_t seed;
+	uint32_t session;
+	uint32_t start_tick;
+	uint32_t crc;          // Tells apart records that agree on the rest
+	uint16_t flags;
+	uint8_t result;
+	uint8_t levels;
+	uint8_t presses;
+	uint8_t mode;
+	uint16_t reaction_ms[SESSION_MAX_PRESSES];
+};
+
+/* Columns of the archive, in file order */
+enum Column {
+	COLUMN_UID0,
+	COLUMN_UID1,
+	COLUMN_UID2,
+	COLUMN_DAY,
+	COLUMN_SEED,
+	COLUMN_SESSION,
+	COLUMN_START_TICK,
+	COLUMN_CRC,
+	COLUMN_FIRST_PRESS, // Index of the record's first press
+	COLUMN_FLAGS,
+	COLUMN_RESULT,
+	COLUMN_LEVELS,
+	COLUMN_PRESSES,
+	COLUMN_MODE,
+	COLUMN_REACTION_MS, // One per press
+	COLUMN_PRESS_LEVEL, // One per press, NO_LEVEL outside classic mode
+	COLUMN_BY_DATE,     // Record numbers in date order
+	COLUMN_BY_SEED,     // Record numbers in seed order
+	COLUMN_COUNT
+};
+
+/* Bytes per entry, and whether a column has an entry per press */
+struct ColumnShape {
+	uint8_t width;
+	bool per_press;
+};
+static const ColumnShape COLUMNS[COLUMN_COUNT] = { { 4, false }, { 4, false },
+		{ 4, false }, { 4, false }, { 4, false }, { 4, false }, { 4, false },
+		{ 4, false }, { 4, false }, { 2, false }, { 1, false }, { 1, false },
+		{ 1, false }, { 1, false }, { 2, true }, { 1, true }, { 4, false },
+		{ 4, false } };
+
+/* Start of an archive file; each column starts 8-byte aligned */
+struct ArchiveHeader {
+	uint32_t magic;
+	uint32_t records;
+	uint64_t presses;
+	uint64_t offset[COLUMN_COUNT];
+};
+
+/* An archive mapped read-only */
+struct Archive {
+	const uint8_t *base;
+	size_t size;
+	uint32_t records;
+	uint64_t presses;
+
+	template<typename T> const T* Get(Column column) const {
+		const ArchiveHeader *header =
+				reinterpret_cast<const ArchiveHeader*>(base);
+		return reinterpret_cast<const T*>(base + header->offset[column]);
+	}
+};
+
+/* Ingest settings */
+struct Options {
+	bool have_secret;
+	uint8_t secret[SHA256_DIGEST_SIZE]; // SHA-256 of the provisioned secret
+	bool signed_only;
+	long day;                           // -1: from the dump's mtime
+	uint32_t threads;
+};
+
+/* What became of the records of a run */
+struct Counts {
+	uint64_t accepted;
+	uint64_t corrupt;    // Wrong magic, CRC or line
+	uint64_t bad_tag;    // Signed, but not by its unit
+	uint64_t unsigned_records;
+	uint64_t unchecked;  // Signed, and no secret to check with
+	uint64_t duplicates; // Accepted, but already in the archive or run
+};
+
+/* A dump mapped read-only */
+struct Dump {
+	std::string path;
+	const uint8_t *data;
+	size_t size;
+	uint32_t day;
+	bool text;
+};
+
+/* Part of a dump for one worker: blocks, or lines that start in it */
+struct Chunk {
+	const Dump *dump;
+	size_t begin;
+	size_t end;
+};
+
+/* A parsing thread's results, and the units it has keyed */
+struct Worker {
+	std::vector<Row> rows;
+	Counts counts;
+	std::map<std::array<uint32_t, 3>, HmacSha256> keys;
+};
+
+static uint32_t crc_table[4][256];
+static int8_t hex_value[256];
+
+/**
+ * @brief  Fills the CRC and hex tables
+ * @return None
+ */
+static void InitTables(void) {
+	for (uint32_t byte = 0; byte < 256; ++byte) {
+		uint32_t crc = byte << 24;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = crc & 0x80000000U ? (crc << 1) ^ 0x04C11DB7U : crc << 1;
+		}
+		crc_table[0][byte] = crc;
+		hex_value[byte] = -1;
+	}
+	/* crc_table[k] is crc_table[0] followed by k zero bytes */
+	for (int k = 1; k < 4; ++k) {
+		for (uint32_t byte = 0; byte < 256; ++byte) {
+			uint32_t crc = crc_table[k - 1][byte];
+			crc_table[k][byte] = (crc << 8) ^ crc_table[0][crc >> 24];
+		}
+	}
+	for (int digit = 0; digit < 10; ++digit) {
+		hex_value['0' + digit] = digit;
+	}
+	for (int digit = 0; digit < 6; ++digit) {
+		hex_value['a' + digit] = hex_value['A' + digit] = 10 + digit;
+	}
+}
+/**
+ * @brief  CRC-32/MPEG-2 of a record, as the CRC unit computes it: the
+ *         little-endian words up to the crc field, a word per step
+ * @return The CRC
+ */
+static uint32_t RecordCrc(const SessionRecord *record) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t*>(record);
+	uint32_t crc = 0xFFFFFFFFU;
+	for (size_t i = 0; i < offsetof(SessionRecord, crc); i += 4) {
+		uint32_t word;
+		memcpy(&word, &bytes[i], 4);
+		crc ^= word;
+		crc = crc_table[3][crc >> 24] ^ crc_table[2][(crc >> 16) & 0xFF]
+				^ crc_table[1][(crc >> 8) & 0xFF] ^ crc_table[0][crc & 0xFF];
+	}
+	return crc;
+}
+/**
+ * @brief  Keys an HMAC context with a unit's key, as LoadKey() in
+ *         record_auth.cpp derives it
+ * @param  secret: SHA-256 of the provisioned secret
+ * @return None
+ */
+static void UnitKey(const uint8_t *secret, const uint32_t uid[3],
+		HmacSha256 *keyed) {
+	uint8_t unit_key[SHA256_DIGEST_SIZE];
+	HmacSha256 derive;
+	HmacSha256_Init(&derive, secret, SHA256_DIGEST_SIZE);
+	HmacSha256_Update(&derive, KEY_LABEL, sizeof(KEY_LABEL) - 1);
+	HmacSha256_Update(&derive, uid, 3 * sizeof(uint32_t));
+	HmacSha256_Final(&derive, unit_key);
+	HmacSha256_Init(keyed, unit_key, sizeof(unit_key));
+}
+/**
+ * @brief  Computes the tag of a record with a keyed context
+ * @return None
+ */
+static void RecordTag(const HmacSha256 *keyed, const SessionRecord *record,
+		uint8_t tag[RECORD_AUTH_TAG_SIZE]) {
+	HmacSha256 hmac = *keyed;
+	uint8_t mac[SHA256_DIGEST_SIZE];
+	HmacSha256_Update(&hmac, record, offsetof(SessionRecord, tag));
+	HmacSha256_Final(&hmac, mac);
+	memcpy(tag, mac, RECORD_AUTH_TAG_SIZE);
+}
+/**
+ * @brief  Reads a secret file the way RecordAuth_Provision() takes the
+ *         secret: its bytes without the line end, then hashed
+ * @return false if the file cannot be read
+ */
+static bool ReadSecret(const char *path, uint8_t secret[SHA256_DIGEST_SIZE]) {
+	FILE *file = fopen(path, "rb");
+	if (file == nullptr) {
+		perror(path);
+		return false;
+	}
+	std::string text;
+	char buffer[256];
+	size_t length;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		text.append(buffer, length);
+	}
+	fclose(file);
+	while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+		text.pop_back();
+	}
+	Sha256 sha;
+	Sha256_Init(&sha);
+	Sha256_Update(&sha, text.data(), text.size());
+	Sha256_Final(&sha, secret);
+	return true;
+}
+/**
+ * @brief  Days since 1970-01-01 from YYYY-MM-DD
+ * @return The day, or -1 if the date is not valid
+ */
+static long ParseDate(const char *text) {
+	struct tm date = { };
+	char end;
+	if (sscanf(text, "%d-%d-%d%c", &date.tm_year, &date.tm_mon,
+			&date.tm_mday, &end) != 3) {
+		return -1;
+	}
+	date.tm_year -= 1900;
+	date.tm_mon -= 1;
+	time_t seconds = timegm(&date);
+	return seconds < 0 ? -1 : seconds / SECONDS_PER_DAY;
+}
+/**
+ * @brief  Writes a day as YYYY-MM-DD
+ * @param  text: 11 bytes
+ * @return None
+ */
+static void FormatDate(uint32_t day, char *text) {
+	time_t seconds = static_cast<time_t>(day) * SECONDS_PER_DAY;
+	struct tm date;
+	gmtime_r(&seconds, &date);
+	strftime(text, 11, "%Y-%m-%d", &date);
+}
+static double Seconds(void) {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Ingest ---------------------------------------------------------------------*/
+
+/**
+ * @brief  Checks a record and keeps it as a row if it passes
+ * @return None
+ */
+static void Accept(const SessionRecord *record, uint32_t day,
+		const Options &options, Worker *worker) {
+	Counts *counts = &worker->counts;
+	if (record->magic != SESSION_RECORD_MAGIC
+			|| record->presses > SESSION_MAX_PRESSES
+			|| RecordCrc(record) != record->crc) {
+		++counts->corrupt;
+		return;
+	}
+	if (!(record->flags & SESSION_FLAG_SIGNED)) {
+		++counts->unsigned_records;
+		if (options.signed_only) {
+			return;
+		}
+	} else if (!options.have_secret) {
+		++counts->unchecked;
+	} else {
+		std::array<uint32_t, 3> uid = { record->uid[0], record->uid[1],
+				record->uid[2] };
+		auto key = worker->keys.find(uid);
+		if (key == worker->keys.end()) {
+			key = worker->keys.emplace(uid, HmacSha256()).first;
+			UnitKey(options.secret, record->uid, &key->second);
+		}
+		uint8_t tag[RECORD_AUTH_TAG_SIZE];
+		RecordTag(&key->second, record, tag);
+		if (memcmp(tag, record->tag, RECORD_AUTH_TAG_SIZE) != 0) {
+			++counts->bad_tag;
+			return;
+		}
+	}
+	++counts->accepted;
+	Row row;
+	memcpy(row.uid, record->uid, sizeof(row.uid));
+	row.day = day;
+	row.seed = record->seed;
+	row.session = record->session;
+	row.start_tick = record->start_tick;
+	row.crc = record->crc;
+	row.flags = record->flags;
+	row.result = record->result;
+	row.levels = record->levels_completed;
+	row.presses = record->presses;
+	row.mode = record->mode;
+	memcpy(row.reaction_ms, record->reaction_ms, sizeof(row.reaction_ms));
+	worker->rows.push_back(row);
+}
+/**
+ * @brief  Parses the "R" lines that start in a chunk of a capture; other
+ *         lines (commands, "ok", frames) are skipped
+ * @return None
+ */
+static void ParseLines(const Chunk &chunk, const Options &options,
+		Worker *worker) {
+	const char *text = reinterpret_cast<const char*>(chunk.dump->data);
+	const char *end = text + chunk.dump->size;
+	const char *line = text + chunk.begin;
+	if (chunk.begin > 0) {
+		const char *newline = static_cast<const char*>(memchr(line - 1, '\n',
+				end - line + 1));
+		line = newline != nullptr ? newline + 1 : end;
+	}
+	while (line < text + chunk.end) {
+		const char *newline = static_cast<const char*>(memchr(line, '\n',
+				end - line));
+		const char *line_end = newline != nullptr ? newline : end;
+		size_t length = line_end - line;
+		if (length > 0 && line[length - 1] == '\r') {
+			--length;
+		}
+		if (length >= 2 && line[0] == 'R' && line[1] == ' ') {
+			SessionRecord record;
+			uint8_t *bytes = reinterpret_cast<uint8_t*>(&record);
+			bool valid = length == 2 + RECORD_HEX;
+			for (size_t i = 0; valid && i < sizeof(record); ++i) {
+				int8_t high = hex_value[static_cast<uint8_t>(line[2 + 2 * i])];
+				int8_t low = hex_value[static_cast<uint8_t>(line[3 + 2 * i])];
+				valid = high >= 0 && low >= 0;
+				bytes[i] = high << 4 | low;
+			}
+			if (valid) {
+				Accept(&record, chunk.dump->day, options, worker);
+			} else {
+				++worker->counts.corrupt;
+			}
+		}
+		line = line_end + 1;
+	}
+}
+/**
+ * @brief  Parses the blocks of a chunk of SESSIONS.BIN; blocks never
+ *         written or with a broken header are skipped like sd_archive.cpp
+ *         skips them
+ * @return None
+ */
+static void ParseBlocks(const Chunk &chunk, const Options &options,
+		Worker *worker) {
+	const uint8_t *data = chunk.dump->data;
+	for (size_t block = chunk.begin; block < chunk.end
+			&& block + SD_ARCHIVE_BLOCK_SIZE <= chunk.dump->size;
+			block += SD_ARCHIVE_BLOCK_SIZE) {
+		uint32_t sequence;
+		uint16_t entries;
+		uint16_t magic;
+		memcpy(&sequence, &data[block], 4);
+		memcpy(&entries, &data[block + 4], 2);
+		memcpy(&magic, &data[block + 6], 2);
+		if (magic != BLOCK_MAGIC || sequence == 0 || entries == 0
+				|| entries > SD_ARCHIVE_ENTRIES_PER_BLOCK) {
+			continue;
+		}
+		for (uint16_t i = 0; i < entries; ++i) {
+			SessionRecord record;
+			memcpy(&record, &data[block + BLOCK_HEADER_SIZE
+					+ i * sizeof(record)], sizeof(record));
+			Accept(&record, chunk.dump->day, options, worker);
+		}
+	}
+}
+/**
+ * @brief  Maps a dump and tells a capture from a card image: a capture is
+ *         plain ASCII, an image has zero bytes in its block headers
+ * @return false if the file cannot be read
+ */
+static bool OpenDump(const char *path, const Options &options, Dump *dump) {
+	int file = open(path, O_RDONLY);
+	struct stat status;
+	if (file < 0 || fstat(file, &status) != 0) {
+		perror(path);
+		if (file >= 0) {
+			close(file);
+		}
+		return false;
+	}
+	dump->path = path;
+	dump->size = status.st_size;
+	dump->data = nullptr;
+	dump->day = options.day >= 0 ? options.day
+			: status.st_mtime / SECONDS_PER_DAY;
+	if (dump->size > 0) {
+		void *data = mmap(nullptr, dump->size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data == MAP_FAILED) {
+			perror(path);
+			close(file);
+			return false;
+		}
+		madvise(data, dump->size, MADV_SEQUENTIAL);
+		dump->data = static_cast<const uint8_t*>(data);
+	}
+	close(file);
+	dump->text = true;
+	for (size_t i = 0; i < std::min(dump->size, SNIFF_SIZE); ++i) {
+		if (dump->data[i] == 0 || dump->data[i] >= 0x80) {
+			dump->text = false;
+			break;
+		}
+	}
+	return true;
+}
+/**
+ * @brief  Maps an archive and checks that its columns fit in the file
+ * @return false if it cannot be read or is not an archive
+ */
+static bool OpenArchive(const char *path, Archive *archive) {
+	int file = open(path, O_RDONLY);
+	struct stat status;
+	if (file < 0 || fstat(file, &status) != 0) {
+		perror(path);
+		if (file >= 0) {
+			close(file);
+		}
+		return false;
+	}
+	archive->size = status.st_size;
+	void *base = archive->size >= sizeof(ArchiveHeader) ? mmap(nullptr,
+			archive->size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+	close(file);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "%s: not an archive\n", path);
+		return false;
+	}
+	archive->base = static_cast<const uint8_t*>(base);
+	const ArchiveHeader *header = reinterpret_cast<const ArchiveHeader*>(base);
+	archive->records = header->records;
+	archive->presses = header->presses;
+	bool valid = header->magic == ARCHIVE_MAGIC;
+	for (int column = 0; valid && column < COLUMN_COUNT; ++column) {
+		uint64_t entries = COLUMNS[column].per_press ? header->presses
+				: header->records;
+		valid = header->offset[column] % 8 == 0
+				&& header->offset[column] + entries * COLUMNS[column].width
+						<= archive->size;
+	}
+	if (!valid) {
+		fprintf(stderr, "%s: not an archive\n", path);
+		munmap(base, archive->size);
+		return false;
+	}
+	return true;
+}
+static void CloseArchive(Archive *archive) {
+	munmap(const_cast<uint8_t*>(archive->base), archive->size);
+}
+/**
+ * @brief  Appends the rows of an archive, to merge a run into it
+ * @return None
+ */
+static void ReadRows(const Archive &archive, std::vector<Row> *rows) {
+	const uint32_t *uid[3] = { archive.Get<uint32_t>(COLUMN_UID0),
+			archive.Get<uint32_t>(COLUMN_UID1),
+			archive.Get<uint32_t>(COLUMN_UID2) };
+	const uint32_t *day = archive.Get<uint32_t>(COLUMN_DAY);
+	const uint32_t *seed = archive.Get<uint32_t>(COLUMN_SEED);
+	const uint32_t *session = archive.Get<uint32_t>(COLUMN_SESSION);
+	const uint32_t *start_tick = archive.Get<uint32_t>(COLUMN_START_TICK);
+	const uint32_t *crc = archive.Get<uint32_t>(COLUMN_CRC);
+	const uint32_t *first_press = archive.Get<uint32_t>(COLUMN_FIRST_PRESS);
+	const uint16_t *flags = archive.Get<uint16_t>(COLUMN_FLAGS);
+	const uint8_t *result = archive.Get<uint8_t>(COLUMN_RESULT);
+	const uint8_t *levels = archive.Get<uint8_t>(COLUMN_LEVELS);
+	const uint8_t *presses = archive.Get<uint8_t>(COLUMN_PRESSES);
+	const uint8_t *mode = archive.Get<uint8_t>(COLUMN_MODE);
+	const uint16_t *reaction_ms = archive.Get<uint16_t>(COLUMN_REACTION_MS);
+	for (uint32_t n = 0; n < archive.records; ++n) {
+		Row row = { };
+		for (int i = 0; i < 3; ++i) {
+			row.uid[i] = uid[i][n];
+		}
+		row.day = day[n];
+		row.seed = seed[n];
+		row.session = session[n];
+		row.start_tick = start_tick[n];
+		row.crc = crc[n];
+		row.flags = flags[n];
+		row.result = result[n];
+		row.levels = levels[n];
+		row.presses = std::min<uint8_t>(presses[n], SESSION_MAX_PRESSES);
+		row.mode = mode[n];
+		if (first_press[n] + row.presses <= archive.presses) {
+			memcpy(row.reaction_ms, &reaction_ms[first_press[n]],
+					row.presses * sizeof(uint16_t));
+		}
+		rows->push_back(row);
+	}
+}
+/**
+ * @brief  Order of rows in the archive; the day comes last, so of the
+ *         copies of one record the first dumped sorts first
+ */
+static auto RowKey(const Row &row) {
+	return std::tie(row.uid[0], row.uid[1], row.uid[2], row.start_tick,
+			row.session, row.seed, row.crc, row.day);
+}
+static bool SameRecord(const Row &a, const Row &b) {
+	return memcmp(a.uid, b.uid, sizeof(a.uid)) == 0
+			&& a.start_tick == b.start_tick && a.session == b.session
+			&& a.seed == b.seed && a.crc == b.crc;
+}
+/**
+ * @brief  Level of the i-th press of a classic game: level L takes L + 1
+ *         presses
+ * @return The level
+ */
+static uint8_t PressLevel(uint32_t press) {
+	uint8_t level = 0;
+	while (press > level) {
+		press -= level + 1;
+		++level;
+	}
+	return level;
+}
+/**
+ * @brief  Column of an archive being written
+ */
+template<typename T> static T* ColumnAt(uint8_t *base,
+		const ArchiveHeader &header, Column column) {
+	return reinterpret_cast<T*>(base + header.offset[column]);
+}
+/**
+ * @brief  Writes sorted, unique rows as an archive next to path, then
+ *         renames it over path, so a reader never sees half an archive
+ * @return false if the file cannot be written
+ */
+static bool WriteArchive(const char *path, const std::vector<Row> &rows) {
+	ArchiveHeader header = { };
+	header.magic = ARCHIVE_MAGIC;
+	header.records = rows.size();
+	for (const Row &row : rows) {
+		header.presses += row.presses;
+	}
+	uint64_t size = sizeof(header);
+	for (int column = 0; column < COLUMN_COUNT; ++column) {
+		header.offset[column] = size;
+		uint64_t entries = COLUMNS[column].per_press ? header.presses
+				: header.records;
+		size = (size + entries * COLUMNS[column].width + 7) & ~7ULL;
+	}
+
+	std::string temporary = std::string(path) + ".tmp";
+	int file = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (file < 0 || ftruncate(file, size) != 0) {
+		perror(temporary.c_str());
+		if (file >= 0) {
+			close(file);
+		}
+		return false;
+	}
+	void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			file, 0);
+	if (mapped == MAP_FAILED) {
+		perror(temporary.c_str());
+		close(file);
+		return false;
+	}
+	uint8_t *base = static_cast<uint8_t*>(mapped);
+	memcpy(base, &header, sizeof(header));
+	uint32_t *uid[3] = { ColumnAt<uint32_t>(base, header, COLUMN_UID0),
+			ColumnAt<uint32_t>(base, header, COLUMN_UID1),
+			ColumnAt<uint32_t>(base, header, COLUMN_UID2) };
+	uint32_t *day = ColumnAt<uint32_t>(base, header, COLUMN_DAY);
+	uint32_t *seed = ColumnAt<uint32_t>(base, header, COLUMN_SEED);
+	uint32_t *session = ColumnAt<uint32_t>(base, header, COLUMN_SESSION);
+	uint32_t *start_tick = ColumnAt<uint32_t>(base, header, COLUMN_START_TICK);
+	uint32_t *crc = ColumnAt<uint32_t>(base, header, COLUMN_CRC);
+	uint32_t *first_press = ColumnAt<uint32_t>(base, header,
+			COLUMN_FIRST_PRESS);
+	uint16_t *flags = ColumnAt<uint16_t>(base, header, COLUMN_FLAGS);
+	uint8_t *result = ColumnAt<uint8_t>(base, header, COLUMN_RESULT);
+	uint8_t *levels = ColumnAt<uint8_t>(base, header, COLUMN_LEVELS);
+	uint8_t *presses = ColumnAt<uint8_t>(base, header, COLUMN_PRESSES);
+	uint8_t *mode = ColumnAt<uint8_t>(base, header, COLUMN_MODE);
+	uint16_t *reaction_ms = ColumnAt<uint16_t>(base, header,
+			COLUMN_REACTION_MS);
+	uint8_t *press_level = ColumnAt<uint8_t>(base, header, COLUMN_PRESS_LEVEL);
+	uint32_t *by_date = ColumnAt<uint32_t>(base, header, COLUMN_BY_DATE);
+	uint32_t *by_seed = ColumnAt<uint32_t>(base, header, COLUMN_BY_SEED);
+
+	uint32_t press = 0;
+	for (uint32_t n = 0; n < header.records; ++n) {
+		const Row &row = rows[n];
+		for (int i = 0; i < 3; ++i) {
+			uid[i][n] = row.uid[i];
+		}
+		day[n] = row.day;
+		seed[n] = row.seed;
+		session[n] = row.session;
+		start_tick[n] = row.start_tick;
+		crc[n] = row.crc;
+		first_press[n] = press;
+		flags[n] = row.flags;
+		result[n] = row.result;
+		levels[n] = row.levels;
+		presses[n] = row.presses;
+		mode[n] = row.mode;
+		for (uint8_t i = 0; i < row.presses; ++i, ++press) {
+			reaction_ms[press] = row.reaction_ms[i];
+			press_level[press] = row.mode == SESSION_MODE_CLASSIC
+					? PressLevel(i) : NO_LEVEL;
+		}
+		by_date[n] = by_seed[n] = n;
+	}
+	std::stable_sort(by_date, by_date + header.records,
+			[day](uint32_t a, uint32_t b) { return day[a] < day[b]; });
+	std::stable_sort(by_seed, by_seed + header.records,
+			[seed](uint32_t a, uint32_t b) { return seed[a] < seed[b]; });
+
+	bool written = msync(mapped, size, MS_SYNC) == 0;
+	munmap(mapped, size);
+	written = close(file) == 0 && written;
+	if (!written || rename(temporary.c_str(), path) != 0) {
+		perror(path);
+		return false;
+	}
+	return true;
+}
+/**
+ * @brief  Parses dumps on all workers and merges them into the archive
+ * @return Exit code
+ */
+static int Ingest(const Options &options, const char *path, char **dump_paths,
+		int dump_count) {
+	double start = Seconds();
+	std::vector<Dump> dumps(dump_count);
+	uint64_t bytes = 0;
+	for (int i = 0; i < dump_count; ++i) {
+		if (!OpenDump(dump_paths[i], options, &dumps[i])) {
+			return 1;
+		}
+		bytes += dumps[i].size;
+	}
+	std::vector<Chunk> chunks;
+	for (const Dump &dump : dumps) {
+		for (size_t begin = 0; begin < dump.size; begin += CHUNK_SIZE) {
+			chunks.push_back({ &dump, begin, std::min(dump.size,
+					begin + CHUNK_SIZE) });
+		}
+	}
+
+	/* Workers take chunks in turn, so one big dump is shared out too */
+	std::atomic<size_t> next_chunk(0);
+	std::vector<Worker> workers(options.threads);
+	auto work = [&](Worker *worker) {
+		size_t i;
+		while ((i = next_chunk++) < chunks.size()) {
+			if (chunks[i].dump->text) {
+				ParseLines(chunks[i], options, worker);
+			} else {
+				ParseBlocks(chunks[i], options, worker);
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (Worker &worker : workers) {
+		threads.emplace_back(work, &worker);
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	double parsed = Seconds();
+
+	Counts counts = { };
+	std::vector<Row> rows;
+	size_t run_rows = 0;
+	for (Worker &worker : workers) {
+		counts.accepted += worker.counts.accepted;
+		counts.corrupt += worker.counts.corrupt;
+		counts.bad_tag += worker.counts.bad_tag;
+		counts.unsigned_records += worker.counts.unsigned_records;
+		counts.unchecked += worker.counts.unchecked;
+		run_rows += worker.rows.size();
+	}
+	Archive archive;
+	bool existing = access(path, F_OK) == 0;
+	if (existing && !OpenArchive(path, &archive)) {
+		return 1;
+	}
+	rows.reserve(run_rows + (existing ? archive.records : 0));
+	if (existing) {
+		ReadRows(archive, &rows);
+		CloseArchive(&archive);
+	}
+	size_t before = rows.size();
+	for (Worker &worker : workers) {
+		rows.insert(rows.end(), worker.rows.begin(), worker.rows.end());
+		std::vector<Row>().swap(worker.rows);
+	}
+	std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+		return RowKey(a) < RowKey(b);
+	});
+	rows.erase(std::unique(rows.begin(), rows.end(), SameRecord), rows.end());
+	counts.duplicates = before + run_rows - rows.size();
+	for (Dump &dump : dumps) {
+		if (dump.size > 0) {
+			munmap(const_cast<uint8_t*>(dump.data), dump.size);
+		}
+	}
+	if (!WriteArchive(path, rows)) {
+		return 1;
+	}
+	double seconds = Seconds() - start;
+
+	uint64_t records = counts.accepted + counts.corrupt + counts.bad_tag
+			+ (options.signed_only ? counts.unsigned_records : 0);
+	printf("accepted %llu, corrupt %llu, bad tag %llu, unsigned %llu, "
+			"duplicates %llu\n", (unsigned long long) counts.accepted,
+			(unsigned long long) counts.corrupt,
+			(unsigned long long) counts.bad_tag,
+			(unsigned long long) counts.unsigned_records,
+			(unsigned long long) counts.duplicates);
+	if (counts.unchecked > 0) {
+		printf("-- %llu signed records not checked, no secret given (-k)\n",
+				(unsigned long long) counts.unchecked);
+	}
+	printf("%s: %zu records. Read %d dumps, %.1f MB, %llu records in %.2f s "
+			"(parsing %.2f s): %.0f records/s, %.1f MB/s, %u threads\n",
+			path, rows.size(), dump_count, bytes / 1e6,
+			(unsigned long long) records, seconds, parsed - start,
+			records / seconds, bytes / 1e6 / seconds, options.threads);
+	return 0;
+}
+
+/* Queries --------------------------------------------------------------------*/
+
+/**
+ * @brief  Reaction time percentiles by level over the classic games of the
+ *         fleet, sessions flagged as automated left out. One pass over the
+ *         press columns fills a histogram per level, so the percentiles are
+ *         exact without sorting.
+ * @return Exit code
+ */
+static int P95(const char *path) {
+	Archive archive;
+	if (!OpenArchive(path, &archive)) {
+		return 1;
+	}
+	double start = Seconds();
+	const uint8_t *mode = archive.Get<uint8_t>(COLUMN_MODE);
+	const uint16_t *flags = archive.Get<uint16_t>(COLUMN_FLAGS);
+	const uint32_t *first_press = archive.Get<uint32_t>(COLUMN_FIRST_PRESS);
+	const uint8_t *presses = archive.Get<uint8_t>(COLUMN_PRESSES);
+	const uint16_t *reaction_ms = archive.Get<uint16_t>(COLUMN_REACTION_MS);
+	const uint8_t *press_level = archive.Get<uint8_t>(COLUMN_PRESS_LEVEL);
+	std::vector<uint32_t> histogram(GAME_MAX_LEVEL * MS_RANGE);
+	uint64_t counted[GAME_MAX_LEVEL] = { };
+	uint32_t games = 0;
+	uint32_t automated = 0;
+	for (uint32_t n = 0; n < archive.records; ++n) {
+		if (mode[n] != SESSION_MODE_CLASSIC) {
+			continue;
+		}
+		if (flags[n] & SESSION_FLAG_AUTOMATED) {
+			++automated;
+			continue;
+		}
+		++games;
+		uint64_t end = std::min<uint64_t>(first_press[n] + presses[n],
+				archive.presses);
+		for (uint64_t i = first_press[n]; i < end; ++i) {
+			if (press_level[i] < GAME_MAX_LEVEL) {
+				++histogram[press_level[i] * MS_RANGE + reaction_ms[i]];
+				++counted[press_level[i]];
+			}
+		}
+	}
+	double seconds = Seconds() - start;
+
+	printf("level,presses,p50_ms,p95_ms\n");
+	for (uint8_t level = 0; level < GAME_MAX_LEVEL; ++level) {
+		/* Nearest rank: the smallest time at or above p percent */
+		uint64_t rank50 = (counted[level] * 50 + 99) / 100;
+		uint64_t rank95 = (counted[level] * 95 + 99) / 100;
+		uint64_t seen = 0;
+		uint32_t p50 = 0;
+		uint32_t p95 = 0;
+		const uint32_t *times = &histogram[level * MS_RANGE];
+		for (uint32_t ms = 0; ms < MS_RANGE && seen < rank95; ++ms) {
+			seen += times[ms];
+			if (p50 == 0 && seen >= rank50 && rank50 > 0) {
+				p50 = ms;
+			}
+			if (seen >= rank95) {
+				p95 = ms;
+			}
+		}
+		printf("%u,%llu,%u,%u\n", level + 1,
+				(unsigned long long) counted[level], p50, p95);
+	}
+	fprintf(stderr, "-- %u classic games of %u records, %u automated left "
+			"out, scanned in %.1f ms\n", games, archive.records, automated,
+			seconds * 1000);
+	CloseArchive(&archive);
+	return 0;
+}
+/**
+ * @brief  Prints one record as a CSV line, the columns of sd_archive.py
+ * @return None
+ */
+static void PrintRecord(const Archive &archive, uint32_t n) {
+	const uint32_t *first_press = archive.Get<uint32_t>(COLUMN_FIRST_PRESS);
+	const uint8_t *presses = archive.Get<uint8_t>(COLUMN_PRESSES);
+	const uint16_t *reaction_ms = archive.Get<uint16_t>(COLUMN_REACTION_MS);
+	uint8_t mode = archive.Get<uint8_t>(COLUMN_MODE)[n];
+	uint8_t result = archive.Get<uint8_t>(COLUMN_RESULT)[n];
+	char date[11];
+	FormatDate(archive.Get<uint32_t>(COLUMN_DAY)[n], date);
+	printf("%u,%08X%08X%08X,%s,%u,%u,", archive.Get<uint32_t>(COLUMN_SESSION)[n],
+			archive.Get<uint32_t>(COLUMN_UID0)[n],
+			archive.Get<uint32_t>(COLUMN_UID1)[n],
+			archive.Get<uint32_t>(COLUMN_UID2)[n], date,
+			archive.Get<uint32_t>(COLUMN_START_TICK)[n],
+			archive.Get<uint32_t>(COLUMN_SEED)[n]);
+	if (mode < sizeof(MODES) / sizeof(MODES[0])) {
+		printf("%s,", MODES[mode]);
+	} else {
+		printf("%u,", mode);
+	}
+	if (result < sizeof(RESULTS) / sizeof(RESULTS[0])) {
+		printf("%s,", RESULTS[result]);
+	} else {
+		printf("%u,", result);
+	}
+	printf("%u,0x%04X,", archive.Get<uint8_t>(COLUMN_LEVELS)[n],
+			archive.Get<uint16_t>(COLUMN_FLAGS)[n]);
+	for (uint8_t i = 0; i < presses[n]
+			&& first_press[n] + i < archive.presses; ++i) {
+		printf(i == 0 ? "%u" : " %u", reaction_ms[first_press[n] + i]);
+	}
+	printf("\n");
+}
+/**
+ * @brief  Prints the records of a unit, a date or a seed, found by binary
+ *         search in the UID columns or in the date or seed order
+ * @return Exit code
+ */
+static int Find(const char *path, const char *field, const char *value) {
+	uint32_t key[3] = { };
+	if (strcmp(field, "uid") == 0) {
+		char digits[9] = { };
+		bool valid = strlen(value) == 24;
+		for (int i = 0; valid && i < 3; ++i) {
+			memcpy(digits, &value[8 * i], 8);
+			char *end;
+			key[i] = strtoul(digits, &end, 16);
+			valid = *end == '\0';
+		}
+		if (!valid) {
+			fprintf(stderr, "%s: a UID is 24 hex digits\n", value);
+			return 1;
+		}
+	} else if (strcmp(field, "date") == 0) {
+		long day = ParseDate(value);
+		if (day < 0) {
+			fprintf(stderr, "%s: not a date (YYYY-MM-DD)\n", value);
+			return 1;
+		}
+		key[0] = day;
+	} else if (strcmp(field, "seed") == 0) {
+		key[0] = strtoul(value, nullptr, 0);
+	} else {
+		fprintf(stderr, "%s: search by uid, date or seed\n", field);
+		return 1;
+	}
+	Archive archive;
+	if (!OpenArchive(path, &archive)) {
+		return 1;
+	}
+	std::vector<uint32_t> found;
+	if (field[0] == 'u') {
+		const uint32_t *uid[3] = { archive.Get<uint32_t>(COLUMN_UID0),
+				archive.Get<uint32_t>(COLUMN_UID1),
+				archive.Get<uint32_t>(COLUMN_UID2) };
+		auto uid_of = [&uid](uint32_t n) {
+			return std::make_tuple(uid[0][n], uid[1][n], uid[2][n]);
+		};
+		auto wanted = std::make_tuple(key[0], key[1], key[2]);
+		uint32_t low = 0;
+		uint32_t high = archive.records;
+		while (low < high) {
+			uint32_t middle = low + (high - low) / 2;
+			if (uid_of(middle) < wanted) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		for (uint32_t n = low; n < archive.records && uid_of(n) == wanted; ++n) {
+			found.push_back(n);
+		}
+	} else {
+		bool by_date = field[0] == 'd';
+		const uint32_t *order = archive.Get<uint32_t>(by_date
+				? COLUMN_BY_DATE : COLUMN_BY_SEED);
+		const uint32_t *values = archive.Get<uint32_t>(by_date
+				? COLUMN_DAY : COLUMN_SEED);
+		const uint32_t *end = order + archive.records;
+		const uint32_t *n = std::lower_bound(order, end, key[0],
+				[values](uint32_t record, uint32_t wanted) {
+					return values[record] < wanted;
+				});
+		for (; n < end && values[*n] == key[0]; ++n) {
+			found.push_back(*n);
+		}
+	}
+	printf("session,uid,date,start_tick,seed,mode,result,levels,flags,"
+			"reaction_ms\n");
+	for (uint32_t n : found) {
+		PrintRecord(archive, n);
+	}
+	fprintf(stderr, "-- %zu records\n", found.size());
+	CloseArchive(&archive);
+	return 0;
+}
+
+/* Synthetic fleet ------------------------------------------------------------*/
+
+/* Expected results of ingesting a synthetic fleet */
+struct Expected {
+	Counts counts;
+	uint64_t records;
+};
+
+static uint32_t Random(uint32_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+/**
+ * @brief  Plays one game of a synthetic unit into a sealed record. People
+ *         slow down as the sequence grows and now and then hesitate; bots
+ *         press every 120 ms and never miss.
+ * @param  keyed: the unit's key, nullptr for a unit never provisioned
+ * @return None
+ */
+static void SynthRecord(const uint32_t uid[3], uint32_t session,
+		uint32_t *tick, uint32_t *random, const HmacSha256 *keyed,
+		SessionRecord *record) {
+	memset(record, 0, sizeof(*record));
+	record->magic = SESSION_RECORD_MAGIC;
+	memcpy(record->uid, uid, sizeof(record->uid));
+	record->session = session;
+	*tick += 20000 + Random(random) % 40000;
+	record->start_tick = *tick;
+	record->seed = Random(random);
+	record->flags = session % SESSION_STATIONS;
+	bool automated = session % 50 == 0;
+	if (automated) {
+		record->flags |= SESSION_FLAG_AUTOMATED;
+	}
+	if (session % 8 == 7) {
+		record->mode = SESSION_MODE_REACTION;
+		record->result = SESSION_WON;
+		record->presses = 10;
+		for (uint8_t i = 0; i < record->presses; ++i) {
+			record->reaction_ms[i] = 180 + Random(random) % 200;
+		}
+	} else {
+		record->mode = SESSION_MODE_CLASSIC;
+		record->result = SESSION_WON;
+		for (uint8_t level = 0; level < GAME_MAX_LEVEL
+				&& record->result == SESSION_WON; ++level) {
+			for (uint8_t i = 0; i <= level; ++i) {
+				uint32_t ms = 250 + 60 * level + Random(random) % 400;
+				if (Random(random) % 20 == 0) {
+					ms += Random(random) % 1500;
+				}
+				record->reaction_ms[record->presses++] = automated ? 120 : ms;
+				if (!automated && Random(random) % 100 < 4) {
+					record->result = SESSION_LOST;
+					break;
+				}
+			}
+			if (record->result == SESSION_WON) {
+				record->levels_completed = level + 1;
+			}
+		}
+	}
+	if (keyed != nullptr) {
+		record->flags |= SESSION_FLAG_SIGNED;
+		RecordTag(keyed, record, record->tag);
+	}
+	record->crc = RecordCrc(record);
+}
+/**
+ * @brief  Counts what ingesting a copy of a record should give
+ * @param  copy: true for the second copy of a record
+ * @return None
+ */
+static void Expect(Expected *expected, const SessionRecord *record,
+		bool corrupt, bool forged, bool copy) {
+	++expected->records;
+	if (corrupt) {
+		++expected->counts.corrupt;
+	} else if (forged) {
+		++expected->counts.bad_tag;
+	} else {
+		++expected->counts.accepted;
+		expected->counts.unsigned_records +=
+				!(record->flags & SESSION_FLAG_SIGNED);
+		expected->counts.duplicates += copy;
+	}
+}
+/**
+ * @brief  Sets the modification time of a dump to noon of a day
+ * @return None
+ */
+static void SetDay(const char *path, uint32_t day) {
+	struct timespec times[2];
+	times[0].tv_sec = times[1].tv_sec = static_cast<time_t>(day)
+			* SECONDS_PER_DAY + SECONDS_PER_DAY / 2;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	utimensat(AT_FDCWD, path, times, 0);
+}
+/**
+ * @brief  Writes a synthetic fleet: a SESSIONS.BIN per unit and, for every
+ *         fourth unit, a capture of `sessions` that repeats its newest
+ *         records. Every tenth unit was never provisioned. One record in
+ *         997 is corrupted on the card and one is altered with its CRC
+ *         fixed, which only the tag gives away. Prints the line ingest
+ *         should print first.
+ * @return Exit code
+ */
+static int Synth(const char *directory, uint32_t units, uint32_t sessions,
+		const char *secret_path) {
+	uint8_t secret[SHA256_DIGEST_SIZE];
+	if (!ReadSecret(secret_path, secret)) {
+		return 1;
+	}
+	long first_day = ParseDate("2026-01-01");
+	uint32_t random = 2463534242U;
+	uint64_t made = 0;
+	Expected expected = { };
+	std::vector<SessionRecord> records(sessions);
+	for (uint32_t unit = 0; unit < units; ++unit) {
+		uint32_t uid[3] = { 0x00200000U + unit, 0x4E415731U ^ (unit
+				* 2654435761U), 0x20313934U };
+		HmacSha256 keyed;
+		bool provisioned = unit % 10 != 9;
+		if (provisioned) {
+			UnitKey(secret, uid, &keyed);
+		}
+		uint32_t tick = 0;
+		std::vector<bool> corrupt(sessions);
+		std::vector<bool> forged(sessions);
+		for (uint32_t s = 0; s < sessions; ++s, ++made) {
+			SessionRecord *record = &records[s];
+			SynthRecord(uid, s + 1, &tick, &random,
+					provisioned ? &keyed : nullptr, record);
+			if (made % 997 == 500) {
+				record->reaction_ms[0] ^= 1;
+				corrupt[s] = true;
+			} else if (made % 997 == 100 && provisioned) {
+				record->reaction_ms[0] += 1;
+				record->crc = RecordCrc(record);
+				forged[s] = true;
+			}
+		}
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/unit-%04u.bin", directory, unit);
+		FILE *file = fopen(path, "wb");
+		if (file == nullptr) {
+			perror(path);
+			return 1;
+		}
+		uint8_t block[SD_ARCHIVE_BLOCK_SIZE];
+		uint32_t sequence = 0;
+		for (uint32_t s = 0; s < sessions;
+				s += SD_ARCHIVE_ENTRIES_PER_BLOCK) {
+			uint16_t entries = std::min<uint32_t>(sessions - s,
+					SD_ARCHIVE_ENTRIES_PER_BLOCK);
+			memset(block, 0, sizeof(block));
+			++sequence;
+			memcpy(&block[0], &sequence, 4);
+			memcpy(&block[4], &entries, 2);
+			memcpy(&block[6], &BLOCK_MAGIC, 2);
+			for (uint16_t i = 0; i < entries; ++i) {
+				memcpy(&block[BLOCK_HEADER_SIZE + i * sizeof(SessionRecord)],
+						&records[s + i], sizeof(SessionRecord));
+				Expect(&expected, &records[s + i], corrupt[s + i],
+						forged[s + i], false);
+			}
+			fwrite(block, 1, sizeof(block), file);
+		}
+		/* The rest of the file, never written */
+		memset(block, 0, sizeof(block));
+		for (int i = 0; i < 4; ++i) {
+			fwrite(block, 1, sizeof(block), file);
+		}
+		fclose(file);
+		SetDay(path, first_day + unit % 28);
+
+		if (unit % 4 != 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/unit-%04u.txt", directory, unit);
+		file = fopen(path, "wb");
+		if (file == nullptr) {
+			perror(path);
+			return 1;
+		}
+		fprintf(file, "sessions\r\n");
+		uint32_t first = sessions > CAPTURED_RECORDS
+				? sessions - CAPTURED_RECORDS : 0;
+		for (uint32_t s = first; s < sessions; ++s) {
+			const uint8_t *bytes =
+					reinterpret_cast<const uint8_t*>(&records[s]);
+			fprintf(file, "R ");
+			for (size_t i = 0; i < sizeof(SessionRecord); ++i) {
+				fprintf(file, "%02x", bytes[i]);
+			}
+			fprintf(file, "\r\n");
+			Expect(&expected, &records[s], corrupt[s], forged[s], true);
+		}
+		fprintf(file, "ok\r\n");
+		fclose(file);
+		SetDay(path, first_day + unit % 28 + 1);
+	}
+	const Counts &counts = expected.counts;
+	printf("accepted %llu, corrupt %llu, bad tag %llu, unsigned %llu, "
+			"duplicates %llu\n", (unsigned long long) counts.accepted,
+			(unsigned long long) counts.corrupt,
+			(unsigned long long) counts.bad_tag,
+			(unsigned long long) counts.unsigned_records,
+			(unsigned long long) counts.duplicates);
+	fprintf(stderr, "-- %llu records of %u units in %s\n",
+			(unsigned long long) expected.records, units, directory);
+	return 0;
+}
+
+static const char USAGE[] =
+		"usage: session_ingest ingest [-j threads] [-k secret_file] "
+		"[-d YYYY-MM-DD]\n"
+		"               [--signed-only] archive dump...\n"
+		"       session_ingest p95 archive\n"
+		"       session_ingest find archive uid|date|seed value\n"
+		"       session_ingest synth dir units sessions secret_file\n";
+
+int main(int argc, char **argv) {
+	InitTables();
+	if (argc >= 2 && strcmp(argv[1], "ingest") == 0) {
+		Options options = { };
+		options.day = -1;
+		options.threads = std::max(std::thread::hardware_concurrency(), 1U);
+		int i = 2;
+		for (; i < argc && argv[i][0] == '-'; ++i) {
+			if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+				options.threads = std::max(atoi(argv[++i]), 1);
+			} else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+				if (!ReadSecret(argv[++i], options.secret)) {
+					return 1;
+				}
+				options.have_secret = true;
+			} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+				options.day = ParseDate(argv[++i]);
+				if (options.day < 0) {
+					fprintf(stderr, "%s: not a date (YYYY-MM-DD)\n", argv[i]);
+					return 1;
+				}
+			} else if (strcmp(argv[i], "--signed-only") == 0) {
+				options.signed_only = true;
+			} else {
+				fputs(USAGE, stderr);
+				return 2;
+			}
+		}
+		if (argc - i >= 2) {
+			return Ingest(options, argv[i], &argv[i + 1], argc - i - 1);
+		}
+	} else if (argc == 3 && strcmp(argv[1], "p95") == 0) {
+		return P95(argv[2]);
+	} else if (argc == 5 && strcmp(argv[1], "find") == 0) {
+		return Find(argv[2], argv[3], argv[4]);
+	} else if (argc == 6 && strcmp(argv[1], "synth") == 0) {
+		return Synth(argv[2], strtoul(argv[3], nullptr, 0),
+				strtoul(argv[4], nullptr, 0), argv[5]);
+	}
+	fputs(USAGE, stderr);
+	return 2;
+}